@@ -0,0 +1,83 @@
+# Command line batch object removal, build separately from the application
+TEMPLATE = app
+TARGET = Batch
+CONFIG += console
+CONFIG -= app_bundle
+
+# same options as the application, see Retargeting.pro
+opencl {
+  DEFINES += IRL_USE_OPENCL
+  LIBS += -lOpenCL
+}
+lean {
+  DEFINES += IRL_COMPACT_DISTANCES
+}
+
+HEADERS += ../IRL/IO.h ../IRL/IO.inl
+SOURCES += ../IRL/IO.cpp ../IRL/IOQt.cpp
+
+HEADERS += ../IRL/Parameters.h
+SOURCES += ../IRL/Parameters.cpp
+
+HEADERS += ../IRL/Profiler.h
+SOURCES += ../IRL/Profiler.cpp
+
+HEADERS += ../IRL/DebugWriter.h
+SOURCES += ../IRL/DebugWriter.cpp
+
+HEADERS += ../IRL/Memory.h
+SOURCES += ../IRL/Memory.cpp
+
+HEADERS += ../IRL/Threading.h ../IRL/ThreadingQt.h ../IRL/Parallel.h ../IRL/Parallel.inl
+SOURCES += ../IRL/Parallel.cpp
+
+HEADERS += ../IRL/JobQueue.h
+SOURCES += ../IRL/JobQueue.cpp
+
+HEADERS += ../IRL/Point2D.h
+SOURCES += ../IRL/Point2D.cpp
+
+HEADERS += ../IRL/OffsetField.h
+SOURCES += ../IRL/OffsetField.cpp
+
+HEADERS += ../IRL/ColorConversion.h ../IRL/ColorConversion.inl
+SOURCES += ../IRL/ColorConversion.cpp
+
+HEADERS += ../IRL/Scaling.h ../IRL/Scaling.inl
+SOURCES += ../IRL/Scaling.cpp
+
+HEADERS += ../IRL/PatchDistance.h
+SOURCES += ../IRL/PatchDistance.cpp
+
+HEADERS += ../IRL/PatchIndex.h
+HEADERS += ../IRL/PatchSummaries.h
+SOURCES += ../IRL/PatchIndex.cpp
+SOURCES += ../IRL/PatchSummaries.cpp
+HEADERS += ../IRL/PatchHashing.h
+SOURCES += ../IRL/PatchHashing.cpp
+HEADERS += ../IRL/CompactVotes.h
+SOURCES += ../IRL/CompactVotes.cpp
+HEADERS += ../IRL/ValidPatches.h
+SOURCES += ../IRL/ValidPatches.cpp
+HEADERS += ../IRL/Checkpoint.h
+SOURCES += ../IRL/Checkpoint.cpp
+
+HEADERS += ../IRL/DeviceNNF.h
+SOURCES += ../IRL/DeviceNNF.cpp
+
+HEADERS += ../IRL/NearestNeighborField.h ../IRL/NearestNeighborField.inl ../IRL/TiledImage.h
+HEADERS += ../IRL/BidirectionalSimilarity.h ../IRL/BidirectionalSimilarity.inl
+HEADERS += ../IRL/PyramidCache.h ../IRL/PyramidCache.inl
+HEADERS += ../IRL/ResultCache.h
+SOURCES += ../IRL/ResultCache.cpp
+HEADERS += ../IRL/ObjectRemoval.h ../IRL/ObjectRemoval.inl
+HEADERS += ../IRL/VideoRemoval.h ../IRL/VideoRemoval.inl
+HEADERS += ../IRL/Calibration.h ../IRL/Calibration.inl
+SOURCES += ../IRL/Calibration.cpp
+
+HEADERS += Pipeline.h
+SOURCES += Pipeline.cpp
+HEADERS += SharedQueue.h
+SOURCES += SharedQueue.cpp
+
+SOURCES += main.cpp
\ No newline at end of file
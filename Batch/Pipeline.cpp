@@ -0,0 +1,295 @@
+#include "../IRL/Includes.h"
+#include "Pipeline.h"
+#include "SharedQueue.h"
+
+#include "../IRL/IO.h"
+#include "../IRL/ObjectRemoval.h"
+#include "../IRL/VideoRemoval.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtGui/QImageReader>
+#include <algorithm>
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////////
+
+BatchQueue::BatchQueue(int capacity) : _capacity(capacity)
+{
+}
+
+void BatchQueue::push(BatchItem* item)
+{
+    QMutexLocker locker(&_lock);
+    while (item != NULL && _items.size() >= _capacity)
+        _notFull.wait(&_lock);
+    _items.push_back(item);
+    _notEmpty.wakeAll();
+}
+
+BatchItem* BatchQueue::pop()
+{
+    QMutexLocker locker(&_lock);
+    while (_items.empty())
+        _notEmpty.wait(&_lock);
+    BatchItem* item = _items.front();
+    if (item == NULL)
+        return NULL; // do not pop NULL as it is marker of the end
+    _items.pop_front();
+    _notFull.wakeOne();
+    return item;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+class BatchPipeline::LoaderThread : public QThread
+{
+public:
+    LoaderThread(BatchPipeline* owner) : _owner(owner)
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        while (BatchItem* item = _owner->nextToLoad())
+        {
+            _owner->load(item);
+            _owner->_loaded.push(item);
+        }
+        _owner->loaderFinished();
+    }
+
+private:
+    BatchPipeline* _owner;
+};
+
+class BatchPipeline::SaverThread : public QThread
+{
+public:
+    SaverThread(BatchPipeline* owner) : _owner(owner)
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        while (BatchItem* item = _owner->_solved.pop())
+            _owner->save(item);
+    }
+
+private:
+    BatchPipeline* _owner;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+BatchPipeline::BatchPipeline(const QList<BatchItem*>& items, int loaders, int depth, bool video)
+    : _items(items), _loaders(video ? 1 : qMax(loaders, 1)), _video(video), _usePreset(false),
+    _preset(IRL::PresetBalanced), _cache(NULL), _queue(NULL), _nextToLoad(0), _activeLoaders(0), _done(0), _failed(0),
+    _loaded(qMax(depth, 1)), _solved(qMax(depth, 1))
+{
+}
+
+void BatchPipeline::setPreset(IRL::RemovalPreset preset, const IRL::CostModel& costs)
+{
+    _usePreset = true;
+    _preset = preset;
+    _costs = costs;
+}
+
+void BatchPipeline::setResultCache(IRL::ResultCache* cache)
+{
+    _cache = cache;
+}
+
+static bool byArea(const QPair<qint64, BatchItem*>& a, const QPair<qint64, BatchItem*>& b)
+{
+    return a.first > b.first || (a.first == b.first && a.second->index < b.second->index);
+}
+
+void BatchPipeline::setSharedQueue(SharedQueue* queue)
+{
+    _queue = queue;
+    // sizes are read from headers, unreadable images go last and fail when loaded
+    QList<QPair<qint64, BatchItem*> > order;
+    for (int i = 0; i < _items.size(); i++)
+    {
+        const QSize size = QImageReader(_items[i]->imagePath).size();
+        order << qMakePair(size.isValid() ? (qint64)size.width() * size.height() : (qint64)0, _items[i]);
+    }
+    std::sort(order.begin(), order.end(), byArea);
+    _pending.clear();
+    for (int i = 0; i < order.size(); i++)
+        _pending << order[i].second;
+}
+
+int BatchPipeline::run()
+{
+    _activeLoaders = _loaders;
+    QList<LoaderThread*> loaders;
+    for (int i = 0; i < _loaders; i++)
+    {
+        loaders << new LoaderThread(this);
+        loaders.back()->start();
+    }
+    SaverThread saver(this);
+    saver.start();
+
+    // solver works in this thread and uses all IRL workers
+    IRL::VideoRemoval<Color> video;
+    while (BatchItem* item = _loaded.pop())
+    {
+        solve(item, _video ? &video : NULL);
+        _solved.push(item);
+    }
+    _solved.push(NULL);
+
+    saver.wait();
+    for (int i = 0; i < loaders.size(); i++)
+    {
+        loaders[i]->wait();
+        delete loaders[i];
+    }
+    return _failed;
+}
+
+BatchItem* BatchPipeline::nextToLoad()
+{
+    if (_queue)
+        return claimNext();
+    QMutexLocker locker(&_lock);
+    if (_nextToLoad >= _items.size())
+        return NULL;
+    return _items[_nextToLoad++];
+}
+
+BatchItem* BatchPipeline::claimNext()
+{
+    QMutexLocker locker(&_claimLock);
+    for (;;)
+    {
+        // done and given up items leave the list, so a scan checks mostly items held by other workers
+        for (int i = 0; i < _pending.size(); )
+        {
+            BatchItem* item = _pending[i];
+            if (_queue->claim(item))
+            {
+                _pending.removeAt(i);
+                return item;
+            }
+            if (_queue->isPending(item))
+                i++;
+            else
+                _pending.removeAt(i);
+        }
+        if (_pending.isEmpty())
+            return NULL;
+        QThread::msleep(_queue->pollInterval());
+    }
+}
+
+void BatchPipeline::loaderFinished()
+{
+    QMutexLocker locker(&_lock);
+    _activeLoaders--;
+    if (_activeLoaders == 0)
+        _loaded.push(NULL);
+}
+
+void BatchPipeline::load(BatchItem* item)
+{
+    QImage image(item->imagePath);
+    if (image.isNull())
+    {
+        item->error = "can't load " + item->imagePath;
+        return;
+    }
+    QImage mask(item->maskPath);
+    if (mask.isNull())
+    {
+        item->error = "can't load " + item->maskPath;
+        return;
+    }
+    if (image.size() != mask.size())
+    {
+        item->error = "image and mask sizes differ";
+        return;
+    }
+    item->input.Image = IRL::LoadFromQImage<Color>(image);
+    item->input.Mask = IRL::LoadMaskFromQImage(mask);
+}
+
+void BatchPipeline::solve(BatchItem* item, IRL::VideoRemoval<Color>* video)
+{
+    if (!item->error.isEmpty())
+    {
+        if (video)
+            video->Reset(); // the next frame does not follow the previous result
+        return;
+    }
+    IRL::ObjectRemovalParameters parameters;
+    if (_usePreset)
+    {
+        parameters = IRL::MakePreset(_preset, _costs, item->input.Image.Width(), item->input.Image.Height(),
+            IRL::GetMaskedRegion(item->input.Mask), parameters.TimeBudget);
+        if (video)
+            video->Parameters = parameters;
+    }
+    if (_queue) // a worker which takes the item over resumes from the last level solved here
+    {
+        parameters.CheckpointPath = _queue->checkpointPath(item).toStdString();
+        parameters.CheckpointOwner = _queue->owner().toStdString();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (video)
+    {
+        item->result = video->RemoveObject(item->input);
+    } else if (_cache)
+    {
+        const IRL::ResultKey key = IRL::ResultCache::MakeKey(item->input, parameters);
+        item->cached = _cache->Find(key, item->result);
+        if (!item->cached)
+        {
+            item->result = IRL::RemoveObject(item->input, (IRL::OperationCallback<Color>*)NULL, parameters);
+            _cache->Add(key, item->result);
+        }
+    } else
+    {
+        item->result = IRL::RemoveObject(item->input, (IRL::OperationCallback<Color>*)NULL, parameters);
+    }
+    item->solveTime = timer.elapsed();
+    item->input = IRL::ImageWithMask<Color>(); // release memory early
+}
+
+void BatchPipeline::save(BatchItem* item)
+{
+    if (item->error.isEmpty())
+    {
+        // written next to the output and renamed over it, so readers never see a partial file
+        QSaveFile file(item->outputPath);
+        if (!file.open(QIODevice::WriteOnly) ||
+            !IRL::SaveToQImage(item->result).save(&file, qPrintable(QFileInfo(item->outputPath).suffix())) ||
+            !file.commit())
+            item->error = "can't save " + item->outputPath;
+    }
+    item->result = IRL::Image<Color>();
+    if (_queue)
+        _queue->finish(item);
+
+    QMutexLocker locker(&_lock);
+    _done++;
+    if (item->error.isEmpty())
+    {
+        printf("[%d/%d] %s -> %s, %lld ms%s\n", _done, _items.size(), qPrintable(item->imagePath),
+            qPrintable(item->outputPath), (long long)item->solveTime, item->cached ? ", cached" : "");
+    } else
+    {
+        _failed++;
+        fprintf(stderr, "[%d/%d] %s: %s\n", _done, _items.size(), qPrintable(item->imagePath), qPrintable(item->error));
+    }
+    fflush(stdout);
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+
+#include "../IRL/ImageWithMask.h"
+#include "../IRL/Lab.h"
+#include "../IRL/Calibration.h"
+#include "../IRL/ResultCache.h"
+
+typedef IRL::LabDouble Color;
+
+namespace IRL
+{
+    template<class PixelType> class VideoRemoval;
+}
+
+class SharedQueue;
+
+// One image and mask pair of the batch
+struct BatchItem
+{
+    BatchItem() : index(0), solveTime(0), cached(false) {}
+
+    int index;
+    QString imagePath;
+    QString maskPath;                  // black pixels mark the object to remove
+    QString outputPath;
+
+    IRL::ImageWithMask<Color> input;   // valid after loading
+    IRL::Image<Color> result;          // valid after solving
+    QString error;                     // not empty once the item failed
+    qint64 solveTime;                  // ms
+    bool cached;                       // result was found in the result cache
+};
+
+// Producer/consumer queue which blocks producers while it holds 'capacity' items.
+// NULL marks the end and is never popped, so all consumers see it.
+class BatchQueue
+{
+public:
+    BatchQueue(int capacity);
+
+    void push(BatchItem* item);
+    BatchItem* pop();
+
+private:
+    int _capacity;
+    QList<BatchItem*> _items;
+    QMutex _lock;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+};
+
+// Removes objects from all items. Decoding of upcoming items and encoding of finished
+// ones run in their own threads, so they overlap with the solve of the current item.
+// At most 'depth' items wait between stages, which bounds memory use.
+// With 'video' set items are frames of one video in order, every frame starts from the result
+// of the previous one (see IRL::VideoRemoval), so there has to be one loader.
+class BatchPipeline
+{
+public:
+    BatchPipeline(const QList<BatchItem*>& items, int loaders, int depth, bool video = false);
+
+    // Items are solved with the schedule of the preset, cut to fit IRL::ObjectRemovalTimeBudget
+    // by predictions of 'costs' when they are valid (see IRL::MakePreset)
+    void setPreset(IRL::RemovalPreset preset, const IRL::CostModel& costs);
+    // Items found in the cache are not solved and solved ones are added to it, except for video
+    // frames which depend on the previous result. The cache has to outlive run.
+    void setResultCache(IRL::ResultCache* cache);
+    // Items are claimed from the queue shared with Batch processes on other hosts, largest images first
+    // as they take longest; items done or held by others are skipped. Loaders wait for items held by
+    // other workers till they are done or their leases expire. The queue has to outlive run.
+    void setSharedQueue(SharedQueue* queue);
+
+    // Return count of failed items
+    int run();
+
+private:
+    class LoaderThread;
+    class SaverThread;
+
+    // Return next item to load, NULL if all are taken
+    BatchItem* nextToLoad();
+    BatchItem* claimNext();
+    void load(BatchItem* item);
+    void solve(BatchItem* item, IRL::VideoRemoval<Color>* video);
+    void save(BatchItem* item);
+    // Called by each loader once there is nothing left to load
+    void loaderFinished();
+
+private:
+    QList<BatchItem*> _items;
+    int _loaders;
+    bool _video;
+    bool _usePreset;
+    IRL::RemovalPreset _preset;
+    IRL::CostModel _costs;
+    IRL::ResultCache* _cache;
+    SharedQueue* _queue;
+    QMutex _claimLock;             // guards the list below, loaders claim one at a time
+    QList<BatchItem*> _pending;    // items of the shared queue which may still be claimed
+
+    QMutex _lock;          // guards fields below
+    int _nextToLoad;
+    int _activeLoaders;
+    int _done;
+    int _failed;
+
+    BatchQueue _loaded;    // waiting for solve
+    BatchQueue _solved;    // waiting for encode
+};
\ No newline at end of file
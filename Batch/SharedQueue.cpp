@@ -0,0 +1,234 @@
+#include "../IRL/Includes.h"
+#include "SharedQueue.h"
+#include "Pipeline.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSysInfo>
+
+// Rewrites owner files of held claims three times per lease till the queue is destroyed
+class SharedQueue::Renewer : public QThread
+{
+public:
+    Renewer(SharedQueue* owner) : _owner(owner)
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        QMutexLocker locker(&_owner->_stopLock);
+        while (!_owner->_stopped)
+        {
+            _owner->_stop.wait(&_owner->_stopLock, (unsigned long)(_owner->_lease / 3));
+            if (_owner->_stopped)
+                break;
+            locker.unlock();
+            _owner->renew();
+            locker.relock();
+        }
+    }
+
+private:
+    SharedQueue* _owner;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+SharedQueue::SharedQueue(const QString& directory, int leaseSeconds, int attempts)
+    : _directory(directory), _lease((qint64)qMax(leaseSeconds, 1) * 1000), _attempts(qMax(attempts, 1)),
+    _claims(0), _renewals(0), _stopped(false), _renewer(NULL)
+{
+    _owner = QSysInfo::machineHostName() + "-" + QString::number(QCoreApplication::applicationPid());
+}
+
+SharedQueue::~SharedQueue()
+{
+    if (_renewer)
+    {
+        {
+            QMutexLocker locker(&_stopLock);
+            _stopped = true;
+            _stop.wakeAll();
+        }
+        _renewer->wait();
+        delete _renewer;
+    }
+}
+
+bool SharedQueue::open()
+{
+    if (!QDir().mkpath(_directory))
+        return false;
+    _renewer = new Renewer(this);
+    _renewer->start();
+    return true;
+}
+
+bool SharedQueue::claim(const BatchItem* item)
+{
+    {
+        QMutexLocker locker(&_lock);
+        if (_held.contains(item->index))
+            return false;
+    }
+    if (!isPending(item))
+        return false;
+
+    const QString claim = path(item->index, ".claim");
+    if (!QDir().mkdir(claim))
+    {
+        if (!takeOver(item->index, claim) || !isPending(item) || !QDir().mkdir(claim))
+            return false;
+    }
+    // a worker may have finished it between the check above and releasing its claim
+    if (QFile::exists(path(item->index, ".done")))
+    {
+        QDir(claim).removeRecursively();
+        return false;
+    }
+    {
+        QMutexLocker locker(&_lock);
+        _held.insert(item->index, _owner + "#" + QString::number(++_claims));
+        _seen.remove(item->index);
+    }
+    writeOwner(item->index, false);
+    return true;
+}
+
+bool SharedQueue::isPending(const BatchItem* item) const
+{
+    return !QFile::exists(path(item->index, ".done")) && attemptsOf(item->index) < _attempts;
+}
+
+void SharedQueue::finish(const BatchItem* item)
+{
+    const QString claim = path(item->index, ".claim");
+    if (item->error.isEmpty())
+    {
+        QFile done(path(item->index, ".done"));
+        if (done.open(QIODevice::WriteOnly))
+            done.write(_owner.toUtf8() + "\n");
+    } else
+    {
+        addAttempt(item->index, item->error);
+    }
+    // a claim taken over belongs to the worker which took it
+    if (isOwn(item->index))
+        QDir(claim).removeRecursively();
+    QMutexLocker locker(&_lock);
+    _held.remove(item->index);
+}
+
+QString SharedQueue::checkpointPath(const BatchItem* item) const
+{
+    return path(item->index, ".checkpoint");
+}
+
+unsigned long SharedQueue::pollInterval() const
+{
+    return (unsigned long)qBound((qint64)1000, _lease / 4, (qint64)10000);
+}
+
+QString SharedQueue::path(int index, const char* suffix) const
+{
+    return QDir(_directory).filePath(QString::number(index) + suffix);
+}
+
+int SharedQueue::attemptsOf(int index) const
+{
+    QFile file(path(index, ".attempts"));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    return file.readAll().count('\n');
+}
+
+void SharedQueue::addAttempt(int index, const QString& reason)
+{
+    QFile file(path(index, ".attempts"));
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append))
+        file.write((_owner + ": " + reason).toUtf8().replace('\n', ' ') + "\n");
+}
+
+bool SharedQueue::takeOver(int index, const QString& claim)
+{
+    QFile owner(claim + "/owner");
+    QByteArray current;
+    if (owner.open(QIODevice::ReadOnly))
+        current = owner.readAll();
+    else if (!QFileInfo(claim).exists())
+        return true; // released meanwhile
+
+    {
+        QMutexLocker locker(&_lock);
+        Seen& seen = _seen[index];
+        if (!seen.Since.isValid() || seen.Owner != current)
+        {
+            seen.Owner = current;
+            seen.Since.start();
+            return false;
+        }
+        if (seen.Since.elapsed() < _lease)
+            return false;
+        _seen.remove(index);
+    }
+
+    // of the workers which saw the lease expire, the rename succeeds for one
+    const QString stale = claim + "." + _owner;
+    if (!QDir().rename(claim, stale))
+        return false;
+    QDir(stale).removeRecursively();
+    addAttempt(index, "lease of " + QString::fromUtf8(current).section(' ', 0, 0).section('#', 0, 0) + " expired");
+    return true;
+}
+
+bool SharedQueue::writeOwner(int index, bool renewal)
+{
+    // the claim which took this one over has the same path, so its token tells them apart
+    if (renewal && !isOwn(index))
+    {
+        QMutexLocker locker(&_lock);
+        _held.remove(index);
+        return false;
+    }
+    QString token;
+    qint64 number;
+    {
+        QMutexLocker locker(&_lock);
+        token = _held.value(index);
+        number = ++_renewals;
+    }
+    if (token.isEmpty())
+        return false;
+    QFile file(path(index, ".claim") + "/owner");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write((token + " " + QString::number(number) + "\n").toUtf8()) > 0;
+}
+
+bool SharedQueue::isOwn(int index) const
+{
+    QString token;
+    {
+        QMutexLocker locker(&_lock);
+        token = _held.value(index);
+    }
+    QFile file(path(index, ".claim") + "/owner");
+    if (token.isEmpty() || !file.open(QIODevice::ReadOnly))
+        return false;
+    return QString::fromUtf8(file.readAll()).section(' ', 0, 0) == token;
+}
+
+void SharedQueue::renew()
+{
+    QList<int> held;
+    {
+        QMutexLocker locker(&_lock);
+        held = _held.keys();
+    }
+    for (int i = 0; i < held.size(); i++)
+        writeOwner(held[i], true);
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+
+struct BatchItem;
+
+// Items of one batch shared by Batch processes on any number of hosts through a directory all of them see,
+// i.e. on a network file system. Every process runs with the same lists and claims items one at a time,
+// so faster workers take more of them and small and huge images balance by themselves.
+//
+// An item is claimed by creating directory <index>.claim, which is atomic on network file systems too.
+// The holder writes a token unique to the claim to <index>.claim/owner and renews its lease by rewriting it
+// while the token there is still its own; a claim whose owner file did not change for the lease time, as seen
+// by the clock of the observer, is taken over. A holder which finds another token there stops renewing and
+// leaves the claim to the worker which took it over. So items of crashed or preempted workers are solved by
+// others, resuming from the checkpoint the removal writes after every level.
+// Finished items get <index>.done. Failures and takeovers append a line to <index>.attempts, items with
+// 'attempts' of them are given up. Results are deterministic, so an item solved twice by a worker which
+// lost its lease to another one gives the same file.
+class SharedQueue
+{
+public:
+    SharedQueue(const QString& directory, int leaseSeconds, int attempts);
+    ~SharedQueue();
+
+    // Creates the directory and starts renewing leases, return false when it can't be created
+    bool open();
+
+    // Claims the item for this process, false when it is done, was given up or is held by a live worker
+    bool claim(const BatchItem* item);
+    // Item which is not done nor given up, so another worker may still solve it or leave it to this one
+    bool isPending(const BatchItem* item) const;
+    // Releases the claim, marks the item done when it has no error and counts an attempt otherwise
+    void finish(const BatchItem* item);
+
+    // Checkpoint of the removal of the item, see IRL::ObjectRemovalParameters::CheckpointPath
+    QString checkpointPath(const BatchItem* item) const;
+    // Host and process, see IRL::ObjectRemovalParameters::CheckpointOwner
+    QString owner() const { return _owner; }
+    // ms between scans for claimable items while all pending ones are held by others
+    unsigned long pollInterval() const;
+
+private:
+    class Renewer;
+
+    QString path(int index, const char* suffix) const;
+    int attemptsOf(int index) const;
+    void addAttempt(int index, const QString& reason);
+    // Removes the claim of a worker whose lease expired, false when it is alive or was taken by another one
+    bool takeOver(int index, const QString& claim);
+    // Writes the token of a held claim, a renewal only while the claim is still own. A claim which was
+    // taken over is no longer held and false is returned.
+    bool writeOwner(int index, bool renewal);
+    // Claim of the item is still the one of this process, i.e. it was not taken over
+    bool isOwn(int index) const;
+    void renew();
+
+private:
+    // disable copy methods
+    SharedQueue(const SharedQueue&);
+    void operator=(const SharedQueue&);
+
+    // Owner file of a claim held by another worker as last seen and since when it did not change
+    struct Seen
+    {
+        QByteArray Owner;
+        QElapsedTimer Since;
+    };
+
+    QString _directory;
+    qint64 _lease;          // ms
+    int _attempts;
+    QString _owner;         // host and process
+
+    mutable QMutex _lock;   // guards fields below
+    QHash<int, QString> _held;  // tokens of claims of this process by index
+    QHash<int, Seen> _seen;
+    qint64 _claims;
+    qint64 _renewals;
+
+    QMutex _stopLock;
+    QWaitCondition _stop;
+    bool _stopped;
+    Renewer* _renewer;
+};
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "../IRL/Includes.h"
+#include "Pipeline.h"
+#include "SharedQueue.h"
+
+#include "../IRL/Parallel.h"
+#include "../IRL/Parameters.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QStringList>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDir>
+#include <QtCore/QTextStream>
+#include <stdio.h>
+
+// Batch object removal.
+// Usage: Batch -i images.txt -m masks.txt -o outdir [-f png] [-w workers] [-j loaders] [-q depth] [-t seconds] [-s tile] [-v 1]
+//        [-p preset] [-c costs.txt] [-r cachedir] [-d queuedir] [-l seconds] [-a attempts] [-n 1]
+// Lists have one path per line, the n-th mask belongs to the n-th image.
+// With -d any number of processes on hosts which share the queue directory and the output one work
+// through the same lists together, see SharedQueue.
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s -i images.txt -m masks.txt -o outdir [-f png] [-w workers] [-j loaders] [-q depth] [-t seconds] [-s tile] [-v 1]\n"
+        "       [-p preset] [-c costs.txt] [-r cachedir] [-d queuedir] [-l seconds] [-a attempts] [-n 1]\n"
+        "  -i  list of images, one path per line\n"
+        "  -m  list of masks of the same size as images, black pixels mark objects to remove\n"
+        "  -o  directory for results, named after images\n"
+        "  -f  format of results, png by default\n"
+        "  -w  threads solving one image, all hardware threads by default\n"
+        "  -j  threads decoding upcoming images, 1 by default\n"
+        "  -q  how many images may wait for each stage, 2 by default\n"
+        "  -t  time budget of one image in seconds, iterations which don't fit are skipped, no limit by default\n"
+        "  -s  solve large images in crops around holes made of tiles of this size, whole image by default\n"
+        "  -v  1 when images are frames of one video in order, later frames start from the previous result\n"
+        "      and solve only fine levels, one loader is used\n"
+        "  -p  iteration schedule: fast, balanced or quality, with -c and -t cut to the predicted time of each image\n"
+        "  -c  costs of this machine written by the calibration mode of Benchmark\n"
+        "  -r  directory of results keyed by image, mask and parameters; repeated requests are not solved again,\n"
+        "      results of this run are kept in memory too. Not used with -v\n"
+        "  -d  directory shared by processes which work through the same lists, i.e. on many hosts;\n"
+        "      every process claims the next image nobody solved yet, largest first. Not with -v\n"
+        "  -l  lease of claimed images in seconds, images of workers which stop renewing it are taken over\n"
+        "      and resume from their checkpoint, 600 by default\n"
+        "  -a  attempts of one image before it is given up, failures and takeovers count, 3 by default\n"
+        "  -n  1 to pin threads solving images to hardware threads spread over sockets and cores, for hosts\n"
+        "      which run one process; big buffers are then placed in the memory of all sockets\n", name);
+}
+
+static bool readList(const QString& path, QStringList& list)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream in(&file);
+    while (!in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+        if (!line.isEmpty())
+            list << line;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv); // image format plugins are found through it
+
+    QString imagesPath;
+    QString masksPath;
+    QString outputDir;
+    QString format = "png";
+    int workers = 0;
+    int loaders = 1;
+    int depth = 2;
+    double budget = 0;
+    int tileSize = 0;
+    bool video = false;
+    QString preset;
+    QString costsPath;
+    QString cacheDir;
+    QString queueDir;
+    int lease = 600;
+    int attempts = 3;
+    bool pin = false;
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); i++)
+    {
+        if (i + 1 >= args.size())
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        if (args[i] == "-i")
+            imagesPath = args[++i];
+        else if (args[i] == "-m")
+            masksPath = args[++i];
+        else if (args[i] == "-o")
+            outputDir = args[++i];
+        else if (args[i] == "-f")
+            format = args[++i];
+        else if (args[i] == "-w")
+            workers = args[++i].toInt();
+        else if (args[i] == "-j")
+            loaders = args[++i].toInt();
+        else if (args[i] == "-q")
+            depth = args[++i].toInt();
+        else if (args[i] == "-t")
+            budget = args[++i].toDouble();
+        else if (args[i] == "-s")
+            tileSize = args[++i].toInt();
+        else if (args[i] == "-v")
+            video = args[++i].toInt() != 0;
+        else if (args[i] == "-p")
+            preset = args[++i];
+        else if (args[i] == "-c")
+            costsPath = args[++i];
+        else if (args[i] == "-r")
+            cacheDir = args[++i];
+        else if (args[i] == "-d")
+            queueDir = args[++i];
+        else if (args[i] == "-l")
+            lease = args[++i].toInt();
+        else if (args[i] == "-a")
+            attempts = args[++i].toInt();
+        else if (args[i] == "-n")
+            pin = args[++i].toInt() != 0;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (imagesPath.isEmpty() || masksPath.isEmpty() || outputDir.isEmpty() || (video && !queueDir.isEmpty()))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    IRL::RemovalPreset removalPreset = IRL::PresetBalanced;
+    if (!preset.isEmpty() && !IRL::ParsePreset(preset.toStdString(), removalPreset))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    IRL::CostModel costs;
+    if (!costsPath.isEmpty() && !costs.Load(costsPath.toStdString()))
+    {
+        fprintf(stderr, "Can't read costs %s\n", qPrintable(costsPath));
+        return 1;
+    }
+
+    QStringList images;
+    QStringList masks;
+    if (!readList(imagesPath, images) || !readList(masksPath, masks))
+    {
+        fprintf(stderr, "Can't read lists\n");
+        return 1;
+    }
+    if (images.size() != masks.size())
+    {
+        fprintf(stderr, "Lists have %d images and %d masks\n", images.size(), masks.size());
+        return 1;
+    }
+    if (!QDir().mkpath(outputDir))
+    {
+        fprintf(stderr, "Can't create %s\n", qPrintable(outputDir));
+        return 1;
+    }
+    if (!cacheDir.isEmpty() && !QDir().mkpath(cacheDir))
+    {
+        fprintf(stderr, "Can't create %s\n", qPrintable(cacheDir));
+        return 1;
+    }
+
+    QList<BatchItem*> items;
+    for (int i = 0; i < images.size(); i++)
+    {
+        BatchItem* item = new BatchItem();
+        item->index = i;
+        item->imagePath = images[i];
+        item->maskPath = masks[i];
+        item->outputPath = QDir(outputDir).filePath(QFileInfo(images[i]).completeBaseName() + "." + format);
+        items << item;
+    }
+
+    IRL::Parallel::Initialize(qMax(workers, 0), pin);
+    IRL::ResetParameters();
+    IRL::ObjectRemovalTimeBudget = budget;
+    IRL::ObjectRemovalTileSize = tileSize;
+
+    BatchPipeline pipeline(items, loaders, depth, video);
+    if (!preset.isEmpty())
+        pipeline.setPreset(removalPreset, costs);
+    IRL::ResultCache cache((size_t)256 << 20, QDir(cacheDir).absolutePath().toStdString());
+    if (!cacheDir.isEmpty())
+        pipeline.setResultCache(&cache);
+    SharedQueue queue(queueDir, lease, attempts);
+    if (!queueDir.isEmpty())
+    {
+        if (!queue.open())
+        {
+            fprintf(stderr, "Can't create %s\n", qPrintable(queueDir));
+            return 1;
+        }
+        pipeline.setSharedQueue(&queue);
+    }
+    int failed = pipeline.run();
+    qDeleteAll(items);
+
+    if (failed > 0)
+        fprintf(stderr, "%d of %d images failed\n", failed, items.size());
+    return failed > 0 ? 1 : 0;
+}
\ No newline at end of file
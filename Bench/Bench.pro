@@ -0,0 +1,3 @@
+# Benchmarks, build separately from the application
+TEMPLATE = subdirs
+SUBDIRS = DispatchLatency.pro Benchmark.pro
\ No newline at end of file
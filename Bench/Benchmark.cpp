@@ -0,0 +1,454 @@
+#include "../IRL/Includes.h"
+#include "../IRL/Parallel.h"
+#include "../IRL/Parameters.h"
+#include "../IRL/PatchDistance.h"
+#include "../IRL/Image.h"
+#include "../IRL/ImageWithMask.h"
+#include "../IRL/ImageConversion.h"
+#include "../IRL/GaussianPyramid.h"
+#include "../IRL/Scaling.h"
+#include "../IRL/NearestNeighborField.h"
+#include "../IRL/BidirectionalSimilarity.h"
+#include "../IRL/ObjectRemoval.h"
+#include "../IRL/IO.h"
+#include "../IRL/Memory.h"
+#include "../IRL/Calibration.h"
+
+#include <QtCore/QElapsedTimer>
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Times stages of object removal in isolation on synthetic and fixture images
+// for several worker counts, writes results as JSON.
+//
+// Usage: Benchmark [-o results.json] [-t 1,2,4] [-r repeats] [-s 320,640,1280] [fixture.png ...]
+// Synthetic images of the given widths are 5:4, so default sizes are halved exactly by every pyramid level.
+// Fixtures are RGBA images, transparent pixels mark the object to remove.
+//
+// Calibration: Benchmark -c costs.txt [-t workers] [-s 320,640,1280]
+// Measures costs of removal stages with the last workers count (all cores by default), writes them for
+// IRL::MakePreset (see Batch -c) and prints predicted times of presets for synthetic images of the sizes.
+
+using namespace IRL;
+
+namespace
+{
+    typedef LabDouble Color; // the same as the application works with
+
+    struct Input
+    {
+        std::string Name;
+        ImageWithMask<RGB8> Rgb;
+    };
+
+    struct Settings
+    {
+        std::string Output;
+        std::vector<int> Workers;
+        std::vector<int> Sizes;
+        int Repeats;
+    };
+
+    // Deterministic texture with noise, so matching has some work to do
+    Input MakeSynthetic(int width, int height)
+    {
+        Input input;
+        std::ostringstream name;
+        name << "synthetic " << width << "x" << height;
+        input.Name = name.str();
+
+        Image<RGB8> image(width, height);
+        Image<Alpha8> mask(width, height);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                uint32_t hash = (x * 73856093u) ^ (y * 19349663u);
+                hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+                int noise = (int)((hash >> 24) % 21) - 10;
+                double wave = 128 + 60 * sin(x * 0.3 + sin(y * 0.1) * 3) + 40 * sin(y * 0.23 + x * 0.05);
+                int r = (int)wave + noise;
+                int g = 255 - (int)wave + noise;
+                int b = ((x / 16 + y / 16) % 2) * 100 + 50 + noise;
+                image(x, y) = RGB8((uint8_t)Maximum(0, Minimum(255, r)), (uint8_t)Maximum(0, Minimum(255, g)), (uint8_t)b);
+
+                bool masked = x > width * 2 / 5 && x < width * 3 / 5 && y > height * 2 / 5 && y < height * 3 / 5;
+                mask(x, y) = Alpha8(masked ? 0 : 255);
+            }
+        }
+        input.Rgb = ImageWithMask<RGB8>(image, mask);
+        return input;
+    }
+
+    bool LoadFixture(const std::string& path, Input& input)
+    {
+        input.Name = path;
+        input.Rgb = LoadImageWithMask<RGB8>(path);
+        return input.Rgb.Image.IsValid();
+    }
+
+    // Timings of one stage in milliseconds
+    class Timings
+    {
+    public:
+        void Add(double ms) { _samples.push_back(ms); }
+
+        double Min() const { return *std::min_element(_samples.begin(), _samples.end()); }
+        double Median() const
+        {
+            std::vector<double> sorted = _samples;
+            std::sort(sorted.begin(), sorted.end());
+            return sorted[sorted.size() / 2];
+        }
+        double Mean() const
+        {
+            double sum = 0;
+            for (unsigned int i = 0; i < _samples.size(); i++)
+                sum += _samples[i];
+            return sum / _samples.size();
+        }
+        int Count() const { return (int)_samples.size(); }
+
+    private:
+        std::vector<double> _samples;
+    };
+
+    class Report
+    {
+    public:
+        explicit Report(std::ostream& out) : _out(out), _first(true)
+        {
+            _out << "{\n  \"simd\": \"" << Internal::GetSimdLevelName(Internal::GetSimdLevel()) << "\",\n"
+                 << "  \"patchSize\": " << PatchSize << ",\n"
+                 << "  \"results\": [";
+        }
+
+        ~Report()
+        {
+            _out << "\n  ]\n}\n";
+        }
+
+        void Add(const Input& input, int workers, const char* stage, const Timings& timings)
+        {
+            if (!_first)
+                _out << ",";
+            _first = false;
+            _out << "\n    {\"image\": \"" << Escape(input.Name) << "\""
+                 << ", \"width\": " << input.Rgb.Image.Width()
+                 << ", \"height\": " << input.Rgb.Image.Height()
+                 << ", \"workers\": " << workers
+                 << ", \"stage\": \"" << stage << "\""
+                 << ", \"repeats\": " << timings.Count()
+                 << ", \"minMs\": " << timings.Min()
+                 << ", \"medianMs\": " << timings.Median()
+                 << ", \"meanMs\": " << timings.Mean() << "}";
+            _out.flush();
+            fprintf(stderr, "%-32s %2d workers %-28s %10.3f ms\n", input.Name.c_str(), workers, stage, timings.Median());
+        }
+
+    private:
+        static std::string Escape(const std::string& s)
+        {
+            std::string result;
+            for (unsigned int i = 0; i < s.size(); i++)
+            {
+                if (s[i] == '"' || s[i] == '\\')
+                    result += '\\';
+                result += s[i];
+            }
+            return result;
+        }
+
+        std::ostream& _out;
+        bool _first;
+    };
+
+    // Fresh solver for matching the image with itself, masked pixels are not allowed as source
+    void SetupNNF(NNF<Color, true>& nnf, const ImageWithMask<Color>& input)
+    {
+        nnf.Source = input.Image;
+        nnf.SourceMask = input.Mask;
+        nnf.Target = input.Image;
+        nnf.Field = MakeRandomField(input.Image, input.Image);
+    }
+
+    void SetupBDS(BidirectionalSimilarity<Color, true>& solver, const ImageWithMask<Color>& input)
+    {
+        solver.Reset();
+        solver.Source = input.Image;
+        solver.SourceMask = input.Mask;
+        solver.Target = input.Image;
+        solver.SourceToTarget = MakeRandomField(input.Image, input.Image);
+        solver.TargetToSource = MakeRandomField(input.Image, input.Image);
+        solver.Alpha = ObjectRemovalAlpha;
+    }
+
+    double Elapsed(const QElapsedTimer& timer)
+    {
+        return timer.nsecsElapsed() / 1e6;
+    }
+
+    // Serial stages are timed once, when 'serial' is set
+    void Run(Report& report, const Input& input, int workers, int repeats, bool serial)
+    {
+        const int Levels = ceil(log((float)Minimum<int>(input.Rgb.Image.Width(), input.Rgb.Image.Height()))) + ObjectRemovalLODBias;
+        QElapsedTimer timer;
+
+        // converted image is the input of other stages
+        ImageWithMask<Color> lab;
+        {
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                Convert(lab, input.Rgb);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "Convert RGB8 to Lab", timings);
+        }
+
+        {
+            Image<RGB8> rgb;
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                Convert(rgb, lab.Image);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "Convert Lab to RGB8", timings);
+        }
+
+        {
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                GaussianPyramid<Color> pyramid(lab.Image, Levels);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "GaussianPyramid", timings);
+        }
+
+        {
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                GaussianPyramid<Color> image;
+                GaussianPyramid<Alpha8> mask;
+                BuildGaussianPyramids(image, mask, lab, Levels);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "GaussianPyramid with mask", timings);
+        }
+
+        {
+            const Image<Color> half = ScaleDown(lab.Image);
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                Image<Color> result = ScaleUp(half);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "ScaleUp", timings);
+        }
+
+        // iterations from random field, the first one also prepares distances
+        const int NNFIterations = 4;
+        for (int parallel = 0; parallel < 2; parallel++)
+        {
+            if (!parallel && !serial)
+                continue;
+            Timings first;
+            Timings next;
+            for (int i = 0; i < repeats; i++)
+            {
+                NNF<Color, true> nnf;
+                SetupNNF(nnf, lab);
+                timer.start();
+                nnf.Iteration(parallel != 0);
+                first.Add(Elapsed(timer));
+                timer.start();
+                for (int j = 1; j < NNFIterations; j++)
+                    nnf.Iteration(parallel != 0);
+                next.Add(Elapsed(timer) / (NNFIterations - 1));
+            }
+            report.Add(input, parallel ? workers : 1, parallel ? "NNF first iteration" : "NNF first iteration serial", first);
+            report.Add(input, parallel ? workers : 1, parallel ? "NNF iteration" : "NNF iteration serial", next);
+        }
+
+        {
+            Timings timings;
+            BidirectionalSimilarity<Color, true> solver;
+            SetupBDS(solver, lab);
+            solver.Iteration(true); // initialization and random fields are not timed
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                solver.Iteration(true);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "BidirectionalSimilarity", timings);
+        }
+
+        {
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                RemoveObject(lab);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "RemoveObject", timings);
+        }
+
+        {
+            ObjectRemovalParameters parameters;
+            parameters.FixedPoint = true;
+            Timings timings;
+            for (int i = 0; i < repeats; i++)
+            {
+                timer.start();
+                RemoveObject(lab, (OperationCallback<Color>*)NULL, parameters);
+                timings.Add(Elapsed(timer));
+            }
+            report.Add(input, workers, "RemoveObject fixed point", timings);
+        }
+    }
+
+    // Writes costs of this machine and what they predict for every preset
+    int Calibrate(const Settings& settings, const std::string& path)
+    {
+        Parallel::Initialize(settings.Workers.back());
+        const CostModel costs = CalibrateCosts<Color>();
+        Parallel::Shutdown();
+        if (!costs.Save(path))
+        {
+            fprintf(stderr, "Can't write %s\n", path.c_str());
+            return 1;
+        }
+        fprintf(stderr, "%d workers: %.2f ns NNF, %.2f ns vote, %.2f ns scale per pixel\n",
+            costs.Workers, costs.NNFPixel, costs.VotePixel, costs.ScalePixel);
+
+        const RemovalPreset presets[] = { PresetFast, PresetBalanced, PresetQuality };
+        for (unsigned int i = 0; i < settings.Sizes.size(); i++)
+        {
+            // hole of MakeSynthetic
+            const int width = settings.Sizes[i];
+            const int height = width * 4 / 5;
+            const Rectangle<int32_t> hole(width * 2 / 5, height * 2 / 5, width / 5, height / 5);
+            fprintf(stderr, "%5dx%-5d", width, height);
+            for (int j = 0; j < 3; j++)
+            {
+                const ObjectRemovalParameters parameters = MakePreset(presets[j], costs, width, height, hole);
+                fprintf(stderr, " %s %8.3f s", GetPresetName(presets[j]), PredictRemovalTime(costs, width, height, hole, parameters));
+            }
+            fprintf(stderr, "\n");
+        }
+        return 0;
+    }
+
+    std::vector<int> ParseList(const char* s)
+    {
+        std::vector<int> result;
+        std::istringstream in(s);
+        std::string item;
+        while (std::getline(in, item, ','))
+        {
+            int value = atoi(item.c_str());
+            if (value > 0)
+                result.push_back(value);
+        }
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    settings.Output = "Benchmark.json";
+    settings.Repeats = 3;
+    std::vector<std::string> fixtures;
+    std::string costsPath;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            settings.Output = argv[++i];
+        else if (arg == "-t" && i + 1 < argc)
+            settings.Workers = ParseList(argv[++i]);
+        else if (arg == "-s" && i + 1 < argc)
+            settings.Sizes = ParseList(argv[++i]);
+        else if (arg == "-r" && i + 1 < argc)
+            settings.Repeats = Maximum(1, atoi(argv[++i]));
+        else if (arg == "-c" && i + 1 < argc)
+            costsPath = argv[++i];
+        else if (arg[0] == '-')
+        {
+            fprintf(stderr, "Usage: %s [-o results.json] [-t 1,2,4] [-r repeats] [-s 320,640,1280] [fixture.png ...]\n"
+                "       %s -c costs.txt [-t workers] [-s 320,640,1280]\n", argv[0], argv[0]);
+            return 1;
+        }
+        else
+            fixtures.push_back(arg);
+    }
+    if (settings.Workers.empty())
+    {
+        for (int workers = 1; workers < QThread::idealThreadCount(); workers *= 2)
+            settings.Workers.push_back(workers);
+        settings.Workers.push_back(Maximum(1, QThread::idealThreadCount()));
+    }
+    if (settings.Sizes.empty())
+    {
+        settings.Sizes.push_back(320);
+        settings.Sizes.push_back(640);
+        settings.Sizes.push_back(1280);
+    }
+
+    ResetParameters();
+    DebugOutput = false;
+    if (!costsPath.empty())
+        return Calibrate(settings, costsPath);
+
+    std::vector<Input> inputs;
+    for (unsigned int i = 0; i < settings.Sizes.size(); i++)
+        inputs.push_back(MakeSynthetic(settings.Sizes[i], settings.Sizes[i] * 4 / 5));
+    for (unsigned int i = 0; i < fixtures.size(); i++)
+    {
+        Input input;
+        if (!LoadFixture(fixtures[i], input))
+        {
+            fprintf(stderr, "Can't load %s\n", fixtures[i].c_str());
+            return 1;
+        }
+        inputs.push_back(input);
+    }
+
+    std::ofstream out(settings.Output.c_str());
+    if (!out)
+    {
+        fprintf(stderr, "Can't write %s\n", settings.Output.c_str());
+        return 1;
+    }
+
+    {
+        Report report(out);
+        for (unsigned int i = 0; i < settings.Workers.size(); i++)
+        {
+            Parallel::Initialize(settings.Workers[i]);
+            for (unsigned int j = 0; j < inputs.size(); j++)
+            {
+                // same random fields for every workers count
+                srand(1);
+                Run(report, inputs[j], settings.Workers[i], settings.Repeats, i == 0);
+            }
+            Parallel::Shutdown();
+        }
+    }
+    Memory::Report(std::cerr);
+    return out.good() ? 0 : 1;
+}
\ No newline at end of file
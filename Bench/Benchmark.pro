@@ -0,0 +1,67 @@
+# Headless benchmark of the IRL core stages, writes results as JSON
+TEMPLATE = app
+TARGET = Benchmark
+CONFIG += console
+CONFIG -= app_bundle
+
+# same options as the application, see Retargeting.pro
+opencl {
+  DEFINES += IRL_USE_OPENCL
+  LIBS += -lOpenCL
+}
+counters {
+  DEFINES += IRL_NNF_COUNTERS
+}
+
+HEADERS += ../IRL/IO.h ../IRL/IO.inl
+SOURCES += ../IRL/IO.cpp ../IRL/IOQt.cpp
+
+HEADERS += ../IRL/Parameters.h
+SOURCES += ../IRL/Parameters.cpp
+
+HEADERS += ../IRL/Profiler.h
+SOURCES += ../IRL/Profiler.cpp
+
+HEADERS += ../IRL/DebugWriter.h
+SOURCES += ../IRL/DebugWriter.cpp
+
+HEADERS += ../IRL/Memory.h
+SOURCES += ../IRL/Memory.cpp
+
+HEADERS += ../IRL/Threading.h ../IRL/ThreadingQt.h ../IRL/Parallel.h ../IRL/Parallel.inl
+SOURCES += ../IRL/Parallel.cpp
+
+HEADERS += ../IRL/JobQueue.h
+SOURCES += ../IRL/JobQueue.cpp
+
+HEADERS += ../IRL/Point2D.h
+SOURCES += ../IRL/Point2D.cpp
+
+HEADERS += ../IRL/OffsetField.h
+SOURCES += ../IRL/OffsetField.cpp
+
+HEADERS += ../IRL/ColorConversion.h ../IRL/ColorConversion.inl
+SOURCES += ../IRL/ColorConversion.cpp
+
+HEADERS += ../IRL/Scaling.h ../IRL/Scaling.inl
+SOURCES += ../IRL/Scaling.cpp
+
+HEADERS += ../IRL/PatchDistance.h
+SOURCES += ../IRL/PatchDistance.cpp
+
+HEADERS += ../IRL/PatchIndex.h ../IRL/PatchSummaries.h ../IRL/CompactVotes.h ../IRL/ValidPatches.h ../IRL/Checkpoint.h ../IRL/PatchHashing.h
+SOURCES += ../IRL/PatchIndex.cpp ../IRL/PatchSummaries.cpp ../IRL/CompactVotes.cpp ../IRL/ValidPatches.cpp ../IRL/Checkpoint.cpp ../IRL/PatchHashing.cpp
+
+HEADERS += ../IRL/DeviceNNF.h
+SOURCES += ../IRL/DeviceNNF.cpp
+
+HEADERS += ../IRL/NearestNeighborField.h ../IRL/NearestNeighborField.inl ../IRL/TiledImage.h
+HEADERS += ../IRL/BidirectionalSimilarity.h ../IRL/BidirectionalSimilarity.inl
+HEADERS += ../IRL/PyramidCache.h ../IRL/PyramidCache.inl
+HEADERS += ../IRL/ResultCache.h
+SOURCES += ../IRL/ResultCache.cpp
+HEADERS += ../IRL/ObjectRemoval.h ../IRL/ObjectRemoval.inl
+HEADERS += ../IRL/Calibration.h ../IRL/Calibration.inl
+SOURCES += ../IRL/Calibration.cpp
+
+SOURCES += Benchmark.cpp
\ No newline at end of file
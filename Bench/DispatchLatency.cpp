@@ -0,0 +1,82 @@
+#include "../IRL/Includes.h"
+#include "../IRL/Parallel.h"
+
+#include <QtCore/QElapsedTimer>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Measures ParallelFor dispatch latency on image sizes of coarse pyramid levels,
+// with and without grain size cutoff
+
+using namespace IRL;
+
+namespace
+{
+    // Cheap per pixel work, similar to Convert
+    class RowTask :
+        public Parallel::Runnable
+    {
+    public:
+        struct State
+        {
+            int Width;
+        };
+
+        void Set(int start, int stop, const State& state)
+        {
+            _start = start;
+            _stop = stop;
+            _state = state;
+        }
+
+        virtual void Run()
+        {
+            int32_t sum = 0;
+            for (int y = _start; y < _stop; y++)
+                for (int x = 0; x < _state.Width; x++)
+                    sum += x ^ y;
+            Result = sum;
+        }
+
+        volatile int32_t Result;
+
+    private:
+        int _start;
+        int _stop;
+        State _state;
+    };
+
+    // Return microseconds per dispatch
+    double Measure(int size, bool grain, int repeats)
+    {
+        RowTask::State state;
+        state.Width = size;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < repeats; i++)
+        {
+            Parallel::ParallelFor<RowTask, RowTask::State> tasks(0, size, state, grain ? size : 0);
+            tasks.SpawnAndSync();
+        }
+        return timer.nsecsElapsed() / 1000.0 / repeats;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : QThread::idealThreadCount();
+    int repeats = argc > 2 ? atoi(argv[2]) : 2000;
+    Parallel::Initialize(workers);
+
+    printf("workers: %d, grain size: %u\n", workers, Parallel::GetGrainSize());
+    printf("%10s %16s %16s\n", "size", "parallel, us", "grain, us");
+    for (int size = 8; size <= 1024; size *= 2)
+    {
+        // warm up workers
+        Measure(size, false, 10);
+        double parallel = Measure(size, false, repeats);
+        double grain = Measure(size, true, repeats);
+        printf("%4dx%-5d %16.2f %16.2f\n", size, size, parallel, grain);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+# Microbenchmark of ParallelFor dispatch
+TEMPLATE = app
+TARGET = DispatchLatency
+CONFIG += console
+QT -= gui
+
+HEADERS += ../IRL/Threading.h ../IRL/ThreadingQt.h ../IRL/Parallel.h ../IRL/Parallel.inl
+SOURCES += ../IRL/Parallel.cpp
+
+SOURCES += DispatchLatency.cpp
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "TypeTraits.h"
+
 namespace IRL
 {
     // Used for linear operation with pixels. 
@@ -7,4 +9,22 @@ namespace IRL
     // definition (Lab.h, RGB.g).
     template<class PixelType, class Coeff>
     class Accumulator;
+
+    // Channels of pixel by index, used by fixed point votes.
+    // Template specializations defined in files with color definition too.
+    template<class PixelType>
+    struct PixelChannels;
+
+    namespace Internal
+    {
+        // Converts value to channel, integer channels are rounded and kept in their range
+        template<class ChannelType>
+        force_inline ChannelType ToChannel(double value)
+        {
+            if (!TypeTraits<ChannelType>::IsInteger)
+                return (ChannelType)value;
+            const double maxValue = (double)TypeTraits<ChannelType>::MaxValue();
+            return (ChannelType)(value <= 0 ? 0 : (value >= maxValue ? maxValue : value + 0.5));
+        }
+    }
 }
\ No newline at end of file
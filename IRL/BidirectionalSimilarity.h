@@ -1,27 +1,71 @@
 #pragma once
 
 #include "NearestNeighborField.h"
+#include "CompactVotes.h"
 #include "TypeTraits.h"
 
 namespace IRL
 {
-    template<class PixelType, bool UseSourceMask>
+    // Size is the patch size of both fields, see NNF
+    template<class PixelType, bool UseSourceMask, int Size = PatchSize>
     class BidirectionalSimilarity
     {
+        enum { HalfSize = Size / 2 };
+
     public:
-        typedef Image<Alpha<typename PixelType::DistanceType> > DistanceField;
+        typedef typename NNF<PixelType, UseSourceMask, Size>::DistanceField DistanceField;
 
-        Image<PixelType> Source;     // source image
-        Image<Alpha8>    SourceMask; // importance mask of the source image
+        ConstImage<PixelType> Source;     // source image
+        ConstImage<Alpha8>    SourceMask; // importance mask of the source image
         Image<PixelType> Target;     // target image and result of the algorithm
 
-        // offset fields
+        // offset fields, set them before the first iteration only (i.e. after Reset())
         OffsetField SourceToTarget;  // SourceToTarget[P] = arg min_{Q \in T} D(P,Q), P \in S
         OffsetField TargetToSource;  // TargetToSource[Q] = arg min_{P \in S} D(P,Q), Q \in T
 
         double Alpha;                // completeness/coherence importance ratio, default 0.5
         int    NNFIterations;        // how many inner NNF calculation iterations to perform, default 5
+        double NNFTolerance;         // stop NNF iterations earlier when offsets updates per patch is lower, 0 to disable
         int    SearchRadius;         // random search radius in patch match algorithm
+        NNFPropagation Propagation;  // propagation engine in patch match algorithm, default ScanOrderPropagation
+        ComputeBackend Backend;      // where patch match iterations are computed, default CpuBackend
+        // Search TargetToSource candidates in PatchIndex of the Source instead of random samples, default false.
+        // The index is built by the first iteration.
+        bool   UsePatchIndex;
+        // Reject candidates of both fields by lower bounds of their distances, see NNF::UsePatchBounds. Default false.
+        bool   UsePatchBounds;
+        // How many best matches of a patch vote in both fields, default 1. Matches vote with weights inverse
+        // to their distances, so fewer iterations are needed to settle. See NNF::K. Set before the first iteration.
+        int    NearestNeighbors;
+        // Collect votes in CompactVotes of 16 bytes per pixel instead of Accumulator images, default false.
+        // Results differ by rounding of fixed point. Set before the first iteration.
+        bool   UseCompactVotes;
+        // Fields are searched exhaustively (see ExhaustiveSearch) by one NNF iteration instead of NNFIterations
+        // when their target patches times source patches are at most this, default 0 (never). Exact matches
+        // of small coarse levels are cheaper than patch match iterations and give finer levels a better start.
+        int64_t ExhaustiveSearchLimit;
+        // Later NNF iterations of both fields process only patches around changed offsets, see NNF::SkipConverged.
+        // Default false. Set before the first iteration.
+        bool   SkipConverged;
+        // Random search of both fields, see NNF::RandomSearchLimit and NNF::RandomSearchInvAlpha. Defaults 80 and 2.
+        // Set before the first iteration.
+        int    RandomSearchLimit;
+        int    RandomSearchInvAlpha;
+        // Scheduling of both fields, see NNF::SuperPatchSize. Default 0. Set before the first iteration.
+        int    SuperPatchSize;
+        // Patch match of both fields reads tiled copies of its source, see NNF::TiledSource. Default false.
+        bool   TiledSource;
+        // Random search of both fields prefetches candidates in batches, see NNF::BatchedRandomSearch. Default false.
+        bool   BatchedRandomSearch;
+        // Target pixels which may change, whole image if empty. Only patches overlapping it are
+        // matched and vote, so completeness is approximated by source patches around it.
+        // Source and Target have to be of the same size when it is set. Set before the first iteration.
+        Rectangle<int32_t> Region;
+        // Non zero value stops NNF work and the iteration early, NULL if never set.
+        // Target and offset fields are not valid after a stopped iteration.
+        const AtomicInt* CancelFlag;
+        // Key of random search in both fields, equal seeds give equal results whatever the workers count
+        uint64_t Seed;
 
         std::string DebugPath;        // where to put debug files
 
@@ -33,9 +77,22 @@ namespace IRL
         // Prepares this object for another run of iterations. Does not change public fields.
         void Reset();
 
+        // Return completeness + coherency terms of the dissimilarity measure after the last iteration
+        double GetEnergy() const;
+        // Return offsets updates per patch (average of both fields) made by the last iteration
+        double GetChangedOffsets() const;
+        // Return work counters of NNF iterations (both fields) made by the last iteration
+        const NNFCounters& GetNNFCounters() const;
+        // Return work counters of NNF iterations (both fields) made since Reset()
+        NNFCounters GetTotalNNFCounters() const;
+        // Return bytes held by this object: Target, votes and both solvers with their fields and
+        // distances. Source and SourceMask are shared with the caller and are not counted.
+        size_t GetBytes() const;
+
     private:
         typedef typename TypeTraits<typename PixelType::ChannelType>::LargerType VoteQuantityType;
         typedef Image<Accumulator<PixelType, VoteQuantityType> > Votes;
+        typedef ConstImageView<IRL::Alpha<typename Internal::StoredDistance<typename PixelType::DistanceType>::Type> > DistanceView;
 
         // Initializes algorithm before first iteration
         inline void Initialize();
@@ -43,17 +100,130 @@ namespace IRL
         inline void UpdateSourceToTargetNNF(bool parallel);
         // Updates TargetToSource
         inline void UpdateTargetToSourceNNF(bool parallel);
+        // Updates both fields and collects their votes. The source to target chain runs on half of the
+        // workers and the target to source one runs concurrently on the rest when 'parallel' is set.
+        inline void UpdateFieldsAndVote(bool parallel);
+        // Updates TargetToSource and collects coherency votes
+        inline void UpdateTargetToSource(bool parallel);
         // Coherency votes
-        inline void VoteTargetToSource();
+        inline void VoteTargetToSource(bool parallel);
+        // Coherency votes for target rows [top, bottom)
+        inline void VoteTargetToSource(int top, int bottom);
         // Completeness votes
-        inline void VoteSourceToTarget();
-        // Calculate results of the voting
-        inline void CollectVotes();
+        inline void VoteSourceToTarget(bool parallel);
+        // Fills _bandPatches of the chunk of source rows
+        inline void BucketSourcePatches(int chunk);
+        // Completeness votes for target rows of the band
+        inline void VoteSourceToTarget(int band);
+        // Splits rows [top, bottom) into 'count' ranges as ParallelFor does, fills their starts and the end
+        static inline void SplitRows(int32_t top, int32_t bottom, int count, std::vector<int32_t>& starts);
+        // Clears votes for the region
+        inline void ClearVotes();
+        // Return weights of completeness and coherency votes of a patch
+        inline VoteQuantityType GetCompletenessWeight() const;
+        inline VoteQuantityType GetCoherencyWeight() const;
+        // Return the largest sum of completeness weights of a target pixel, bounds CompactVotes
+        inline double GetCompletenessNorm(VoteQuantityType w) const;
+        // Calculate results of the voting, both kinds of votes are summed up
+        inline void CollectVotes(bool parallel);
         // Saves debug images
         inline void DebugOutput();
+        // Return true once CancelFlag is set
+        inline bool IsCancelled() const;
 
+        // Unchecked views used by voting
+        struct VotingViews
+        {
+            ConstImageView<PixelType> Source;
+            ConstImageView<Alpha8>    SourceMask;
+            ImageView<Accumulator<PixelType, VoteQuantityType> > Votes;
+            CompactVotes* Compact;                  // NULL unless UseCompactVotes is set
+            const CompactSource* QuantizedSource;
+        };
+        inline VotingViews GetVotingViews(Votes& votes, CompactVotes& compact);
+
+        // Fills offsets of the patch centered in (x, y) of the solver and their shares of weight 'w': the match
+        // and its runners-up while NearestNeighbors is above 1. Return their count.
+        template<class Solver>
+        force_inline int GetCandidates(const Solver& nnf, const DistanceView& distances, int32_t x, int32_t y,
+            const Point16& offset, VoteQuantityType w, Point16* offsets, VoteQuantityType* weights) const;
         // Vote for pixel with weight
-        force_inline void Vote(int32_t tx, int32_t ty, int32_t sx, int32_t sy, VoteQuantityType w);
+        force_inline void Vote(const VotingViews& views, int32_t tx, int32_t ty, int32_t sx, int32_t sy, VoteQuantityType w);
+        // Vote for 'columns' x 'rows' target pixels from (tx, ty) on by source pixels from (sx, sy) on in compact votes
+        force_inline void VoteCompact(const VotingViews& views, int32_t tx, int32_t ty, int32_t sx, int32_t sy, 
+            int columns, int rows, VoteQuantityType w);
+
+        // Used to implement multithreading in coherency voting.
+        // Each task collects votes for its own range of target rows, so tasks never write
+        // the same pixel and every pixel gets its votes in the same order as in serial mode.
+        class VoteTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                BidirectionalSimilarity* Owner;
+            };
+
+            void Set(int start, int stop, const State& state);
+            virtual void Run();
+        private:
+            int _start;
+            int _stop;
+            State _state;
+        };
+
+        // Used to implement multithreading in completeness voting, buckets source patches of a chunk
+        // of source rows or collects votes of a band of target rows
+        class CompletenessTask :
+            public Parallel::Runnable
+        {
+        public:
+            BidirectionalSimilarity* Owner;
+            int Index;      // of the chunk or the band
+            bool Bucket;
+
+            virtual void Run();
+        };
+
+        // Runs the target to source chain concurrently with the source to target one,
+        // limited to its share of workers
+        class TargetToSourceTask :
+            public Parallel::Runnable
+        {
+        public:
+            BidirectionalSimilarity* Owner;
+            const AtomicInt* Concurrency;
+
+            virtual void Run();
+        };
+
+        // Used to implement multithreading in CollectVotes.
+        // Each task handles its own range of target rows.
+        class CollectVotesTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                ConstImageView<Accumulator<PixelType, VoteQuantityType> > CompletenessVotes;
+                ConstImageView<Accumulator<PixelType, VoteQuantityType> > CoherencyVotes;
+                const CompactVotes* CompactCompleteness;   // NULL unless UseCompactVotes is set
+                const CompactVotes* CompactCoherency;
+                double Quantum;                            // of the compact source
+                ImageView<PixelType> Target;
+                ImageView<uint8_t> Changed;
+                int Left;   // columns [Left, Right) are processed
+                int Right;
+            };
+
+            void Set(int start, int stop, const State& state);
+            virtual void Run();
+        private:
+            int _start;
+            int _stop;
+            State _state;
+        };
 
     private:
         // iteration number, start with 0
@@ -65,9 +235,42 @@ namespace IRL
 
         double Completeness;          // completeness term in dissimilarity measure
         double Coherency;             // coherency term in dissimilarity measure
+        double _s2tChanges;           // offsets updates per patch in SourceToTarget during the last iteration
+        double _t2sChanges;           // offsets updates per patch in TargetToSource during the last iteration
+        NNFCounters _nnfCounters;     // work of both fields during the last iteration
+        NNFCounters _s2tCounters;     // work of each field during the last iteration, the fields are
+        NNFCounters _t2sCounters;     // updated concurrently
+
+        // target pixels which may change, see Region
+        Rectangle<int32_t> _region;
+        // target and source patch centers which are matched and vote for _region
+        Rectangle<int32_t> _targetPatches;
+        Rectangle<int32_t> _sourcePatches;
+
+        // used in voting, each kind of votes has its own buffer, so they are collected concurrently
+        Votes _completenessVotes;
+        Votes _coherencyVotes;
+        // the same in fixed point with quantized source, while UseCompactVotes is set
+        CompactVotes _compactCompleteness;
+        CompactVotes _compactCoherency;
+        CompactSource _compactSource;
+        // Completeness votes are collected by bands of target rows of the region, one task each. Source patches
+        // are bucketed once per iteration by chunks of source rows: _bandPatches[chunk * bands + band] are
+        // centers of the chunk with a candidate which votes for the band, in scan order. Chunks are walked in
+        // order, so every pixel gets its votes in the same order as in serial mode.
+        std::vector<int32_t> _bandStarts;   // first rows of bands and the end of the last one
+        std::vector<int32_t> _chunkStarts;  // the same of chunks of source patch centers
+        std::vector<std::vector<Point16> > _bandPatches;
+        // pixels of the Target changed by the last CollectVotes, non zero if changed
+        Image<uint8_t> _changed;
 
-        // used in voting
-        Votes _votes;
+        // solvers live during the whole run of iterations, so their buffers and distances are reused
+        NNF<PixelType, false, Size>         _s2t;
+        NNF<PixelType, UseSourceMask, Size> _t2s;
+        // Source patches for _t2s, valid while UsePatchIndex is set
+        PatchIndex _index;
+        // Valid patches of SourceMask for _t2s and its initial field, valid while UseSourceMask is set
+        ValidPatches _validPatches;
     };
 }
 
@@ -2,9 +2,11 @@
 #include "Profiler.h"
 #include "Parallel.h"
 #include "Parameters.h"
+#include "DebugWriter.h"
 
 #include <iostream>
-#include <fstream>
+#include <sstream>
+#include <algorithm>
 
 namespace IRL
 {
@@ -25,108 +27,532 @@ namespace IRL
 
     //////////////////////////////////////////////////////////////////////////
 
-    template<class PixelType, bool UseSourceMask>
-    BidirectionalSimilarity<PixelType, UseSourceMask>::BidirectionalSimilarity()
+    template<class PixelType, bool UseSourceMask, int Size>
+    BidirectionalSimilarity<PixelType, UseSourceMask, Size>::BidirectionalSimilarity()
     {
         Alpha = 0.5;
         NNFIterations = 4;
+        NNFTolerance = 0;
         SearchRadius = -1;
+        Propagation = ScanOrderPropagation;
+        Backend = CpuBackend;
+        UsePatchIndex = false;
+        UsePatchBounds = false;
+        NearestNeighbors = 1;
+        UseCompactVotes = false;
+        ExhaustiveSearchLimit = 0;
+        SkipConverged = false;
+        RandomSearchLimit = 80;
+        RandomSearchInvAlpha = 2;
+        SuperPatchSize = 0;
+        TiledSource = false;
+        BatchedRandomSearch = false;
+        Region = Rectangle<int32_t>(0, 0, 0, 0);
+        CancelFlag = NULL;
+        Seed = 0;
 
         _iteration = 0;
+        Completeness = 0;
+        Coherency = 0;
+        _s2tChanges = 0;
+        _t2sChanges = 0;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::Iteration(bool parallel)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::Iteration(bool parallel)
     {
         if (_iteration == 0)
             Initialize();
 
-        _votes.Clear();
+        ClearVotes();
 
-        UpdateSourceToTargetNNF(parallel);
-        VoteSourceToTarget();
-        UpdateTargetToSourceNNF(parallel);
-        VoteTargetToSource();
-        CollectVotes();
+        // Target does not change till CollectVotes, so the directions are independent
+        UpdateFieldsAndVote(parallel);
+        _nnfCounters = _s2tCounters;
+        _nnfCounters += _t2sCounters;
+        if (IsCancelled())
+            return;
+        CollectVotes(parallel);
         DebugOutput();
 
         _iteration++;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::VoteTargetToSource()
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline bool BidirectionalSimilarity<PixelType, UseSourceMask, Size>::IsCancelled() const
+    {
+        return CancelFlag != NULL && CancelFlag->Load() != 0;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::UpdateFieldsAndVote(bool parallel)
+    {
+        if (!parallel || Parallel::GetConcurrency() < 2)
+        {
+            UpdateSourceToTargetNNF(parallel);
+            if (!IsCancelled())
+                VoteSourceToTarget(parallel);
+            UpdateTargetToSource(parallel);
+            return;
+        }
+
+        // Each field alone is limited by parallelism of its wavefront, so the chains share workers:
+        // both split their work for their halves, and idle workers steal tasks of either one
+        const AtomicInt* limit = Parallel::GetConcurrencyLimit();
+        const int workers = (int)Parallel::GetConcurrency();
+        AtomicInt s2tConcurrency;
+        AtomicInt t2sConcurrency;
+        s2tConcurrency.Store(workers / 2);
+        t2sConcurrency.Store(workers - workers / 2);
+
+        Parallel::Future<TargetToSourceTask> t2s;
+        t2s.Get().Owner = this;
+        t2s.Get().Concurrency = &t2sConcurrency;
+        t2s.Start();
+
+        Parallel::SetConcurrencyLimit(&s2tConcurrency);
+        UpdateSourceToTargetNNF(parallel);
+        if (!IsCancelled())
+            VoteSourceToTarget(parallel);
+        Parallel::SetConcurrencyLimit(limit);
+        t2s.Wait();
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::UpdateTargetToSource(bool parallel)
+    {
+        UpdateTargetToSourceNNF(parallel);
+        if (!IsCancelled())
+            VoteTargetToSource(parallel);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::TargetToSourceTask::Run()
+    {
+        // the task runs on any worker, which may have its own limit
+        const AtomicInt* limit = Parallel::GetConcurrencyLimit();
+        Parallel::SetConcurrencyLimit(Concurrency);
+        Owner->UpdateTargetToSource(true);
+        Parallel::SetConcurrencyLimit(limit);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteTask::Set(int start, int stop, const State& state)
+    {
+        _start = start;
+        _stop = stop;
+        _state = state;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteTask::Run()
+    {
+        _state.Owner->VoteTargetToSource(_start, _stop);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::CompletenessTask::Run()
+    {
+        if (Bucket)
+            Owner->BucketSourcePatches(Index);
+        else
+            Owner->VoteSourceToTarget(Index);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteTargetToSource(bool parallel)
     {
         // 1) For each target patch find the most similar source patch.
         //    Colors of pixels in source patch are votes for pixels in target patch.
         //    (Coherency).
         Tools::Profiler profiler("VoteTargetToSource");
-        VoteQuantityType w = (VoteQuantityType)(100 * (1.0 - Alpha) * _wcomplete);
-        for (int32_t y = HalfPatchSize; y < Target.Height() - HalfPatchSize; y++)
+        if (UseCompactVotes)
+        {
+            // a target pixel is covered by Size * Size patches, their candidates share the weight of a patch
+            const VoteQuantityType w = GetCoherencyWeight();
+            _compactCoherency.SetScale((double)w, (double)w * Size * Size);
+        }
+        if (!parallel)
+            VoteTargetToSource(_region.Top, _region.Bottom);
+        else
+        {
+            typename VoteTask::State state;
+            state.Owner = this;
+            Parallel::ParallelFor<VoteTask, typename VoteTask::State> tasks(_region.Top, _region.Bottom, state);
+            tasks.SpawnAndSync();
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteTargetToSource(int top, int bottom)
+    {
+        VoteQuantityType w = GetCoherencyWeight();
+        const ConstImageView<Point16> field = TargetToSource.ConstView();
+        const DistanceView distances = _t2s.D.ConstView();
+        const VotingViews views = GetVotingViews(_coherencyVotes, _compactCoherency);
+        Point16 offsets[NNF<PixelType, UseSourceMask, Size>::MaxK];
+        VoteQuantityType weights[NNF<PixelType, UseSourceMask, Size>::MaxK];
+        // only patches covering rows [top, bottom) of the region vote here
+        const int32_t startY = Maximum<int32_t>(_targetPatches.Top, top - HalfSize);
+        const int32_t stopY = Minimum<int32_t>(_targetPatches.Bottom, bottom + HalfSize);
+        for (int32_t y = startY; y < stopY; y++)
         {
-            for (int32_t x = HalfPatchSize; x < Target.Width() - HalfPatchSize; x++)
+            const int startPy = Maximum<int>(-HalfSize, top - y);
+            const int stopPy = Minimum<int>(HalfSize, bottom - 1 - y);
+            for (int32_t x = _targetPatches.Left; x < _targetPatches.Right; x++)
             {
                 Point16 Qc(x, y);
-                Point16 Pc = Qc + TargetToSource(x, y);
+                const int startPx = Maximum<int>(-HalfSize, _region.Left - x);
+                const int stopPx = Minimum<int>(HalfSize, _region.Right - 1 - x);
 
-                for (int py = -HalfPatchSize; py <= HalfPatchSize; py++)
+                const int count = GetCandidates(_t2s, distances, x, y, field(x, y), w, offsets, weights);
+                for (int i = 0; i < count; i++)
                 {
-                    for (int px = -HalfPatchSize; px <= HalfPatchSize; px++)
+                    Point16 Pc = Qc + offsets[i];
+                    if (views.Compact != NULL)
+                    {
+                        VoteCompact(views, Qc.x + startPx, Qc.y + startPy, Pc.x + startPx, Pc.y + startPy, 
+                            stopPx - startPx + 1, stopPy - startPy + 1, weights[i]);
+                        continue;
+                    }
+                    for (int py = startPy; py <= stopPy; py++)
                     {
-                        Vote(Qc.x + px, Qc.y + py, Pc.x + px, Pc.y + py, w);
+                        for (int px = startPx; px <= stopPx; px++)
+                        {
+                            Vote(views, Qc.x + px, Qc.y + py, Pc.x + px, Pc.y + py, weights[i]);
+                        }
                     }
                 }
             }
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::VoteSourceToTarget()
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteSourceToTarget(bool parallel)
     {
         // 2) For each source patch find the most similar target patch.
         //    Colors of pixels in source patch are votes for pixels in target patch.
         //    (Completeness).
         Tools::Profiler profiler("VoteSourceToTarget");
-        VoteQuantityType w = (VoteQuantityType)(100 * Alpha * _wcoherent);
-        for (int32_t y = HalfPatchSize; y < Source.Height() - HalfPatchSize; y++)
+        if (UseCompactVotes)
+        {
+            const VoteQuantityType w = GetCompletenessWeight();
+            _compactCompleteness.SetScale((double)w, GetCompletenessNorm(w));
+        }
+        // every task of both stages gets one chunk or band, so there are as many as workers
+        const int workers = parallel ? (int)Parallel::GetConcurrency() : 1;
+        SplitRows(_sourcePatches.Top, _sourcePatches.Bottom, workers, _chunkStarts);
+        SplitRows(_region.Top, _region.Bottom, workers, _bandStarts);
+        const int chunks = (int)_chunkStarts.size() - 1;
+        const int bands = (int)_bandStarts.size() - 1;
+        _bandPatches.resize((size_t)chunks * bands);
+        if (!parallel)
+        {
+            for (int i = 0; i < chunks; i++)
+                BucketSourcePatches(i);
+            for (int i = 0; i < bands; i++)
+                VoteSourceToTarget(i);
+            return;
+        }
+
+        Parallel::TaskGroup<CompletenessTask> tasks(chunks);
+        for (int i = 0; i < chunks; i++)
+        {
+            tasks[i].Owner = this;
+            tasks[i].Index = i;
+            tasks[i].Bucket = true;
+        }
+        tasks.SpawnAndSync();
+        tasks.Resize(bands);
+        for (int i = 0; i < bands; i++)
+        {
+            tasks[i].Owner = this;
+            tasks[i].Index = i;
+            tasks[i].Bucket = false;
+        }
+        tasks.SpawnAndSync();
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::SplitRows(int32_t top, int32_t bottom, int count,
+        std::vector<int32_t>& starts)
+    {
+        starts.assign(1, top);
+        if (bottom <= top)
+            return;
+        count = Maximum(Minimum(count, bottom - top), 1);
+        const int32_t step = (bottom - top) / count;
+        for (int i = 1; i < count; i++)
+            starts.push_back(top + i * step);
+        starts.push_back(bottom);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::BucketSourcePatches(int chunk)
+    {
+        const int bands = (int)_bandStarts.size() - 1;
+        std::vector<Point16>* patches = &_bandPatches[(size_t)chunk * bands];
+        for (int i = 0; i < bands; i++)
+            patches[i].clear();
+        VoteQuantityType w = GetCompletenessWeight();
+        const ConstImageView<Point16> field = SourceToTarget.ConstView();
+        const DistanceView distances = _s2t.D.ConstView();
+        Point16 offsets[NNF<PixelType, false, Size>::MaxK];
+        VoteQuantityType weights[NNF<PixelType, false, Size>::MaxK];
+        for (int32_t y = _chunkStarts[chunk]; y < _chunkStarts[chunk + 1]; y++)
         {
-            for (int32_t x = HalfPatchSize; x < Source.Width() - HalfPatchSize; x++)
+            for (int32_t x = _sourcePatches.Left; x < _sourcePatches.Right; x++)
             {
                 Point16 Pc(x, y);
-                Point16 Qc = Pc + SourceToTarget(x, y);
+                const int count = GetCandidates(_s2t, distances, x, y, field(x, y), w, offsets, weights);
+                for (int i = 0; i < count; i++)
+                {
+                    Point16 Qc = Pc + offsets[i];
+                    if (Qc.x + HalfSize < _region.Left || Qc.x - HalfSize >= _region.Right)
+                        continue;
+                    const int32_t top = Maximum<int32_t>(Qc.y - HalfSize, _region.Top);
+                    const int32_t bottom = Minimum<int32_t>(Qc.y + HalfSize + 1, _region.Bottom);
+                    if (top >= bottom)
+                        continue;
+                    // first band which reaches past 'top', the patch goes to every band it covers once
+                    int band = (int)(std::upper_bound(_bandStarts.begin(), _bandStarts.end(), top) - _bandStarts.begin()) - 1;
+                    for (; band < bands && _bandStarts[band] < bottom; band++)
+                    {
+                        if (patches[band].empty() || !(patches[band].back() == Pc))
+                            patches[band].push_back(Pc);
+                    }
+                }
+            }
+        }
+    }
 
-                for (int py = -HalfPatchSize; py <= HalfPatchSize; py++)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteSourceToTarget(int band)
+    {
+        VoteQuantityType w = GetCompletenessWeight();
+        const ConstImageView<Point16> field = SourceToTarget.ConstView();
+        const DistanceView distances = _s2t.D.ConstView();
+        const VotingViews views = GetVotingViews(_completenessVotes, _compactCompleteness);
+        Point16 offsets[NNF<PixelType, false, Size>::MaxK];
+        VoteQuantityType weights[NNF<PixelType, false, Size>::MaxK];
+        const int bands = (int)_bandStarts.size() - 1;
+        const int chunks = (int)_chunkStarts.size() - 1;
+        const int top = _bandStarts[band];
+        const int bottom = _bandStarts[band + 1];
+        // candidates of the band's patches are found again, they vote only for rows [top, bottom) of the region
+        for (int chunk = 0; chunk < chunks; chunk++)
+        {
+            const std::vector<Point16>& patches = _bandPatches[(size_t)chunk * bands + band];
+            for (size_t k = 0; k < patches.size(); k++)
+            {
+                const Point16 Pc = patches[k];
+                const int count = GetCandidates(_s2t, distances, Pc.x, Pc.y, field(Pc.x, Pc.y), w, offsets, weights);
+                for (int i = 0; i < count; i++)
                 {
-                    for (int px = -HalfPatchSize; px <= HalfPatchSize; px++)
+                    Point16 Qc = Pc + offsets[i];
+                    const int startPy = Maximum<int>(-HalfSize, top - Qc.y);
+                    const int stopPy = Minimum<int>(HalfSize, bottom - 1 - Qc.y);
+                    const int startPx = Maximum<int>(-HalfSize, _region.Left - Qc.x);
+                    const int stopPx = Minimum<int>(HalfSize, _region.Right - 1 - Qc.x);
+                    if (views.Compact != NULL)
+                    {
+                        VoteCompact(views, Qc.x + startPx, Qc.y + startPy, Pc.x + startPx, Pc.y + startPy, 
+                            stopPx - startPx + 1, stopPy - startPy + 1, weights[i]);
+                        continue;
+                    }
+
+                    for (int py = startPy; py <= stopPy; py++)
                     {
-                        Vote(Qc.x + px, Qc.y + py, Pc.x + px, Pc.y + py, w);
+                        for (int px = startPx; px <= stopPx; px++)
+                        {
+                            Vote(views, Qc.x + px, Qc.y + py, Pc.x + px, Pc.y + py, weights[i]);
+                        }
                     }
                 }
             }
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::CollectVotes()
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::CollectVotesTask::Set(int start, int stop, const State& state)
     {
-        Tools::Profiler profiler("CollectVotes");
-        for (int32_t y = 0; y < Target.Height(); y++)
+        _start = start;
+        _stop = stop;
+        _state = state;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::CollectVotesTask::Run()
+    {
+        if (_state.CompactCompleteness != NULL)
         {
-            for (int32_t x = 0; x < Target.Width(); x++)
+            typedef PixelChannels<PixelType> Channels;
+            const CompactVotes& completeness = *_state.CompactCompleteness;
+            const CompactVotes& coherency = *_state.CompactCoherency;
+            const double completenessValue = completeness.GetValueUnit(_state.Quantum);
+            const double completenessWeight = completeness.GetWeightUnit();
+            const double coherencyValue = coherency.GetValueUnit(_state.Quantum);
+            const double coherencyWeight = coherency.GetWeightUnit();
+            const int left = completeness.GetLeft();
+            for (int32_t y = _start; y < _stop; y++)
             {
-                if (_votes(x, y).Norm > 0)
-                    Target(x, y) = _votes(x, y).GetSum();
+                const int32_t* completenessRows[CompactVotes::Planes];
+                const int32_t* coherencyRows[CompactVotes::Planes];
+                for (int p = 0; p < CompactVotes::Planes; p++)
+                {
+                    completenessRows[p] = completeness.Row(p, y);
+                    coherencyRows[p] = coherency.Row(p, y);
+                }
+                PixelType* pixel = _state.Target.Row(y);
+                uint8_t* changedPixel = _state.Changed.Row(y);
+                for (int32_t x = _state.Left; x < _state.Right; x++)
+                {
+                    changedPixel[x] = 0;
+                    const int i = x - left;
+                    const double norm = completenessRows[CompactSource::Channels][i] * completenessWeight +
+                        coherencyRows[CompactSource::Channels][i] * coherencyWeight;
+                    if (norm > 0)
+                    {
+                        PixelType value = pixel[x];
+                        for (int c = 0; c < Channels::Count; c++)
+                        {
+                            const double sum = completenessRows[c][i] * completenessValue + coherencyRows[c][i] * coherencyValue;
+                            Channels::Set(value, c, sum / norm);
+                        }
+                        if (memcmp(&value, &pixel[x], sizeof(PixelType)) != 0)
+                        {
+                            pixel[x] = value;
+                            changedPixel[x] = 1;
+                        }
+                    }
+                }
+            }
+            return;
+        }
+
+        for (int32_t y = _start; y < _stop; y++)
+        {
+            const Accumulator<PixelType, VoteQuantityType>* completeness = _state.CompletenessVotes.Row(y);
+            const Accumulator<PixelType, VoteQuantityType>* coherency = _state.CoherencyVotes.Row(y);
+            PixelType* pixel = _state.Target.Row(y);
+            uint8_t* changedPixel = _state.Changed.Row(y);
+            for (int32_t x = _state.Left; x < _state.Right; x++)
+            {
+                changedPixel[x] = 0;
+                Accumulator<PixelType, VoteQuantityType> vote = completeness[x];
+                vote += coherency[x];
+                if (vote.Norm > 0)
+                {
+                    const PixelType value = vote.GetSum();
+                    if (memcmp(&value, &pixel[x], sizeof(PixelType)) != 0)
+                    {
+                        pixel[x] = value;
+                        changedPixel[x] = 1;
+                    }
+                }
             }
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::Reset()
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::ClearVotes()
+    {
+        if (UseCompactVotes)
+        {
+            // planes cover the region only
+            _compactCompleteness.Clear();
+            _compactCoherency.Clear();
+            return;
+        }
+        const ImageView<Accumulator<PixelType, VoteQuantityType> > completeness = _completenessVotes.View();
+        const ImageView<Accumulator<PixelType, VoteQuantityType> > coherency = _coherencyVotes.View();
+        const size_t bytes = sizeof(Accumulator<PixelType, VoteQuantityType>) * (_region.Right - _region.Left);
+        for (int32_t y = _region.Top; y < _region.Bottom; y++)
+        {
+            memset(&completeness(_region.Left, y), 0, bytes);
+            memset(&coherency(_region.Left, y), 0, bytes);
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::CollectVotes(bool parallel)
+    {
+        Tools::Profiler profiler("CollectVotes");
+        // solvers get the target back on the next iteration, drop their references
+        // to change the target in place
+        _s2t.Source.Discard();
+        _t2s.Target.Discard();
+
+        typename CollectVotesTask::State state;
+        if (!UseCompactVotes)
+        {
+            state.CompletenessVotes = _completenessVotes.ConstView();
+            state.CoherencyVotes = _coherencyVotes.ConstView();
+        }
+        state.CompactCompleteness = UseCompactVotes ? &_compactCompleteness : NULL;
+        state.CompactCoherency = UseCompactVotes ? &_compactCoherency : NULL;
+        state.Quantum = _compactSource.GetQuantum();
+        state.Target = Target.View();
+        state.Changed = _changed.View();
+        state.Left = _region.Left;
+        state.Right = _region.Right;
+        if (!parallel)
+        {
+            CollectVotesTask task;
+            task.Set(_region.Top, _region.Bottom, state);
+            task.Run();
+        } else
+        {
+            Parallel::ParallelFor<CollectVotesTask, typename CollectVotesTask::State> tasks(_region.Top, _region.Bottom, state);
+            tasks.SpawnAndSync();
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::Reset()
     {
         _iteration = 0;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::Initialize()
+    template<class PixelType, bool UseSourceMask, int Size>
+    double BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetEnergy() const
+    {
+        return Completeness + Coherency;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    double BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetChangedOffsets() const
+    {
+        return (_s2tChanges + _t2sChanges) / 2;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    const NNFCounters& BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetNNFCounters() const
+    {
+        return _nnfCounters;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    NNFCounters BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetTotalNNFCounters() const
+    {
+        NNFCounters counters = _s2t.GetTotalCounters();
+        counters += _t2s.GetTotalCounters();
+        return counters;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    size_t BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetBytes() const
+    {
+        // fields are shared with the solvers between iterations, so they are counted by them
+        size_t result = Target.GetBytes() + _completenessVotes.GetBytes() + _coherencyVotes.GetBytes() + _changed.GetBytes() + _s2t.GetBytes() + _t2s.GetBytes() + _index.GetBytes() + _validPatches.GetBytes() +
+            _compactCompleteness.GetBytes() + _compactCoherency.GetBytes() + _compactSource.GetBytes();
+        for (size_t i = 0; i < _bandPatches.size(); i++)
+            result += _bandPatches[i].capacity() * sizeof(Point16);
+        return result;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::Initialize()
     {
         ASSERT(Source.IsValid());
         ASSERT(Target.IsValid());
@@ -134,103 +560,365 @@ namespace IRL
         ASSERT(!SourceToTarget.IsValid() || (SourceToTarget.Width() == Source.Width() && SourceToTarget.Height() == Source.Height()));
         ASSERT(!TargetToSource.IsValid() || (TargetToSource.Width() == Target.Width() && TargetToSource.Height() == Target.Height()));
 
-        _votes = Votes(Target.Width(), Target.Height());
+        _changed = Image<uint8_t>(Target.Width(), Target.Height());
+        _changed.Clear(); // pixels outside of the region never change
+
+        const Rectangle<int32_t> target(0, 0, Target.Width(), Target.Height());
+        const Rectangle<int32_t> targetPatches(HalfSize, HalfSize, Target.Width() - Size + 1, Target.Height() - Size + 1);
+        _region = target;
+        _targetPatches = targetPatches;
+        _sourcePatches = Rectangle<int32_t>(HalfSize, HalfSize, Source.Width() - Size + 1, Source.Height() - Size + 1);
+        uint32_t targetPatchesCount = Target.GetPatchesCount(Size);
+        uint32_t sourcePatchesCount = Source.GetPatchesCount(Size);
+        // region which does not intersect patches of the image falls back to the whole image
+        if (!Region.IsEmpty() && !Region.Inflated(HalfSize).Intersection(targetPatches).IsEmpty())
+        {
+            ASSERT(Source.Width() == Target.Width() && Source.Height() == Target.Height());
+            _region = Region.Intersection(target);
+            _targetPatches = _region.Inflated(HalfSize).Intersection(targetPatches);
+            _sourcePatches = _targetPatches;
+            targetPatchesCount = sourcePatchesCount = _targetPatches.Area();
+        }
+
+        if (UseCompactVotes)
+        {
+            _completenessVotes = Votes();
+            _coherencyVotes = Votes();
+            _compactCompleteness.Resize(_region);
+            _compactCoherency.Resize(_region);
+            _compactSource.Set(Source.Get(), UseSourceMask ? SourceMask.Get() : Image<Alpha8>());
+        } else
+        {
+            _completenessVotes = Votes(Target.Width(), Target.Height());
+            _coherencyVotes = Votes(Target.Width(), Target.Height());
+            _compactCompleteness.Release();
+            _compactCoherency.Release();
+            _compactSource.Clear();
+        }
 
         if (TypeTraits<VoteQuantityType>::IsInteger)
         {
-            VoteQuantityType gcd = GCD<VoteQuantityType>(Target.GetPatchesCount(), Source.GetPatchesCount());
-            _wcoherent = Target.GetPatchesCount() / gcd;
-            _wcomplete = Source.GetPatchesCount() / gcd;
+            VoteQuantityType gcd = GCD<VoteQuantityType>(targetPatchesCount, sourcePatchesCount);
+            _wcoherent = targetPatchesCount / gcd;
+            _wcomplete = sourcePatchesCount / gcd;
+            // images of different sizes may have nearly coprime counts, their exact ratio overflows votes
+            const VoteQuantityType limit = 1024;
+            if (_wcoherent > limit || _wcomplete > limit)
+            {
+                const double scale = (double)limit / Maximum(_wcoherent, _wcomplete);
+                _wcoherent = Maximum<VoteQuantityType>((VoteQuantityType)(_wcoherent * scale + 0.5), 1);
+                _wcomplete = Maximum<VoteQuantityType>((VoteQuantityType)(_wcomplete * scale + 0.5), 1);
+            }
         } else
         {
             _wcoherent = VoteQuantityType(1.0);
-            _wcomplete = VoteQuantityType((double)Source.GetPatchesCount() / Target.GetPatchesCount());
+            _wcomplete = VoteQuantityType((double)sourcePatchesCount / targetPatchesCount);
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::UpdateSourceToTargetNNF(bool parallel)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::UpdateSourceToTargetNNF(bool parallel)
     {
         Tools::Profiler profiler("SourceToTargetNNF");
-        NNF<PixelType, false> s2t;
-        s2t.SearchRadius = SearchRadius;
-        s2t.Source = Target;
-        s2t.Target = Source;
-        if (SourceToTarget.IsValid())
-            s2t.Field = SourceToTarget;
-        else
-            s2t.Field  = MakeRandomField(s2t.Target, s2t.Source);
-        for (int i = 0; i < NNFIterations; i++)
-            s2t.Iteration(parallel);
-        SourceToTarget = s2t.Field;
-        if (IRL::DebugOutput)
-            Completeness = s2t.GetMeasure();
+        if (_iteration == 0)
+        {
+            _s2t.Reset();
+            _s2t.Seed = CounterRandom::Key(Seed, (uint64_t)0);
+            _s2t.SearchRadius = SearchRadius;
+            _s2t.K = NearestNeighbors;
+            _s2t.SkipConverged = SkipConverged;
+            _s2t.RandomSearchLimit = RandomSearchLimit;
+            _s2t.RandomSearchInvAlpha = RandomSearchInvAlpha;
+            _s2t.SuperPatchSize = SuperPatchSize;
+            _s2t.TargetRegion = _sourcePatches;
+            _s2t.Source = Target;
+            _s2t.Target = Source;
+            if (SourceToTarget.IsValid())
+                _s2t.Field = SourceToTarget;
+            else
+                _s2t.Field = MakeRandomField(_s2t.Target.Get(), _s2t.Source.Get());
+            // leave the only reference to the field in the solver, so it is updated in place
+            SourceToTarget.Discard();
+        } else
+        {
+            SourceToTarget.Discard(); // before the field is changed by UpdateDistances
+            _s2t.Source = Target;
+            _s2t.UpdateDistances(_changed, true, parallel);
+        }
+        const bool exhaustive = (int64_t)_sourcePatches.Area() * Target.GetPatchesCount(Size) <= ExhaustiveSearchLimit;
+        _s2t.Propagation = exhaustive ? ExhaustiveSearch : Propagation;
+        _s2t.Backend = Backend;
+        _s2t.UsePatchBounds = UsePatchBounds;
+        _s2t.TiledSource = TiledSource;
+        _s2t.BatchedRandomSearch = BatchedRandomSearch;
+        _s2t.CancelFlag = CancelFlag;
+        _s2tChanges = 0;
+        _s2tCounters.Clear();
+        const int iterations = exhaustive ? 1 : NNFIterations;
+        for (int i = 0; i < iterations && !IsCancelled(); i++)
+        {
+            _s2t.Iteration(parallel);
+            _s2tChanges += _s2t.GetChangedFraction();
+            _s2tCounters += _s2t.GetIterationCounters();
+            // do at least one iteration in each scan order
+            if (i > 0 && _s2t.GetChangedFraction() < NNFTolerance)
+                break;
+        }
+        SourceToTarget = _s2t.Field;
+        Completeness = _s2t.GetMeasure();
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::UpdateTargetToSourceNNF(bool parallel)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::UpdateTargetToSourceNNF(bool parallel)
     {
         Tools::Profiler profiler("TargetToSourceNNF");
-        NNF<PixelType, UseSourceMask> t2s; 
-        t2s.SearchRadius = SearchRadius;
-        t2s.Source = Source;
-        if (UseSourceMask)
-            t2s.SourceMask = SourceMask;
-        t2s.Target = Target;
-        if (TargetToSource.IsValid())
-            t2s.Field = TargetToSource;
-        else
-            t2s.Field = MakeRandomField(t2s.Target, t2s.Source);
-        if (UseSourceMask)
-            t2s.Field = RemoveMaskedOffsets(t2s.Field, SourceMask);
+        if (_iteration == 0)
+        {
+            _t2s.Reset();
+            _t2s.Seed = CounterRandom::Key(Seed, (uint64_t)1);
+            _t2s.SearchRadius = SearchRadius;
+            _t2s.K = NearestNeighbors;
+            _t2s.SkipConverged = SkipConverged;
+            _t2s.RandomSearchLimit = RandomSearchLimit;
+            _t2s.RandomSearchInvAlpha = RandomSearchInvAlpha;
+            _t2s.SuperPatchSize = SuperPatchSize;
+            _t2s.TargetRegion = _targetPatches;
+            _t2s.Source = Source;
+            if (UseSourceMask)
+            {
+                // SourceMask does not change during the run
+                _validPatches.Compute(SourceMask.Get(), Size);
+                _t2s.SourceMask = SourceMask;
+                _t2s.SourcePatches = &_validPatches;
+            }
+            _t2s.Target = Target;
+            if (TargetToSource.IsValid())
+                _t2s.Field = TargetToSource;
+            else
+                _t2s.Field = MakeRandomField(_t2s.Target.Get(), _t2s.Source.Get());
+            // leave the only reference to the field in the solver, so it is updated in place
+            TargetToSource.Discard();
+            if (UseSourceMask)
+                _t2s.Field = RemoveMaskedOffsets(_t2s.Field, _validPatches);
+            // Source does not change during the run
+            if (UsePatchIndex)
+                _index.Build(Source.Get(), UseSourceMask ? SourceMask.Get() : Image<Alpha8>(), Size);
+            else
+                _index.Clear();
+            // fully masked source leaves nothing to index
+            _t2s.Index = _index.IsEmpty() ? NULL : &_index;
+        } else
+        {
+            TargetToSource.Discard(); // before the field is changed by UpdateDistances
+            _t2s.Target = Target;
+            _t2s.UpdateDistances(_changed, false, parallel);
+        }
 
+        if (!DebugPath.empty())
         {
             std::ostringstream str;
             str << _iteration;
-            std::string i = str.str();
-            SaveImage(t2s.Field, DebugPath + "/T2S/" + i + " before.png");
+            Debug::SaveImage(_t2s.Field, DebugPath + "/T2S/" + str.str() + " before.png");
+        }
+
+        const bool exhaustive = (int64_t)_targetPatches.Area() * Source.GetPatchesCount(Size) <= ExhaustiveSearchLimit;
+        _t2s.Propagation = exhaustive ? ExhaustiveSearch : Propagation;
+        _t2s.Backend = Backend;
+        _t2s.UsePatchBounds = UsePatchBounds;
+        _t2s.TiledSource = TiledSource;
+        _t2s.BatchedRandomSearch = BatchedRandomSearch;
+        _t2s.CancelFlag = CancelFlag;
+        _t2sChanges = 0;
+        _t2sCounters.Clear();
+        const int iterations = exhaustive ? 1 : NNFIterations;
+        for (int i = 0; i < iterations && !IsCancelled(); i++)
+        {
+            _t2s.Iteration(parallel);
+            _t2sChanges += _t2s.GetChangedFraction();
+            _t2sCounters += _t2s.GetIterationCounters();
+            // do at least one iteration in each scan order
+            if (i > 0 && _t2s.GetChangedFraction() < NNFTolerance)
+                break;
+        }
+        TargetToSource = _t2s.Field;
+        Coherency = _t2s.GetMeasure();
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VotingViews 
+        BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetVotingViews(Votes& votes, CompactVotes& compact)
+    {
+        VotingViews views;
+        views.Source = Source.ConstView();
+        if (UseSourceMask)
+            views.SourceMask = SourceMask.ConstView();
+        views.Compact = UseCompactVotes ? &compact : NULL;
+        views.QuantizedSource = &_compactSource;
+        if (!UseCompactVotes)
+            views.Votes = votes.View();
+        return views;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteQuantityType 
+        BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetCompletenessWeight() const
+    {
+        return (VoteQuantityType)(100 * Alpha * _wcoherent);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteQuantityType 
+        BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetCoherencyWeight() const
+    {
+        return (VoteQuantityType)(100 * (1.0 - Alpha) * _wcomplete);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    double BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetCompletenessNorm(VoteQuantityType w) const
+    {
+        Tools::Profiler profiler("CompletenessNorm");
+        // weights of target patches which cover the region in a summed area table,
+        // a pixel gets weights of patches covering it
+        const Rectangle<int32_t> centers = _region.Inflated(HalfSize).Intersection(
+            Rectangle<int32_t>(0, 0, Target.Width(), Target.Height()));
+        const int width = centers.Right - centers.Left;
+        const int height = centers.Bottom - centers.Top;
+        std::vector<double> table((size_t)(width + 1) * (height + 1), 0.0);
+        const ConstImageView<Point16> field = SourceToTarget.ConstView();
+        const DistanceView distances = _s2t.D.ConstView();
+        Point16 offsets[NNF<PixelType, false, Size>::MaxK];
+        VoteQuantityType weights[NNF<PixelType, false, Size>::MaxK];
+        for (int32_t y = _sourcePatches.Top; y < _sourcePatches.Bottom; y++)
+        {
+            for (int32_t x = _sourcePatches.Left; x < _sourcePatches.Right; x++)
+            {
+                const int count = GetCandidates(_s2t, distances, x, y, field(x, y), w, offsets, weights);
+                for (int i = 0; i < count; i++)
+                {
+                    const int32_t cx = x + offsets[i].x - centers.Left;
+                    const int32_t cy = y + offsets[i].y - centers.Top;
+                    if (cx >= 0 && cx < width && cy >= 0 && cy < height)
+                        table[(size_t)(cy + 1) * (width + 1) + cx + 1] += (double)weights[i];
+                }
+            }
+        }
+        for (int y = 1; y <= height; y++)
+        {
+            double* row = &table[(size_t)y * (width + 1)];
+            const double* above = row - (width + 1);
+            double sum = 0;
+            for (int x = 1; x <= width; x++)
+            {
+                sum += row[x];
+                row[x] = sum + above[x];
+            }
         }
 
-        for (int i = 0; i < NNFIterations; i++)
-            t2s.Iteration(parallel);
-        TargetToSource = t2s.Field;
+        double norm = 0;
+        for (int y = _region.Top; y < _region.Bottom; y++)
+        {
+            const int top = Maximum(y - HalfSize, centers.Top) - centers.Top;
+            const int bottom = Minimum(y + HalfSize + 1, centers.Bottom) - centers.Top;
+            const double* topRow = &table[(size_t)top * (width + 1)];
+            const double* bottomRow = &table[(size_t)bottom * (width + 1)];
+            for (int x = _region.Left; x < _region.Right; x++)
+            {
+                const int left = Maximum(x - HalfSize, centers.Left) - centers.Left;
+                const int right = Minimum(x + HalfSize + 1, centers.Right) - centers.Left;
+                norm = Maximum(norm, bottomRow[right] - bottomRow[left] - topRow[right] + topRow[left]);
+            }
+        }
+        return norm;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    template<class Solver>
+    int BidirectionalSimilarity<PixelType, UseSourceMask, Size>::GetCandidates(const Solver& nnf, 
+        const DistanceView& distances, int32_t x, int32_t y, const Point16& offset, VoteQuantityType w, 
+        Point16* offsets, VoteQuantityType* weights) const
+    {
+        offsets[0] = offset;
+        weights[0] = w;
+        if (NearestNeighbors < 2)
+            return 1;
+
+        // shares fall exponentially with distance relative to the match's one,
+        // epsilon keeps exact matches from taking all of the weight
+        const double sharpness = 4;
+        const double epsilon = PatchDistanceUpperBound<PixelType, Size>() * 1e-3;
+        const double best = distances(x, y).A + epsilon;
+        const typename Solver::RunnerUp* runnersUp = nnf.GetRunnersUp(x, y);
+        double shares[Solver::MaxK];
+        shares[0] = 1;
+        double sum = 1;
+        int count = 1;
+        for (int k = 0; k < nnf.K - 1 && !runnersUp[k].IsEmpty(); k++, count++)
+        {
+            offsets[count] = runnersUp[k].Offset;
+            shares[count] = exp(-sharpness * (runnersUp[k].Distance + epsilon - best) / best);
+            sum += shares[count];
+        }
 
-        if (IRL::DebugOutput)
-            Coherency = t2s.GetMeasure();
+        // integer weights are rounded down, candidates left without weight do not vote
+        int result = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const VoteQuantityType weight = (VoteQuantityType)(w * shares[i] / sum);
+            if (weight == 0)
+                continue;
+            offsets[result] = offsets[i];
+            weights[result] = weight;
+            result++;
+        }
+        return result;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::Vote(int32_t tx, int32_t ty, int32_t sx, int32_t sy, VoteQuantityType w)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::Vote(const VotingViews& views, 
+        int32_t tx, int32_t ty, int32_t sx, int32_t sy, VoteQuantityType w)
     {
-        if (!UseSourceMask || !SourceMask(sx, sy).IsMasked())
-            _votes(tx, ty).AppendAndChangeNorm(Source(sx, sy), w);
+        if (!UseSourceMask || !views.SourceMask(sx, sy).IsMasked())
+            views.Votes(tx, ty).AppendAndChangeNorm(views.Source(sx, sy), w);
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void BidirectionalSimilarity<PixelType, UseSourceMask>::DebugOutput()
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::VoteCompact(const VotingViews& views, 
+        int32_t tx, int32_t ty, int32_t sx, int32_t sy, int columns, int rows, VoteQuantityType w)
     {
-        std::ostringstream str;
-        str << _iteration;
-        std::string i = str.str();
+        // masked source pixels are zeros of the quantized source, so they need no checks
+        if (columns <= 0 || rows <= 0)
+            return;
+        const int32_t fixed = views.Compact->QuantizeWeight((double)w);
+        if (fixed > 0)
+            views.Compact->Vote(*views.QuantizedSource, tx, ty, sx, sy, columns, rows, fixed);
+    }
 
+    template<class PixelType, bool UseSourceMask, int Size>
+    void BidirectionalSimilarity<PixelType, UseSourceMask, Size>::DebugOutput()
+    {
         if (!DebugPath.empty())
         {
-            _mkdir(DebugPath.c_str());
-            _mkdir((DebugPath + "/Target").c_str());
-            _mkdir((DebugPath + "/S2T").c_str());
-            _mkdir((DebugPath + "/T2S").c_str());
+            std::ostringstream str;
+            str << _iteration;
+            std::string i = str.str();
+
+            Debug::MakeDirectory(DebugPath);
+            Debug::MakeDirectory(DebugPath + "/Target");
+            Debug::MakeDirectory(DebugPath + "/S2T");
+            Debug::MakeDirectory(DebugPath + "/T2S");
 
-            std::string fileName = DebugPath + "/Target/" + i + " Func.txt";
-            std::ofstream f;
-            f.open(fileName.c_str());
+            std::ostringstream f;
             f << "Completeness: " << Completeness << "\n";
             f << "Coherency:    " << Coherency << "\n";
             f << "Sum:          " << Completeness + Coherency << "\n";
-            f.close();
+            f << "NNF counters: " << _nnfCounters << "\n";
+            f << "S2T wavefront: " << _s2t.GetWavefront() << "\n";
+            f << "T2S wavefront: " << _t2s.GetWavefront() << "\n";
+            Debug::SaveText(f.str(), DebugPath + "/Target/" + i + " Func.txt");
 
-            SaveImage(Target, DebugPath + "/Target/" + i + ".png");
-            SaveImage(SourceToTarget, DebugPath + "/S2T/" + i + ".png");
-            SaveImage(TargetToSource, DebugPath + "/T2S/" + i + ".png");
+            Debug::SaveImage(Target, DebugPath + "/Target/" + i + ".png");
+            Debug::SaveImage(SourceToTarget, DebugPath + "/S2T/" + i + ".png");
+            Debug::SaveImage(TargetToSource, DebugPath + "/T2S/" + i + ".png");
         }
 
         std::cout << "Iteration " << _iteration << " Completness: " << Completeness
@@ -0,0 +1,206 @@
+#include "Includes.h"
+#include "Calibration.h"
+#include "PatchDistance.h"
+
+#include <fstream>
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Masked pixels of 'hole' on level 'level', where pixels are 2^level times larger
+        inline Rectangle<int32_t> ScaleHole(const Rectangle<int32_t>& hole, int level)
+        {
+            const int32_t scale = 1 << level;
+            Rectangle<int32_t> result;
+            result.Left = hole.Left / scale;
+            result.Top = hole.Top / scale;
+            result.Right = (hole.Right + scale - 1) / scale;
+            result.Bottom = (hole.Bottom + scale - 1) / scale;
+            return result;
+        }
+
+        // Knobs cut by MakePreset and their least values
+        struct ScheduleKnob
+        {
+            int ObjectRemovalParameters::* Value;
+            int Least;
+        };
+
+        const ScheduleKnob ScheduleKnobs[] =
+        {
+            { &ObjectRemovalParameters::IterationsLODFactor, 0 },
+            { &ObjectRemovalParameters::NNFIterationsLODFactor, 0 },
+            { &ObjectRemovalParameters::MinIterations, 1 },
+            { &ObjectRemovalParameters::MinNNFIterations, 1 }
+        };
+    }
+
+    bool CostModel::Save(const std::string& path) const
+    {
+        std::ofstream out(path.c_str());
+        out << "# IRL object removal costs in ns per pixel, see CalibrateCosts\n";
+        out << "simd " << Internal::GetSimdLevelName(Internal::GetSimdLevel()) << "\n";
+        out << "workers " << Workers << "\n";
+        out << "nnf " << NNFPixel << "\n";
+        out << "vote " << VotePixel << "\n";
+        out << "scale " << ScalePixel << "\n";
+        out << "convergence " << Convergence << "\n";
+        out.close();
+        return !out.fail();
+    }
+
+    bool CostModel::Load(const std::string& path)
+    {
+        std::ifstream in(path.c_str());
+        if (!in)
+            return false;
+        CostModel costs;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            std::string name;
+            fields >> name;
+            if (name == "workers")
+                fields >> costs.Workers;
+            else if (name == "nnf")
+                fields >> costs.NNFPixel;
+            else if (name == "vote")
+                fields >> costs.VotePixel;
+            else if (name == "scale")
+                fields >> costs.ScalePixel;
+            else if (name == "convergence")
+                fields >> costs.Convergence;
+        }
+        if (!costs.IsValid())
+            return false;
+        *this = costs;
+        return true;
+    }
+
+    const char* GetPresetName(RemovalPreset preset)
+    {
+        switch (preset)
+        {
+            case PresetFast:     return "fast";
+            case PresetBalanced: return "balanced";
+            case PresetQuality:  return "quality";
+            default:             return "";
+        }
+    }
+
+    bool ParsePreset(const std::string& name, RemovalPreset& preset)
+    {
+        const RemovalPreset presets[] = { PresetFast, PresetBalanced, PresetQuality };
+        for (int i = 0; i < 3; i++)
+        {
+            if (name == GetPresetName(presets[i]))
+            {
+                preset = presets[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double PredictRemovalTime(const CostModel& costs, int width, int height, const Rectangle<int32_t>& hole,
+        const ObjectRemovalParameters& parameters)
+    {
+        using namespace Internal;
+
+        // follows the schedule of RemoveObject: level i has MinIterations + IterationsLODFactor * i solver
+        // iterations over its region, each with MinNNFIterations + NNFIterationsLODFactor * i patch match ones
+        const int levels = GetPyramidLevels(width, height, parameters);
+        double time = 0;
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int i = 0; i < levels; i++)
+        {
+            if (i > 0)
+            {
+                levelWidth = ScaledDownSize(levelWidth);
+                levelHeight = ScaledDownSize(levelHeight);
+            }
+            const Rectangle<int32_t> image(0, 0, levelWidth, levelHeight);
+            const int patchSize = LevelPatchSize(parameters, i);
+            double pixels = (double)image.Area();
+            if (parameters.RegionReach > 0 && !hole.IsEmpty())
+            {
+                const Rectangle<int32_t> region = ScaleHole(hole, i).Inflated(patchSize / 2 * parameters.RegionReach).Intersection(image);
+                if (region.Area() * 2 <= image.Area())
+                    pixels = (double)region.Area();
+            }
+            // distances cost the area of patches
+            const double patchCost = (double)(patchSize * patchSize) / (PatchSize * PatchSize);
+            const int iterations = parameters.MinIterations + parameters.IterationsLODFactor * i;
+            const int nnfIterations = parameters.MinNNFIterations + parameters.NNFIterationsLODFactor * i;
+            time += iterations * pixels * patchCost * (costs.VotePixel + nnfIterations * costs.NNFPixel);
+        }
+        return (costs.ScalePixel * width * height + costs.Convergence * time) * 1e-9;
+    }
+
+    ObjectRemovalParameters MakePreset(RemovalPreset preset, const CostModel& costs, int width, int height,
+        const Rectangle<int32_t>& hole, double seconds)
+    {
+        using namespace Internal;
+
+        ObjectRemovalParameters result;
+        switch (preset)
+        {
+            case PresetFast:
+                result.MinIterations = 1;
+                result.IterationsLODFactor = 2;
+                result.MinNNFIterations = 2;
+                result.NNFIterationsLODFactor = 2;
+                result.SkipConverged = true;
+                break;
+            case PresetBalanced:
+                result.MinIterations = 2;
+                result.IterationsLODFactor = 4;
+                result.MinNNFIterations = 4;
+                result.NNFIterationsLODFactor = 4;
+                break;
+            case PresetQuality:
+                result.MinIterations = 3;
+                result.IterationsLODFactor = 6;
+                result.MinNNFIterations = 6;
+                result.NNFIterationsLODFactor = 4;
+                result.EnergyTolerance = 0.0002;
+                result.OffsetsTolerance = 0.0002;
+                break;
+        }
+        if (seconds <= 0)
+            return result;
+        result.TimeBudget = seconds;
+        if (!costs.IsValid())
+            return result;
+
+        const int knobs = sizeof(ScheduleKnobs) / sizeof(ScheduleKnobs[0]);
+        double predicted = PredictRemovalTime(costs, width, height, hole, result);
+        while (predicted > seconds)
+        {
+            int best = -1;
+            double bestTime = predicted;
+            for (int i = 0; i < knobs; i++)
+            {
+                int& value = result.*ScheduleKnobs[i].Value;
+                if (value <= ScheduleKnobs[i].Least)
+                    continue;
+                value--;
+                const double time = PredictRemovalTime(costs, width, height, hole, result);
+                value++;
+                if (time < bestTime)
+                {
+                    best = i;
+                    bestTime = time;
+                }
+            }
+            if (best < 0) // the least schedule, the time budget does the rest
+                break;
+            result.*ScheduleKnobs[best].Value -= 1;
+            predicted = bestTime;
+        }
+        return result;
+    }
+}
\ No newline at end of file
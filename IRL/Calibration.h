@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Parameters.h"
+#include "Rectangle.h"
+
+namespace IRL
+{
+    // Cost of the stages of object removal on this machine with the workers it was measured with,
+    // in nanoseconds per pixel of PatchSize patches. Measured by CalibrateCosts, i.e. by the Benchmark's
+    // calibration mode, and kept in a file, as it holds till the hardware changes.
+    struct CostModel
+    {
+        CostModel() : NNFPixel(0), VotePixel(0), ScalePixel(0), Convergence(1), Workers(0) {}
+
+        double NNFPixel;     // one patch match iteration of both fields
+        double VotePixel;    // rest of a solver iteration, i.e. voting the target
+        double ScalePixel;   // pyramids of the image and mask and upscaling, per pixel of the finest level
+        // share of scheduled iterations which run, as tolerances stop levels and patch match early
+        double Convergence;
+        int Workers;
+
+        bool IsValid() const { return NNFPixel > 0 && VotePixel > 0; }
+
+        // Text file of "name value" lines
+        bool Save(const std::string& path) const;
+        bool Load(const std::string& path);
+    };
+
+    // Iteration schedules of RemoveObject from the cheapest to the best
+    enum RemovalPreset
+    {
+        PresetFast,
+        PresetBalanced,      // the defaults of ResetParameters
+        PresetQuality
+    };
+
+    extern const char* GetPresetName(RemovalPreset preset);
+    // Accepts names returned by GetPresetName, returns false for others
+    extern bool ParsePreset(const std::string& name, RemovalPreset& preset);
+
+    // Measures costs on a synthetic width x height image with the current Parallel workers, Convergence
+    // by a removal with the current parameters. Takes a few seconds for the default size.
+    template<class PixelType>
+    CostModel CalibrateCosts(int width = 640, int height = 512);
+
+    // Seconds RemoveObject is expected to take on a width x height image whose masked pixels are within
+    // 'hole' (see GetMaskedRegion). Scheduled iterations are scaled by costs.Convergence, so images which
+    // settle slower than the synthetic one take longer.
+    extern double PredictRemovalTime(const CostModel& costs, int width, int height, const Rectangle<int32_t>& hole,
+        const ObjectRemovalParameters& parameters);
+
+    // Current parameters with the iteration schedule of the preset. With 'seconds' > 0 iterations are cut,
+    // the one saving most time first, till the predicted time fits, and TimeBudget is set to 'seconds'
+    // to catch what was predicted wrong.
+    extern ObjectRemovalParameters MakePreset(RemovalPreset preset, const CostModel& costs, int width, int height,
+        const Rectangle<int32_t>& hole, double seconds = 0);
+}
+
+#include "Calibration.inl"
\ No newline at end of file
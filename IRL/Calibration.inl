@@ -0,0 +1,120 @@
+#include "Calibration.h"
+#include "ImageConversion.h"
+#include "GaussianPyramid.h"
+#include "Scaling.h"
+#include "BidirectionalSimilarity.h"
+#include "ObjectRemoval.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Textured image with noise and a hole in the middle, so matching has some work to do
+        inline ImageWithMask<RGB8> MakeCalibrationImage(int width, int height)
+        {
+            Image<RGB8> image(width, height);
+            Image<Alpha8> mask(width, height);
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    uint32_t hash = (x * 73856093u) ^ (y * 19349663u);
+                    hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+                    const int noise = (int)((hash >> 24) % 21) - 10;
+                    const double wave = 128 + 60 * sin(x * 0.3 + sin(y * 0.1) * 3) + 40 * sin(y * 0.23 + x * 0.05);
+                    const int r = (int)wave + noise;
+                    const int g = 255 - (int)wave + noise;
+                    const int b = ((x / 16 + y / 16) % 2) * 100 + 50 + noise;
+                    image(x, y) = RGB8((uint8_t)Maximum(0, Minimum(255, r)), (uint8_t)Maximum(0, Minimum(255, g)), (uint8_t)b);
+                    const bool masked = x > width * 2 / 5 && x < width * 3 / 5 && y > height * 2 / 5 && y < height * 3 / 5;
+                    mask(x, y) = Alpha8(masked ? 0 : 255);
+                }
+            }
+            return ImageWithMask<RGB8>(image, mask);
+        }
+
+        // Nanoseconds of the fastest of solver iterations with 'nnfIterations' patch match iterations each
+        template<class PixelType>
+        double TimeSolverIteration(const ImageWithMask<PixelType>& input, int nnfIterations, int repeats)
+        {
+            BidirectionalSimilarity<PixelType, true> solver;
+            solver.Source = input.Image;
+            solver.SourceMask = input.Mask;
+            solver.Target = input.Image;
+            solver.SourceToTarget = MakeRandomField(input.Image, input.Image);
+            solver.TargetToSource = MakeRandomField(input.Image, input.Image);
+            solver.Alpha = ObjectRemovalAlpha;
+            solver.NNFIterations = nnfIterations;
+            solver.NNFTolerance = 0;
+            // initialization and iterations from random fields are not timed, removals mostly refine
+            for (int i = 0; i < 3; i++)
+                solver.Iteration(true);
+            double best = 0;
+            for (int i = 0; i < repeats; i++)
+            {
+                const int64_t start = Tools::GetTime();
+                solver.Iteration(true);
+                const double time = (double)(Tools::GetTime() - start);
+                if (i == 0 || time < best)
+                    best = time;
+            }
+            return best;
+        }
+    }
+
+    template<class PixelType>
+    CostModel CalibrateCosts(int width, int height)
+    {
+        using namespace Internal;
+
+        Tools::Profiler profiler("CalibrateCosts");
+        const int repeats = 3;
+        ImageWithMask<PixelType> input;
+        Convert(input, MakeCalibrationImage(width, height));
+        const double pixels = (double)width * height;
+
+        CostModel costs;
+        costs.Workers = (int)Parallel::GetWorkersCount();
+
+        // the cost of one more patch match iteration is the difference of solver iterations
+        const double single = TimeSolverIteration(input, 1, repeats);
+        const double triple = TimeSolverIteration(input, 3, repeats);
+        costs.NNFPixel = Maximum(triple - single, 0.0) / 2 / pixels;
+        costs.VotePixel = Maximum(single / pixels - costs.NNFPixel, 0.0);
+        if (costs.NNFPixel == 0 || costs.VotePixel == 0) // timer noise, split the iteration evenly
+            costs.NNFPixel = costs.VotePixel = Maximum(single, 1.0) / 2 / pixels;
+
+        ObjectRemovalParameters parameters;
+        const int levels = GetPyramidLevels(width, height, parameters);
+        for (int i = 0; i < repeats; i++)
+        {
+            const int64_t start = Tools::GetTime();
+            GaussianPyramid<PixelType> source;
+            GaussianPyramid<Alpha8> mask;
+            BuildGaussianPyramids(source, mask, input, levels);
+            if (levels > 1)
+                ScaleUp(source.Levels[1], width, height);
+            const double cost = (double)(Tools::GetTime() - start) / pixels;
+            if (i == 0 || cost < costs.ScalePixel)
+                costs.ScalePixel = cost;
+        }
+
+        // what a removal takes of the schedule predicted by the costs above
+        double removal = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            const int64_t start = Tools::GetTime();
+            RemoveObject(input, (OperationCallback<PixelType>*)NULL, parameters);
+            const double time = (double)(Tools::GetTime() - start) * 1e-9;
+            if (i == 0 || time < removal)
+                removal = time;
+        }
+        const double scale = costs.ScalePixel * pixels * 1e-9;
+        const double scheduled = PredictRemovalTime(costs, width, height, GetMaskedRegion(input.Mask), parameters) - scale;
+        if (scheduled > 0)
+            costs.Convergence = Maximum(0.05, Minimum((removal - scale) / scheduled, 1.0));
+        return costs;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include "Includes.h"
+#include "Checkpoint.h"
+#include "Threading.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace IRL
+{
+    namespace Internal
+    {
+        const char CheckpointMagic[8] = { 'I', 'R', 'L', 'C', 'K', 'P', 'T', 0 };
+        const uint32_t CheckpointByteOrder = 0x01020304;
+
+        struct CheckpointHeader
+        {
+            char Magic[8];
+            uint32_t Version;
+            uint32_t ByteOrder;     // CheckpointByteOrder as written by the machine
+            uint64_t Entries;
+            uint64_t TableOffset;
+        };
+
+        // Read-only mapping of a whole file, released by the last reference
+        class MappedFile :
+            public SharedPixels
+        {
+        public:
+            // Return NULL when the file can't be mapped
+            static MappedFile* Open(const std::string& path)
+            {
+                MappedFile* res = new MappedFile();
+#ifdef _WIN32
+                HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (file != INVALID_HANDLE_VALUE)
+                {
+                    LARGE_INTEGER size;
+                    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+                    {
+                        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                        if (mapping)
+                        {
+                            res->_data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                            res->_size = res->_data ? (size_t)size.QuadPart : 0;
+                            CloseHandle(mapping); // the view keeps it
+                        }
+                    }
+                    CloseHandle(file);
+                }
+#else
+                int file = open(path.c_str(), O_RDONLY);
+                if (file >= 0)
+                {
+                    struct stat info;
+                    if (fstat(file, &info) == 0 && info.st_size > 0)
+                    {
+                        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+                        if (data != MAP_FAILED)
+                        {
+                            res->_data = (const uint8_t*)data;
+                            res->_size = (size_t)info.st_size;
+                        }
+                    }
+                    close(file); // the mapping keeps it
+                }
+#endif
+                if (!res->_data)
+                {
+                    res->ReleasePixels();
+                    return NULL;
+                }
+                return res;
+            }
+
+            virtual void AcquirePixels() const
+            {
+                _refs.FetchAndAdd(1);
+            }
+            virtual void ReleasePixels() const
+            {
+                if (_refs.FetchAndAdd(-1) == 1)
+                    delete this;
+            }
+
+            const uint8_t* Data() const { return _data; }
+            size_t Size() const { return _size; }
+
+        private:
+            MappedFile() : _refs(1), _data(NULL), _size(0) {}
+            virtual ~MappedFile()
+            {
+                if (!_data)
+                    return;
+#ifdef _WIN32
+                UnmapViewOfFile(_data);
+#else
+                munmap((void*)_data, _size);
+#endif
+            }
+
+            mutable AtomicInt _refs;
+            const uint8_t* _data;
+            size_t _size;
+        };
+
+        // Return the entry table of a valid checkpoint, NULL for anything else
+        inline const CheckpointEntry* GetEntries(const MappedFile* file, uint64_t& count)
+        {
+            if (file->Size() < sizeof(CheckpointHeader))
+                return NULL;
+            const CheckpointHeader* header = (const CheckpointHeader*)file->Data();
+            if (memcmp(header->Magic, CheckpointMagic, sizeof(CheckpointMagic)) != 0 ||
+                header->Version != CheckpointWriter::Version || header->ByteOrder != CheckpointByteOrder)
+                return NULL;
+            if (header->TableOffset > file->Size() ||
+                header->Entries > (file->Size() - header->TableOffset) / sizeof(CheckpointEntry))
+                return NULL;
+            const CheckpointEntry* entries = (const CheckpointEntry*)(file->Data() + header->TableOffset);
+            for (uint64_t i = 0; i < header->Entries; i++)
+            {
+                const CheckpointEntry& entry = entries[i];
+                if (entry.Offset > file->Size() || entry.Bytes > file->Size() - entry.Offset ||
+                    entry.Width < 0 || entry.Height < 0 || entry.Name[sizeof(entry.Name) - 1] != 0 ||
+                    entry.Bytes != (uint64_t)entry.Width * entry.Height * entry.PixelSize)
+                    return NULL;
+            }
+            count = header->Entries;
+            return entries;
+        }
+    }
+
+    CheckpointWriter::CheckpointWriter()
+        : _size(0)
+    {
+    }
+
+    CheckpointWriter::~CheckpointWriter()
+    {
+        // not finished, the previous checkpoint stays
+        if (_file.is_open())
+        {
+            _file.close();
+            remove(_temporary.c_str());
+        }
+    }
+
+    bool CheckpointWriter::Open(const std::string& path, const std::string& owner)
+    {
+        using namespace Internal;
+        ASSERT(!_file.is_open());
+        _path = path;
+        _temporary = owner.empty() ? path + ".tmp" : path + "." + owner + ".tmp";
+        _entries.clear();
+        _file.open(_temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+        // the header is rewritten by Finish once the table is known
+        CheckpointHeader header;
+        memset(&header, 0, sizeof(header));
+        _file.write((const char*)&header, sizeof(header));
+        _size = sizeof(header);
+        return _file.good();
+    }
+
+    void CheckpointWriter::AddEntry(const std::string& name, size_t pixelSize, int32_t width, int32_t height,
+        const void* data)
+    {
+        using namespace Internal;
+        Tools::Profiler profiler("CheckpointWriter::Add");
+        ASSERT(_file.is_open());
+        ASSERT(name.size() < sizeof(((CheckpointEntry*)NULL)->Name));
+
+        // pixels start aligned, so wrapping images keep aligned rows of the source
+        static const char padding[Memory::Alignment] = { 0 };
+        const size_t pad = (size_t)((Memory::Alignment - _size % Memory::Alignment) % Memory::Alignment);
+        _file.write(padding, pad);
+        _size += pad;
+
+        CheckpointEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.Name, name.c_str(), sizeof(entry.Name) - 1);
+        entry.Offset = _size;
+        entry.Bytes = (uint64_t)width * height * pixelSize;
+        entry.Width = width;
+        entry.Height = height;
+        entry.PixelSize = (uint32_t)pixelSize;
+        _file.write((const char*)data, (std::streamsize)entry.Bytes);
+        _size += entry.Bytes;
+        _entries.push_back(entry);
+    }
+
+    void CheckpointWriter::AddValue(const std::string& name, int64_t value)
+    {
+        AddEntry(name, sizeof(value), 1, 1, &value);
+    }
+
+    std::string CheckpointWriter::LevelName(const std::string& name, int level)
+    {
+        std::ostringstream str;
+        str << name << "/" << level;
+        return str.str();
+    }
+
+    bool CheckpointWriter::Finish()
+    {
+        using namespace Internal;
+        ASSERT(_file.is_open());
+        CheckpointHeader header;
+        memcpy(header.Magic, CheckpointMagic, sizeof(CheckpointMagic));
+        header.Version = Version;
+        header.ByteOrder = CheckpointByteOrder;
+        header.Entries = _entries.size();
+        header.TableOffset = _size;
+        if (!_entries.empty())
+            _file.write((const char*)&_entries[0], (std::streamsize)(_entries.size() * sizeof(CheckpointEntry)));
+        _file.seekp(0);
+        _file.write((const char*)&header, sizeof(header));
+        _file.close();
+
+        if (_file.fail())
+        {
+            remove(_temporary.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        // rename does not replace files there, a mapped checkpoint can't be replaced at all
+        remove(_path.c_str());
+#endif
+        return rename(_temporary.c_str(), _path.c_str()) == 0;
+    }
+
+    Checkpoint::Checkpoint()
+        : _file(NULL)
+    {
+    }
+
+    Checkpoint::~Checkpoint()
+    {
+        Close();
+    }
+
+    bool Checkpoint::Open(const std::string& path)
+    {
+        Close();
+        _file = Internal::MappedFile::Open(path);
+        uint64_t count = 0;
+        if (_file && !Internal::GetEntries(_file, count))
+            Close();
+        return _file != NULL;
+    }
+
+    void Checkpoint::Close()
+    {
+        if (_file)
+            _file->ReleasePixels();
+        _file = NULL;
+    }
+
+    const void* Checkpoint::Find(const std::string& name, size_t pixelSize, int32_t& width, int32_t& height) const
+    {
+        if (!_file)
+            return NULL;
+        uint64_t count = 0;
+        const Internal::CheckpointEntry* entries = Internal::GetEntries(_file, count);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (name != entries[i].Name)
+                continue;
+            if (entries[i].PixelSize != pixelSize)
+                return NULL;
+            width = entries[i].Width;
+            height = entries[i].Height;
+            return _file->Data() + entries[i].Offset;
+        }
+        return NULL;
+    }
+
+    bool Checkpoint::Contains(const std::string& name) const
+    {
+        if (!_file)
+            return false;
+        uint64_t count = 0;
+        const Internal::CheckpointEntry* entries = Internal::GetEntries(_file, count);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (name == entries[i].Name)
+                return true;
+        }
+        return false;
+    }
+
+    bool Checkpoint::GetValue(const std::string& name, int64_t& value) const
+    {
+        int32_t width = 0, height = 0;
+        const void* data = Find(name, sizeof(value), width, height);
+        if (!data || width != 1 || height != 1)
+            return false;
+        memcpy(&value, data, sizeof(value));
+        return true;
+    }
+
+    const SharedPixels* Checkpoint::GetOwner() const
+    {
+        return _file;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Image.h"
+#include "GaussianPyramid.h"
+
+#include <fstream>
+
+namespace IRL
+{
+    namespace Internal
+    {
+        class MappedFile;
+
+        // Entry of the table as it is stored
+        struct CheckpointEntry
+        {
+            char Name[64];          // zero terminated
+            uint64_t Offset;        // of pixels from the start of the file
+            uint64_t Bytes;
+            int32_t Width;
+            int32_t Height;
+            uint32_t PixelSize;
+            uint32_t Reserved;
+        };
+    }
+
+    // Binary container of named images, i.e. pyramid levels, offset fields and distance fields, which is
+    // mapped into memory on load. Pixels are stored raw at offsets aligned to Memory::Alignment, so loaded
+    // images wrap the mapping without a copy and processes which load one file share its pages.
+    //
+    // Layout: header (magic, version, byte order, number of entries, offset of the entry table), pixels
+    // of the entries, entry table (name, pixel size, width, height, offset and bytes of pixels).
+    // The table is written last, so entries are streamed to the file one by one.
+    // Files of other versions or byte order are rejected, pixels are checked by size only.
+    class CheckpointWriter
+    {
+    public:
+        static const uint32_t Version = 1;
+
+        CheckpointWriter();
+        ~CheckpointWriter();
+
+        // Starts writing 'path', the file is written next to it and replaces it on Finish,
+        // so a preempted writer leaves the previous checkpoint intact. Non empty 'owner' is a part of the name
+        // of the temporary file, so concurrent writers of one path do not write into the same file.
+        bool Open(const std::string& path, const std::string& owner = std::string());
+        // Writes the entry table and replaces the file, return false when anything failed to write
+        bool Finish();
+
+        template<class PixelType>
+        void Add(const std::string& name, const Image<PixelType>& image)
+        {
+            AddEntry(name, sizeof(PixelType), image.Width(), image.Height(), image.Data());
+        }
+
+        // Levels are entries 'name'/0, 'name'/1, ...
+        template<class PixelType>
+        void Add(const std::string& name, const GaussianPyramid<PixelType>& pyramid)
+        {
+            for (size_t i = 0; i < pyramid.Levels.size(); i++)
+                Add(LevelName(name, (int)i), pyramid.Levels[i]);
+        }
+
+        // Value is 1 x 1 entry of int64_t
+        void AddValue(const std::string& name, int64_t value);
+
+        static std::string LevelName(const std::string& name, int level);
+
+    private:
+        // disable copy methods
+        CheckpointWriter(const CheckpointWriter&);
+        CheckpointWriter& operator=(const CheckpointWriter&);
+
+        void AddEntry(const std::string& name, size_t pixelSize, int32_t width, int32_t height, const void* data);
+
+        std::string _path;
+        std::string _temporary;
+        std::ofstream _file;
+        std::vector<Internal::CheckpointEntry> _entries;
+        uint64_t _size;
+    };
+
+    // Mapped checkpoint, images it returns keep the mapping alive after it is closed
+    class Checkpoint
+    {
+    public:
+        Checkpoint();
+        ~Checkpoint();
+
+        // Maps the file, return false when it is missing or is not a valid checkpoint
+        bool Open(const std::string& path);
+        void Close();
+        bool IsOpen() const { return _file != NULL; }
+
+        bool Contains(const std::string& name) const;
+
+        // Return read-only image of the entry without a copy, invalid one when there is no entry
+        // of the name and pixel size
+        template<class PixelType>
+        Image<PixelType> GetImage(const std::string& name) const
+        {
+            int32_t width = 0, height = 0;
+            const void* data = Find(name, sizeof(PixelType), width, height);
+            if (!data)
+                return Image<PixelType>();
+            return Image<PixelType>::Wrap((const PixelType*)data, width, height, GetOwner());
+        }
+
+        // Return false when there is no level 0, levels are read till the first missing one
+        template<class PixelType>
+        bool GetPyramid(const std::string& name, GaussianPyramid<PixelType>& pyramid) const
+        {
+            pyramid.Levels.clear();
+            for (int i = 0; ; i++)
+            {
+                Image<PixelType> level = GetImage<PixelType>(CheckpointWriter::LevelName(name, i));
+                if (!level.IsValid())
+                    break;
+                pyramid.Levels.push_back(level);
+            }
+            return !pyramid.Levels.empty();
+        }
+
+        bool GetValue(const std::string& name, int64_t& value) const;
+
+    private:
+        // disable copy methods
+        Checkpoint(const Checkpoint&);
+        Checkpoint& operator=(const Checkpoint&);
+
+        const void* Find(const std::string& name, size_t pixelSize, int32_t& width, int32_t& height) const;
+        const SharedPixels* GetOwner() const;
+
+        Internal::MappedFile* _file;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include "Includes.h"
+#include "ColorConversion.h"
+#include "PatchDistance.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define IRL_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// see PatchDistance.cpp, byte shuffles are available on every CPU with AVX2
+#if defined(IRL_SIMD_X86) && !defined(_MSC_VER)
+#define IRL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IRL_TARGET_AVX2
+#endif
+
+namespace IRL
+{
+    namespace Internal
+    {
+        //////////////////////////////////////////////////////////////////////////
+        // RGB8 -> Lab tables
+
+        static void BuildRgbToLabTable(RgbToLabTable& table)
+        {
+            // the same matrix as in Convert(Lab&, const RGB&)
+            for (int i = 0; i <= UINT8_MAX; i++)
+            {
+                double value = TypeTraits<uint8_t>::Denormalize((uint8_t)i, 0.0, 1.0);
+                table.R[i][0] = 0.431 * value / Xr;
+                table.R[i][1] = 0.222 * value / Yr;
+                table.R[i][2] = 0.020 * value / Zr;
+                table.G[i][0] = 0.342 * value / Xr;
+                table.G[i][1] = 0.707 * value / Yr;
+                table.G[i][2] = 0.130 * value / Zr;
+                table.B[i][0] = 0.178 * value / Xr;
+                table.B[i][1] = 0.071 * value / Yr;
+                table.B[i][2] = 0.939 * value / Zr;
+            }
+            for (int i = 0; i <= RgbToLabTable::Steps + 1; i++)
+                table.F[i] = _f(i * RgbToLabTable::Range() / RgbToLabTable::Steps);
+        }
+
+        // built before main(), so concurrent conversions do not race on the first use
+        static struct RgbToLabTableInstance
+        {
+            RgbToLabTableInstance() { BuildRgbToLabTable(Table); }
+            RgbToLabTable Table;
+        } g_RgbToLab;
+
+        const RgbToLabTable& GetRgbToLabTable()
+        {
+            return g_RgbToLab.Table;
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+        // LabDouble -> RGB8 kernels
+
+#if defined(IRL_SIMD_X86)
+        static force_inline __m128d FReverse_SSE2(__m128d input)
+        {
+            // both branches of _f_reverse in the same order of operations
+            __m128d cube = _mm_mul_pd(_mm_mul_pd(input, input), input);
+            __m128d linear = _mm_sub_pd(input, _mm_set1_pd(16.0 / 116.0));
+            linear = _mm_mul_pd(_mm_mul_pd(_mm_mul_pd(linear, _mm_set1_pd(3)), _mm_set1_pd(LAB_delta)), _mm_set1_pd(LAB_delta));
+            __m128d above = _mm_cmpgt_pd(input, _mm_set1_pd(LAB_delta));
+            return _mm_or_pd(_mm_and_pd(above, cube), _mm_andnot_pd(above, linear));
+        }
+
+        static force_inline __m128d Mix_SSE2(__m128d X, __m128d Y, __m128d Z, double x, double y, double z)
+        {
+            return _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(x), X), _mm_mul_pd(_mm_set1_pd(y), Y)), _mm_mul_pd(_mm_set1_pd(z), Z));
+        }
+
+        // Two pixels at once, every operation matches Convert(RGB&, const Lab&) so results are exactly the same
+        static void LabDoubleToRGB8_SSE2(RGB8* to, const LabDouble* from, int count)
+        {
+            const __m128d rangeL = _mm_set1_pd(Max_L - Min_L);
+            const __m128d rangeA = _mm_set1_pd(Max_a - Min_a);
+            const __m128d rangeB = _mm_set1_pd(Max_b - Min_b);
+            const __m128d scale = _mm_set1_pd(TypeTraits<uint8_t>::MaxValue());
+            const __m128d offset = _mm_set1_pd(RoundingOffset<uint8_t>(0.0, 1.0));
+
+            int i = 0;
+            for (; i + 2 <= count; i += 2)
+            {
+                // L0 a0 | b0 L1 | a1 b1
+                const double* ptr = &from[i].L;
+                __m128d v0 = _mm_loadu_pd(ptr);
+                __m128d v1 = _mm_loadu_pd(ptr + 2);
+                __m128d v2 = _mm_loadu_pd(ptr + 4);
+
+                __m128d L = _mm_add_pd(_mm_mul_pd(_mm_shuffle_pd(v0, v1, 2), rangeL), _mm_set1_pd(Min_L));
+                __m128d a = _mm_add_pd(_mm_mul_pd(_mm_shuffle_pd(v0, v2, 1), rangeA), _mm_set1_pd(Min_a));
+                __m128d b = _mm_add_pd(_mm_mul_pd(_mm_shuffle_pd(v1, v2, 2), rangeB), _mm_set1_pd(Min_b));
+
+                __m128d f_y = _mm_div_pd(_mm_add_pd(L, _mm_set1_pd(16)), _mm_set1_pd(116));
+                __m128d f_x = _mm_add_pd(f_y, _mm_div_pd(a, _mm_set1_pd(500)));
+                __m128d f_z = _mm_sub_pd(f_y, _mm_div_pd(b, _mm_set1_pd(200)));
+
+                __m128d X = _mm_mul_pd(FReverse_SSE2(f_x), _mm_set1_pd(Xr));
+                __m128d Y = _mm_mul_pd(FReverse_SSE2(f_y), _mm_set1_pd(Yr));
+                __m128d Z = _mm_mul_pd(FReverse_SSE2(f_z), _mm_set1_pd(Zr));
+
+                // subtractions of Convert are additions of negated products, which is exact
+                __m128i R = _mm_cvttpd_epi32(_mm_mul_pd(_mm_add_pd(Mix_SSE2(X, Y, Z,  3.059590, -1.392746, -0.474677), offset), scale));
+                __m128i G = _mm_cvttpd_epi32(_mm_mul_pd(_mm_add_pd(Mix_SSE2(X, Y, Z, -0.967629,  1.874841,  0.041666), offset), scale));
+                __m128i B = _mm_cvttpd_epi32(_mm_mul_pd(_mm_add_pd(Mix_SSE2(X, Y, Z,  0.068797, -0.229898,  1.069305), offset), scale));
+
+                // B0 G0 R0 0 | B1 G1 R1 0, saturated to [0, 255] as Normalize does
+                __m128i BG = _mm_unpacklo_epi32(B, G);
+                __m128i R0 = _mm_unpacklo_epi32(R, _mm_setzero_si128());
+                __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi64(BG, R0), _mm_unpackhi_epi64(BG, R0));
+                packed = _mm_packus_epi16(packed, packed);
+
+                uint32_t first = (uint32_t)_mm_cvtsi128_si32(packed);
+                uint32_t second = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+                to[i].B = (uint8_t)first;
+                to[i].G = (uint8_t)(first >> 8);
+                to[i].R = (uint8_t)(first >> 16);
+                to[i + 1].B = (uint8_t)second;
+                to[i + 1].G = (uint8_t)(second >> 8);
+                to[i + 1].R = (uint8_t)(second >> 16);
+            }
+            for (; i < count; i++)
+                Convert(to[i], from[i]);
+        }
+#endif
+
+        //////////////////////////////////////////////////////////////////////////
+        // RGB32 <-> RGB8 kernels. Both formats keep B, G, R bytes in the same order,
+        // so conversion only drops or inserts every fourth byte.
+
+        // Four pixels per three 32 bit words (little endian)
+        static void RGB32ToRGB8_Words(RGB8* to, const uint32_t* from, int count)
+        {
+            int i = 0;
+            uint8_t* out = &to[0].B;
+            for (; i + 4 <= count; i += 4, out += 12)
+            {
+                const uint32_t p0 = from[i];
+                const uint32_t p1 = from[i + 1];
+                const uint32_t p2 = from[i + 2];
+                const uint32_t p3 = from[i + 3];
+                const uint32_t words[3] = {
+                    (p0 & 0x00ffffff) | (p1 << 24),
+                    ((p1 >> 8) & 0x0000ffff) | (p2 << 16),
+                    ((p2 >> 16) & 0x000000ff) | (p3 << 8) };
+                memcpy(out, words, sizeof(words));
+            }
+            for (; i < count; i++)
+                to[i] = RGB8::FromRGB32(from[i]);
+        }
+
+        static void RGB8ToRGB32_Words(uint32_t* to, const RGB8* from, int count)
+        {
+            int i = 0;
+            const uint8_t* in = &from[0].B;
+            for (; i + 4 <= count; i += 4, in += 12)
+            {
+                uint32_t words[3];
+                memcpy(words, in, sizeof(words));
+                to[i] = words[0] | 0xff000000;
+                to[i + 1] = (words[0] >> 24) | (words[1] << 8) | 0xff000000;
+                to[i + 2] = (words[1] >> 16) | (words[2] << 16) | 0xff000000;
+                to[i + 3] = (words[2] >> 8) | 0xff000000;
+            }
+            for (; i < count; i++)
+                to[i] = from[i].ToRGB32();
+        }
+
+#if defined(IRL_SIMD_X86)
+        // Sixteen pixels per iteration with byte shuffles
+        IRL_TARGET_AVX2 static void RGB32ToRGB8_Shuffle(RGB8* to, const uint32_t* from, int count)
+        {
+            const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+            int i = 0;
+            uint8_t* out = &to[0].B;
+            for (; i + 16 <= count; i += 16, out += 48)
+            {
+                __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(from + i)), pack);
+                __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(from + i + 4)), pack);
+                __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(from + i + 8)), pack);
+                __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(from + i + 12)), pack);
+                // 12 bytes of each vector are glued into three full ones
+                _mm_storeu_si128((__m128i*)out, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+                _mm_storeu_si128((__m128i*)(out + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+                _mm_storeu_si128((__m128i*)(out + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+            }
+            RGB32ToRGB8_Words(to + i, from + i, count - i);
+        }
+
+        IRL_TARGET_AVX2 static void RGB8ToRGB32_Shuffle(uint32_t* to, const RGB8* from, int count)
+        {
+            const __m128i unpack = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+            const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+            int i = 0;
+            const uint8_t* in = &from[0].B;
+            // the last vector load reads 4 bytes past the 16 pixels, so one more pixel has to follow
+            for (; i + 17 <= count; i += 16, in += 48)
+            {
+                __m128i v0 = _mm_loadu_si128((const __m128i*)in);
+                __m128i v1 = _mm_loadu_si128((const __m128i*)(in + 16));
+                __m128i v2 = _mm_loadu_si128((const __m128i*)(in + 32));
+                __m128i p0 = v0;
+                __m128i p1 = _mm_or_si128(_mm_srli_si128(v0, 12), _mm_slli_si128(v1, 4));
+                __m128i p2 = _mm_or_si128(_mm_srli_si128(v1, 8), _mm_slli_si128(v2, 8));
+                __m128i p3 = _mm_srli_si128(v2, 4);
+                _mm_storeu_si128((__m128i*)(to + i), _mm_or_si128(_mm_shuffle_epi8(p0, unpack), alpha));
+                _mm_storeu_si128((__m128i*)(to + i + 4), _mm_or_si128(_mm_shuffle_epi8(p1, unpack), alpha));
+                _mm_storeu_si128((__m128i*)(to + i + 8), _mm_or_si128(_mm_shuffle_epi8(p2, unpack), alpha));
+                _mm_storeu_si128((__m128i*)(to + i + 12), _mm_or_si128(_mm_shuffle_epi8(p3, unpack), alpha));
+            }
+            RGB8ToRGB32_Words(to + i, from + i, count - i);
+        }
+#endif
+    }
+
+    void ConvertRow(RGB8* to, const LabDouble* from, int count)
+    {
+#if defined(IRL_SIMD_X86)
+        if (Internal::GetSimdLevel() != Internal::SimdNone)
+        {
+            Internal::LabDoubleToRGB8_SSE2(to, from, count);
+            return;
+        }
+#endif
+        for (int i = 0; i < count; i++)
+            Convert(to[i], from[i]);
+    }
+
+    void ConvertRowFromRGB32(RGB8* to, const uint32_t* from, int count)
+    {
+#if defined(IRL_SIMD_X86)
+        if (Internal::GetSimdLevel() == Internal::SimdAVX2)
+        {
+            Internal::RGB32ToRGB8_Shuffle(to, from, count);
+            return;
+        }
+#endif
+        Internal::RGB32ToRGB8_Words(to, from, count);
+    }
+
+    void ConvertRowToRGB32(uint32_t* to, const RGB8* from, int count)
+    {
+#if defined(IRL_SIMD_X86)
+        if (Internal::GetSimdLevel() == Internal::SimdAVX2)
+        {
+            Internal::RGB8ToRGB32_Shuffle(to, from, count);
+            return;
+        }
+#endif
+        Internal::RGB8ToRGB32_Words(to, from, count);
+    }
+
+    void ConvertRowFromRGB32(Alpha8* to, const uint32_t* from, int count, int shift)
+    {
+        for (int i = 0; i < count; i++)
+            to[i].A = (uint8_t)(from[i] >> shift);
+    }
+
+    void ConvertRowFromMono(Alpha8* to, const uint8_t* from, int count, bool msbFirst, const uint8_t values[2])
+    {
+        for (int i = 0; i < count; i += 8)
+        {
+            // every byte holds eight pixels
+            const int byte = from[i / 8];
+            const int bits = Minimum(8, count - i);
+            for (int bit = 0; bit < bits; bit++)
+                to[i + bit].A = values[(byte >> (msbFirst ? 7 - bit : bit)) & 1];
+        }
+    }
+}
\ No newline at end of file
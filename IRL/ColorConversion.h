@@ -26,6 +26,23 @@ namespace IRL
     // Alpha <-> Alpha
     template<class ChannelTo, class ChannelFrom>
     void Convert(Alpha<ChannelTo>& to, const Alpha<ChannelFrom>& from);
+
+    // Rows of RGB8 -> Lab through lookup tables instead of pow(),
+    // L, a and b differ from Convert by less than 0.001
+    template<class LabChannel>
+    void ConvertRow(Lab<LabChannel>* to, const RGB8* from, int count);
+
+    // Rows of LabDouble -> RGB8 with SIMD, results are equal to Convert
+    void ConvertRow(RGB8* to, const LabDouble* from, int count);
+
+    // Rows of 0xAARRGGBB words (QImage::Format_RGB32 and ARGB32 scanlines) -> RGB8, alpha is dropped
+    void ConvertRowFromRGB32(RGB8* to, const uint32_t* from, int count);
+    // Rows of RGB8 -> opaque 0xFFRRGGBB words
+    void ConvertRowToRGB32(uint32_t* to, const RGB8* from, int count);
+    // Rows of 0xAARRGGBB words -> one of their channels, 'shift' is 24 for alpha, 16 for red
+    void ConvertRowFromRGB32(Alpha8* to, const uint32_t* from, int count, int shift);
+    // Rows of 1 bit indices (QImage::Format_Mono when msbFirst, Format_MonoLSB otherwise) -> values[index]
+    void ConvertRowFromMono(Alpha8* to, const uint8_t* from, int count, bool msbFirst, const uint8_t values[2]);
 }
 
 // implementation file
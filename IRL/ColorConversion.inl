@@ -30,14 +30,65 @@ namespace IRL
                 return (1.0 / 3.0 * LAB_InvDelta * LAB_InvDelta * input) + 4.0 / 29.0;
         }
 
+        // Half step of integer channel, added to values before Normalize so that they are rounded 
+        // instead of truncated, i.e. fixed point Lab does not get darker with every conversion
+        template<class Channel, class Type>
+        static inline Type RoundingOffset(Type minValue, Type maxValue)
+        {
+            if (!TypeTraits<Channel>::IsInteger)
+                return 0;
+            return (Type)((maxValue - minValue) / (2 * (double)TypeTraits<Channel>::MaxValue()));
+        }
+
         static inline double _f_reverse(double input)
         {
             // http://ru.wikipedia.org/wiki/LAB
             if (input > LAB_delta)
-                return pow(input, 3);
+                return input * input * input;
             else                    
                 return (input - 16.0 / 116.0) * 3 * LAB_delta * LAB_delta;
         }
+
+        // XYZ -> L*a*b*, arguments are _f of X/Xr, Y/Yr and Z/Zr
+        template<class LabChannel>
+        static inline void StoreLab(Lab<LabChannel>& lab, double fx, double fy, double fz)
+        {
+            double L = (116 * fy) - 16;
+            double a = 500 * (fx - fy);
+            double b = 200 * (fy - fz);
+
+            ASSERT(L > Min_L - 0.1);
+            ASSERT(L < Max_L + 0.1);
+
+            lab.L = TypeTraits<LabChannel>::Normalize(L + RoundingOffset<LabChannel>(Min_L, Max_L), Min_L, Max_L);
+            lab.a = TypeTraits<LabChannel>::Normalize(a + RoundingOffset<LabChannel>(Min_a, Max_a), Min_a, Max_a); 
+            lab.b = TypeTraits<LabChannel>::Normalize(b + RoundingOffset<LabChannel>(Min_b, Max_b), Min_b, Max_b);
+        }
+
+        // Tables of RGB8 -> Lab, built once in ColorConversion.cpp.
+        // _f is interpolated linearly between Steps samples in [0, Range], which is 
+        // enough for X/Xr, Y/Yr and Z/Zr of any RGB color. Its second derivative is 
+        // the largest right above LAB_delta3 and bounds the error of _f by 2e-6.
+        struct RgbToLabTable
+        {
+            enum { Steps = 8192 };
+            static double Range() { return 4.0 / 3.0; }
+
+            double R[UINT8_MAX + 1][3]; // contribution of the channel to X/Xr, Y/Yr and Z/Zr
+            double G[UINT8_MAX + 1][3];
+            double B[UINT8_MAX + 1][3];
+            double F[Steps + 2];        // one more sample, so interpolation may read F[index + 1] at Range
+
+            force_inline double InterpolateF(double input) const
+            {
+                double position = input * (Steps / Range());
+                int index = (int)position;
+                ASSERT(index >= 0 && index <= Steps);
+                return F[index] + (position - index) * (F[index + 1] - F[index]);
+            }
+        };
+
+        extern const RgbToLabTable& GetRgbToLabTable();
     }
 
     // Lab -> RGB
@@ -62,14 +113,17 @@ namespace IRL
         double Y = _f_reverse(f_y) * Yr;
         double Z = _f_reverse(f_z) * Zr;
 
-        // http://ru.wikipedia.org/wiki/RGB
-        double R =  3.063 * X - 1.393 * Y - 0.476 * Z;
-        double G = -0.969 * X + 1.876 * Y + 0.042 * Z;
-        double B =  0.068 * X - 0.229 * Y + 1.069 * Z;
-
-        rgb.R = TypeTraits<RgbChannel>::Normalize(R, 0.0, 1.0);
-        rgb.G = TypeTraits<RgbChannel>::Normalize(G, 0.0, 1.0);
-        rgb.B = TypeTraits<RgbChannel>::Normalize(B, 0.0, 1.0);
+        // inverse of the matrix in RGB -> Lab, rounded less than http://ru.wikipedia.org/wiki/RGB
+        // so that colors survive the round trip
+        double R =  3.059590 * X - 1.392746 * Y - 0.474677 * Z;
+        double G = -0.967629 * X + 1.874841 * Y + 0.041666 * Z;
+        double B =  0.068797 * X - 0.229898 * Y + 1.069305 * Z;
+
+        // rounded, so that RGB8 -> Lab -> RGB8 gives the same colors
+        const double offset = RoundingOffset<RgbChannel>(0.0, 1.0);
+        rgb.R = TypeTraits<RgbChannel>::Normalize(R + offset, 0.0, 1.0);
+        rgb.G = TypeTraits<RgbChannel>::Normalize(G + offset, 0.0, 1.0);
+        rgb.B = TypeTraits<RgbChannel>::Normalize(B + offset, 0.0, 1.0);
     }
 
     // RGB -> Lab
@@ -89,20 +143,26 @@ namespace IRL
         double Z = 0.020 * R + 0.130 * G + 0.939 * B;
 
         // XYZ -> L*a*b*
-        X = _f(X / Xr);
-        Y = _f(Y / Yr);
-        Z = _f(Z / Zr);
-
-        double L = (116 * Y) - 16;
-        double a = 500 * (X - Y);
-        double b = 200 * (Y - Z);
+        StoreLab(lab, _f(X / Xr), _f(Y / Yr), _f(Z / Zr));
+    }
 
-        ASSERT(L > Min_L - 0.1);
-        ASSERT(L < Max_L + 0.1);
+    // RGB8 -> Lab rows
+    template<class LabChannel>
+    void ConvertRow(Lab<LabChannel>* to, const RGB8* from, int count)
+    {
+        using namespace Internal;
 
-        lab.L = TypeTraits<LabChannel>::Normalize(L, Min_L, Max_L);
-        lab.a = TypeTraits<LabChannel>::Normalize(a, Min_a, Max_a); 
-        lab.b = TypeTraits<LabChannel>::Normalize(b, Min_b, Max_b);
+        const RgbToLabTable& table = GetRgbToLabTable();
+        for (int i = 0; i < count; i++)
+        {
+            const double* r = table.R[from[i].R];
+            const double* g = table.G[from[i].G];
+            const double* b = table.B[from[i].B];
+            StoreLab(to[i], 
+                table.InterpolateF(r[0] + g[0] + b[0]), 
+                table.InterpolateF(r[1] + g[1] + b[1]), 
+                table.InterpolateF(r[2] + g[2] + b[2]));
+        }
     }
 
     // RGB <-> RGB
@@ -118,9 +178,12 @@ namespace IRL
     template<class ChannelTo, class ChannelFrom>
     void Convert(Lab<ChannelTo>& to, const Lab<ChannelFrom>& from)
     {
-        to.L = TypeTraits<ChannelTo>::Normalize(from.L, (ChannelFrom)0, TypeTraits<ChannelFrom>::MaxValue());
-        to.a = TypeTraits<ChannelTo>::Normalize(from.a, (ChannelFrom)0, TypeTraits<ChannelFrom>::MaxValue());
-        to.b = TypeTraits<ChannelTo>::Normalize(from.b, (ChannelFrom)0, TypeTraits<ChannelFrom>::MaxValue());
+        typedef typename TypeTraits<ChannelFrom>::LargerType Value; // values with offset may exceed the channel
+        const Value maxValue = TypeTraits<ChannelFrom>::MaxValue();
+        const Value offset = Internal::RoundingOffset<ChannelTo>((Value)0, maxValue);
+        to.L = TypeTraits<ChannelTo>::Normalize(from.L + offset, (Value)0, maxValue);
+        to.a = TypeTraits<ChannelTo>::Normalize(from.a + offset, (Value)0, maxValue);
+        to.b = TypeTraits<ChannelTo>::Normalize(from.b + offset, (Value)0, maxValue);
     }
 
     template<class ChannelTo, class ChannelFrom>
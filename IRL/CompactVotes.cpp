@@ -0,0 +1,147 @@
+#include "Includes.h"
+#include "CompactVotes.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define IRL_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Sums of weights of a pixel stay below it, so that weighted sums of ValueBits values fit int32_t
+        const double CompactNormLimit = 65535;
+
+#if defined(IRL_SIMD_X86)
+        // Lanes of the first 'columns' values are loaded from LaneMasks + Padding - columns
+        static const int16_t LaneMasks[2 * CompactSource::Padding] = {
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+        // Adds 8 values masked by 'mask' and multiplied by 'weight' to 8 sums
+        static force_inline void MultiplyAdd_SSE2(int32_t* sums, const int16_t* values, __m128i mask, __m128i weight)
+        {
+            const __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)values), mask);
+            const __m128i low = _mm_mullo_epi16(v, weight);
+            const __m128i high = _mm_mulhi_epi16(v, weight);
+            _mm_storeu_si128((__m128i*)sums, _mm_add_epi32(_mm_loadu_si128((const __m128i*)sums), _mm_unpacklo_epi16(low, high)));
+            _mm_storeu_si128((__m128i*)(sums + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sums + 4)), _mm_unpackhi_epi16(low, high)));
+        }
+#endif
+    }
+
+    CompactSource::CompactSource()
+        : _width(0), _height(0), _quantum(1.0)
+    {
+    }
+
+    void CompactSource::Clear()
+    {
+        std::vector<int16_t>().swap(_values);
+    }
+
+    size_t CompactSource::GetBytes() const
+    {
+        return _values.capacity() * sizeof(int16_t);
+    }
+
+    CompactVotes::CompactVotes()
+        : _region(0, 0, 0, 0), _stride(0), _planeSize(0), _scale(1.0), _shift(0), _valueUnit(1.0), _weightUnit(1.0)
+    {
+    }
+
+    void CompactVotes::Resize(const Rectangle<int32_t>& region)
+    {
+        _region = region;
+        _stride = region.Right - region.Left + CompactSource::Padding;
+        _planeSize = (size_t)_stride * (region.Bottom - region.Top);
+        _sums.assign(Planes * _planeSize, 0);
+    }
+
+    void CompactVotes::Release()
+    {
+        _region = Rectangle<int32_t>(0, 0, 0, 0);
+        _stride = 0;
+        _planeSize = 0;
+        std::vector<int32_t>().swap(_sums);
+    }
+
+    void CompactVotes::Clear()
+    {
+        if (!_sums.empty())
+            memset(&_sums[0], 0, _sums.size() * sizeof(int32_t));
+    }
+
+    void CompactVotes::SetScale(double maxWeight, double maxNorm)
+    {
+        using Internal::CompactNormLimit;
+        _shift = 0;
+        if (maxWeight <= 0)
+            _scale = 1.0;
+        else
+        {
+            _scale = WeightUnits / maxWeight;
+            if (maxNorm * _scale > CompactNormLimit)
+                _scale = CompactNormLimit / maxNorm;
+            if (maxWeight * _scale < 1)
+            {
+                // so many votes for a pixel are left only by many equal patches, precision of values matters less
+                _scale = 1 / maxWeight;
+                while (maxNorm * _scale > CompactNormLimit * (1 << _shift) && _shift < CompactSource::ValueBits)
+                    _shift++;
+            }
+        }
+        _valueUnit = (1 << _shift) / _scale;
+        _weightUnit = 1 / _scale;
+    }
+
+    void CompactVotes::Vote(const CompactSource& source, int tx, int ty, int sx, int sy, int columns, int rows,
+        int32_t weight)
+    {
+        const size_t sourcePlane = source.GetPlaneSize();
+        int32_t* sums = &_sums[(size_t)(ty - _region.Top) * _stride + tx - _region.Left];
+        const int16_t* values = source.Pixel(sx, sy);
+
+#if defined(IRL_SIMD_X86)
+        // weights fit 16 bits unless values are shifted, see SetScale
+        if (_shift == 0 && columns <= CompactSource::Padding)
+        {
+            using namespace Internal;
+            const __m128i w = _mm_set1_epi16((int16_t)weight);
+            const __m128i first = _mm_loadu_si128((const __m128i*)(LaneMasks + CompactSource::Padding - columns));
+            const __m128i second = _mm_loadu_si128((const __m128i*)(LaneMasks + CompactSource::Padding + 8 - columns));
+            for (int y = 0; y < rows; y++, sums += _stride, values += source.Width())
+            {
+                for (int p = 0; p < Planes; p++)
+                {
+                    MultiplyAdd_SSE2(sums + p * _planeSize, values + p * sourcePlane, first, w);
+                    if (columns > 8)
+                        MultiplyAdd_SSE2(sums + p * _planeSize + 8, values + p * sourcePlane + 8, second, w);
+                }
+            }
+            return;
+        }
+#endif
+
+        for (int y = 0; y < rows; y++, sums += _stride, values += source.Width())
+        {
+            for (int p = 0; p < Planes; p++)
+            {
+                // the plane of pixels which vote keeps its bits
+                const int shift = p < CompactSource::Channels ? _shift : 0;
+                int32_t* planeSums = sums + p * _planeSize;
+                const int16_t* planeValues = values + p * sourcePlane;
+                for (int i = 0; i < columns; i++)
+                    planeSums[i] += weight * (planeValues[i] >> shift);
+            }
+        }
+    }
+
+    size_t CompactVotes::GetBytes() const
+    {
+        return _sums.capacity() * sizeof(int32_t);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Image.h"
+#include "Alpha.h"
+#include "Rectangle.h"
+#include "Accumulator.h"
+
+#include <vector>
+
+namespace IRL
+{
+    // Source pixels of CompactVotes: channels quantized to ValueBits by one quantum of the whole image,
+    // and a plane which is 1 for pixels which may vote and 0 for masked ones. Planes are int16_t without stride,
+    // the last one is followed by Padding values, so SIMD loads of rows never leave the buffer.
+    class CompactSource
+    {
+    public:
+        static const int Channels = 3;
+        static const int Planes = Channels + 1;
+        static const int ValueBits = 15;
+        static const int Padding = 16;
+
+        CompactSource();
+
+        // Quantizes the source, pixels masked in a valid mask do not vote
+        template<class PixelType>
+        void Set(const Image<PixelType>& source, const Image<Alpha8>& mask);
+        // Releases planes
+        void Clear();
+        bool IsEmpty() const { return _values.empty(); }
+
+        int Width() const { return _width; }
+        // Return pixel (x, y) of the first plane, the next ones follow by GetPlaneSize()
+        const int16_t* Pixel(int x, int y) const
+        {
+            return &_values[(size_t)y * _width + x];
+        }
+        size_t GetPlaneSize() const { return (size_t)_width * _height; }
+        // Return source value of one quantum
+        double GetQuantum() const { return _quantum; }
+
+        // Return bytes held by planes
+        size_t GetBytes() const;
+
+    private:
+        int _width;
+        int _height;
+        double _quantum;
+        std::vector<int16_t> _values;
+    };
+
+    // Votes of BidirectionalSimilarity in integer fixed point: weighted sums of CompactSource channels and
+    // sums of weights for a rectangle of target pixels. Planes are int32_t in one buffer, so it is cleared by
+    // one memset, and votes for a row of patch are SIMD multiply-adds of 16 bit values. Rows are padded by
+    // CompactSource::Padding sums, which SIMD stores of a row cover without changing them.
+    // Weights are scaled on every iteration, so that sums of any pixel fit 32 bits (see SetScale).
+    // 16 bytes per pixel, a half of Accumulator of double channels.
+    class CompactVotes
+    {
+    public:
+        static const int Planes = CompactSource::Planes;   // weighted channels and weights
+        static const int WeightUnits = 1024;               // quantized largest weight when sums allow it
+
+        CompactVotes();
+
+        // Covers target pixels of 'region', votes are cleared
+        void Resize(const Rectangle<int32_t>& region);
+        // Releases planes
+        void Release();
+        // Clears votes
+        void Clear();
+        // Chooses fixed point of weights up to 'maxWeight', which sum up to 'maxNorm' for a pixel at most.
+        // When even the largest weight quantized to 1 overflows, source values lose low bits instead.
+        void SetScale(double maxWeight, double maxNorm);
+        // Return weight in fixed point of the iteration, 0 for weights which do not vote
+        force_inline int32_t QuantizeWeight(double weight) const
+        {
+            return (int32_t)(weight * _scale + 0.5);
+        }
+
+        // Votes for 'columns' x 'rows' target pixels from (tx, ty) on by source pixels from (sx, sy) on.
+        // Rows of the same target row have to be voted by one thread.
+        void Vote(const CompactSource& source, int tx, int ty, int sx, int sy, int columns, int rows, int32_t weight);
+
+        // Return sums of target row 'y' in the plane, sums of pixel x are at [x - GetLeft()]
+        const int32_t* Row(int plane, int y) const
+        {
+            return &_sums[plane * _planeSize + (size_t)(y - _region.Top) * _stride];
+        }
+        int GetLeft() const { return _region.Left; }
+        // Return weighted sum of channel in source units and weight of one fixed point unit
+        double GetValueUnit(double quantum) const { return quantum * _valueUnit; }
+        double GetWeightUnit() const { return _weightUnit; }
+
+        // Return bytes held by planes
+        size_t GetBytes() const;
+
+    private:
+        Rectangle<int32_t> _region;
+        int _stride;              // sums of a plane row
+        size_t _planeSize;
+        double _scale;            // quantized weight of weight 1
+        int _shift;               // low bits of source values which are dropped
+        double _valueUnit;        // weighted sum of a source quantum per fixed point unit
+        double _weightUnit;       // weight per fixed point unit
+        std::vector<int32_t> _sums;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+
+    template<class PixelType>
+    void CompactSource::Set(const Image<PixelType>& source, const Image<Alpha8>& mask)
+    {
+        typedef PixelChannels<PixelType> Channels;
+        _width = source.Width();
+        _height = source.Height();
+        const ConstImageView<PixelType> view = source.ConstView();
+
+        // one quantum for all channels, so the largest magnitude takes all of ValueBits
+        double largest = 0;
+        for (int y = 0; y < _height; y++)
+        {
+            const PixelType* row = view.Row(y);
+            for (int x = 0; x < _width; x++)
+            {
+                for (int c = 0; c < Channels::Count; c++)
+                    largest = Maximum(largest, fabs(Channels::Get(row[x], c)));
+            }
+        }
+        _quantum = largest > 0 ? largest / ((1 << ValueBits) - 1) : 1.0;
+
+        _values.assign((size_t)Planes * _width * _height + Padding, 0);
+        const ConstImageView<Alpha8> maskView = mask.IsValid() ? mask.ConstView() : ConstImageView<Alpha8>();
+        for (int y = 0; y < _height; y++)
+        {
+            const PixelType* row = view.Row(y);
+            int16_t* valid = &_values[((size_t)Channels::Count * _height + y) * _width];
+            for (int x = 0; x < _width; x++)
+            {
+                const bool masked = mask.IsValid() && maskView(x, y).IsMasked();
+                valid[x] = masked ? 0 : 1;
+                for (int c = 0; c < Channels::Count; c++)
+                {
+                    _values[((size_t)c * _height + y) * _width + x] =
+                        masked ? 0 : (int16_t)floor(Channels::Get(row[x], c) / _quantum + 0.5);
+                }
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -1,9 +1,21 @@
 #pragma once
 
+// Threading and image files are backed by Qt unless IRL_NO_QT is defined, i.e. by the Qt-free library IRL/IRL.pro
+#ifndef IRL_NO_QT
 #define IRL_USE_QT
+#endif
 
 namespace IRL
 {
     const int PatchSize = 7;                    // main parameter of the algorithm
     const int HalfPatchSize = PatchSize / 2;    // handy shortcut
+    const int MinPatchSize = 5;                 // range of patch sizes solvers are compiled for, odd ones only
+    const int MaxPatchSize = 9;
+
+    // Return the nearest patch size solvers are compiled for
+    inline int SupportedPatchSize(int size)
+    {
+        size = size < MinPatchSize ? MinPatchSize : (size > MaxPatchSize ? MaxPatchSize : size);
+        return size | 1;
+    }
 }
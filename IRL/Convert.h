@@ -9,5 +9,14 @@ namespace IRL
         to = (To)from; 
     }
 
+    // Row of 'count' pixels, image conversion goes through it so that
+    // pairs with a faster implementation can overload it
+    template<class To, class From>
+    void ConvertRow(To* to, const From* from, int count)
+    {
+        for (int i = 0; i < count; i++)
+            Convert(to[i], from[i]);
+    }
+
     // Other conversions in ***Conversion.h files
 }
\ No newline at end of file
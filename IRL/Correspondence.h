@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Image.h"
+#include "ImageWithMask.h"
+#include "Parameters.h"
+#include "Threading.h"
+#include "GaussianPyramid.h"
+#include "OffsetField.h"
+#include "ValidPatches.h"
+#include "PatchIndex.h"
+#include "PatchSummaries.h"
+#include "NearestNeighborField.h"
+
+namespace IRL
+{
+    // Best matches of target patches in a source, see CorrespondenceSource
+    template<class PixelType>
+    struct Correspondence
+    {
+        typedef typename NNF<PixelType, false>::DistanceField DistanceField;
+
+        // Q + Field[Q] is the center of the source patch matching the target patch centered in Q.
+        // Only patches at least PatchSize / 2 from the borders are matched.
+        OffsetField Field;
+        // Distances of the matches, PixelType::Distance summed over patches
+        DistanceField Distances;
+    };
+
+    // Source side of correspondence queries, i.e. finding duplicate regions of many images in one source or
+    // transferring edits: pyramids of the source and its mask and, for every level, valid patches, PatchIndex
+    // and summaries as the parameters ask for. Prepared once, it answers any number of queries, concurrent
+    // ones too, and every query builds only the pyramid of its target and its own fields.
+    //
+    // Queries match levels coarse to fine, each level starts from the upscaled field of the coarser one and
+    // runs MinNNFIterations + level * NNFIterationsLODFactor patch match iterations, fewer once NNFTolerance
+    // is reached, or one exhaustive pass on levels within ExhaustiveSearchLimit. PatchSize, Seed, UseOpenCL,
+    // SkipConverged and the random search and memory layout settings apply as in object removal.
+    // Results are deterministic for a seed whatever the workers count.
+    template<class PixelType>
+    class CorrespondenceSource
+    {
+    public:
+        CorrespondenceSource();
+
+        // Prepares 'source' for queries with 'parameters', patches covering masked pixels of its mask are never
+        // matched (invalid mask to match all). Levels whose side is not above the patch size are left out.
+        void Prepare(const ImageWithMask<PixelType>& source, const CorrespondenceParameters& parameters);
+        // Releases prepared levels
+        void Clear();
+        // True when there is nothing to match, i.e. not prepared, too small or fully masked
+        bool IsEmpty() const { return _levels.empty(); }
+
+        const CorrespondenceParameters& GetParameters() const { return _parameters; }
+        int GetLevels() const { return (int)_levels.size(); }
+        // Return bytes held by prepared levels
+        size_t GetBytes() const;
+
+        // Matches patches of 'target', 'seed' keys its random search together with parameters' Seed.
+        // Return false when there is nothing to match or when stopped by non zero 'cancelFlag', then
+        // 'result' is not changed.
+        bool Find(const Image<PixelType>& target, Correspondence<PixelType>& result, uint64_t seed = 0,
+            const AtomicInt* cancelFlag = NULL) const;
+        // Matches all targets in parallel, results[i] of targets[i] keyed by seed i.
+        // Return how many targets were matched, results of the others are invalid.
+        int Find(const std::vector<Image<PixelType> >& targets, std::vector<Correspondence<PixelType> >& results,
+            const AtomicInt* cancelFlag = NULL) const;
+
+    private:
+        // disable copy methods
+        CorrespondenceSource(const CorrespondenceSource&);
+        void operator=(const CorrespondenceSource&);
+
+        struct Level
+        {
+            Image<PixelType> Source;
+            Image<Alpha8> Mask;         // invalid when the source has none
+            ValidPatches Patches;       // of Mask
+            PatchIndex Index;           // empty unless parameters.PatchIndex
+            PatchSummaries Summaries;   // empty unless parameters.PatchBounds
+        };
+
+        template<bool UseSourceMask, int Size>
+        bool Find(const Image<PixelType>& target, Correspondence<PixelType>& result, uint64_t seed,
+            const AtomicInt* cancelFlag) const;
+
+    private:
+        CorrespondenceParameters _parameters;
+        int _patchSize;
+        std::vector<Level> _levels; // finest first
+    };
+}
+
+#include "Correspondence.inl"
\ No newline at end of file
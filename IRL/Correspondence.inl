@@ -0,0 +1,231 @@
+#include "Correspondence.h"
+#include "Scaling.h"
+#include "Random.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Levels of an image whose coarsest side is still above the patch size, at most 'levels'
+        inline int GetCorrespondenceLevels(int width, int height, int patchSize, int levels)
+        {
+            int size = Minimum(width, height);
+            if (size <= patchSize)
+                return 0;
+            int result = 1;
+            while (result < levels && ScaledDownSize(size) > patchSize)
+            {
+                size = ScaledDownSize(size);
+                result++;
+            }
+            return result;
+        }
+
+        // One query of CorrespondenceSource::Find of many targets
+        template<class PixelType>
+        class CorrespondenceTask :
+            public Parallel::Runnable
+        {
+        public:
+            virtual void Run()
+            {
+                Found = Source->Find(*Target, *Result, Seed, CancelFlag);
+            }
+
+            const CorrespondenceSource<PixelType>* Source;
+            const Image<PixelType>* Target;
+            Correspondence<PixelType>* Result;
+            uint64_t Seed;
+            const AtomicInt* CancelFlag;
+            bool Found;
+        };
+    }
+
+    template<class PixelType>
+    CorrespondenceSource<PixelType>::CorrespondenceSource() : _patchSize(PatchSize)
+    {
+    }
+
+    template<class PixelType>
+    void CorrespondenceSource<PixelType>::Prepare(const ImageWithMask<PixelType>& source, const CorrespondenceParameters& parameters)
+    {
+        Tools::Profiler profiler("CorrespondenceSource::Prepare");
+        Clear();
+        _parameters = parameters;
+        _patchSize = SupportedPatchSize(parameters.PatchSize);
+        const int levels = Internal::GetCorrespondenceLevels(source.Image.Width(), source.Image.Height(), _patchSize,
+            Maximum(parameters.Levels, 1));
+        if (levels == 0)
+            return;
+
+        GaussianPyramid<PixelType> images;
+        GaussianPyramid<Alpha8> masks;
+        const bool masked = source.Mask.IsValid();
+        if (masked)
+            BuildGaussianPyramids(images, masks, source, levels);
+        else
+            images = GaussianPyramid<PixelType>(source.Image, levels);
+
+        _levels.resize(levels);
+        std::vector<float> pixels;
+        for (int i = 0; i < levels; i++)
+        {
+            Level& level = _levels[i];
+            level.Source = images.Levels[i];
+            if (masked)
+            {
+                level.Mask = masks.Levels[i];
+                level.Patches.Compute(level.Mask, _patchSize);
+                // coarser levels of a source masked this much have nothing to match
+                if (level.Patches.GetCount() == 0)
+                {
+                    _levels.resize(i);
+                    break;
+                }
+            }
+            if (parameters.PatchIndex || parameters.PatchBounds)
+                Internal::ConvertForDevice(level.Source, pixels);
+            if (parameters.PatchIndex)
+                level.Index.Build(pixels, level.Source.Width(), level.Source.Height(), level.Mask, _patchSize);
+            if (parameters.PatchBounds)
+                level.Summaries.Compute(pixels, level.Source.Width(), level.Source.Height(), _patchSize);
+        }
+    }
+
+    template<class PixelType>
+    void CorrespondenceSource<PixelType>::Clear()
+    {
+        _levels.clear();
+    }
+
+    template<class PixelType>
+    size_t CorrespondenceSource<PixelType>::GetBytes() const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < _levels.size(); i++)
+        {
+            const Level& level = _levels[i];
+            result += level.Source.GetBytes() + level.Mask.GetBytes() + level.Patches.GetBytes() +
+                level.Index.GetBytes() + level.Summaries.GetBytes();
+        }
+        return result;
+    }
+
+    template<class PixelType>
+    bool CorrespondenceSource<PixelType>::Find(const Image<PixelType>& target, Correspondence<PixelType>& result,
+        uint64_t seed, const AtomicInt* cancelFlag) const
+    {
+        if (_levels.empty() || !target.IsValid())
+            return false;
+        const bool masked = _levels[0].Mask.IsValid();
+        switch (_patchSize)
+        {
+        case 5:  return masked ? Find<true, 5>(target, result, seed, cancelFlag) : Find<false, 5>(target, result, seed, cancelFlag);
+        case 9:  return masked ? Find<true, 9>(target, result, seed, cancelFlag) : Find<false, 9>(target, result, seed, cancelFlag);
+        default: return masked ? Find<true, 7>(target, result, seed, cancelFlag) : Find<false, 7>(target, result, seed, cancelFlag);
+        }
+    }
+
+    template<class PixelType>
+    int CorrespondenceSource<PixelType>::Find(const std::vector<Image<PixelType> >& targets,
+        std::vector<Correspondence<PixelType> >& results, const AtomicInt* cancelFlag) const
+    {
+        Tools::Profiler profiler("CorrespondenceSource::Find");
+        results.assign(targets.size(), Correspondence<PixelType>());
+        // queries run as tasks of their own, their iterations split further, so workers are busy
+        // with few large targets and with many small ones
+        std::vector<Internal::CorrespondenceTask<PixelType> > tasks(targets.size());
+        Parallel::Completion completion;
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            Internal::CorrespondenceTask<PixelType>& task = tasks[i];
+            task.Source = this;
+            task.Target = &targets[i];
+            task.Result = &results[i];
+            task.Seed = i;
+            task.CancelFlag = cancelFlag;
+            task.Found = false;
+            completion.Spawn(&task);
+        }
+        completion.Wait();
+
+        int found = 0;
+        for (size_t i = 0; i < tasks.size(); i++)
+            found += tasks[i].Found ? 1 : 0;
+        return found;
+    }
+
+    template<class PixelType>
+    template<bool UseSourceMask, int Size>
+    bool CorrespondenceSource<PixelType>::Find(const Image<PixelType>& target, Correspondence<PixelType>& result,
+        uint64_t seed, const AtomicInt* cancelFlag) const
+    {
+        Tools::Profiler profiler("CorrespondenceSource::Query");
+        const int levels = Minimum((int)_levels.size(),
+            Internal::GetCorrespondenceLevels(target.Width(), target.Height(), Size, (int)_levels.size()));
+        if (levels == 0)
+            return false;
+        const GaussianPyramid<PixelType> pyramid(target, levels);
+        const uint64_t key = CounterRandom::Key((uint64_t)_parameters.Seed, seed);
+
+        NNF<PixelType, UseSourceMask, Size> solver;
+        OffsetField field;
+        for (int i = levels - 1; i >= 0; i--)
+        {
+            const Level& level = _levels[i];
+            const Image<PixelType>& levelTarget = pyramid.Levels[i];
+            solver.Reset();
+            solver.Source = level.Source;
+            if (UseSourceMask)
+            {
+                solver.SourceMask = level.Mask;
+                solver.SourcePatches = &level.Patches;
+            }
+            solver.Target = levelTarget;
+            solver.Seed = CounterRandom::Key(key, (uint64_t)i);
+            solver.Index = level.Index.IsEmpty() ? NULL : &level.Index;
+            solver.UsePatchBounds = _parameters.PatchBounds;
+            solver.SourceSummaries = _parameters.PatchBounds ? &level.Summaries : NULL;
+            solver.SkipConverged = _parameters.SkipConverged;
+            solver.RandomSearchLimit = _parameters.RandomSearchLimit;
+            solver.RandomSearchInvAlpha = _parameters.RandomSearchInvAlpha;
+            solver.SuperPatchSize = _parameters.SuperPatchSize;
+            solver.TiledSource = _parameters.TiledSource;
+            solver.BatchedRandomSearch = _parameters.BatchedRandomSearch;
+            solver.Backend = _parameters.UseOpenCL ? OpenCLBackend : CpuBackend;
+            solver.CancelFlag = cancelFlag;
+
+            // the coarsest level starts at random, finer ones from the coarser matches
+            if (i == levels - 1)
+                field = MakeRandomField(levelTarget, level.Source);
+            else
+                field = UpscaleField(field, levelTarget.Width(), levelTarget.Height(), level.Source.Width(), level.Source.Height());
+            if (UseSourceMask)
+                RemoveMaskedOffsets(field, level.Patches);
+            solver.Field = field;
+            // leave the only reference to the field in the solver, so it is updated in place
+            field.Discard();
+
+            const bool exhaustive = (int64_t)levelTarget.GetPatchesCount(Size) * level.Source.GetPatchesCount(Size) <=
+                _parameters.ExhaustiveSearchLimit;
+            solver.Propagation = exhaustive ? ExhaustiveSearch : ScanOrderPropagation;
+            const int iterations = exhaustive ? 1 : _parameters.MinNNFIterations + i * _parameters.NNFIterationsLODFactor;
+            for (int k = 0; k < iterations; k++)
+            {
+                solver.Iteration(true);
+                if (cancelFlag && cancelFlag->Load() != 0)
+                    return false;
+                // do at least one iteration in each scan order
+                if (k > 0 && solver.GetChangedFraction() < _parameters.NNFTolerance)
+                    break;
+            }
+            field = solver.Field;
+        }
+
+        result.Field = solver.Field;
+        result.Distances = solver.D;
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "Includes.h"
+#include "DebugWriter.h"
+#include "IO.h"
+#include "Threading.h"
+
+#include <deque>
+#include <fstream>
+
+#ifdef _MSC_VER
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace IRL
+{
+    namespace Debug
+    {
+        namespace
+        {
+            struct Artifact
+            {
+                enum Kind
+                {
+                    Directory,
+                    Text,
+                    Picture
+                };
+
+                Kind Type;
+                std::string Path;
+                std::string Content;   // Text
+                Image<RGB8> Pixels;    // Picture
+            };
+
+            // Writer thread is started by the first artifact and lives till exit
+            class Writer :
+                public Thread
+            {
+            public:
+                Writer() : _started(false), _busy(false), _stop(false) {}
+
+                ~Writer()
+                {
+                    _lock.Lock();
+                    bool started = _started;
+                    _stop = true;
+                    _changed.WakeAll();
+                    _lock.Unlock();
+                    if (started)
+                        Join();
+                }
+
+                void Queue(const Artifact& artifact)
+                {
+                    AutoMutex lock(_lock);
+                    _queue.push_back(artifact);
+                    if (!_started)
+                    {
+                        _started = true;
+                        Start();
+                    }
+                    _changed.WakeAll();
+                }
+
+                void Flush()
+                {
+                    AutoMutex lock(_lock);
+                    while (!_queue.empty() || _busy)
+                        _changed.Wait(_lock);
+                }
+
+            private:
+                virtual void Run()
+                {
+                    _lock.Lock();
+                    while (true)
+                    {
+                        while (_queue.empty() && !_stop)
+                            _changed.Wait(_lock);
+                        if (_queue.empty())
+                            break; // stopped and everything is written
+                        Artifact artifact = _queue.front();
+                        _queue.pop_front();
+                        _busy = true;
+                        _lock.Unlock();
+
+                        Write(artifact);
+
+                        _lock.Lock();
+                        _busy = false;
+                        _changed.WakeAll();
+                    }
+                    _lock.Unlock();
+                }
+
+                static void Write(const Artifact& artifact)
+                {
+                    switch (artifact.Type)
+                    {
+                    case Artifact::Directory:
+#ifdef _MSC_VER
+                        _mkdir(artifact.Path.c_str());
+#else
+                        mkdir(artifact.Path.c_str(), 0777);
+#endif
+                        break;
+                    case Artifact::Text:
+                        {
+                            std::ofstream file(artifact.Path.c_str());
+                            file << artifact.Content;
+                        }
+                        break;
+                    case Artifact::Picture:
+                        IRL::SaveImage(artifact.Pixels, artifact.Path);
+                        break;
+                    }
+                }
+
+            private:
+                Mutex _lock;                  // guards fields below
+                WaitCondition _changed;       // artifact is queued or written, or writer stops
+                std::deque<Artifact> _queue;
+                bool _started;
+                bool _busy;                   // artifact taken from the queue is being written
+                bool _stop;
+            } g_Writer;
+        }
+
+        void MakeDirectory(const std::string& path)
+        {
+            Artifact artifact;
+            artifact.Type = Artifact::Directory;
+            artifact.Path = path;
+            g_Writer.Queue(artifact);
+        }
+
+        void SaveText(const std::string& text, const std::string& path)
+        {
+            Artifact artifact;
+            artifact.Type = Artifact::Text;
+            artifact.Path = path;
+            artifact.Content = text;
+            g_Writer.Queue(artifact);
+        }
+
+        void SaveImage(const Image<RGB8>& image, const std::string& path)
+        {
+            Artifact artifact;
+            artifact.Type = Artifact::Picture;
+            artifact.Path = path;
+            artifact.Pixels = image;
+            g_Writer.Queue(artifact);
+        }
+
+        void Flush()
+        {
+            g_Writer.Flush();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Image.h"
+#include "RGB.h"
+#include "ImageConversion.h"
+
+namespace IRL
+{
+    // Debug artifacts (see DebugOutput) are written by a background thread in the order they were queued,
+    // so PNG compression and file I/O do not stall the solver. Callers check DebugOutput before building
+    // paths, so disabled output costs nothing.
+    namespace Debug
+    {
+        // Queues creation of the directory, files queued after it may go into it
+        extern void MakeDirectory(const std::string& path);
+        // Queues writing of the text file
+        extern void SaveText(const std::string& text, const std::string& path);
+        // Queues writing of the image, its data is shared till it is written
+        extern void SaveImage(const Image<RGB8>& image, const std::string& path);
+        // Waits till everything queued is written
+        extern void Flush();
+
+        // Converts the image to RGB8 on the calling thread and queues it
+        template<class PixelType>
+        void SaveImage(const Image<PixelType>& image, const std::string& path)
+        {
+            Image<RGB8> converted;
+            Convert(converted, image);
+            SaveImage(converted, path);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,701 @@
+#include "Includes.h"
+#include "DeviceNNF.h"
+#include "Threading.h"
+
+#ifdef IRL_USE_OPENCL
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+#endif
+
+namespace IRL
+{
+    namespace Internal
+    {
+        //////////////////////////////////////////////////////////////////////////
+        // Pixel conversion
+
+        template<>
+        void ConvertForDevice<RGB8>(const Image<RGB8>& image, std::vector<float>& pixels)
+        {
+            const ConstImageView<RGB8> view = image.ConstView();
+            pixels.resize(view.Width() * view.Height() * 4);
+            float* out = &pixels[0];
+            for (int32_t y = 0; y < view.Height(); y++)
+            {
+                const RGB8* row = view.Row(y);
+                for (int32_t x = 0; x < view.Width(); x++, out += 4)
+                {
+                    out[0] = row[x].R;
+                    out[1] = row[x].G;
+                    out[2] = row[x].B;
+                    out[3] = 0;
+                }
+            }
+        }
+
+        // Lab distance weights channels, so weights are applied to pixels instead
+        template<class Channel>
+        static void ConvertLabForDevice(const Image<Lab<Channel> >& image, std::vector<float>& pixels)
+        {
+            typedef Lab<Channel> PixelType;
+            const PixelType zero(0, 0, 0);
+            const float L = (float)sqrt((double)PixelType::Distance(PixelType(1, 0, 0), zero));
+            const float a = (float)sqrt((double)PixelType::Distance(PixelType(0, 1, 0), zero));
+            const float b = (float)sqrt((double)PixelType::Distance(PixelType(0, 0, 1), zero));
+            const ConstImageView<Lab<Channel> > view = image.ConstView();
+            pixels.resize(view.Width() * view.Height() * 4);
+            float* out = &pixels[0];
+            for (int32_t y = 0; y < view.Height(); y++)
+            {
+                const Lab<Channel>* row = view.Row(y);
+                for (int32_t x = 0; x < view.Width(); x++, out += 4)
+                {
+                    out[0] = (float)row[x].L * L;
+                    out[1] = (float)row[x].a * a;
+                    out[2] = (float)row[x].b * b;
+                    out[3] = 0;
+                }
+            }
+        }
+
+        template<>
+        void ConvertForDevice<Lab8>(const Image<Lab8>& image, std::vector<float>& pixels)
+        {
+            ConvertLabForDevice(image, pixels);
+        }
+
+        template<>
+        void ConvertForDevice<Lab16>(const Image<Lab16>& image, std::vector<float>& pixels)
+        {
+            ConvertLabForDevice(image, pixels);
+        }
+
+        template<>
+        void ConvertForDevice<LabFloat>(const Image<LabFloat>& image, std::vector<float>& pixels)
+        {
+            ConvertLabForDevice(image, pixels);
+        }
+
+        template<>
+        void ConvertForDevice<LabDouble>(const Image<LabDouble>& image, std::vector<float>& pixels)
+        {
+            ConvertLabForDevice(image, pixels);
+        }
+
+#ifdef IRL_USE_OPENCL
+        //////////////////////////////////////////////////////////////////////////
+        // Kernels
+
+        // Keeps kernel source readable, it must not contain preprocessor directives.
+        // PATCH_SIZE, HALF_PATCH_SIZE and MASK_THRESHOLD are passed as build options.
+        #define IRL_OPENCL_SOURCE(...) #__VA_ARGS__
+
+        static const char* KernelSource = IRL_OPENCL_SOURCE(
+
+        // Pixels are 4 floats, offsets are 2 shorts, all arrays are stored without stride
+
+        int Contains(int x, int y, int left, int top, int right, int bottom)
+        {
+            return x >= left && x < right && y >= top && y < bottom;
+        }
+
+        // Distance between patches centered in (sx, sy) and (tx, ty),
+        // stops once it exceeds 'known', the check is done once per patch row
+        float PatchDistance(__global const float* source, __global const uchar* mask, int sourceWidth, int useMask, float penalty,
+                            __global const float* target, int targetWidth, int sx, int sy, int tx, int ty, float known)
+        {
+            float distance = 0.0f;
+            for (int y = -HALF_PATCH_SIZE; y <= HALF_PATCH_SIZE; y++)
+            {
+                __global const float* s = source + ((sy + y) * sourceWidth + sx - HALF_PATCH_SIZE) * 4;
+                __global const float* t = target + ((ty + y) * targetWidth + tx - HALF_PATCH_SIZE) * 4;
+                for (int i = 0; i < PATCH_SIZE * 4; i++)
+                {
+                    float d = s[i] - t[i];
+                    distance += d * d;
+                }
+                if (useMask)
+                {
+                    __global const uchar* m = mask + (sy + y) * sourceWidth + sx - HALF_PATCH_SIZE;
+                    for (int i = 0; i < PATCH_SIZE; i++)
+                    {
+                        if (m[i] < MASK_THRESHOLD)
+                            distance += penalty;
+                    }
+                }
+                if (distance > known)
+                    return distance;
+            }
+            return distance;
+        }
+
+        // Same generator as IRL::Random
+        int Uniform(uint* state, int min, int max)
+        {
+            *state = *state * 214013u + 2531011u;
+            uint next = (*state >> 16) & 0x7fffu;
+            return (int)(next * (uint)(max - min - 1) / 0x7fffu + (uint)min);
+        }
+
+        __kernel void Prepare(__global const float* source, __global const uchar* mask, int sourceWidth, int useMask, float penalty,
+                              __global const float* target, int targetWidth, __global short* field, __global float* distance,
+                              int targetLeft, int targetTop, int targetRight, int targetBottom)
+        {
+            int x = targetLeft + (int)get_global_id(0);
+            int y = targetTop + (int)get_global_id(1);
+            if (x >= targetRight || y >= targetBottom)
+                return;
+            int index = y * targetWidth + x;
+            distance[index] = PatchDistance(source, mask, sourceWidth, useMask, penalty, target, targetWidth,
+                x + field[index * 2], y + field[index * 2 + 1], x, y, INFINITY);
+        }
+
+        // Processes pixels of one color, their neighbors at odd 'step' have the other color
+        // and are not changed by this pass
+        __kernel void Pass(__global const float* source, __global const uchar* mask, int sourceWidth, int useMask, float penalty,
+                           __global const float* target, int targetWidth, __global short* field, __global float* distance,
+                           int sourceLeft, int sourceTop, int sourceRight, int sourceBottom,
+                           int targetLeft, int targetTop, int targetRight, int targetBottom,
+                           int pass, int step, int searchRadius, int searchLimit, int searchInvAlpha, uint seed)
+        {
+            int y = targetTop + (int)get_global_id(1);
+            int x = targetLeft + 2 * (int)get_global_id(0) + ((targetLeft + y + pass) & 1);
+            if (x >= targetRight || y >= targetBottom)
+                return;
+            int index = y * targetWidth + x;
+            int offsetX = field[index * 2];
+            int offsetY = field[index * 2 + 1];
+            float bestD = distance[index];
+            if (bestD == 0.0f)
+                return;
+            int bestX = offsetX;
+            int bestY = offsetY;
+
+            // propagation
+            int neighborX[4] = { x - step, x + step, x, x };
+            int neighborY[4] = { y, y, y - step, y + step };
+            for (int i = 0; i < 4; i++)
+            {
+                if (!Contains(neighborX[i], neighborY[i], targetLeft, targetTop, targetRight, targetBottom))
+                    continue;
+                int neighbor = neighborY[i] * targetWidth + neighborX[i];
+                int candidateX = field[neighbor * 2];
+                int candidateY = field[neighbor * 2 + 1];
+                if ((candidateX == bestX && candidateY == bestY) ||
+                    !Contains(x + candidateX, y + candidateY, sourceLeft, sourceTop, sourceRight, sourceBottom))
+                    continue;
+                float d = PatchDistance(source, mask, sourceWidth, useMask, penalty, target, targetWidth,
+                    x + candidateX, y + candidateY, x, y, bestD);
+                if (d < bestD)
+                {
+                    bestD = d;
+                    bestX = candidateX;
+                    bestY = candidateY;
+                }
+            }
+
+            // random search, candidate has to halve the distance like on CPU
+            if (searchRadius >= 2 && bestD > 0.0f)
+            {
+                uint state = seed ^ ((uint)index * 2654435761u);
+                int centerX = x + bestX;
+                int centerY = y + bestY;
+                int wx = Uniform(&state, -searchRadius, searchRadius);
+                int wy = Uniform(&state, -searchRadius, searchRadius);
+                if (wx + centerX <  sourceLeft)   wx = sourceLeft - centerX;
+                if (wx + centerX >= sourceRight)  wx = sourceRight - centerX - 1;
+                if (wy + centerY <  sourceTop)    wy = sourceTop - centerY;
+                if (wy + centerY >= sourceBottom) wy = sourceBottom - centerY - 1;
+
+                float limit = bestD / 2;
+                int foundX = 0;
+                int foundY = 0;
+                int found = 0;
+                for (int i = 0; i < searchLimit; i++)
+                {
+                    if (wx == 0 && wy == 0)
+                        break;
+                    float d = PatchDistance(source, mask, sourceWidth, useMask, penalty, target, targetWidth,
+                        centerX + wx, centerY + wy, x, y, limit);
+                    if (d < limit)
+                    {
+                        limit = d;
+                        foundX = wx;
+                        foundY = wy;
+                        found = 1;
+                        if (limit == 0.0f)
+                            break;
+                    }
+                    wx /= searchInvAlpha;
+                    wy /= searchInvAlpha;
+                }
+                if (found)
+                {
+                    bestX += foundX;
+                    bestY += foundY;
+                    bestD = limit;
+                }
+            }
+
+            if (bestX != offsetX || bestY != offsetY)
+            {
+                field[index * 2] = (short)bestX;
+                field[index * 2 + 1] = (short)bestY;
+                distance[index] = bestD;
+            }
+        }
+
+        );
+
+        #undef IRL_OPENCL_SOURCE
+
+        //////////////////////////////////////////////////////////////////////////
+        // Device management
+
+        const int PatchSizes = (MaxPatchSize - MinPatchSize) / 2 + 1;
+
+        // Context and programs shared by all DeviceNNF objects
+        struct DeviceContext
+        {
+            cl_device_id Device;
+            cl_context Context;
+            cl_program Programs[PatchSizes];   // one per odd patch size from MinPatchSize, NULL till built
+        };
+
+        static Mutex ContextLock;
+        static bool ContextCreated = false;
+        static DeviceContext* Context = NULL;
+
+        static cl_device_id FindDevice()
+        {
+            cl_uint count = 0;
+            if (clGetPlatformIDs(0, NULL, &count) != CL_SUCCESS || count == 0)
+                return NULL;
+            std::vector<cl_platform_id> platforms(count);
+            if (clGetPlatformIDs(count, &platforms[0], NULL) != CL_SUCCESS)
+                return NULL;
+
+            // prefer GPU, other devices are unlikely to outperform CPU code
+            const cl_device_type types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+            for (int t = 0; t < 2; t++)
+            {
+                for (cl_uint i = 0; i < count; i++)
+                {
+                    cl_device_id device;
+                    if (clGetDeviceIDs(platforms[i], types[t], 1, &device, NULL) == CL_SUCCESS)
+                        return device;
+                }
+            }
+            return NULL;
+        }
+
+        static cl_program BuildProgram(cl_context context, cl_device_id device, int patchSize)
+        {
+            cl_int error;
+            cl_program program = clCreateProgramWithSource(context, 1, &KernelSource, NULL, &error);
+            if (error != CL_SUCCESS)
+                return NULL;
+            std::ostringstream options;
+            options << "-DPATCH_SIZE=" << patchSize << " -DHALF_PATCH_SIZE=" << patchSize / 2;
+            options << " -DMASK_THRESHOLD=" << (int)(TypeTraits<uint8_t>::MaxValue() / 2);
+            if (clBuildProgram(program, 1, &device, options.str().c_str(), NULL, NULL) != CL_SUCCESS)
+            {
+                clReleaseProgram(program);
+                return NULL;
+            }
+            return program;
+        }
+
+        // Builds the program of the default patch size, so that IsAvailable knows kernels compile
+        static DeviceContext* CreateContext()
+        {
+            cl_device_id device = FindDevice();
+            if (device == NULL)
+                return NULL;
+
+            cl_int error;
+            cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &error);
+            if (error != CL_SUCCESS)
+                return NULL;
+
+            cl_program program = BuildProgram(context, device, PatchSize);
+            if (program == NULL)
+            {
+                clReleaseContext(context);
+                return NULL;
+            }
+
+            DeviceContext* result = new DeviceContext();
+            result->Device = device;
+            result->Context = context;
+            for (int i = 0; i < PatchSizes; i++)
+                result->Programs[i] = NULL;
+            result->Programs[(PatchSize - MinPatchSize) / 2] = program;
+            return result;
+        }
+
+        // Return NULL if there is no usable device, the context lives until the process ends
+        static DeviceContext* GetContext()
+        {
+            AutoMutex lock(ContextLock);
+            if (!ContextCreated)
+            {
+                Context = CreateContext();
+                ContextCreated = true;
+            }
+            return Context;
+        }
+
+        // Return program of the patch size, builds it on first use, NULL if it fails
+        static cl_program GetProgram(DeviceContext* context, int patchSize)
+        {
+            ASSERT(patchSize >= MinPatchSize && patchSize <= MaxPatchSize && patchSize % 2 == 1);
+            AutoMutex lock(ContextLock);
+            cl_program& program = context->Programs[(patchSize - MinPatchSize) / 2];
+            if (program == NULL)
+                program = BuildProgram(context->Context, context->Device, patchSize);
+            return program;
+        }
+
+        // Device memory which grows on demand
+        struct DeviceBuffer
+        {
+            cl_mem Memory;
+            size_t Size;
+
+            DeviceBuffer() : Memory(NULL), Size(0) {}
+            ~DeviceBuffer() { Release(); }
+
+            void Release()
+            {
+                if (Memory != NULL)
+                    clReleaseMemObject(Memory);
+                Memory = NULL;
+                Size = 0;
+            }
+
+            bool Reserve(cl_context context, size_t size)
+            {
+                if (Memory != NULL && Size >= size)
+                    return true;
+                Release();
+                cl_int error;
+                Memory = clCreateBuffer(context, CL_MEM_READ_WRITE, size, NULL, &error);
+                if (error != CL_SUCCESS)
+                {
+                    Memory = NULL;
+                    return false;
+                }
+                Size = size;
+                return true;
+            }
+        };
+
+        // Sets kernel arguments one by one and remembers if any failed
+        class KernelArguments
+        {
+        public:
+            explicit KernelArguments(cl_kernel kernel) : _kernel(kernel), _index(0), _ok(true) {}
+
+            template<class T>
+            KernelArguments& operator()(const T& value)
+            {
+                _ok = _ok && clSetKernelArg(_kernel, _index, sizeof(T), &value) == CL_SUCCESS;
+                _index++;
+                return *this;
+            }
+
+            bool Ok() const { return _ok; }
+
+        private:
+            cl_kernel _kernel;
+            cl_uint _index;
+            bool _ok;
+        };
+
+        // Every object has its own queue and kernels, so objects may be used from different threads
+        struct DeviceNNF::Buffers
+        {
+            DeviceContext* Context;
+            cl_command_queue Queue;
+            cl_kernel Prepare;
+            cl_kernel Pass;
+
+            DeviceBuffer Source;
+            DeviceBuffer Mask;
+            DeviceBuffer Target;
+            DeviceBuffer Field;
+            DeviceBuffer Distance;
+
+            bool UseMask;
+            float Penalty;
+
+            Buffers() : Context(NULL), Queue(NULL), Prepare(NULL), Pass(NULL), UseMask(false), Penalty(0) {}
+
+            ~Buffers()
+            {
+                Source.Release();
+                Mask.Release();
+                Target.Release();
+                Field.Release();
+                Distance.Release();
+                if (Prepare != NULL)
+                    clReleaseKernel(Prepare);
+                if (Pass != NULL)
+                    clReleaseKernel(Pass);
+                if (Queue != NULL)
+                    clReleaseCommandQueue(Queue);
+            }
+
+            bool Initialize(DeviceContext* context, int patchSize)
+            {
+                Context = context;
+                cl_program program = GetProgram(context, patchSize);
+                if (program == NULL)
+                    return false;
+                cl_int error;
+                Queue = clCreateCommandQueue(context->Context, context->Device, 0, &error);
+                if (error != CL_SUCCESS)
+                {
+                    Queue = NULL;
+                    return false;
+                }
+                Prepare = clCreateKernel(program, "Prepare", &error);
+                if (error != CL_SUCCESS)
+                {
+                    Prepare = NULL;
+                    return false;
+                }
+                Pass = clCreateKernel(program, "Pass", &error);
+                if (error != CL_SUCCESS)
+                {
+                    Pass = NULL;
+                    return false;
+                }
+                return true;
+            }
+
+            bool Upload(DeviceBuffer& buffer, const void* data, size_t size)
+            {
+                if (!buffer.Reserve(Context->Context, size))
+                    return false;
+                return clEnqueueWriteBuffer(Queue, buffer.Memory, CL_TRUE, 0, size, data, 0, NULL, NULL) == CL_SUCCESS;
+            }
+
+            bool Download(DeviceBuffer& buffer, void* data, size_t size)
+            {
+                ASSERT(buffer.Size >= size);
+                return clEnqueueReadBuffer(Queue, buffer.Memory, CL_TRUE, 0, size, data, 0, NULL, NULL) == CL_SUCCESS;
+            }
+
+            // Arguments shared by all kernels
+            KernelArguments Arguments(cl_kernel kernel, int sourceWidth, int targetWidth)
+            {
+                KernelArguments arguments(kernel);
+                arguments(Source.Memory)(UseMask ? Mask.Memory : Source.Memory)(sourceWidth)((int)UseMask)(Penalty);
+                arguments(Target.Memory)(targetWidth)(Field.Memory)(Distance.Memory);
+                return arguments;
+            }
+
+            bool Run(cl_kernel kernel, size_t width, size_t height)
+            {
+                if (width == 0 || height == 0)
+                    return true;
+                size_t size[2] = { width, height };
+                return clEnqueueNDRangeKernel(Queue, kernel, 2, NULL, size, NULL, 0, NULL, NULL) == CL_SUCCESS;
+            }
+        };
+#else
+        struct DeviceNNF::Buffers
+        {
+        };
+#endif
+
+        //////////////////////////////////////////////////////////////////////////
+        // DeviceNNF
+
+        bool DeviceNNF::IsAvailable()
+        {
+#ifdef IRL_USE_OPENCL
+            return GetContext() != NULL;
+#else
+            return false;
+#endif
+        }
+
+        DeviceNNF::DeviceNNF(int patchSize)
+        {
+            _buffers = NULL;
+            _sourceWidth = _sourceHeight = 0;
+            _targetWidth = _targetHeight = 0;
+            _sourceRect = Rectangle<int32_t>(0, 0, 0, 0);
+            _targetRect = Rectangle<int32_t>(0, 0, 0, 0);
+#ifdef IRL_USE_OPENCL
+            DeviceContext* context = GetContext();
+            if (context == NULL)
+                return;
+            _buffers = new Buffers();
+            if (!_buffers->Initialize(context, patchSize))
+            {
+                delete _buffers;
+                _buffers = NULL;
+            }
+#else
+            (void)patchSize;
+#endif
+        }
+
+        DeviceNNF::~DeviceNNF()
+        {
+            delete _buffers;
+        }
+
+        bool DeviceNNF::SetSource(const std::vector<float>& pixels, int width, int height, const Image<Alpha8>& mask, float penalty)
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL || pixels.size() != (size_t)width * height * 4)
+                return false;
+            _sourceWidth = width;
+            _sourceHeight = height;
+            if (!_buffers->Upload(_buffers->Source, &pixels[0], pixels.size() * sizeof(float)))
+                return false;
+
+            _buffers->UseMask = mask.IsValid();
+            _buffers->Penalty = penalty;
+            if (!_buffers->UseMask)
+                return true;
+            ASSERT(mask.Width() == width && mask.Height() == height);
+            std::vector<uint8_t> packed(width * height);
+            const ConstImageView<Alpha8> view = mask.ConstView();
+            for (int32_t y = 0; y < height; y++)
+            {
+                const Alpha8* row = view.Row(y);
+                for (int32_t x = 0; x < width; x++)
+                    packed[x + y * width] = row[x].A;
+            }
+            return _buffers->Upload(_buffers->Mask, &packed[0], packed.size());
+#else
+            (void)pixels;
+            (void)width;
+            (void)height;
+            (void)mask;
+            (void)penalty;
+            return false;
+#endif
+        }
+
+        bool DeviceNNF::SetTarget(const std::vector<float>& pixels, int width, int height)
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL || pixels.size() != (size_t)width * height * 4)
+                return false;
+            _targetWidth = width;
+            _targetHeight = height;
+            return _buffers->Upload(_buffers->Target, &pixels[0], pixels.size() * sizeof(float)) &&
+                   _buffers->Distance.Reserve(_buffers->Context->Context, width * height * sizeof(float));
+#else
+            (void)pixels;
+            (void)width;
+            (void)height;
+            return false;
+#endif
+        }
+
+        void DeviceNNF::SetRects(const Rectangle<int32_t>& sourceRect, const Rectangle<int32_t>& targetRect)
+        {
+            _sourceRect = sourceRect;
+            _targetRect = targetRect;
+        }
+
+        bool DeviceNNF::SetField(const OffsetField& field)
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL || field.Width() != _targetWidth || field.Height() != _targetHeight)
+                return false;
+            std::vector<Point16> packed(_targetWidth * _targetHeight);
+            const ConstImageView<Point16> view = field.ConstView();
+            for (int32_t y = 0; y < _targetHeight; y++)
+            {
+                const Point16* row = view.Row(y);
+                for (int32_t x = 0; x < _targetWidth; x++)
+                {
+                    // fields of other patch sizes may point too close to the border
+                    const int32_t sx = Maximum<int32_t>(_sourceRect.Left, Minimum<int32_t>(x + row[x].x, _sourceRect.Right - 1));
+                    const int32_t sy = Maximum<int32_t>(_sourceRect.Top, Minimum<int32_t>(y + row[x].y, _sourceRect.Bottom - 1));
+                    packed[x + y * _targetWidth] = Point16((int16_t)(sx - x), (int16_t)(sy - y));
+                }
+            }
+            return _buffers->Upload(_buffers->Field, &packed[0], packed.size() * sizeof(Point16));
+#else
+            (void)field;
+            return false;
+#endif
+        }
+
+        bool DeviceNNF::PrepareDistances()
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL)
+                return false;
+            KernelArguments arguments = _buffers->Arguments(_buffers->Prepare, _sourceWidth, _targetWidth);
+            arguments(_targetRect.Left)(_targetRect.Top)(_targetRect.Right)(_targetRect.Bottom);
+            return arguments.Ok() && 
+                _buffers->Run(_buffers->Prepare, _targetRect.Right - _targetRect.Left, _targetRect.Bottom - _targetRect.Top);
+#else
+            return false;
+#endif
+        }
+
+        bool DeviceNNF::Pass(int pass, int step, int searchRadius, int searchLimit, int searchInvAlpha, uint32_t seed)
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL)
+                return false;
+            KernelArguments arguments = _buffers->Arguments(_buffers->Pass, _sourceWidth, _targetWidth);
+            arguments(_sourceRect.Left)(_sourceRect.Top)(_sourceRect.Right)(_sourceRect.Bottom);
+            arguments(_targetRect.Left)(_targetRect.Top)(_targetRect.Right)(_targetRect.Bottom);
+            arguments(pass)(step)(searchRadius)(searchLimit)(searchInvAlpha)((cl_uint)seed);
+            // every work item handles one pixel of the pass color in its row
+            int width = _targetRect.Right - _targetRect.Left;
+            return arguments.Ok() && _buffers->Run(_buffers->Pass, (width + 1) / 2, _targetRect.Bottom - _targetRect.Top);
+#else
+            (void)pass;
+            (void)step;
+            (void)searchRadius;
+            (void)searchLimit;
+            (void)searchInvAlpha;
+            (void)seed;
+            return false;
+#endif
+        }
+
+        bool DeviceNNF::GetField(std::vector<Point16>& field)
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL)
+                return false;
+            field.resize(_targetWidth * _targetHeight);
+            return _buffers->Download(_buffers->Field, &field[0], field.size() * sizeof(Point16));
+#else
+            (void)field;
+            return false;
+#endif
+        }
+
+        bool DeviceNNF::GetDistances(std::vector<float>& distances)
+        {
+#ifdef IRL_USE_OPENCL
+            if (_buffers == NULL)
+                return false;
+            distances.resize(_targetWidth * _targetHeight);
+            return _buffers->Download(_buffers->Distance, &distances[0], distances.size() * sizeof(float));
+#else
+            (void)distances;
+            return false;
+#endif
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Image.h"
+#include "Point2D.h"
+#include "Rectangle.h"
+#include "RGB.h"
+#include "Lab.h"
+#include "Alpha.h"
+#include "OffsetField.h"
+
+namespace IRL
+{
+    // Where NNF iterations are computed
+    enum ComputeBackend
+    {
+        CpuBackend,
+        // OpenCL device, needs build with CONFIG+=opencl. Always uses checkerboard propagation,
+        // falls back to CpuBackend when there is no device or it fails.
+        OpenCLBackend
+    };
+
+    namespace Internal
+    {
+        // NNF iterations on OpenCL device.
+        // Images, offsets and distances stay in device memory between iterations, buffers are
+        // reused while they are large enough. Every method returns false on failure,
+        // caller should continue on CPU then.
+        class DeviceNNF
+        {
+        public:
+            // Return true if OpenCL device was found and kernels were built
+            static bool IsAvailable();
+
+            // Kernels are built once per patch size and shared by all objects
+            explicit DeviceNNF(int patchSize = PatchSize);
+            ~DeviceNNF();
+
+            // Pixels are 4 floats each (see ConvertForDevice), 'mask' is ignored if not valid.
+            // Masked source pixel adds 'penalty' to distance of every patch covering it.
+            bool SetSource(const std::vector<float>& pixels, int width, int height, const Image<Alpha8>& mask, float penalty);
+            bool SetTarget(const std::vector<float>& pixels, int width, int height);
+            // Rectangles with allowed source and target patch centers
+            void SetRects(const Rectangle<int32_t>& sourceRect, const Rectangle<int32_t>& targetRect);
+
+            // Offsets are clamped into the source rectangle, so call SetRects first
+            bool SetField(const OffsetField& field);
+            // Recalculates distances of all target patches
+            bool PrepareDistances();
+            // Red/black pass of checkerboard propagation with neighbors at 'step' distance and random search
+            bool Pass(int pass, int step, int searchRadius, int searchLimit, int searchInvAlpha, uint32_t seed);
+
+            // Download results, buffers contain target image sized arrays without stride
+            bool GetField(std::vector<Point16>& field);
+            bool GetDistances(std::vector<float>& distances);
+
+        private:
+            // disable copy methods
+            DeviceNNF(const DeviceNNF&);
+            DeviceNNF& operator=(const DeviceNNF&);
+
+        private:
+            struct Buffers;
+            Buffers* _buffers; // NULL without OpenCL
+
+            int _sourceWidth;
+            int _sourceHeight;
+            int _targetWidth;
+            int _targetHeight;
+            Rectangle<int32_t> _sourceRect;
+            Rectangle<int32_t> _targetRect;
+        };
+
+        // Converts image to 4 floats per pixel, so that squared euclidean distance between them
+        // equals PixelType::Distance. Defined for RGB8, Lab8, Lab16, LabFloat and LabDouble in DeviceNNF.cpp.
+        template<class PixelType>
+        void ConvertForDevice(const Image<PixelType>& image, std::vector<float>& pixels);
+
+        template<> void ConvertForDevice<RGB8>(const Image<RGB8>& image, std::vector<float>& pixels);
+        template<> void ConvertForDevice<Lab8>(const Image<Lab8>& image, std::vector<float>& pixels);
+        template<> void ConvertForDevice<Lab16>(const Image<Lab16>& image, std::vector<float>& pixels);
+        template<> void ConvertForDevice<LabFloat>(const Image<LabFloat>& image, std::vector<float>& pixels);
+        template<> void ConvertForDevice<LabDouble>(const Image<LabDouble>& image, std::vector<float>& pixels);
+    }
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Image.h"
+#include "ImageWithMask.h"
 #include "Convert.h"
 
 namespace IRL
@@ -16,6 +17,11 @@ namespace IRL
         std::vector<Image<PixelType> > Levels;
     };
 
+    // Pyramids of an image and of its mask, every level of both is built in one pass
+    template<class PixelType>
+    void BuildGaussianPyramids(GaussianPyramid<PixelType>& image, GaussianPyramid<Alpha8>& mask, 
+        const ImageWithMask<PixelType>& source, int levels);
+
     // Converter for pyramid
     template<class ToPixelFormat, class FromPixelFormat>
     void Convert(GaussianPyramid<ToPixelFormat>& to, const GaussianPyramid<FromPixelFormat>& from);
@@ -2,9 +2,80 @@
 #include "Scaling.h"
 #include "Profiler.h"
 #include "ImageConversion.h"
+#include "Parallel.h"
 
 namespace IRL
 {
+    namespace Internal
+    {
+        // Rows of the next level of an image and, when given, of its mask
+        template<class PixelType>
+        class PyramidLevelTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                ConstImageView<PixelType> Src;
+                ImageView<PixelType> Dst;
+                ConstImageView<Alpha8> SrcMask;
+                ImageView<Alpha8> DstMask;
+            };
+
+        private:
+            int _start;
+            int _end;
+            State _state;
+        public:
+            void Set(int start, int end, const State& state)
+            {
+                _start = start;
+                _end = end;
+                _state = state;
+            }
+
+            virtual void Run()
+            {
+                ScaleDownStrip<Kernel1D5Tap, PixelType>(_state.Src, _state.Dst).Process(_start, _end);
+                if (_state.DstMask.IsValid())
+                    ScaleDownStrip<Kernel1D5Tap, Alpha8>(_state.SrcMask, _state.DstMask).Process(_start, _end);
+            }
+        };
+
+        // Fills levels after the first one, masks may be NULL. Each level is one pass over the previous
+        // one, the next level can't start earlier as its strips need rows of neighbouring strips.
+        template<class PixelType>
+        void BuildPyramidLevels(std::vector<Image<PixelType> >& levels, std::vector<Image<Alpha8> >* masks)
+        {
+            for (unsigned int i = 1; i < levels.size(); i++)
+            {
+                Memory::LevelScope level((int)i);
+                const Image<PixelType>& previous = levels[i - 1];
+                levels[i] = Image<PixelType>(ScaledDownSize(previous.Width()), ScaledDownSize(previous.Height()));
+
+                typename PyramidLevelTask<PixelType>::State state;
+                state.Src = previous.ConstView();
+                state.Dst = levels[i].View();
+                if (masks != NULL)
+                {
+                    const Image<Alpha8>& previousMask = (*masks)[i - 1];
+                    ASSERT(previousMask.Width() == previous.Width() && previousMask.Height() == previous.Height());
+                    (*masks)[i] = Image<Alpha8>(levels[i].Width(), levels[i].Height());
+                    state.SrcMask = previousMask.ConstView();
+                    state.DstMask = (*masks)[i].View();
+                }
+
+                // every row of the level reads two rows of the previous one
+                Parallel::ParallelFor
+                    <
+                    PyramidLevelTask<PixelType>,
+                    typename PyramidLevelTask<PixelType>::State
+                    > tasks(0, levels[i].Height(), state, 2 * previous.Width());
+                tasks.SpawnAndSync();
+            }
+        }
+    }
+
     template<class PixelType>
     GaussianPyramid<PixelType>::GaussianPyramid()
     {
@@ -16,8 +87,20 @@ namespace IRL
         ASSERT(levels > 0);
         Levels.resize(levels);
         Levels[0] = source;
-        for (int i = 1; i < levels; i++)
-            Levels[i] = ScaleDown(Levels[i - 1]);
+        Internal::BuildPyramidLevels(Levels, (std::vector<Image<Alpha8> >*)NULL);
+    }
+
+    template<class PixelType>
+    void BuildGaussianPyramids(GaussianPyramid<PixelType>& image, GaussianPyramid<Alpha8>& mask, 
+        const ImageWithMask<PixelType>& source, int levels)
+    {
+        Tools::Profiler profiler("BuildGaussianPyramids");
+        ASSERT(levels > 0);
+        image.Levels.resize(levels);
+        image.Levels[0] = source.Image;
+        mask.Levels.resize(levels);
+        mask.Levels[0] = source.Mask;
+        Internal::BuildPyramidLevels(image.Levels, &mask.Levels);
     }
 
     // Converter for pyramid
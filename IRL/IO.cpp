@@ -2,124 +2,185 @@
 #include "IO.h"
 #include "Profiler.h"
 
+#include <fstream>
+
 namespace IRL
 {
-    template<> 
-    const Image<RGB8> LoadFromQImage(const QImage& img)
+    namespace Internal
     {
-        Tools::Profiler profiler("LoadFromQImage");
-        Image<RGB8> result(img.width(), img.height());
-        img.convertToFormat(QImage::Format_RGB32);
-        uint32_t* rgb = (uint32_t*)img.bits();
-        RGB8* color = result.Data();
-        RGB8* end = color + img.width() * img.height();
-        while (color != end)
+        // Binary Netpbm files with 8 bit channels: PGM (P5), PPM (P6) and PAM (P7) of 1 to 4 channels.
+        // Gray is read to all color channels, images with a mask are written as PAM of RGB_ALPHA tuples.
+        class NetpbmCodec :
+            public ImageCodec
         {
-            *color = RGB8::FromRGB32(*rgb);
-            ++color;
-            ++rgb;
-        }
-        return result;
-    }
+        public:
+            virtual ImageWithMask<RGB8> Load(const std::string& path)
+            {
+                std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+                std::string magic;
+                file >> magic;
+                int width = 0, height = 0, depth = 0, maxValue = 0;
+                if (magic == "P5" || magic == "P6")
+                {
+                    depth = magic == "P5" ? 1 : 3;
+                    width = ReadNumber(file);
+                    height = ReadNumber(file);
+                    maxValue = ReadNumber(file);
+                } else if (magic == "P7")
+                {
+                    std::string token;
+                    while (file >> token && token != "ENDHDR")
+                    {
+                        if (token == "WIDTH") width = ReadNumber(file);
+                        else if (token == "HEIGHT") height = ReadNumber(file);
+                        else if (token == "DEPTH") depth = ReadNumber(file);
+                        else if (token == "MAXVAL") maxValue = ReadNumber(file);
+                        else std::getline(file, token); // TUPLTYPE and comments
+                    }
+                }
+                file.get(); // single whitespace before pixels
+                if (!file || width <= 0 || height <= 0 || depth < 1 || depth > 4 || maxValue <= 0 || maxValue > 255)
+                    return ImageWithMask<RGB8>();
 
-    const Image<Alpha8> LoadMaskFromQImage(const QImage& img)
-    {
-        Tools::Profiler profiler("LoadMaskFromQImage");
-        Image<Alpha8> result(img.width(), img.height());
-        img.convertToFormat(QImage::Format_Mono);
-        Alpha8* color = result.Data();
-        for (int y = 0; y < img.height(); y++)
-        {
-            for (int x = 0; x < img.width(); x++)
+                Image<RGB8> result(width, height);
+                Image<Alpha8> mask(width, height);
+                const ImageView<RGB8> color = result.View();
+                const ImageView<Alpha8> alpha = mask.View();
+                const bool hasAlpha = depth == 2 || depth == 4;
+                std::vector<uint8_t> row((size_t)width * depth);
+                for (int y = 0; y < height; y++)
+                {
+                    if (!file.read((char*)&row[0], (std::streamsize)row.size()))
+                        return ImageWithMask<RGB8>();
+                    RGB8* c = color.Row(y);
+                    Alpha8* a = alpha.Row(y);
+                    for (int x = 0; x < width; x++)
+                    {
+                        const uint8_t* p = &row[(size_t)x * depth];
+                        c[x].R = Scale(p[0], maxValue);
+                        c[x].G = Scale(p[depth >= 3 ? 1 : 0], maxValue);
+                        c[x].B = Scale(p[depth >= 3 ? 2 : 0], maxValue);
+                        a[x].A = hasAlpha ? Scale(p[depth - 1], maxValue) : 255;
+                    }
+                }
+                return ImageWithMask<RGB8>(result, mask);
+            }
+
+            virtual bool Save(const ImageWithMask<RGB8>& image, const std::string& path)
             {
-                QRgb rgb = img.pixel(x, y);
-                *color = qRed(rgb);
-                ++color;
+                const int width = image.Image.Width();
+                const int height = image.Image.Height();
+                const bool hasAlpha = image.Mask.IsValid();
+                ASSERT(!hasAlpha || (image.Mask.Width() == width && image.Mask.Height() == height));
+                std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+                if (hasAlpha)
+                {
+                    file << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\n"
+                        "TUPLTYPE RGB_ALPHA\nENDHDR\n";
+                } else
+                    file << "P6\n" << width << " " << height << "\n255\n";
+
+                const int depth = hasAlpha ? 4 : 3;
+                const ConstImageView<RGB8> color = image.Image.ConstView();
+                const ConstImageView<Alpha8> alpha = hasAlpha ? image.Mask.ConstView() : ConstImageView<Alpha8>();
+                std::vector<uint8_t> row((size_t)width * depth);
+                for (int y = 0; y < height; y++)
+                {
+                    const RGB8* c = color.Row(y);
+                    for (int x = 0; x < width; x++)
+                    {
+                        uint8_t* p = &row[(size_t)x * depth];
+                        p[0] = c[x].R;
+                        p[1] = c[x].G;
+                        p[2] = c[x].B;
+                        if (hasAlpha)
+                            p[3] = alpha.Row(y)[x].A;
+                    }
+                    file.write((const char*)&row[0], (std::streamsize)row.size());
+                }
+                file.close();
+                return !file.fail();
             }
+
+        private:
+            // Reads decimal number of the header, skipping whitespace and comments
+            static int ReadNumber(std::istream& in)
+            {
+                while (in)
+                {
+                    const int c = in.peek();
+                    if (c == '#')
+                    {
+                        std::string comment;
+                        std::getline(in, comment);
+                    } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+                        in.get();
+                    else
+                        break;
+                }
+                int value = 0;
+                in >> value;
+                return value;
+            }
+
+            static uint8_t Scale(uint8_t value, int maxValue)
+            {
+                return maxValue == 255 ? value : (uint8_t)((value * 255 + maxValue / 2) / maxValue);
+            }
+        };
+
+        static NetpbmCodec g_NetpbmCodec;
+        static ImageCodec* g_ImageCodec = NULL;
+
+        inline ImageCodec* GetDefaultImageCodec()
+        {
+#ifdef IRL_USE_QT
+            return GetQtImageCodec();
+#else
+            return &g_NetpbmCodec;
+#endif
         }
-        return result;
+    }
+
+    void SetImageCodec(ImageCodec* codec)
+    {
+        Internal::g_ImageCodec = codec;
+    }
+
+    ImageCodec* GetImageCodec()
+    {
+        return Internal::g_ImageCodec ? Internal::g_ImageCodec : Internal::GetDefaultImageCodec();
     }
 
     template<>
-    const Image<RGB8> LoadImage(const std::string& path)
+    Image<RGB8> LoadImage(const std::string& path)
     {
         Tools::Profiler profiler("LoadImage");
-        QImage img(QString::fromStdString(path));
-        if (img.isNull())
-            return Image<RGB8>();
-        return LoadFromQImage<RGB8>(img);
+        return GetImageCodec()->Load(path).Image;
     }
 
-    template<> 
-    const ImageWithMask<RGB8> LoadImageWithMask(const std::string& path)
+    template<>
+    ImageWithMask<RGB8> LoadImageWithMask(const std::string& path)
     {
         Tools::Profiler profiler("LoadImageWithMask");
-        QImage img(QString::fromStdString(path));
-        if (img.isNull())
-            return ImageWithMask<RGB8>();
-        Image<RGB8> result(img.width(), img.height());
-        Image<Alpha8> mask(img.width(), img.height());
-        img.convertToFormat(QImage::Format_ARGB32);
-        uint32_t* rgb = (uint32_t*)img.bits();
-        RGB8* color = result.Data();
-        Alpha8* alpha = mask.Data();
-        RGB8* end = color + img.width() * img.height();
-        while (color != end)
-        {
-            *color = RGB8::FromRGB32(*rgb);
-            *alpha = Alpha8::FromRGB32(*rgb);
-            ++color;
-            ++rgb;
-            ++alpha;
-        }
-        return ImageWithMask<RGB8>(result, mask);
+        return GetImageCodec()->Load(path);
     }
 
     template<>
     bool SaveImage(const Image<RGB8>& image, const std::string& path)
     {
         Tools::Profiler profiler("SaveImage");
-        return SaveToQImage<RGB8>(image).save(QString::fromStdString(path));
+        return GetImageCodec()->Save(ImageWithMask<RGB8>(image, Image<Alpha8>()), path);
     }
 
     template<>
-    QImage SaveToQImage(const Image<RGB8>& image)
-    {
-        Tools::Profiler profiler("SaveToQImage");
-        QImage img(image.Width(), image.Height(), QImage::Format_RGB32);
-        uint32_t* bits = (uint32_t*)img.bits();
-        const RGB8* color = image.Data();
-        const RGB8* end = color + image.Width() * image.Height();
-        while (color != end)
-        {
-            *bits = color->ToRGB32();
-            ++color;
-            ++bits;
-        }
-        return img;
-    }
-
-    template<> 
     bool SaveImage(const ImageWithMask<RGB8>& image, const std::string& path)
     {
         ASSERT(image.Image.Width() == image.Mask.Width());
         ASSERT(image.Image.Height() == image.Mask.Height());
 
         Tools::Profiler profiler("SaveImage");
-        QImage img(image.Image.Width(), image.Image.Height(), QImage::Format_ARGB32);
-        QRgb* bits = (QRgb*)img.bits();
-        const RGB8* color = image.Image.Data();
-        const Alpha8* alpha = image.Mask.Data();
-        const RGB8* end = color + image.Image.Width() * image.Image.Height();
-        while (color != end)
-        {
-            QRgb rgb = color->ToRGB32();
-            *bits = qRgba(qRed(rgb), qGreen(rgb), qBlue(rgb), alpha->A);
-            ++color;
-            ++alpha;
-            ++bits;
-        }
-        return img.save(QString::fromStdString(path));
+        return GetImageCodec()->Save(image, path);
     }
 
     template<>
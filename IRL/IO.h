@@ -1,31 +1,42 @@
 #pragma once
 
+#include "Config.h"
 #include "RGB.h"
 #include "Image.h"
 #include "GaussianPyramid.h"
+#include "ColorConversion.h"
 
 #ifdef IRL_USE_QT
 #include <QtGui/QImage>
-#else
-#error Implement ImageIO without Qt.
 #endif
 
 namespace IRL
 {
-    template<class PixelType>
-    const Image<PixelType> LoadImage(const std::string& path);
+    // Reads and writes image files for LoadImage and SaveImage functions. The default codec reads and writes
+    // formats of Qt with IRL_USE_QT, and binary Netpbm files (PGM, PPM and PAM with alpha) without it.
+    // Embedders set their own codec for other formats.
+    class ImageCodec
+    {
+    public:
+        virtual ~ImageCodec() {}
+        // Return invalid image when the file can't be read. Mask is alpha of the file, opaque when it has none.
+        virtual ImageWithMask<RGB8> Load(const std::string& path) = 0;
+        // Writes alpha from the mask when it is valid
+        virtual bool Save(const ImageWithMask<RGB8>& image, const std::string& path) = 0;
+    };
 
-    template<class PixelType>
-    const Image<PixelType> LoadFromQImage(const QImage& path);
+    // Codec used by all threads, NULL restores the default one. The codec has to outlive its use.
+    extern void SetImageCodec(ImageCodec* codec);
+    extern ImageCodec* GetImageCodec();
 
     template<class PixelType>
-    const ImageWithMask<PixelType> LoadImageWithMask(const std::string& path);
+    Image<PixelType> LoadImage(const std::string& path);
 
     template<class PixelType>
-    bool SaveImage(const Image<PixelType>& image, const std::string& path);
+    ImageWithMask<PixelType> LoadImageWithMask(const std::string& path);
 
     template<class PixelType>
-    QImage SaveToQImage(const Image<PixelType>& image);
+    bool SaveImage(const Image<PixelType>& image, const std::string& path);
 
     template<class PixelType>
     bool SaveImage(const ImageWithMask<PixelType>& image, const std::string& path);
@@ -34,15 +45,32 @@ namespace IRL
     bool SaveGaussianPyramid(const GaussianPyramid<PixelType>& image, const std::string& path);
 
     // Concrete implementations for RGB8
-    template<> extern const Image<RGB8> LoadImage(const std::string& path);
-    template<> extern const ImageWithMask<RGB8> LoadImageWithMask(const std::string& path);
-    template<> extern const Image<RGB8> LoadFromQImage(const QImage& image);
-    template<> extern bool SaveImage(const Image<RGB8>& image, const std::string& path);
-    template<> extern QImage SaveToQImage(const Image<RGB8>& image);
-    template<> extern bool SaveImage(const ImageWithMask<RGB8>& image, const std::string& path);
-    template<> extern bool SaveGaussianPyramid(const GaussianPyramid<RGB8>& pyramid, const std::string& path);
-
-    extern const Image<Alpha8> LoadMaskFromQImage(const QImage& img);
+    template<> Image<RGB8> LoadImage(const std::string& path);
+    template<> ImageWithMask<RGB8> LoadImageWithMask(const std::string& path);
+    template<> bool SaveImage(const Image<RGB8>& image, const std::string& path);
+    template<> bool SaveImage(const ImageWithMask<RGB8>& image, const std::string& path);
+    template<> bool SaveGaussianPyramid(const GaussianPyramid<RGB8>& pyramid, const std::string& path);
+
+#ifdef IRL_USE_QT
+    template<class PixelType>
+    Image<PixelType> LoadFromQImage(const QImage& path);
+
+    template<class PixelType>
+    QImage SaveToQImage(const Image<PixelType>& image);
+
+    template<> Image<RGB8> LoadFromQImage(const QImage& image);
+    template<> QImage SaveToQImage(const Image<RGB8>& image);
+
+    // Red channel of the image, reads bits of Format_Mono and Format_MonoLSB images directly
+    extern Image<Alpha8> LoadMaskFromQImage(const QImage& img);
+
+    // Scanlines of Format_RGB32 or Format_ARGB32 image without a copy, invalid view for other formats.
+    // Valid while the image is alive and is not modified.
+    extern ConstImageView<uint32_t> ViewQImage(const QImage& img);
+
+    // Default codec with Qt
+    extern ImageCodec* GetQtImageCodec();
+#endif
 }
 
 #include "IO.inl"
\ No newline at end of file
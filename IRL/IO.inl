@@ -3,7 +3,7 @@
 namespace IRL
 {
     template<class PixelType>
-    const Image<PixelType> LoadImage(const std::string& path)
+    Image<PixelType> LoadImage(const std::string& path)
     {
         Image<PixelType> result;
         Convert(result, LoadImage<RGB8>(path));
@@ -11,15 +11,7 @@ namespace IRL
     }
 
     template<class PixelType>
-    const Image<PixelType> LoadFromQImage(const QImage& path)
-    {
-        Image<PixelType> result;
-        Convert(result, LoadFromQImage<RGB8>(path));
-        return result;
-    }
-
-    template<class PixelType>
-    const ImageWithMask<PixelType> LoadImageWithMask(const std::string& path)
+    ImageWithMask<PixelType> LoadImageWithMask(const std::string& path)
     {
         ImageWithMask<PixelType> result;
         Convert(result, LoadImageWithMask<RGB8>(path));
@@ -34,14 +26,6 @@ namespace IRL
         return SaveImage(result, path);
     }
 
-    template<class PixelType>
-    QImage SaveToQImage(const Image<PixelType>& image)
-    {
-        Image<RGB8> result;
-        Convert(result, image);
-        return SaveToQImage(result);
-    }
-
     template<class PixelType>
     bool SaveImage(const ImageWithMask<PixelType>& image, const std::string& path)
     {
@@ -57,4 +41,22 @@ namespace IRL
         Convert(result, image);
         return SaveGaussianPyramid(result, path);
     }
+
+#ifdef IRL_USE_QT
+    template<class PixelType>
+    Image<PixelType> LoadFromQImage(const QImage& path)
+    {
+        Image<PixelType> result;
+        Convert(result, LoadFromQImage<RGB8>(path));
+        return result;
+    }
+
+    template<class PixelType>
+    QImage SaveToQImage(const Image<PixelType>& image)
+    {
+        Image<RGB8> result;
+        Convert(result, image);
+        return SaveToQImage(result);
+    }
+#endif
 }
\ No newline at end of file
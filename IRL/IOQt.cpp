@@ -0,0 +1,134 @@
+#include "Includes.h"
+#include "IO.h"
+#include "Profiler.h"
+
+#ifdef IRL_USE_QT
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Formats of Qt image plugins
+        class QtImageCodec :
+            public ImageCodec
+        {
+        public:
+            virtual ImageWithMask<RGB8> Load(const std::string& path)
+            {
+                QImage img(QString::fromStdString(path));
+                if (img.isNull())
+                    return ImageWithMask<RGB8>();
+                Image<RGB8> result(img.width(), img.height());
+                Image<Alpha8> mask(img.width(), img.height());
+                if (img.format() != QImage::Format_ARGB32 && img.format() != QImage::Format_RGB32)
+                    img = img.convertToFormat(QImage::Format_ARGB32);
+                const ConstImageView<uint32_t> rgb = ViewQImage(img);
+                const ImageView<RGB8> color = result.View();
+                const ImageView<Alpha8> alpha = mask.View();
+                for (int y = 0; y < color.Height(); y++)
+                {
+                    ConvertRowFromRGB32(color.Row(y), rgb.Row(y), color.Width());
+                    ConvertRowFromRGB32(alpha.Row(y), rgb.Row(y), alpha.Width(), 24);
+                }
+                return ImageWithMask<RGB8>(result, mask);
+            }
+
+            virtual bool Save(const ImageWithMask<RGB8>& image, const std::string& path)
+            {
+                if (!image.Mask.IsValid())
+                    return SaveToQImage<RGB8>(image.Image).save(QString::fromStdString(path));
+
+                ASSERT(image.Image.Width() == image.Mask.Width());
+                ASSERT(image.Image.Height() == image.Mask.Height());
+                QImage img(image.Image.Width(), image.Image.Height(), QImage::Format_ARGB32);
+                QRgb* bits = (QRgb*)img.bits();
+                const RGB8* color = image.Image.Data();
+                const Alpha8* alpha = image.Mask.Data();
+                const RGB8* end = color + image.Image.Width() * image.Image.Height();
+                while (color != end)
+                {
+                    QRgb rgb = color->ToRGB32();
+                    *bits = qRgba(qRed(rgb), qGreen(rgb), qBlue(rgb), alpha->A);
+                    ++color;
+                    ++alpha;
+                    ++bits;
+                }
+                return img.save(QString::fromStdString(path));
+            }
+        };
+    }
+
+    ImageCodec* GetQtImageCodec()
+    {
+        static Internal::QtImageCodec codec;
+        return &codec;
+    }
+
+    template<>
+    Image<RGB8> LoadFromQImage(const QImage& img)
+    {
+        Tools::Profiler profiler("LoadFromQImage");
+        // 32 bit images are read in place, only other formats are converted first
+        QImage converted;
+        ConstImageView<uint32_t> rgb = ViewQImage(img);
+        if (!rgb.IsValid())
+        {
+            converted = img.convertToFormat(QImage::Format_RGB32);
+            rgb = ViewQImage(converted);
+        }
+        Image<RGB8> result(img.width(), img.height());
+        const ImageView<RGB8> color = result.View();
+        for (int y = 0; y < color.Height(); y++)
+            ConvertRowFromRGB32(color.Row(y), rgb.Row(y), color.Width());
+        return result;
+    }
+
+    Image<Alpha8> LoadMaskFromQImage(const QImage& img)
+    {
+        Tools::Profiler profiler("LoadMaskFromQImage");
+        Image<Alpha8> result(img.width(), img.height());
+        const ImageView<Alpha8> mask = result.View();
+        if ((img.format() == QImage::Format_Mono || img.format() == QImage::Format_MonoLSB) && img.colorCount() == 2)
+        {
+            // painted masks are 1 bit images, so the red channel is one of two colors of the table
+            const uint8_t values[2] = { (uint8_t)qRed(img.color(0)), (uint8_t)qRed(img.color(1)) };
+            const bool msbFirst = img.format() == QImage::Format_Mono;
+            for (int y = 0; y < mask.Height(); y++)
+                ConvertRowFromMono(mask.Row(y), img.scanLine(y), mask.Width(), msbFirst, values);
+            return result;
+        }
+
+        QImage converted;
+        ConstImageView<uint32_t> rgb = ViewQImage(img);
+        if (!rgb.IsValid())
+        {
+            converted = img.convertToFormat(QImage::Format_RGB32);
+            rgb = ViewQImage(converted);
+        }
+        for (int y = 0; y < mask.Height(); y++)
+            ConvertRowFromRGB32(mask.Row(y), rgb.Row(y), mask.Width(), 16);
+        return result;
+    }
+
+    ConstImageView<uint32_t> ViewQImage(const QImage& img)
+    {
+        if (img.format() != QImage::Format_RGB32 && img.format() != QImage::Format_ARGB32)
+            return ConstImageView<uint32_t>();
+        // scanlines of 32 bit images are always aligned to whole pixels
+        return ConstImageView<uint32_t>((const uint32_t*)img.bits(), img.bytesPerLine() / sizeof(uint32_t),
+            img.width(), img.height());
+    }
+
+    template<>
+    QImage SaveToQImage(const Image<RGB8>& image)
+    {
+        Tools::Profiler profiler("SaveToQImage");
+        QImage img(image.Width(), image.Height(), QImage::Format_RGB32);
+        const ConstImageView<RGB8> color = image.ConstView();
+        for (int y = 0; y < color.Height(); y++)
+            ConvertRowToRGB32((uint32_t*)img.scanLine(y), color.Row(y), color.Width());
+        return img;
+    }
+}
+
+#endif
\ No newline at end of file
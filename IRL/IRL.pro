@@ -0,0 +1,92 @@
+# Algorithm core as a static library without Qt, i.e. for services which embed the solver.
+# Threads run on the C++11 standard library (ThreadingStd.h), image files are binary Netpbm
+# unless the embedder sets its own ImageCodec (IO.h).
+TEMPLATE = lib
+TARGET = IRL
+CONFIG += staticlib c++11
+CONFIG -= qt
+DEFINES += IRL_NO_QT
+unix {
+  QMAKE_CXXFLAGS += -pthread
+}
+
+# same options as the application, see Retargeting.pro
+opencl {
+  DEFINES += IRL_USE_OPENCL
+}
+counters {
+  DEFINES += IRL_NNF_COUNTERS
+}
+lean {
+  DEFINES += IRL_COMPACT_DISTANCES
+}
+
+HEADERS += pstdint.h Config.h Includes.h RefCounted.h
+HEADERS += Convert.h Accumulator.h TypeTraits.h Random.h Rectangle.h
+
+HEADERS += IO.h IO.inl
+SOURCES += IO.cpp
+
+HEADERS += Parameters.h
+SOURCES += Parameters.cpp
+
+HEADERS += Profiler.h
+SOURCES += Profiler.cpp
+
+HEADERS += DebugWriter.h
+SOURCES += DebugWriter.cpp
+
+HEADERS += Memory.h
+SOURCES += Memory.cpp
+
+HEADERS += Threading.h ThreadingStd.h Parallel.h Queue.h LockFreeQueue.h Parallel.inl
+SOURCES += Parallel.cpp
+
+HEADERS += JobQueue.h
+SOURCES += JobQueue.cpp
+
+HEADERS += Point2D.h
+SOURCES += Point2D.cpp
+
+HEADERS += OffsetField.h
+SOURCES += OffsetField.cpp
+
+HEADERS += RGB.h Lab.h Alpha.h ColorConversion.h ColorConversion.inl
+SOURCES += ColorConversion.cpp
+
+HEADERS += ImageView.h PaddedImage.h TiledImage.h
+HEADERS += Image.h ImageConversion.h ImageWithMask.h Image.inl ImageConversion.inl ImageWithMask.inl
+HEADERS += Scaling.h Scaling.inl
+SOURCES += Scaling.cpp
+HEADERS += GaussianPyramid.h GaussianPyramid.inl
+
+HEADERS += PatchDistance.h
+SOURCES += PatchDistance.cpp
+
+HEADERS += PatchIndex.h
+HEADERS += PatchSummaries.h
+SOURCES += PatchIndex.cpp
+SOURCES += PatchSummaries.cpp
+HEADERS += PatchHashing.h
+SOURCES += PatchHashing.cpp
+HEADERS += CompactVotes.h
+SOURCES += CompactVotes.cpp
+HEADERS += ValidPatches.h
+SOURCES += ValidPatches.cpp
+HEADERS += Checkpoint.h
+SOURCES += Checkpoint.cpp
+
+HEADERS += DeviceNNF.h
+SOURCES += DeviceNNF.cpp
+
+HEADERS += NNFCounters.h NearestNeighborField.h NearestNeighborField.inl
+HEADERS += BidirectionalSimilarity.h BidirectionalSimilarity.inl
+HEADERS += PyramidCache.h PyramidCache.inl
+HEADERS += ResultCache.h
+SOURCES += ResultCache.cpp
+HEADERS += ObjectRemoval.h ObjectRemoval.inl
+HEADERS += VideoRemoval.h VideoRemoval.inl
+HEADERS += Calibration.h Calibration.inl
+SOURCES += Calibration.cpp
+HEADERS += Retargeting.h Retargeting.inl
+HEADERS += Correspondence.h Correspondence.inl
\ No newline at end of file
@@ -1,9 +1,21 @@
 #pragma once
 
 #include "RefCounted.h"
+#include "Memory.h"
+#include "ImageView.h"
 
 namespace IRL
 {
+    // Owner of pixels which images wrap without a copy, i.e. a mapped file. Every wrapping image holds
+    // a reference of the owner, which is released with the image.
+    class SharedPixels
+    {
+    public:
+        virtual ~SharedPixels() {}
+        virtual void AcquirePixels() const = 0;
+        virtual void ReleasePixels() const = 0;
+    };
+
     template<class PixelType>
     class Image
     {
@@ -13,12 +25,27 @@ namespace IRL
         Image(const Image& obj) : _ptr(NULL) {  *this = obj; }
         ~Image() {  if (_ptr) _ptr->Release(); }
         Image& operator=(const Image& obj);
+#ifdef IRL_HAS_MOVE
+        Image(Image&& obj) : _ptr(obj._ptr) { obj._ptr = NULL; }
+        Image& operator=(Image&& obj) { Swap(obj); return *this; }
+#endif
+        // Image of w x h pixels of 'owner' at 'data' without a copy. They are never written,
+        // non-const access makes a private copy first.
+        static Image Wrap(const PixelType* data, int32_t w, int32_t h, const SharedPixels* owner)
+        {
+            return Image(Private::Wrap(data, w, h, owner));
+        }
+
+        // Exchanges data without touching reference counters
+        inline void Swap(Image& obj) { Private* ptr = _ptr; _ptr = obj._ptr; obj._ptr = ptr; }
 
         inline bool IsValid() const {  return _ptr != NULL; }
         inline bool IsPrivate() const { ASSERT(IsValid()); return _ptr->GetRefs() == 1; }
 
         inline int32_t Width() const { ASSERT(IsValid()); return _ptr->Width; }
         inline int32_t Height() const { ASSERT(IsValid()); return _ptr->Height; }
+        // Bytes of pixels, 0 for invalid image. Shared data is counted by every image holding it.
+        inline size_t GetBytes() const { return _ptr ? sizeof(PixelType) * _ptr->Width * _ptr->Height : 0; }
 
         inline PixelType* Data() { MakePrivate(); return &_ptr->Data[0]; }
         inline const PixelType* Data() const { ASSERT(IsValid()); return &_ptr->Data[0]; }
@@ -43,32 +70,75 @@ namespace IRL
             return _ptr->Data[x + y * Width()];
         }
 
+        // Unchecked access for hot loops. View() makes data private once,
+        // so take it after all sharing assignments are done.
+        inline ImageView<PixelType> View() { return ImageView<PixelType>(Data(), Width(), Width(), Height()); }
+        inline ConstImageView<PixelType> ConstView() const { return ConstImageView<PixelType>(Data(), Width(), Width(), Height()); }
+
         // more compact operator versions
         force_inline PixelType& operator()(int32_t x, int32_t y) { return Pixel(x, y); }
         force_inline const PixelType& operator()(int32_t x, int32_t y) const { return Pixel(x, y); }
 
         // Some helpers
-        uint32_t GetPatchesCount() const { return (Width() - PatchSize) * (Height() - PatchSize); }
+        uint32_t GetPatchesCount(int patchSize = PatchSize) const { return (Width() - patchSize) * (Height() - patchSize); }
 
     private:
         inline void MakePrivate();
 
-        // Private shared data
+        // Private shared data, header and pixels in one pooled block, pixels are aligned to Memory::Alignment.
+        // Header of wrapped pixels is a block of its own and holds their owner.
         class Private : 
             public RefCounted<Private>
         {
         public:
             static Private* Create(int32_t w, int32_t h);
+            static Private* Wrap(const PixelType* data, int32_t w, int32_t h, const SharedPixels* owner);
             static void Delete(Private* obj);
             Private* Clone() const;
         public:
             int32_t Width;
             int32_t Height;
             PixelType* Data;
+            const SharedPixels* Owner;  // NULL for pixels of the block
         };
 
+        explicit Image(Private* ptr) : _ptr(ptr) {}
+
         Private* _ptr;
     };
+
+    // Read-only handle to image data, i.e. for solver inputs.
+    // It has no non-const access, so it never makes a private copy of shared data.
+    template<class PixelType>
+    class ConstImage
+    {
+    public:
+        ConstImage() {}
+        ConstImage(const Image<PixelType>& image) : _image(image) {}
+#ifdef IRL_HAS_MOVE
+        ConstImage(Image<PixelType>&& image) : _image(static_cast<Image<PixelType>&&>(image)) {}
+#endif
+
+        inline bool IsValid() const { return _image.IsValid(); }
+        inline int32_t Width() const { return _image.Width(); }
+        inline int32_t Height() const { return _image.Height(); }
+        inline size_t GetBytes() const { return _image.GetBytes(); }
+        inline const PixelType* Data() const { return _image.Data(); }
+        inline void Discard() { _image.Discard(); }
+
+        force_inline const PixelType& Pixel(int32_t x, int32_t y) const { return _image.Pixel(x, y); }
+        force_inline const PixelType& operator()(int32_t x, int32_t y) const { return _image.Pixel(x, y); }
+        inline ConstImageView<PixelType> ConstView() const { return _image.ConstView(); }
+
+        uint32_t GetPatchesCount(int patchSize = PatchSize) const { return _image.GetPatchesCount(patchSize); }
+
+        // Shared image for functions taking images, writes to its copy make a private copy
+        inline const Image<PixelType>& Get() const { return _image; }
+        inline operator const Image<PixelType>&() const { return _image; }
+
+    private:
+        Image<PixelType> _image;
+    };
 }
 
 #include "Image.inl"
\ No newline at end of file
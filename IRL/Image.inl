@@ -1,4 +1,5 @@
 #include "Image.h"
+#include "Profiler.h"
 
 namespace IRL
 {
@@ -6,7 +7,7 @@ namespace IRL
     void Image<PixelType>::MakePrivate()
     {
         ASSERT(IsValid());
-        if (IsPrivate())
+        if (IsPrivate() && !_ptr->Owner)
             return;
         Private* copy = _ptr->Clone();
         _ptr->Release();
@@ -29,26 +30,48 @@ namespace IRL
     template<class PixelType>
     typename Image<PixelType>::Private* Image<PixelType>::Private::Create(int32_t w, int32_t h)
     {
-        int sz = sizeof(Private) + w * h * sizeof(PixelType);
-        uint8_t* ptr = (uint8_t*)malloc(sz);
-        ASSERT(ptr != NULL);
+        // pixels start at the next aligned address after the header
+        const size_t header = (sizeof(Private) + Memory::Alignment - 1) & ~(Memory::Alignment - 1);
+        uint8_t* ptr = (uint8_t*)Memory::Allocate(header + (size_t)w * h * sizeof(PixelType));
         Private* res = (Private*)ptr;
         new(res) Private();
         res->Width = w;
         res->Height = h;
-        res->Data = (PixelType*)(ptr + sizeof(Private));
+        res->Data = (PixelType*)(ptr + header);
+        res->Owner = NULL;
+        return res;
+    }
+
+    template<class PixelType>
+    typename Image<PixelType>::Private* Image<PixelType>::Private::Wrap(const PixelType* data, int32_t w, int32_t h,
+        const SharedPixels* owner)
+    {
+        Private* res = (Private*)Memory::Allocate(sizeof(Private));
+        new(res) Private();
+        res->Width = w;
+        res->Height = h;
+        res->Data = const_cast<PixelType*>(data);
+        res->Owner = owner;
+        owner->AcquirePixels();
         return res;
     }
 
     template<class PixelType>
     void Image<PixelType>::Private::Delete(typename Image<PixelType>::Private* obj)
     {
-        free(obj);
+        const SharedPixels* owner = obj->Owner;
+        obj->~Private();
+        Memory::Free(obj);
+        if (owner)
+            owner->ReleasePixels();
     }
 
     template<class PixelType>
     typename Image<PixelType>::Private* Image<PixelType>::Private::Clone() const
     {
+        // shared data was changed, see Memory::Statistics::Clones to find such copies
+        Tools::Profiler profiler("Image::Clone");
+        Memory::CountClone(sizeof(PixelType) * Width * Height);
         Image::Private* res = Create(Width, Height);
         if (!res)
             return NULL;
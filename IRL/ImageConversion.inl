@@ -14,16 +14,16 @@ namespace IRL
         public:
             struct State
             {
-                const FromPixelType* From;
-                ToPixelType* To;
+                ConstImageView<FromPixelType> From;
+                ImageView<ToPixelType> To;
             };
 
         private:
-            const FromPixelType* _start;
-            const FromPixelType* _end;
+            int _start;
+            int _end;
             State _state;
         public:
-            void Set(const FromPixelType* start, const FromPixelType* end, const State& state)
+            void Set(int start, int end, const State& state)
             {
                 _start = start;
                 _end = end;
@@ -32,13 +32,12 @@ namespace IRL
 
             virtual void Run()
             {
-                const FromPixelType* fromPtr = _start;
-                ToPixelType* toPtr = _state.To + (_start - _state.From);
-                while (fromPtr < _end)
+                const int width = _state.From.Width();
+                for (int y = _start; y < _end; y++)
                 {
-                    Convert(*toPtr, *fromPtr);
-                    ++fromPtr;
-                    ++toPtr;
+                    const FromPixelType* fromPtr = _state.From.Row(y);
+                    ToPixelType* toPtr = _state.To.Row(y);
+                    ConvertRow(toPtr, fromPtr, width);
                 }
             }
         };
@@ -55,19 +54,15 @@ namespace IRL
 
         to = Image<ToPixelType>(from.Width(), from.Height());
 
-        const FromPixelType* fromStart = from.Data();
-        const FromPixelType* fromEnd   = from.Data() + from.Width() * from.Height();
-
         typename ConvertTask<ToPixelType, FromPixelType>::State state;
-        state.From = fromStart;
-        state.To = to.Data();
+        state.From = from.ConstView();
+        state.To = to.View();
 
         Parallel::ParallelFor
             <
             ConvertTask<ToPixelType, FromPixelType>, 
-            typename ConvertTask<ToPixelType, FromPixelType>::State,
-            const FromPixelType*
-            > tasks(fromStart, fromEnd, state);
+            typename ConvertTask<ToPixelType, FromPixelType>::State
+            > tasks(0, from.Height(), state, from.Width());
 
         tasks.SpawnAndSync();
     }
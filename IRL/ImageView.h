@@ -0,0 +1,98 @@
+#pragma once
+
+namespace IRL
+{
+    // Lightweight window into image data: row pointer, stride and size.
+    // Does no reference counting and no copy-on-write checks, so it is meant to be
+    // taken once per operation (see Image::View() and Image::ConstView()) and used
+    // in inner loops. Valid only while the image it was taken from is alive and
+    // is not reallocated.
+    template<class PixelType>
+    class ImageView
+    {
+    public:
+        ImageView() : _data(NULL), _stride(0), _width(0), _height(0) {}
+        ImageView(PixelType* data, int32_t stride, int32_t width, int32_t height)
+            : _data(data), _stride(stride), _width(width), _height(height) {}
+
+        inline bool IsValid() const { return _data != NULL; }
+
+        inline int32_t Width() const { return _width; }
+        inline int32_t Height() const { return _height; }
+        inline int32_t Stride() const { return _stride; }
+        inline PixelType* Data() const { return _data; }
+
+        force_inline PixelType* Row(int32_t y) const
+        {
+            ASSERT(y >= 0 && y < _height);
+            return _data + y * _stride;
+        }
+
+        force_inline PixelType& operator()(int32_t x, int32_t y) const
+        {
+            ASSERT(x >= 0 && x < _width);
+            ASSERT(y >= 0 && y < _height);
+            return _data[x + y * _stride];
+        }
+
+        // View of the rectangle with top left corner in (x, y)
+        ImageView SubView(int32_t x, int32_t y, int32_t width, int32_t height) const
+        {
+            ASSERT(x >= 0 && y >= 0 && width >= 0 && height >= 0);
+            ASSERT(x + width <= _width && y + height <= _height);
+            return ImageView(_data + x + y * _stride, _stride, width, height);
+        }
+
+    private:
+        PixelType* _data;
+        int32_t _stride;
+        int32_t _width;
+        int32_t _height;
+    };
+
+    // Read only version of ImageView
+    template<class PixelType>
+    class ConstImageView
+    {
+    public:
+        ConstImageView() : _data(NULL), _stride(0), _width(0), _height(0) {}
+        ConstImageView(const PixelType* data, int32_t stride, int32_t width, int32_t height)
+            : _data(data), _stride(stride), _width(width), _height(height) {}
+        ConstImageView(const ImageView<PixelType>& view)
+            : _data(view.Data()), _stride(view.Stride()), _width(view.Width()), _height(view.Height()) {}
+
+        inline bool IsValid() const { return _data != NULL; }
+
+        inline int32_t Width() const { return _width; }
+        inline int32_t Height() const { return _height; }
+        inline int32_t Stride() const { return _stride; }
+        inline const PixelType* Data() const { return _data; }
+
+        force_inline const PixelType* Row(int32_t y) const
+        {
+            ASSERT(y >= 0 && y < _height);
+            return _data + y * _stride;
+        }
+
+        force_inline const PixelType& operator()(int32_t x, int32_t y) const
+        {
+            ASSERT(x >= 0 && x < _width);
+            ASSERT(y >= 0 && y < _height);
+            return _data[x + y * _stride];
+        }
+
+        // View of the rectangle with top left corner in (x, y)
+        ConstImageView SubView(int32_t x, int32_t y, int32_t width, int32_t height) const
+        {
+            ASSERT(x >= 0 && y >= 0 && width >= 0 && height >= 0);
+            ASSERT(x + width <= _width && y + height <= _height);
+            return ConstImageView(_data + x + y * _stride, _stride, width, height);
+        }
+
+    private:
+        const PixelType* _data;
+        int32_t _stride;
+        int32_t _width;
+        int32_t _height;
+    };
+}
\ No newline at end of file
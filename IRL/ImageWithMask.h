@@ -2,6 +2,7 @@
 
 #include "Image.h"
 #include "Alpha.h"
+#include "Rectangle.h"
 
 namespace IRL
 {
@@ -17,10 +18,25 @@ namespace IRL
         ImageWithMask(const ImageWithMask& i) : Image(i.Image), Mask(i.Mask) {}
         ImageWithMask(const IRL::Image<PixelType>& img, const IRL::Image<Alpha8>& mask) : Image(img), Mask(mask) {}
         ImageWithMask& operator=(const ImageWithMask& i) { Image = i.Image; Mask = i.Mask; return *this; }
+#ifdef IRL_HAS_MOVE
+        ImageWithMask(ImageWithMask&& i) { Image.Swap(i.Image); Mask.Swap(i.Mask); }
+        ImageWithMask& operator=(ImageWithMask&& i) { Image.Swap(i.Image); Mask.Swap(i.Mask); return *this; }
+#endif
     };
 
     template<class PixelType>
     Image<PixelType> MixImages(const Image<PixelType>& a, const Image<PixelType>& b, const Image<Alpha8>& mask);
+
+    // Return bounding box of masked pixels, empty if there is no one
+    inline const Rectangle<int32_t> GetMaskedRegion(const Image<Alpha8>& mask);
+
+    // Return copy of pixels within 'region'
+    template<class PixelType>
+    Image<PixelType> Crop(const Image<PixelType>& image, const Rectangle<int32_t>& region);
+
+    // Copies pixels of 'part' masked in 'mask' of the same size into 'image' at (left, top)
+    template<class PixelType>
+    void PasteMasked(Image<PixelType>& image, const Image<PixelType>& part, const Image<Alpha8>& mask, int32_t left, int32_t top);
 }
 
 #include "ImageWithMask.inl"
\ No newline at end of file
@@ -3,18 +3,123 @@
 
 namespace IRL
 {
+    namespace Internal
+    {
+        template<class PixelType>
+        class MixImagesTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                ConstImageView<PixelType> Source;
+                ConstImageView<Alpha8> Mask;
+                ImageView<PixelType> Result;
+            };
+
+        private:
+            int _start;
+            int _end;
+            State _state;
+        public:
+            void Set(int start, int end, const State& state)
+            {
+                _start = start;
+                _end = end;
+                _state = state;
+            }
+
+            virtual void Run()
+            {
+                const int width = _state.Result.Width();
+                for (int y = _start; y < _end; y++)
+                {
+                    PixelType* dst = _state.Result.Row(y);
+                    const PixelType* src = _state.Source.Row(y);
+                    const Alpha8* m = _state.Mask.Row(y);
+                    for (int x = 0; x < width; x++)
+                    {
+                        if (m[x].IsMasked())
+                            dst[x] = src[x];
+                    }
+                }
+            }
+        };
+    }
+
     template<class PixelType>
     Image<PixelType> MixImages(const Image<PixelType>& a, const Image<PixelType>& b, const Image<Alpha8>& mask)
     {
+        using namespace Internal;
+
         Image<PixelType> target = a;
-        for (int y = 0; y < a.Height(); y++)
+        typename MixImagesTask<PixelType>::State state;
+        state.Result = target.View();
+        state.Source = b.ConstView();
+        state.Mask = mask.ConstView();
+
+        Parallel::ParallelFor
+            <
+            MixImagesTask<PixelType>, 
+            typename MixImagesTask<PixelType>::State
+            > tasks(0, target.Height(), state, target.Width());
+
+        tasks.SpawnAndSync();
+        return target;
+    }
+
+    inline const Rectangle<int32_t> GetMaskedRegion(const Image<Alpha8>& mask)
+    {
+        const ConstImageView<Alpha8> view = mask.ConstView();
+        Rectangle<int32_t> region(view.Width(), view.Height(), 0, 0);
+        region.Right = region.Bottom = 0;
+        for (int32_t y = 0; y < view.Height(); y++)
         {
-            for (int x = 0; x < a.Width(); x++)
+            const Alpha8* row = view.Row(y);
+            for (int32_t x = 0; x < view.Width(); x++)
             {
-                if (mask(x, y).IsMasked())
-                    target(x, y) = b(x, y);
+                if (row[x].IsMasked())
+                {
+                    region.Left = Minimum(region.Left, x);
+                    region.Right = Maximum(region.Right, x + 1);
+                    region.Top = Minimum(region.Top, y);
+                    region.Bottom = y + 1;
+                }
+            }
+        }
+        return region;
+    }
+
+    template<class PixelType>
+    Image<PixelType> Crop(const Image<PixelType>& image, const Rectangle<int32_t>& region)
+    {
+        ASSERT(region.Left >= 0 && region.Top >= 0 && region.Right <= image.Width() && region.Bottom <= image.Height());
+        Image<PixelType> result(region.Right - region.Left, region.Bottom - region.Top);
+        const ConstImageView<PixelType> src = image.ConstView();
+        const ImageView<PixelType> dst = result.View();
+        for (int32_t y = 0; y < dst.Height(); y++)
+            memcpy(dst.Row(y), src.Row(y + region.Top) + region.Left, sizeof(PixelType) * dst.Width());
+        return result;
+    }
+
+    template<class PixelType>
+    void PasteMasked(Image<PixelType>& image, const Image<PixelType>& part, const Image<Alpha8>& mask, int32_t left, int32_t top)
+    {
+        ASSERT(part.Width() == mask.Width() && part.Height() == mask.Height());
+        ASSERT(left >= 0 && top >= 0 && left + part.Width() <= image.Width() && top + part.Height() <= image.Height());
+        const ConstImageView<PixelType> src = part.ConstView();
+        const ConstImageView<Alpha8> m = mask.ConstView();
+        const ImageView<PixelType> dst = image.View();
+        for (int32_t y = 0; y < src.Height(); y++)
+        {
+            const PixelType* s = src.Row(y);
+            const Alpha8* r = m.Row(y);
+            PixelType* d = dst.Row(y + top) + left;
+            for (int32_t x = 0; x < src.Width(); x++)
+            {
+                if (r[x].IsMasked())
+                    d[x] = s[x];
             }
         }
-        return target;
     }
 }
\ No newline at end of file
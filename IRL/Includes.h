@@ -3,6 +3,7 @@
 // CRT includes
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 #include <time.h>
 
 // Common STL includes 
@@ -26,12 +27,27 @@
 #endif
 #endif
 
+// C++11 rvalue references, MSVC has them since 2010
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#define IRL_HAS_MOVE
+#endif
+
 #ifdef _MSC_VER
 #define force_inline __forceinline
 #else
 #define force_inline inline
 #endif
 
+// Hint to load the cache line holding 'address' for reading, ignored where there is none
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#define IRL_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define IRL_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define IRL_PREFETCH(address) ((void)(address))
+#endif
+
 template<class T>
 const T& Minimum(const T& l, const T& r) // because MSVC does not know std::min
 {
@@ -0,0 +1,158 @@
+#include "Includes.h"
+#include "JobQueue.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+namespace IRL
+{
+    //////////////////////////////////////////////////////////////////////////
+    // Job implementation
+
+    Job::Job(int priority, int64_t size) : _priority(priority), _size(Maximum<int64_t>(size, 1)), _order(0), _done(false)
+    {
+    }
+
+    Job::~Job()
+    {
+    }
+
+    bool Job::IsDone()
+    {
+        AutoMutex lock(_lock);
+        return _done;
+    }
+
+    void Job::Wait()
+    {
+        AutoMutex lock(_lock);
+        while (!_done)
+            _finished.Wait(_lock);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // JobQueue implementation
+
+    class JobQueue::SlotThread :
+        public Thread
+    {
+    public:
+        SlotThread(JobQueue* owner) : _owner(owner) {}
+
+    private:
+        virtual void Run()
+        {
+            _owner->SlotLoop();
+        }
+
+        JobQueue* _owner;
+    };
+
+    JobQueue::JobQueue(unsigned int slots)
+    {
+        _submitted = 0;
+        _stop = false;
+        if (slots == 0)
+            slots = Parallel::GetWorkersCount();
+        _slots.resize(slots);
+        for (unsigned int i = 0; i < _slots.size(); i++)
+        {
+            _slots[i] = new SlotThread(this);
+            _slots[i]->Start();
+        }
+    }
+
+    JobQueue::~JobQueue()
+    {
+        WaitAll();
+        _lock.Lock();
+        _stop = true;
+        _changed.WakeAll();
+        _lock.Unlock();
+        for (unsigned int i = 0; i < _slots.size(); i++)
+        {
+            _slots[i]->Join();
+            delete _slots[i];
+        }
+    }
+
+    void JobQueue::Submit(Job* job)
+    {
+        ASSERT(job != NULL);
+        AutoMutex lock(_lock);
+        job->_order = _submitted++;
+        job->_done = false;
+        _queued.push_back(job);
+        std::push_heap(_queued.begin(), _queued.end(), StartsLater);
+        _changed.WakeAll();
+    }
+
+    void JobQueue::WaitAll()
+    {
+        AutoMutex lock(_lock);
+        while (!_queued.empty() || !_running.empty())
+            _changed.Wait(_lock);
+    }
+
+    unsigned int JobQueue::Unfinished()
+    {
+        AutoMutex lock(_lock);
+        return _queued.size() + _running.size();
+    }
+
+    void JobQueue::SlotLoop()
+    {
+        while (1)
+        {
+            Job* job = NULL;
+            {
+                AutoMutex lock(_lock);
+                while (_queued.empty() && !_stop)
+                    _changed.Wait(_lock);
+                if (_stop)
+                    break;
+                std::pop_heap(_queued.begin(), _queued.end(), StartsLater);
+                job = _queued.back();
+                _queued.pop_back();
+                _running.push_back(job);
+                Rebalance();
+            }
+
+            Parallel::SetConcurrencyLimit(&job->_concurrency);
+            job->Run();
+            Parallel::SetConcurrencyLimit(NULL);
+
+            {
+                AutoMutex lock(_lock);
+                _running.erase(std::find(_running.begin(), _running.end(), job));
+                Rebalance();
+                _changed.WakeAll();
+            }
+            // the job may be deleted right after it is done, so it is the last access
+            AutoMutex lock(job->_lock);
+            job->_done = true;
+            job->_finished.WakeAll();
+        }
+    }
+
+    bool JobQueue::StartsLater(const Job* l, const Job* r)
+    {
+        if (l->_priority != r->_priority)
+            return l->_priority < r->_priority;
+        return l->_order > r->_order;
+    }
+
+    void JobQueue::Rebalance()
+    {
+        int64_t total = 0;
+        for (unsigned int i = 0; i < _running.size(); i++)
+            total += _running[i]->Size();
+        const unsigned int workers = Parallel::GetWorkersCount();
+        for (unsigned int i = 0; i < _running.size(); i++)
+        {
+            // every job gets at least one worker, so small jobs progress next to big ones
+            int64_t share = (workers * _running[i]->Size() + total / 2) / total;
+            _running[i]->_concurrency.Store((int)Maximum<int64_t>(share, 1));
+        }
+    }
+}
\ No newline at end of file
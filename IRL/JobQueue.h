@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Threading.h"
+
+namespace IRL
+{
+    // Unit of work for JobQueue
+    class Job
+    {
+        friend class JobQueue;
+    public:
+        // Jobs with higher priority start first. Running jobs share workers in proportion 
+        // to their size, i.e. pixels count.
+        Job(int priority = 0, int64_t size = 1);
+        virtual ~Job();
+
+        virtual void Run() = 0;
+
+        int Priority() const { return _priority; }
+        int64_t Size() const { return _size; }
+
+        // Return true once Run() is finished
+        bool IsDone();
+        // Wait till Run() is finished
+        void Wait();
+
+    private:
+        // disable copy methods
+        Job(const Job&);
+        void operator=(const Job&);
+
+        int _priority;
+        int64_t _size;
+        uint64_t _order;        // submission order, jobs with the same priority start in it
+        AtomicInt _concurrency; // share of workers while running, see Parallel::SetConcurrencyLimit
+
+        Mutex _lock;
+        WaitCondition _finished;
+        bool _done;
+    };
+
+    // Runs submitted jobs concurrently on Parallel workers, so small jobs do not wait for big ones.
+    // Each job runs in its own slot thread, jobs beyond slots count wait in priority order.
+    class JobQueue
+    {
+    public:
+        // 'slots' is how many jobs may run at once, 0 for workers count
+        explicit JobQueue(unsigned int slots = 0);
+        // Waits for all submitted jobs
+        ~JobQueue();
+
+        // Queues the job, it has to live till it is done
+        void Submit(Job* job);
+        // Wait till all submitted jobs are done
+        void WaitAll();
+        // Return count of queued and running jobs
+        unsigned int Unfinished();
+
+    private:
+        // disable copy methods
+        JobQueue(const JobQueue&);
+        void operator=(const JobQueue&);
+
+        class SlotThread;
+
+        void SlotLoop();
+        // Heap order, higher priority first, then earlier submitted
+        static bool StartsLater(const Job* l, const Job* r);
+        // Splits workers among running jobs by their sizes, called under _lock
+        void Rebalance();
+
+    private:
+        Mutex _lock;                   // guards fields below
+        WaitCondition _changed;        // job is queued or finished, or queue stops
+        std::vector<Job*> _queued;     // heap, top job starts next
+        std::vector<Job*> _running;
+        uint64_t _submitted;
+        bool _stop;
+
+        std::vector<SlotThread*> _slots;
+    };
+}
\ No newline at end of file
@@ -45,28 +45,48 @@ namespace IRL
         }
 
     private:
-        template<class PixelType>
+        // Dummy turns the specializations below into partial ones, full ones are not allowed in class scope
+        template<class PixelType, int Dummy = 0>
         struct Multiplier;
 
-        template<>
-        struct  Multiplier<double>
+        template<int Dummy>
+        struct Multiplier<double, Dummy>
         {
             static double L() { return 100.0; }               // L \in [0, 100]
             static double a() { return 96.7768 + 91.3727; }   // a \in [-91.3727, 96.7768]
             static double b() { return 81.7356 + 125.845; }  // b \in [-125.845, 81.7356]
         };
 
-        template<>
-        struct  Multiplier<float>
+        template<int Dummy>
+        struct Multiplier<float, Dummy>
         {
             static float L() { return 100.0f; }               // L \in [0, 100]
             static float a() { return 96.7768f + 91.3727f; }   // a \in [-91.3727, 96.7768]
             static float b() { return 81.7356f + 125.845f; }  // b \in [-125.845, 81.7356]
         };
+
+        // Fixed point channels keep the ratio of ranges above (100 : 188 : 208) in small integers,
+        // so mask penalties of a whole patch still fit DistanceType.
+
+        template<int Dummy>
+        struct Multiplier<uint8_t, Dummy>
+        {
+            static uint8_t L() { return 1; }
+            static uint8_t a() { return 2; }
+            static uint8_t b() { return 2; }
+        };
+
+        template<int Dummy>
+        struct Multiplier<uint16_t, Dummy>
+        {
+            static uint16_t L() { return 25; }
+            static uint16_t a() { return 47; }
+            static uint16_t b() { return 52; }
+        };
     };
 
-    typedef Lab<uint8_t>  Lab8;
-    typedef Lab<uint16_t> Lab16;
+    typedef Lab<uint8_t>  Lab8;    // fixed point, the fastest solver pixel, see ObjectRemovalFixedPoint
+    typedef Lab<uint16_t> Lab16;   // fixed point
     typedef Lab<float>    LabFloat;
     typedef Lab<double>   LabDouble;
 
@@ -97,9 +117,19 @@ namespace IRL
         force_inline const PixelType GetSum(Coeff normalizer) const
         {
             PixelType result;
-            result.L = (ChannelType)(L / normalizer);
-            result.a = (ChannelType)(a / normalizer);
-            result.b = (ChannelType)(b / normalizer);
+            if (TypeTraits<ChannelType>::IsInteger)
+            {
+                // round to nearest, truncation would darken fixed point images
+                const LargerType half = (LargerType)(normalizer / 2);
+                result.L = (ChannelType)((L + half) / normalizer);
+                result.a = (ChannelType)((a + half) / normalizer);
+                result.b = (ChannelType)((b + half) / normalizer);
+            } else
+            {
+                result.L = (ChannelType)(L / normalizer);
+                result.a = (ChannelType)(a / normalizer);
+                result.b = (ChannelType)(b / normalizer);
+            }
             return result;
         }
 
@@ -109,6 +139,16 @@ namespace IRL
             Norm += c;
         }
 
+        // Adds pixels and norm appended to other accumulator
+        force_inline Accumulator& operator+=(const Accumulator& other)
+        {
+            L += other.L;
+            a += other.a;
+            b += other.b;
+            Norm += other.Norm;
+            return *this;
+        }
+
         force_inline const PixelType GetSum() const
         {
             return GetSum(Norm);
@@ -120,4 +160,20 @@ namespace IRL
     private:
         LargerType L, a, b;
     };
+
+    template<class ChannelType>
+    struct PixelChannels<Lab<ChannelType> >
+    {
+        static const int Count = 3;
+
+        static force_inline double Get(const Lab<ChannelType>& pixel, int i)
+        {
+            return i == 0 ? (double)pixel.L : (i == 1 ? (double)pixel.a : (double)pixel.b);
+        }
+
+        static force_inline void Set(Lab<ChannelType>& pixel, int i, double value)
+        {
+            (i == 0 ? pixel.L : (i == 1 ? pixel.a : pixel.b)) = Internal::ToChannel<ChannelType>(value);
+        }
+    };
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Threading.h"
+
+namespace IRL
+{
+    // Fixed capacity queue of T* without locks.
+    // Only one thread (the owner) may Add, any thread may Get. Every slot is used once,
+    // so at most Capacity values can be added between Reinitialize calls.
+    template<class T>
+    class LockFreeQueue
+    {
+    public:
+        LockFreeQueue() : _head(0), _tail(0) {}
+
+        void Reserve(int capacity)
+        {
+            _items.resize(capacity);
+        }
+
+        // Should not be called while other threads use the queue
+        void Reinitialize()
+        {
+            _head.Store(0);
+            _tail.Store(0);
+        }
+
+        void Add(T* value)
+        {
+            int tail = _tail.Load(); // only the owner changes _tail
+            ASSERT(tail < (int)_items.size());
+            _items[tail] = value;
+            _tail.FetchAndAdd(1); // publishes the item
+        }
+
+        // Returns NULL if queue is empty
+        T* Get()
+        {
+            while (1)
+            {
+                int head = _head.Load();
+                if (head >= _tail.Load())
+                    return NULL;
+                // successful swap is a barrier, so the item added before _tail change is visible
+                if (_head.CompareAndSwap(head, head + 1))
+                    return _items[head];
+            }
+        }
+
+    private:
+        std::vector<T*> _items;
+        AtomicInt _head;
+        AtomicInt _tail;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "Includes.h"
+#include "Memory.h"
+#include "Threading.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <algorithm>
+#include <iomanip>
+
+namespace IRL
+{
+    namespace Memory
+    {
+        // Blocks up to 4 KB are rounded to powers of two, bigger ones to quarters of powers of two,
+        // which wastes at most 25% of big block while images of similar sizes share class.
+        const size_t SmallClassBytes = 4096;
+        const unsigned int SubClasses = 4;
+        const unsigned int ClassesCount = 256;
+        // Fresh blocks from this size on are first touched by all workers when they are pinned to more
+        // than one socket (see Parallel::Initialize), pages go to the memory of the socket which touches them
+        const size_t FirstTouchBytes = (size_t)4 << 20;
+        const size_t PageBytes = 4096;
+
+        // Precedes every block. Takes whole Alignment bytes, so data stays aligned.
+        struct BlockHeader
+        {
+            void* Raw;          // what malloc returned
+            size_t Bytes;       // requested size
+            unsigned int Class;
+            unsigned int Stage; // index of the stage in Pool
+        };
+
+        // Level of LevelScope of every thread, plus one so that threads without it read 0
+        static ThreadLocal<int> g_Level;
+
+        struct StageEntry
+        {
+            const char* Name;
+            int Level;
+            int64_t BytesInUse;
+            int64_t PeakBytesInUse;
+            int64_t BytesAtPeak;
+            int64_t Allocations;
+        };
+
+        // Writes one byte of every page in a range of pages of the block
+        class FirstTouchTask :
+            public Parallel::Runnable
+        {
+        public:
+            void Set(int32_t start, int32_t end, uint8_t* block)
+            {
+                _start = start;
+                _end = end;
+                _block = block;
+            }
+
+            virtual void Run()
+            {
+                for (int32_t i = _start; i < _end; i++)
+                    _block[(size_t)i * PageBytes] = 0;
+            }
+
+        private:
+            int32_t _start;
+            int32_t _end;
+            uint8_t* _block;
+        };
+
+        // Spreads pages of a block nothing was written to yet over sockets of the workers. Blocks are split
+        // into ranges as ParallelFor splits rows of images, and stay in the pool where they were placed.
+        static void FirstTouch(void* block, size_t bytes)
+        {
+            if (bytes < FirstTouchBytes || !Parallel::IsPinned() || Parallel::GetTopology().Sockets < 2)
+                return;
+            Parallel::ParallelFor<FirstTouchTask, uint8_t*> tasks(0, (int32_t)(bytes / PageBytes), (uint8_t*)block);
+            tasks.SpawnAndSync();
+        }
+
+        static unsigned int GetClass(size_t bytes, size_t& classBytes)
+        {
+            classBytes = Alignment;
+            unsigned int index = 0;
+            while (classBytes < bytes && classBytes < SmallClassBytes)
+            {
+                classBytes *= 2;
+                index++;
+            }
+            if (classBytes >= bytes)
+                return index;
+            // quarter steps between powers of two
+            size_t base = classBytes;
+            while (base * 2 < bytes)
+            {
+                base *= 2;
+                index += SubClasses;
+            }
+            size_t step = base / SubClasses;
+            unsigned int sub = (unsigned int)((bytes - base + step - 1) / step);
+            classBytes = base + sub * step;
+            return index + sub;
+        }
+
+        class Pool
+        {
+        public:
+            Pool() : _limit((size_t)512 << 20)
+            {
+                memset(&_statistics, 0, sizeof(_statistics));
+            }
+
+            void* Allocate(size_t bytes)
+            {
+                size_t classBytes;
+                unsigned int index = GetClass(bytes, classBytes);
+                ASSERT(index < ClassesCount);
+                const char* name = Tools::Profiler::GetCurrentScope();
+                const int level = GetLevel();
+                void* block = NULL;
+                unsigned int stage;
+                {
+                    AutoMutex lock(_lock);
+                    _statistics.Allocations++;
+                    _statistics.BytesInUse += bytes;
+                    stage = AddToStage(name, level, (int64_t)bytes);
+                    if (_statistics.BytesInUse > _statistics.PeakBytesInUse)
+                    {
+                        _statistics.PeakBytesInUse = _statistics.BytesInUse;
+                        for (unsigned int i = 0; i < _stages.size(); i++)
+                            _stages[i].BytesAtPeak = _stages[i].BytesInUse;
+                    }
+                    if (!_free[index].empty())
+                    {
+                        block = _free[index].back();
+                        _free[index].pop_back();
+                        _statistics.BytesPooled -= classBytes;
+                        _statistics.PoolHits++;
+                    }
+                }
+                if (block == NULL)
+                {
+                    void* raw = malloc(classBytes + 2 * Alignment);
+                    ASSERT(raw != NULL);
+                    block = (void*)(((size_t)raw + 2 * Alignment - 1) & ~(Alignment - 1));
+                    Header(block)->Raw = raw;
+                    Header(block)->Class = index;
+                    FirstTouch(block, classBytes);
+                }
+                Header(block)->Bytes = bytes;
+                Header(block)->Stage = stage;
+                return block;
+            }
+
+            void Free(void* block)
+            {
+                BlockHeader* header = Header(block);
+                size_t classBytes;
+                GetClass(header->Bytes, classBytes);
+                {
+                    AutoMutex lock(_lock);
+                    _statistics.BytesInUse -= header->Bytes;
+                    _stages[header->Stage].BytesInUse -= header->Bytes;
+                    if (_statistics.BytesPooled + (int64_t)classBytes <= (int64_t)_limit)
+                    {
+                        _free[header->Class].push_back(block);
+                        _statistics.BytesPooled += classBytes;
+                        return;
+                    }
+                }
+                free(header->Raw);
+            }
+
+            void SetLimit(size_t bytes)
+            {
+                {
+                    AutoMutex lock(_lock);
+                    _limit = bytes;
+                }
+                if (bytes == 0)
+                    Trim();
+            }
+
+            size_t GetLimit()
+            {
+                AutoMutex lock(_lock);
+                return _limit;
+            }
+
+            void Trim()
+            {
+                std::vector<void*> blocks;
+                {
+                    AutoMutex lock(_lock);
+                    for (unsigned int i = 0; i < ClassesCount; i++)
+                    {
+                        blocks.insert(blocks.end(), _free[i].begin(), _free[i].end());
+                        _free[i].clear();
+                    }
+                    _statistics.BytesPooled = 0;
+                }
+                for (unsigned int i = 0; i < blocks.size(); i++)
+                    free(Header(blocks[i])->Raw);
+            }
+
+            void CountClone(size_t bytes)
+            {
+                AutoMutex lock(_lock);
+                _statistics.Clones++;
+                _statistics.ClonedBytes += bytes;
+            }
+
+            Statistics GetStatistics()
+            {
+                AutoMutex lock(_lock);
+                return _statistics;
+            }
+
+            void ResetPeak()
+            {
+                AutoMutex lock(_lock);
+                _statistics.PeakBytesInUse = _statistics.BytesInUse;
+                for (unsigned int i = 0; i < _stages.size(); i++)
+                    _stages[i].PeakBytesInUse = _stages[i].BytesAtPeak = _stages[i].BytesInUse;
+            }
+
+            std::vector<StageEntry> GetStages()
+            {
+                AutoMutex lock(_lock);
+                return _stages;
+            }
+
+        private:
+            // Returns index of the stage, called under the lock
+            unsigned int AddToStage(const char* name, int level, int64_t bytes)
+            {
+                const std::pair<const char*, int> key(name, level);
+                std::map<std::pair<const char*, int>, unsigned int>::iterator it = _stageIndices.find(key);
+                if (it == _stageIndices.end())
+                {
+                    StageEntry entry = { name, level, 0, 0, 0, 0 };
+                    it = _stageIndices.insert(std::make_pair(key, (unsigned int)_stages.size())).first;
+                    _stages.push_back(entry);
+                }
+                StageEntry& stage = _stages[it->second];
+                stage.BytesInUse += bytes;
+                stage.PeakBytesInUse = Maximum(stage.PeakBytesInUse, stage.BytesInUse);
+                stage.Allocations++;
+                return it->second;
+            }
+
+            static BlockHeader* Header(void* block)
+            {
+                return (BlockHeader*)((uint8_t*)block - Alignment);
+            }
+
+            Mutex _lock;                                // guards fields below
+            std::vector<void*> _free[ClassesCount];     // free blocks by class
+            size_t _limit;
+            Statistics _statistics;
+            std::vector<StageEntry> _stages;
+            std::map<std::pair<const char*, int>, unsigned int> _stageIndices;
+        };
+
+        // Never destroyed, so images released by destructors of other statics still find it
+        static Pool& GetPool()
+        {
+            static Pool* pool = new Pool();
+            return *pool;
+        }
+
+        void* Allocate(size_t bytes)
+        {
+            return GetPool().Allocate(bytes);
+        }
+
+        void Free(void* ptr)
+        {
+            if (ptr != NULL)
+                GetPool().Free(ptr);
+        }
+
+        void SetPoolLimit(size_t bytes)
+        {
+            GetPool().SetLimit(bytes);
+        }
+
+        size_t GetPoolLimit()
+        {
+            return GetPool().GetLimit();
+        }
+
+        void Trim()
+        {
+            GetPool().Trim();
+        }
+
+        void CountClone(size_t bytes)
+        {
+            GetPool().CountClone(bytes);
+        }
+
+        Statistics GetStatistics()
+        {
+            return GetPool().GetStatistics();
+        }
+
+        void ResetPeak()
+        {
+            GetPool().ResetPeak();
+        }
+
+        static bool ByBytesAtPeak(const StageStatistics& a, const StageStatistics& b)
+        {
+            return a.BytesAtPeak > b.BytesAtPeak;
+        }
+
+        void Report(std::ostream& out)
+        {
+            Statistics statistics = GetStatistics();
+            const double MB = 1 << 20;
+            out << "Memory in use: " << statistics.BytesInUse / MB << " MB, peak: " << statistics.PeakBytesInUse / MB
+                << " MB, pooled: " << statistics.BytesPooled / MB << " MB" << std::endl;
+            out << "Allocations: " << statistics.Allocations << ", from pool: " << statistics.PoolHits << std::endl;
+            out << "Image clones: " << statistics.Clones << ", " << statistics.ClonedBytes / MB << " MB" << std::endl;
+
+            // stages which held most at the peak first, then levels by what they held
+            std::vector<StageStatistics> stages = GetStageStatistics();
+            std::sort(stages.begin(), stages.end(), ByBytesAtPeak);
+            std::map<int, int64_t> levels;
+            out << std::setw(32) << std::left << "Stage" << std::right << std::setw(7) << "Level"
+                << std::setw(14) << "At peak, MB" << std::setw(14) << "Peak, MB" << std::setw(14) << "In use, MB"
+                << std::setw(12) << "Allocations" << "\n";
+            for (unsigned int i = 0; i < stages.size(); i++)
+            {
+                levels[stages[i].Level] += stages[i].BytesAtPeak;
+                if (stages[i].PeakBytesInUse == 0)
+                    continue;
+                out << std::setw(32) << std::left << (stages[i].Stage.empty() ? "(no scope)" : stages[i].Stage)
+                    << std::right << std::setw(7) << stages[i].Level << std::fixed << std::setprecision(2)
+                    << std::setw(14) << stages[i].BytesAtPeak / MB << std::setw(14) << stages[i].PeakBytesInUse / MB
+                    << std::setw(14) << stages[i].BytesInUse / MB << std::setw(12) << stages[i].Allocations << "\n";
+            }
+            std::map<int, int64_t>::const_iterator it;
+            for (it = levels.begin(); it != levels.end(); ++it)
+                out << "Level " << it->first << " at peak: " << it->second / MB << " MB\n";
+            out.flush();
+        }
+
+        std::vector<StageStatistics> GetStageStatistics()
+        {
+            const std::vector<StageEntry> entries = GetPool().GetStages();
+            // the same name may come from different literals, so merge by string
+            std::map<std::pair<std::string, int>, StageStatistics> merged;
+            for (unsigned int i = 0; i < entries.size(); i++)
+            {
+                const std::string name = entries[i].Name ? entries[i].Name : "";
+                StageStatistics& stage = merged[std::make_pair(name, entries[i].Level)];
+                stage.Stage = name;
+                stage.Level = entries[i].Level;
+                stage.BytesInUse += entries[i].BytesInUse;
+                stage.PeakBytesInUse += entries[i].PeakBytesInUse;
+                stage.BytesAtPeak += entries[i].BytesAtPeak;
+                stage.Allocations += entries[i].Allocations;
+            }
+            std::vector<StageStatistics> result;
+            std::map<std::pair<std::string, int>, StageStatistics>::const_iterator it;
+            for (it = merged.begin(); it != merged.end(); ++it)
+                result.push_back(it->second);
+            return result;
+        }
+
+        int GetLevel()
+        {
+            return g_Level.Get() - 1;
+        }
+
+        LevelScope::LevelScope(int level)
+        {
+            _previous = g_Level.Get();
+            g_Level.Set(level + 1);
+        }
+
+        LevelScope::~LevelScope()
+        {
+            g_Level.Set(_previous);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+namespace IRL
+{
+    namespace Memory
+    {
+        // Alignment of all allocated blocks, enough for any SIMD load
+        const size_t Alignment = 64;
+
+        // Allocates block aligned to Alignment, never returns NULL.
+        // Freed blocks are kept in pool by size classes and reused for allocations of the same class,
+        // so buffers rebuilt every iteration and level do not go through malloc and page faults.
+        extern void* Allocate(size_t bytes);
+        // Returns block to the pool, NULL is ignored
+        extern void Free(void* ptr);
+
+        // Most bytes kept in the pool, blocks above it are freed to the system (default 512 MB)
+        extern void SetPoolLimit(size_t bytes);
+        extern size_t GetPoolLimit();
+        // Frees all pooled blocks to the system
+        extern void Trim();
+
+        struct Statistics
+        {
+            int64_t BytesInUse;       // requested by allocated blocks
+            int64_t PeakBytesInUse;   // since start or ResetPeak()
+            int64_t BytesPooled;      // held by free blocks of the pool
+            int64_t Allocations;      // total calls of Allocate
+            int64_t PoolHits;         // allocations served from the pool
+            int64_t Clones;           // deep copies of shared images made by writes to them
+            int64_t ClonedBytes;
+        };
+
+        // Called by Image on every deep copy
+        extern void CountClone(size_t bytes);
+
+        extern Statistics GetStatistics();
+        // Peak starts again from current bytes in use
+        extern void ResetPeak();
+        // Writes statistics in human readable form, with stages which held memory at the peak
+        extern void Report(std::ostream& out);
+
+        // Blocks of one stage: allocated within one Tools::Profiler scope, the innermost one of the allocating
+        // thread, on one pyramid level (see LevelScope). Blocks are accounted to it till they are freed.
+        // Parallel tasks allocate within the scope and level of the thread which spawned them.
+        struct StageStatistics
+        {
+            std::string Stage;        // empty outside of profiler scopes
+            int Level;                // -1 outside of LevelScope
+            int64_t BytesInUse;
+            int64_t PeakBytesInUse;   // most held by the stage since start or ResetPeak()
+            int64_t BytesAtPeak;      // held by the stage when Statistics::PeakBytesInUse was reached
+            int64_t Allocations;
+        };
+
+        // Stages by name and level, the same name from different literals is merged
+        extern std::vector<StageStatistics> GetStageStatistics();
+
+        // Level of the LevelScope of the calling thread, -1 outside of it
+        extern int GetLevel();
+
+        // Blocks allocated by the calling thread while it lives belong to pyramid level 'level'
+        class LevelScope
+        {
+        public:
+            explicit LevelScope(int level);
+            ~LevelScope();
+
+        private:
+            // disable copy methods
+            LevelScope(const LevelScope&);
+            void operator=(const LevelScope&);
+
+            int _previous;
+        };
+    }
+}
\ No newline at end of file
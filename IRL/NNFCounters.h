@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Config.h"
+
+namespace IRL
+{
+    // Work done by patch match iterations, used to tune search parameters.
+    // Counted only when IRL_NNF_COUNTERS is defined (build with CONFIG+=counters), zeros otherwise.
+    struct NNFCounters
+    {
+        int64_t PropagationAttempts;     // neighbor offsets tested
+        int64_t PropagationAccepts;      // neighbor offsets which improved the match
+        int64_t RandomSearchCandidates;  // random search offsets tested
+        int64_t RandomSearchImprovements;// random search offsets which improved the match
+        int64_t EarlyTerminationTests;   // distances calculated with known upper bound
+        int64_t EarlyTerminations;       // distances stopped before the last patch row
+        int64_t ZeroDistanceSkips;       // searches skipped or stopped since match is exact
+        int64_t LowerBoundRejections;    // candidates rejected by patch summaries without distance
+        int64_t MaskRejections;          // candidates covering masked source rejected without distance
+        int64_t ConvergedSkips;          // patches skipped since neither they nor their neighbors changed
+
+        NNFCounters()
+        {
+            Clear();
+        }
+
+        void Clear()
+        {
+            PropagationAttempts = 0;
+            PropagationAccepts = 0;
+            RandomSearchCandidates = 0;
+            RandomSearchImprovements = 0;
+            EarlyTerminationTests = 0;
+            EarlyTerminations = 0;
+            ZeroDistanceSkips = 0;
+            LowerBoundRejections = 0;
+            MaskRejections = 0;
+            ConvergedSkips = 0;
+        }
+
+        NNFCounters& operator+=(const NNFCounters& other)
+        {
+            PropagationAttempts += other.PropagationAttempts;
+            PropagationAccepts += other.PropagationAccepts;
+            RandomSearchCandidates += other.RandomSearchCandidates;
+            RandomSearchImprovements += other.RandomSearchImprovements;
+            EarlyTerminationTests += other.EarlyTerminationTests;
+            EarlyTerminations += other.EarlyTerminations;
+            ZeroDistanceSkips += other.ZeroDistanceSkips;
+            LowerBoundRejections += other.LowerBoundRejections;
+            MaskRejections += other.MaskRejections;
+            ConvergedSkips += other.ConvergedSkips;
+            return *this;
+        }
+    };
+
+    // Scheduling of a parallel scan order iteration over the wavefront of super patches, in nanoseconds.
+    // Collected always, it costs two clock reads per super patch.
+    struct NNFWavefront
+    {
+        int Workers;             // tasks processing super patches
+        int SuperPatchWidth;     // pixels, the last column and row of super patches may be smaller
+        int SuperPatchHeight;
+        int SuperPatches;
+        int64_t WallTime;        // from spawning tasks till all of them finished
+        int64_t BusyTime;        // spent processing super patches by all tasks
+        int64_t IdleTime;        // Workers * WallTime - BusyTime: waiting for the wavefront and scheduling
+        int64_t CriticalPath;    // longest chain of dependent super patches, lower bound of WallTime
+
+        NNFWavefront()
+        {
+            Clear();
+        }
+
+        void Clear()
+        {
+            Workers = 0;
+            SuperPatchWidth = 0;
+            SuperPatchHeight = 0;
+            SuperPatches = 0;
+            WallTime = 0;
+            BusyTime = 0;
+            IdleTime = 0;
+            CriticalPath = 0;
+        }
+    };
+
+    inline std::ostream& operator<<(std::ostream& out, const NNFWavefront& wavefront)
+    {
+        out << wavefront.SuperPatches << " super patches of " << wavefront.SuperPatchWidth << "x" << wavefront.SuperPatchHeight
+            << " on " << wavefront.Workers << " workers, wall: " << wavefront.WallTime / 1000 << " us"
+            << ", idle: " << wavefront.IdleTime / 1000 << " us"
+            << ", critical path: " << wavefront.CriticalPath / 1000 << " us";
+        return out;
+    }
+
+    inline std::ostream& operator<<(std::ostream& out, const NNFCounters& counters)
+    {
+        out << "Propagation: " << counters.PropagationAccepts << " / " << counters.PropagationAttempts
+            << ", random search: " << counters.RandomSearchImprovements << " / " << counters.RandomSearchCandidates
+            << ", early terminations: " << counters.EarlyTerminations << " / " << counters.EarlyTerminationTests
+            << ", zero distance skips: " << counters.ZeroDistanceSkips
+            << ", lower bound rejections: " << counters.LowerBoundRejections;
+        return out;
+    }
+}
+
+#ifdef IRL_NNF_COUNTERS
+#define NNF_COUNT(counters, name) ((counters).name++)
+#else
+#define NNF_COUNT(counters, name) ((void)0)
+#endif
\ No newline at end of file
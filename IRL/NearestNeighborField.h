@@ -7,46 +7,182 @@
 #include "Point2D.h"
 #include "Rectangle.h"
 #include "Parallel.h"
-#include "Queue.h"
+#include "LockFreeQueue.h"
 #include "Alpha.h"
 #include "OffsetField.h"
+#include "PatchDistance.h"
+#include "DeviceNNF.h"
+#include "PatchIndex.h"
+#include "TiledImage.h"
+#include "PatchSummaries.h"
+#include "ValidPatches.h"
+#include "NNFCounters.h"
+
+#include <limits>
 
 namespace IRL
 {
-    // NNF stands for NearestNeighborField
-    template<class PixelType, bool UseSourceMask>
+    // How NNF propagates good offsets between neighbor pixels, or finds them without propagation
+    enum NNFPropagation
+    {
+        // Alternating direct and reverse scan order, parallel over the wavefront of super patches
+        ScanOrderPropagation,
+        // Red/black passes: pixel takes offsets of its neighbors of the other color, so all
+        // pixels of one color are processed in parallel. First iterations also take offsets
+        // from distant neighbors (jump flood) to make up for slower propagation.
+        CheckerboardPropagation,
+        // Every patch tests all source patches, rows in parallel. One iteration finds exact matches
+        // deterministically, but costs source patches per target patch, so it suits small images only.
+        ExhaustiveSearch
+    };
+
+    namespace Internal
+    {
+        // Type distances are kept in between iterations. Build with CONFIG+=lean (IRL_COMPACT_DISTANCES)
+        // to keep double distances in single precision, they are still computed and summed up in double.
+        template<class DistanceType>
+        struct StoredDistance
+        {
+            typedef DistanceType Type;
+        };
+
+#ifdef IRL_COMPACT_DISTANCES
+        template<>
+        struct StoredDistance<double>
+        {
+            typedef float Type;
+        };
+#endif
+    }
+
+    // NNF stands for NearestNeighborField.
+    // Size is the patch size, odd one from MinPatchSize to MaxPatchSize, so that distance kernels are unrolled for it.
+    template<class PixelType, bool UseSourceMask, int Size = PatchSize>
     class NNF
     {
         typedef typename PixelType::DistanceType DistanceType;
+        typedef typename Internal::StoredDistance<DistanceType>::Type StoredDistanceType;
+
+        enum { HalfSize = Size / 2 };
 
     public:
-        typedef Image<Alpha<DistanceType> > DistanceField;
+        typedef Image<Alpha<StoredDistanceType> > DistanceField;
+
+        static const int MaxK = 16;    // most offsets kept per patch, see K
+
+        // Offset which is not the best one, but is among K best ones found so far
+        struct RunnerUp
+        {
+            Point16 Offset;
+            StoredDistanceType Distance;
+
+            // Return true for unused slot
+            bool IsEmpty() const { return Distance == std::numeric_limits<StoredDistanceType>::max(); }
+        };
 
-        Image<PixelType> Source;       // B
-        Image<Alpha8>    SourceMask;   // which pixel from source is allowed to use
-        Image<PixelType> Target;       // A
+        ConstImage<PixelType> Source;  // B
+        ConstImage<Alpha8>    SourceMask; // which pixel from source is allowed to use
+        ConstImage<PixelType> Target;  // A
 
         OffsetField      Field;        // On input: initial approximation, on output: result of the algorithm's work
         DistanceField    D;            // Holds current best distances on output
 
         int              SearchRadius; // Random search radius (-1 for whole image, 0 to disable random search)
+        NNFPropagation   Propagation;  // Propagation engine, may be changed between iterations
+        ComputeBackend   Backend;      // Where iterations are computed, may be changed between iterations
+        Rectangle<int32_t> TargetRegion; // Target patch centers to process, empty for whole image. Set before the first iteration.
+        const AtomicInt* CancelFlag;     // Non zero value stops the iteration between super patches or rows, NULL if never set
+        uint64_t         Seed;         // Key of random search, equal seeds give equal results whatever the workers count
+        // Index of Source patches (and SourceMask), NULL if never set. When it is set and SearchRadius covers
+        // the whole source, random search tests patches of the target patch's leaf instead of random ones.
+        const PatchIndex* Index;
+        // Valid patches of SourceMask, NULL if never set, then they are computed before the first iteration.
+        // Candidates covering masked pixels are rejected by their count, the distance kernel never reads the mask.
+        const ValidPatches* SourcePatches;
+        // Candidates are rejected by lower bounds of their distances (see PatchSummaries) before the distances
+        // are calculated, default false. Results do not change, summaries cost 36 bytes per pixel of Source
+        // and Target and are computed again after the image changes. CPU backend only.
+        bool             UsePatchBounds;
+        // Summaries of Source of Size for UsePatchBounds, NULL if never set, then they are computed by the
+        // iteration. Shared by solvers matching the same source, whose pixels do not change meanwhile.
+        const PatchSummaries* SourceSummaries;
+        // How many best offsets per patch are kept, from 1 to MaxK, default 1. Field holds the match,
+        // the other K - 1 are runners-up kept by CPU iterations only, so OpenCL backend is not used
+        // when it is above 1. Set before the first iteration.
+        int              K;
+        // Iterations after the first one process only patches whose offset or offset of an adjacent patch
+        // changed since the previous iteration began, and one in ConvergedExploration of the others, default
+        // false. Late iterations cost about as much as they change. Distances recalculated by UpdateDistances
+        // count as changes. Jump flood passes and device iterations process all patches. Set before the first iteration.
+        bool             SkipConverged;
+        int              RandomSearchLimit;    // How many candidates random search examines per patch, default 80
+        int              RandomSearchInvAlpha; // Random search radius is divided by this after every candidate, at least 2, default 2
+        // Side of square super patches CPU iterations are scheduled by, at least Size, default 0 chooses it
+        // by the target size and the workers count. Results do not depend on it.
+        int              SuperPatchSize;
+        // CPU iterations read a copy of Source in tiles of 16 columns (see TiledImage), so every patch is one
+        // contiguous block instead of Size rows far apart, default false. Results do not change, the copy costs
+        // about 1.4 times Source and UpdateDistances copies rows with changed pixels again.
+        bool             TiledSource;
+        // Random search of CPU iterations takes its candidates in batches and prefetches their source rows before
+        // the first distance of a batch, so misses of distant patches overlap instead of following each other.
+        // Default false. Results do not change.
+        bool             BatchedRandomSearch;
 
     public:
         NNF();
+        ~NNF();
 
         // Make one iteration of the algorithm.
         void Iteration(bool parallel = true);
-        // Return \sum_{P \in Target} min_{Q \in Source} D(P, Q) * (1 / Nt)
+        // Prepares this object for another run. Next iteration starts from Field and recalculates
+        // all distances, D and super patches are reused when image sizes are not changed.
+        void Reset();
+        // Call after pixels of Source (sourceChanged == true) or Target were modified between
+        // iterations and the modified image was assigned back. Non zero pixels of 'changed' mark
+        // modified pixels, only distances of patches covering them are recalculated.
+        void UpdateDistances(const Image<uint8_t>& changed, bool sourceChanged, bool parallel = true);
+        // Return \sum_{P \in Target} min_{Q \in Source} D(P, Q) * (1 / Nt).
+        // Distances are summed up while they change, so it is cheap.
         double GetMeasure();
+        // Return how many offsets updates per target patch were made by the last iteration
+        double GetChangedFraction();
+        // Return work counters of the last iteration, see NNFCounters
+        const NNFCounters& GetIterationCounters() const;
+        // Return work counters of all iterations since Reset()
+        const NNFCounters& GetTotalCounters() const;
+        // Return scheduling of the last iteration, zeros unless it was a parallel scan order one on CPU
+        const NNFWavefront& GetWavefront() const;
+        // Return bytes held by this object: Field, D and work buffers. Source and Target are shared
+        // with the caller and are not counted.
+        size_t GetBytes() const;
+        // Return K - 1 runners-up of the patch centered in (x, y), sorted by distance, empty ones last.
+        // Distances are valid as long as D is. K has to be above 1.
+        const RunnerUp* GetRunnersUp(int x, int y) const
+        {
+            return &_runnersUp[(x + y * Target.Width()) * (K - 1)];
+        }
 
     private:
+        // disable copy methods
+        NNF(const NNF&);
+        NNF& operator=(const NNF&);
+
         // Initializes the algorithm before first iteration.
         void Initialize();
+        // Takes views of the images, has to be done before any work since images may be reassigned
+        void BindViews();
 
+        // Chooses size of super patches for the target rectangle and workers count
+        void ChooseSuperPatchSize(int& width, int& height) const;
         // Fills _superPatches vector
         void BuildSuperPatches();
         // Fills D variable with initial value
         void PrepareCache(int left, int top, int right, int bottom);
+        // Recalculates distances of patches in rows [top, bottom) covering changed pixels
+        void UpdateDistances(int top, int bottom, bool sourceChanged);
+        // Return true if patch centered in (x, y) covers any changed pixel
+        force_inline bool PatchChanged(int x, int y);
 
         // Sequential complete iteration over target image's region
         void Iteration(int left, int top, int right, int bottom, int iteration);
@@ -56,6 +192,10 @@ namespace IRL
         // Perform reverse scan order step over target image's region
         void ReverseScanOrder(int left, int top, int right, int bottom);
 
+        // Propagation and random search on the patch unless it is skipped, see SkipConverged
+        template<int Direction, bool LeftAvailable, bool UpAvailable>
+        force_inline void ScanUpdate(const Point32& target);
+
         // Propagation.
         // Direction +1 for direct scan order, -1 for reverse one.
         // LeftAvailable == true if can propagate horizontally.
@@ -63,32 +203,91 @@ namespace IRL
         template<int Direction, bool LeftAvailable, bool UpAvailable>
         void Propagate(const Point32& target);
 
-        // Random search step on pixel
+        // Random search step on pixel, its values come from the pixel's stream of the current pass
         inline void RandomSearch(const Point32& target);
+        // Replaces random search when Index is set
+        inline void IndexSearch(const Point32& target);
+        // Tests all source patches, valid ones only when some are
+        inline void SearchAll(const Point32& target);
+
+        // Complete iteration with CheckerboardPropagation
+        void CheckerboardIteration(bool parallel);
+        // Complete iteration with ExhaustiveSearch
+        void ExhaustiveIteration(bool parallel);
+        // Complete iteration on OpenCL device, return false if CPU has to do it
+        bool DeviceIteration();
+        // Copies device results to Field and D, updates statistics
+        void DownloadDeviceResults();
+        // Return key of random streams of the pass of the current iteration
+        uint64_t PassKey(int pass) const;
+        // Processes all pixels of one color with distance 'step' to neighbors.
+        // Pass == PrepareCachePass fills D instead, pass == ExhaustivePass searches all source patches.
+        void CheckerboardPass(int pass, int step, bool parallel);
+        // Processes rows [top, bottom) of the pass
+        void CheckerboardPass(int top, int bottom, int pass, int step);
+        // Takes better offsets from neighbors at 'step' distance and does random search
+        force_inline void CheckerboardUpdate(const Point32& target, int step);
+        // Tests offset of the adjacent neighbor, distance is updated incrementally
+        template<int Direction, bool Horizontal> 
+        force_inline void TryNeighbor(const Point32& target, Point16& bestOffset, DistanceType& bestD);
+        // Tests offset of the distant neighbor
+        force_inline void TryNeighbor(const Point32& target, const Point32& neighbor, Point16& bestOffset, DistanceType& bestD);
+        // Return true if summaries prove that distance from target to source patch is not below 'known'
+        force_inline bool BoundRejects(const Point32& targetPatch, const Point32& sourcePatch, DistanceType known);
 
         #pragma region Propagate support methods
         template<int Direction> force_inline DistanceType MoveDistanceByDx(const Point32& target);
         template<int Direction> force_inline DistanceType MoveDistanceByDy(const Point32& target);
 
-        template<int Direction> bool CheckX(int x); // no implementation here
-        template<> inline bool CheckX<-1>(int x) { return x > _targetRect.Left; }
-        template<> inline bool CheckX<+1>(int x) { return x < _targetRect.Right - 1; }
-
-        template<int Direction> bool CheckY(int x);
-        template<> inline bool CheckY<-1>(int y) { return y > _targetRect.Top; }
-        template<> inline bool CheckY<+1>(int y) { return y < _targetRect.Bottom - 1; }
+        // Direction is a compile time constant, so only one comparison is left after inlining
+        template<int Direction> bool CheckX(int x) { return Direction < 0 ? x > _targetRect.Left : x < _targetRect.Right - 1; }
+        template<int Direction> bool CheckY(int y) { return Direction < 0 ? y > _targetRect.Top : y < _targetRect.Bottom - 1; }
         #pragma endregion
 
         // Calculate distance from target to source patch.
-        // If EarlyTermination == true use 'known' to stop calculation once distance > known
+        // If EarlyTermination == true use 'known' to stop calculation once distance > known,
+        // the check is done once per patch row and before the first one for mask penalty.
         template<bool EarlyTermination>
         force_inline DistanceType Distance(const Point32& targetPatch, const Point32& sourcePatch, DistanceType known = 0);
 
-        // Return distance between pixels
-        force_inline DistanceType PixelDistance(int sx, int sy, int tx, int ty);
+        // Return pointer to the source pixel, following Size - 1 pixels are contiguous and the one below
+        // is _sourcePitch pixels further
+        force_inline const PixelType* SourcePixel(int x, int y);
+        // Starts loading source rows of the patch centered in (sx, sy) and its mask count into caches
+        force_inline void PrefetchPatch(int sx, int sy);
+        // Return distance between rows of Size pixels starting at (sx, sy) and (tx, ty)
+        force_inline DistanceType RowDistance(int sx, int sy, int tx, int ty);
+        // Return distance between columns of Size pixels starting at (sx, sy) and (tx, ty)
+        force_inline DistanceType ColumnDistance(int sx, int sy, int tx, int ty);
+        // Return penalty for masked pixels covered by source patch centered in (sx, sy)
+        force_inline DistanceType MaskPenalty(int sx, int sy);
 
         // handy shortcut
-        force_inline Point16& f(const Point32& p) { return Field(p.x, p.y); }
+        force_inline Point16& f(const Point32& p) { return _field(p.x, p.y); }
+
+        // Changes cached distance of the patch, keeps _rowMeasure up to date
+        force_inline void SetDistance(int x, int y, DistanceType distance);
+        // Changes offset and cached distance of the patch, updates statistics
+        force_inline void SetMatch(const Point32& target, const Point16& offset, DistanceType distance);
+        // Return runners-up of the target patch
+        force_inline RunnerUp* RunnersUp(const Point32& target)
+        {
+            return &_runnersUp[(target.x + target.y * Target.Width()) * (K - 1)];
+        }
+        // Keeps offset which is not the best one among runners-up if it is better than the worst of them
+        force_inline void OfferRunnerUp(const Point32& target, const Point16& offset, DistanceType distance);
+        // Return distance candidates have to beat to be kept: the best one or the worst runner-up
+        force_inline DistanceType KeepDistance(const Point32& target, DistanceType bestD);
+        // Recalculates distances of runners-up covering changed pixels and sorts them again
+        void UpdateRunnersUp(const Point32& target, bool sourceChanged);
+        // Return false when SkipConverged lets the patch be skipped by this iteration
+        force_inline bool IsActive(const Point32& target);
+        // Marks offset or distance of the patch as changed by this iteration, see SkipConverged
+        force_inline void MarkChanged(int x, int y, int iteration);
+        // Sums up counters of target rows into iteration and total counters
+        void CollectCounters();
+        // Return true once CancelFlag is set, Field and D are left partially updated then
+        inline bool IsCancelled() const;
 
     private:
         // Used to implement multithreading
@@ -105,34 +304,83 @@ namespace IRL
             SuperPatch* RightNeighbor;
             SuperPatch* BottomNeighbor;
 
-            bool AddedToQueue;
-            bool Processed;
+            // How many neighbors it waits for in current scan order
+            AtomicInt Predecessors;
+            // Longest time of dependent super patches ending with this one, set once it is processed
+            int64_t PathTime;
         };
 
         // Used to implement multithreading.
-        // All tasks share queue with superpatches.
+        // Each task takes ready superpatches from its own queue first
+        // and from queues of other tasks when its own is empty.
         class IterationTask :
             public Parallel::Runnable
         {
         public:
             IterationTask();
-            void Initialize(NNF* owner, Queue<SuperPatch>* queue, int iteration, Mutex* lock);
+            void Initialize(NNF* owner, int index, int iteration);
             virtual void Run();
+            // Return time spent processing super patches
+            int64_t GetBusyTime() const { return _busyTime; }
         private:
-            inline void VisitRightPatch(SuperPatch* patch);
-            inline void VisitBottomPatch(SuperPatch* patch);
-            inline void VisitLeftPatch(SuperPatch* patch);
-            inline void VisitTopPatch(SuperPatch* patch);
+            // Get ready superpatch from own or other tasks queues, NULL if there is no one
+            inline SuperPatch* GetReadyPatch();
+            // Notifies successors of processed superpatch.
+            // Returns one of ready successors to process next, other ones are queued
+            inline SuperPatch* Finish(SuperPatch* patch);
+            // Returns true if 'patch' became ready
+            inline bool Visit(SuperPatch* patch);
         private:
             NNF* _owner;
-            Queue<SuperPatch>* _queue;
+            int _index;
             int _iteration;
-            Mutex* _lock;
+            int64_t _busyTime;
+        };
+
+        // Used to implement multithreading in UpdateDistances.
+        // Each task handles its own range of target rows.
+        class UpdateDistancesTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                NNF* Owner;
+                bool SourceChanged;
+            };
+
+            void Set(int start, int stop, const State& state);
+            virtual void Run();
+        private:
+            int _start;
+            int _stop;
+            State _state;
+        };
+
+        // Used to implement multithreading in checkerboard passes.
+        // Each task handles its own range of target rows.
+        class CheckerboardTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                NNF* Owner;
+                int Pass;
+                int Step;
+            };
+
+            void Set(int start, int stop, const State& state);
+            virtual void Run();
+        private:
+            int _start;
+            int _stop;
+            State _state;
         };
 
     private:
-        // Random generator. Note: in parallel mode result is also depends on thread scheduling
-        Random _random;
+        // Key of random streams of the running pass, see PassKey
+        uint64_t _passKey;
         // Current iteration number (starts with 0)
         int _iteration;
 
@@ -141,18 +389,76 @@ namespace IRL
         // Rectangle with allowed target patch centers
         Rectangle<int32_t> _targetRect;
 
+        // Unchecked views used in inner loops, valid after BindViews()
+        ConstImageView<PixelType>        _source;
+        ConstImageView<PixelType>        _target;
+        // Copy of Source read instead of _source when TiledSource, copied whole by BindViews once dirty
+        TiledImage<PixelType>            _tiledSource;
+        bool                             _tiledSourceDirty;
+        bool                             _tiled;       // TiledSource as of BindViews
+        int32_t                          _sourcePitch; // pixels between rows of SourcePixel
+        ImageView<Point16>               _field;
+        ImageView<Alpha<StoredDistanceType> > _distance;
+
+        // Summed area table of changed pixels, used by UpdateDistances
+        Image<int32_t>                   _changedSum;
+        ConstImageView<int32_t>          _changed;
+
+        // Statistics of target rows. Every row is changed by one task at a time.
+        std::vector<double>              _rowMeasure; // sum of distances
+        std::vector<int32_t>             _rowChanges; // offsets updates during current iteration
+        std::vector<NNFCounters>         _rowCounters; // work counters of current iteration, see NNF_COUNT
+        // Iteration which last changed the patch per target pixel without stride, -1 for never, empty unless
+        // SkipConverged. Written by the task processing the pixel, adjacent pixels read it.
+        std::vector<int32_t>             _changedIteration;
+        // K - 1 runners-up per target pixel without stride, sorted lists of fixed size. Every list is
+        // changed by the task processing its pixel only.
+        std::vector<RunnerUp>            _runnersUp;
+        NNFCounters                      _iterationCounters;
+        NNFCounters                      _totalCounters;
+        NNFWavefront                     _wavefront;
+
+        // Patch row distance kernel
+        typename Internal::PatchRowKernel<PixelType, Size>::Function _rowDistance;
+
+        // OpenCL backend, created by the first device iteration
+        Internal::DeviceNNF*             _device;
+        bool                             _deviceFailed;      // do not try device again
+        bool                             _deviceSourceDirty; // Source has to be uploaded again
+        bool                             _deviceTargetDirty; // Target has to be uploaded again
+        int                              _deviceIteration;   // iteration device state is valid for, -1 if none
+        std::vector<float>               _devicePixels;      // image converted for device, Index or summaries
+        std::vector<Point16>             _deviceField;
+        std::vector<float>               _deviceDistances;
+
+        // Index leaves of target patches, found again by the iteration after Target changes
+        std::vector<int32_t>             _indexLeaves;
+        bool                             _indexLeavesDirty;
+        // Summaries of patches for UsePatchBounds, computed again by the iteration after the image changes
+        PatchSummaries                   _sourceSummaries;
+        PatchSummaries                   _targetSummaries;
+        bool                             _sourceSummariesDirty;
+        bool                             _targetSummariesDirty;
+        // Either SourceSummaries or _sourceSummaries, valid after the iteration prepared them
+        const PatchSummaries*            _usedSourceSummaries;
+        // Valid patches of SourceMask, either SourcePatches or computed ones, valid after Initialize()
+        const ValidPatches*              _validPatches;
+        ValidPatches                     _ownValidPatches;
+
         // Multithreading support
-        Queue<SuperPatch> _superPatchQueue;
+        std::vector<LockFreeQueue<SuperPatch> > _readyQueues; // one per task
+        AtomicInt _unprocessed;                               // superpatches left in current iteration
         std::vector<SuperPatch> _superPatches;
+        int _superPatchWidth;                                 // pixels processed in one sequential step in parallel mode
+        int _superPatchHeight;
         SuperPatch* _topLeftSuperPatch;
         SuperPatch* _bottomRightSuperPatch;
-        Mutex _lock;
     };
 
-    template<class PixelType>
+    template<class PixelType, int Size>
     typename PixelType::DistanceType PatchDistanceUpperBound()
     {
-        return PixelType::DistanceUpperBound() * PatchSize * PatchSize;
+        return PixelType::DistanceUpperBound() * Size * Size;
     }
 }
 
@@ -4,118 +4,205 @@
 
 namespace IRL
 {
-    const int RandomSearchInvAlpha = 2;         // how much to cut each step during random search
-    const int RandomSearchLimit = 80;           // how many pixels to examine during random search
-    const int SuperPatchSize = 2 * PatchSize;   // how many pixels to process in one sequential step in parallel mode
+    const int JumpFloodSteps = 3;               // how many first checkerboard iterations take offsets from distant neighbors
+    const int PrepareCachePass = -1;            // checkerboard pass which fills D
+    const int ExhaustivePass = -2;              // checkerboard pass which tests all source patches
+    const int ConvergedExploration = 16;        // one in so many converged patches is processed anyway, see SkipConverged
+    const int WavefrontSlack = 4;               // super patches per worker the average wavefront has to hold
+    const int MaxSuperPatchScale = 8;           // largest super patch side in patch sizes
+    const int RandomSearchBatch = 8;            // candidates prefetched at once by BatchedRandomSearch
 
     //////////////////////////////////////////////////////////////////////////
     // IterationTask implementation
 
-    template<class PixelType, bool UseSourceMask>
-    NNF<PixelType, UseSourceMask>::IterationTask::IterationTask() : 
-    _queue(NULL), _owner(NULL), _iteration(0), _lock(NULL)
+    template<class PixelType, bool UseSourceMask, int Size>
+    NNF<PixelType, UseSourceMask, Size>::IterationTask::IterationTask() : 
+    _owner(NULL), _index(0), _iteration(0), _busyTime(0)
     { }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::IterationTask::Initialize(NNF* owner, 
-        Queue<SuperPatch>* queue, int iteration, Mutex* lock)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::IterationTask::Initialize(NNF* owner, int index, int iteration)
     {
         _owner = owner;
-        _queue = queue;
+        _index = index;
         _iteration = iteration;
-        _lock = lock;
+        _busyTime = 0;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::IterationTask::Run()
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::IterationTask::Run()
     {
+        SuperPatch* superPatch = NULL;
         while (1)
         {
-            SuperPatch* superPatch = _queue->Get();
             if (superPatch == NULL)
-                break; // quit signal
-            _owner->Iteration(superPatch->Left, superPatch->Top, superPatch->Right, superPatch->Bottom, _iteration);
-            _lock->Lock();
-            superPatch->Processed = true;
-            if ((_iteration % 2) == 0) // direct scan order?
-            {
-                VisitRightPatch(superPatch->RightNeighbor);
-                VisitBottomPatch(superPatch->BottomNeighbor);
-                if (superPatch->RightNeighbor == NULL && superPatch->BottomNeighbor == NULL)
-                    _queue->Add(NULL); // it was the last patch, send quit signal
-            } else
+                superPatch = GetReadyPatch();
+            if (superPatch == NULL)
             {
-                VisitLeftPatch(superPatch->LeftNeighbor);
-                VisitTopPatch(superPatch->TopNeighbor);
-                if (superPatch->LeftNeighbor == NULL && superPatch->TopNeighbor == NULL)
-                    _queue->Add(NULL); // it was the last patch, send quit signal
+                if (_owner->_unprocessed.Load() == 0)
+                    break; // all done
+                Thread::YieldCurrentThread(); // wait for the wavefront
+                continue;
             }
-            _lock->Unlock();
+            // cancelled patches are only passed on, so the wavefront drains without work
+            const int64_t start = Tools::GetTime();
+            if (!_owner->IsCancelled())
+                _owner->Iteration(superPatch->Left, superPatch->Top, superPatch->Right, superPatch->Bottom, _iteration);
+            const int64_t time = Tools::GetTime() - start;
+            _busyTime += time;
+
+            // predecessors are processed, Visit made their path times visible
+            const SuperPatch* first = (_iteration % 2) == 0 ? superPatch->LeftNeighbor : superPatch->RightNeighbor;
+            const SuperPatch* second = (_iteration % 2) == 0 ? superPatch->TopNeighbor : superPatch->BottomNeighbor;
+            int64_t path = 0;
+            if (first != NULL)
+                path = first->PathTime;
+            if (second != NULL)
+                path = Maximum(path, second->PathTime);
+            superPatch->PathTime = path + time;
+            superPatch = Finish(superPatch);
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    inline void NNF<PixelType, UseSourceMask>::IterationTask::VisitRightPatch(SuperPatch* patch)
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline typename NNF<PixelType, UseSourceMask, Size>::SuperPatch* 
+        NNF<PixelType, UseSourceMask, Size>::IterationTask::GetReadyPatch()
     {
-        if (patch != NULL && !patch->AddedToQueue)
+        int count = (int)_owner->_readyQueues.size();
+        for (int i = 0; i < count; i++)
         {
-            if (patch->TopNeighbor != NULL && !patch->TopNeighbor->Processed)
-                return;
-            patch->AddedToQueue = true;
-            _queue->Add(patch);
+            SuperPatch* patch = _owner->_readyQueues[(_index + i) % count].Get();
+            if (patch != NULL)
+                return patch;
         }
+        return NULL;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    inline void NNF<PixelType, UseSourceMask>::IterationTask::VisitBottomPatch(SuperPatch* patch)
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline typename NNF<PixelType, UseSourceMask, Size>::SuperPatch* 
+        NNF<PixelType, UseSourceMask, Size>::IterationTask::Finish(SuperPatch* patch)
     {
-        if (patch != NULL && !patch->AddedToQueue)
+        SuperPatch* first;
+        SuperPatch* second;
+        if ((_iteration % 2) == 0) // direct scan order?
         {
-            if (patch->LeftNeighbor != NULL && !patch->LeftNeighbor->Processed)
-                return;
-            patch->AddedToQueue = true;
-            _queue->Add(patch);
+            first = patch->RightNeighbor;
+            second = patch->BottomNeighbor;
+        } else
+        {
+            first = patch->LeftNeighbor;
+            second = patch->TopNeighbor;
         }
-    }
 
-    template<class PixelType, bool UseSourceMask>
-    inline void NNF<PixelType, UseSourceMask>::IterationTask::VisitLeftPatch(SuperPatch* patch)
-    {
-        if (patch != NULL && !patch->AddedToQueue)
+        // keep one ready successor for this task, it shares border pixels with processed patch
+        SuperPatch* next = NULL;
+        if (Visit(first))
+            next = first;
+        if (Visit(second))
         {
-            if (patch->BottomNeighbor != NULL && !patch->BottomNeighbor->Processed)
-                return;
-            patch->AddedToQueue = true;
-            _queue->Add(patch);
+            if (next == NULL)
+                next = second;
+            else
+                _owner->_readyQueues[_index].Add(second);
         }
+        _owner->_unprocessed.FetchAndAdd(-1);
+        return next;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    inline void NNF<PixelType, UseSourceMask>::IterationTask::VisitTopPatch(SuperPatch* patch)
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline bool NNF<PixelType, UseSourceMask, Size>::IterationTask::Visit(SuperPatch* patch)
     {
-        if (patch != NULL && !patch->AddedToQueue)
-        {
-            if (patch->RightNeighbor != NULL && !patch->RightNeighbor->Processed)
-                return;
-            patch->AddedToQueue = true;
-            _queue->Add(patch);
-        }
+        // the last visitor makes patch ready, full barrier makes results of other visitors visible
+        return patch != NULL && patch->Predecessors.FetchAndAdd(-1) == 1;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // UpdateDistancesTask implementation
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::UpdateDistancesTask::Set(int start, int stop, const State& state)
+    {
+        _start = start;
+        _stop = stop;
+        _state = state;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::UpdateDistancesTask::Run()
+    {
+        _state.Owner->UpdateDistances(_start, _stop, _state.SourceChanged);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // CheckerboardTask implementation
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CheckerboardTask::Set(int start, int stop, const State& state)
+    {
+        _start = start;
+        _stop = stop;
+        _state = state;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CheckerboardTask::Run()
+    {
+        _state.Owner->CheckerboardPass(_start, _stop, _state.Pass, _state.Step);
     }
 
     //////////////////////////////////////////////////////////////////////////
     // NNF implementation
 
-    template<class PixelType, bool UseSourceMask>
-    NNF<PixelType, UseSourceMask>::NNF()
+    template<class PixelType, bool UseSourceMask, int Size>
+    NNF<PixelType, UseSourceMask, Size>::NNF()
     {
         SearchRadius = -1;
+        Propagation = ScanOrderPropagation;
+        Backend = CpuBackend;
+        TargetRegion = Rectangle<int32_t>(0, 0, 0, 0);
+        CancelFlag = NULL;
+        Seed = 0;
+        Index = NULL;
+        SourcePatches = NULL;
+        UsePatchBounds = false;
+        SourceSummaries = NULL;
+        K = 1;
+        SkipConverged = false;
+        RandomSearchLimit = 80;
+        RandomSearchInvAlpha = 2;
+        SuperPatchSize = 0;
+        TiledSource = false;
+        BatchedRandomSearch = false;
         _iteration = 0;
+        _indexLeavesDirty = true;
+        _sourceSummariesDirty = true;
+        _targetSummariesDirty = true;
+        _usedSourceSummaries = NULL;
+        _tiledSourceDirty = true;
+        _tiled = false;
+        _sourcePitch = 0;
+        _passKey = 0;
         _topLeftSuperPatch = NULL;
         _bottomRightSuperPatch = NULL;
+        _superPatchWidth = 0;
+        _superPatchHeight = 0;
+        _rowDistance = NULL;
+        _validPatches = NULL;
+        _device = NULL;
+        _deviceFailed = false;
+        _deviceSourceDirty = false;
+        _deviceTargetDirty = false;
+        _deviceIteration = -1;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::Initialize()
+    template<class PixelType, bool UseSourceMask, int Size>
+    NNF<PixelType, UseSourceMask, Size>::~NNF()
+    {
+        delete _device;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::Initialize()
     {
         ASSERT(Source.IsValid());
         ASSERT(Target.IsValid());
@@ -124,57 +211,184 @@ namespace IRL
         {
             ASSERT(SourceMask.IsValid());
             ASSERT((Source.Width() == SourceMask.Width() && Source.Height() == SourceMask.Height()));
+            if (SourcePatches == NULL)
+            {
+                _ownValidPatches.Compute(SourceMask.Get(), Size);
+                _validPatches = &_ownValidPatches;
+            } else
+            {
+                ASSERT(SourcePatches->Width() == Source.Width() && SourcePatches->Height() == Source.Height());
+                _ownValidPatches.Clear();
+                _validPatches = SourcePatches;
+            }
         } 
 
         ASSERT(Field.IsValid());
         ASSERT(Field.Width() == Target.Width());
         ASSERT(Field.Height() == Target.Height());
 
-        D = DistanceField(Target.Width(), Target.Height());
+        // reuse distances buffer and super patches from the previous run if possible
+        bool resized = !D.IsValid() || D.Width() != Target.Width() || D.Height() != Target.Height();
+        if (resized)
+            D = DistanceField(Target.Width(), Target.Height());
 
-        _sourceRect.Left = HalfPatchSize;
-        _sourceRect.Right = Source.Width() - HalfPatchSize;
-        _sourceRect.Top = HalfPatchSize;
-        _sourceRect.Bottom = Source.Height() - HalfPatchSize;
+        _tiledSourceDirty = true;
+        BindViews();
+        _rowDistance = Internal::PatchRowKernel<PixelType, Size>::Get();
 
-        _targetRect.Left = HalfPatchSize;
-        _targetRect.Right = Target.Width() - HalfPatchSize;
-        _targetRect.Top = HalfPatchSize;
-        _targetRect.Bottom = Target.Height() - HalfPatchSize;
+        _sourceRect.Left = HalfSize;
+        _sourceRect.Right = Source.Width() - HalfSize;
+        _sourceRect.Top = HalfSize;
+        _sourceRect.Bottom = Source.Height() - HalfSize;
 
-        BuildSuperPatches();
+        _targetRect.Left = HalfSize;
+        _targetRect.Right = Target.Width() - HalfSize;
+        _targetRect.Top = HalfSize;
+        _targetRect.Bottom = Target.Height() - HalfSize;
+        // region which does not intersect the image falls back to the whole image
+        if (!TargetRegion.IsEmpty() && !_targetRect.Intersection(TargetRegion).IsEmpty())
+            _targetRect = _targetRect.Intersection(TargetRegion);
+
+        // super patches cover the target rectangle, so they are rebuilt when it or their size changes
+        int superPatchWidth;
+        int superPatchHeight;
+        ChooseSuperPatchSize(superPatchWidth, superPatchHeight);
+        if (superPatchWidth != _superPatchWidth || superPatchHeight != _superPatchHeight)
+        {
+            _superPatchWidth = superPatchWidth;
+            _superPatchHeight = superPatchHeight;
+            _superPatches.clear();
+        }
+        if (resized || _superPatches.empty() ||
+            _superPatches.front().Left != _targetRect.Left || _superPatches.front().Top != _targetRect.Top ||
+            _superPatches.back().Right != _targetRect.Right || _superPatches.back().Bottom != _targetRect.Bottom)
+            BuildSuperPatches();
+
+        // distances are summed up by the first iteration
+        _rowMeasure.assign(Target.Height(), 0.0);
+        _rowChanges.assign(Target.Height(), 0);
+#ifdef IRL_NNF_COUNTERS
+        _rowCounters.assign(Target.Height(), NNFCounters());
+#endif
 
         int maxSR = Maximum(Source.Width(), Source.Height());
         if (SearchRadius < 0 || SearchRadius > maxSR)
             SearchRadius = maxSR;
+        if (K < 1)
+            K = 1;
+        if (K > MaxK)
+            K = MaxK;
+        if (K > 1)
+        {
+            RunnerUp empty;
+            empty.Offset = Point16(0, 0);
+            empty.Distance = std::numeric_limits<StoredDistanceType>::max();
+            _runnersUp.assign((size_t)Target.Width() * Target.Height() * (K - 1), empty);
+        } else
+            std::vector<RunnerUp>().swap(_runnersUp);
+        if (SkipConverged)
+            _changedIteration.assign((size_t)Target.Width() * Target.Height(), -1);
+        else
+            std::vector<int32_t>().swap(_changedIteration);
+        _indexLeavesDirty = true;
+        _sourceSummariesDirty = true;
+        _targetSummariesDirty = true;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::BindViews()
+    {
+        // inputs are read only, so use const views to avoid copy-on-write of shared images
+        _source = Source.ConstView();
+        _target = Target.ConstView();
+        _field = Field.View();
+        _distance = D.View();
+        _tiled = TiledSource;
+        if (_tiled)
+        {
+            if (_tiledSourceDirty)
+            {
+                Tools::Profiler profiler("TileSource");
+                _tiledSource.Assign(_source, Size - 1);
+                _tiledSourceDirty = false;
+            }
+            _sourcePitch = _tiledSource.Pitch();
+        } else
+        {
+            _tiledSource.Clear();
+            _tiledSourceDirty = true;
+            _sourcePitch = _source.Stride();
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::Reset()
+    {
+        _iteration = 0;
+        _deviceIteration = -1;
+        _deviceSourceDirty = false;
+        _deviceTargetDirty = false;
+        _iterationCounters.Clear();
+        _totalCounters.Clear();
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::ChooseSuperPatchSize(int& width, int& height) const
+    {
+        // The wavefront processes anti-diagonals of the grid of super patches one after another, so
+        // a grid of W x H holds W * H / (W + H - 1) super patches on average. Small super patches keep
+        // more workers busy, large ones cost less scheduling and share more cached rows. The largest
+        // ones which keep the average wavefront at WavefrontSlack per worker are taken, stretched along
+        // the longer side of the target, so that the grid is closer to a square and ramps up faster.
+        if (SuperPatchSize > 0)
+        {
+            width = height = Maximum(SuperPatchSize, Size);
+            return;
+        }
+        const int targetWidth = _targetRect.Right - _targetRect.Left;
+        const int targetHeight = _targetRect.Bottom - _targetRect.Top;
+        const double aspect = sqrt(Maximum(0.25, Minimum(4.0, (double)targetWidth / Maximum(targetHeight, 1))));
+        const int workers = (int)Parallel::GetConcurrency();
+        for (int side = MaxSuperPatchScale * Size; ; side--)
+        {
+            width = Maximum(Size, (int)(side * aspect + 0.5));
+            height = Maximum(Size, (int)(side / aspect + 0.5));
+            if (side <= Size)
+                return;
+            const int64_t w = (targetWidth + width - 1) / width;
+            const int64_t h = (targetHeight + height - 1) / height;
+            if (w * h >= (int64_t)WavefrontSlack * workers * (w + h - 1))
+                return;
+        }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::BuildSuperPatches()
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::BuildSuperPatches()
     {
         Tools::Profiler profiler("BuildSuperPatches");
 
-        int w = (_targetRect.Right - _targetRect.Left) / SuperPatchSize + 1;
-        int h = (_targetRect.Bottom - _targetRect.Top) / SuperPatchSize + 1;
+        int w = (_targetRect.Right - _targetRect.Left) / _superPatchWidth + 1;
+        int h = (_targetRect.Bottom - _targetRect.Top) / _superPatchHeight + 1;
+        _superPatches.clear();
         _superPatches.reserve(w * h);
         int y = _targetRect.Top;
         while (y < _targetRect.Bottom)
         {
             w = 0;
             int x = _targetRect.Left;
-            int bottomLine = Minimum<int>(y + SuperPatchSize, _targetRect.Bottom);
+            int bottomLine = Minimum<int>(y + _superPatchHeight, _targetRect.Bottom);
             while (x < _targetRect.Right)
             {
                 SuperPatch patch;
                 patch.Left   = x;
                 patch.Top    = y;
-                patch.Right  = Minimum<int>(x + SuperPatchSize, _targetRect.Right);
+                patch.Right  = Minimum<int>(x + _superPatchWidth, _targetRect.Right);
                 patch.Bottom = bottomLine;
                 _superPatches.push_back(patch);
-                x += SuperPatchSize;
+                x += _superPatchWidth;
                 w++;
             }
-            y += SuperPatchSize;
+            y += _superPatchHeight;
         }
         _topLeftSuperPatch = &_superPatches.front();
         _bottomRightSuperPatch = &_superPatches.back();
@@ -202,42 +416,105 @@ namespace IRL
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::Iteration(bool parallel = true)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::Iteration(bool parallel)
     {
         if (_iteration == 0)
             Initialize();
+        else
+            BindViews();
 
         Tools::Profiler profiler("Iteration");
-        if (!parallel)
+        for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+            _rowChanges[y] = 0;
+        _wavefront.Clear();
+        if (Backend == OpenCLBackend && K == 1 && Propagation != ExhaustiveSearch && DeviceIteration())
+        {
+            CollectCounters(); // device does not count its work
+            _iteration++;
+            return;
+        }
+        if (_iteration > 0 && (_deviceSourceDirty || _deviceTargetDirty))
+        {
+            // UpdateDistances left distances to the device, but CPU continues
+            for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+                _rowMeasure[y] = 0;
+            CheckerboardPass(PrepareCachePass, 0, parallel);
+            _deviceSourceDirty = false;
+            _deviceTargetDirty = false;
+        }
+        if (UsePatchBounds && SourceSummaries == NULL && _sourceSummariesDirty)
+        {
+            Internal::ConvertForDevice(Source.Get(), _devicePixels);
+            _sourceSummaries.Compute(_devicePixels, Source.Width(), Source.Height(), Size);
+            _sourceSummariesDirty = false;
+        }
+        _usedSourceSummaries = SourceSummaries != NULL ? SourceSummaries : &_sourceSummaries;
+        const bool leaves = Index != NULL && _indexLeavesDirty;
+        const bool summaries = UsePatchBounds && _targetSummariesDirty;
+        if (leaves || summaries)
+        {
+            Internal::ConvertForDevice(Target.Get(), _devicePixels);
+            if (leaves)
+                Index->FindLeaves(_devicePixels, Target.Width(), _targetRect, _indexLeaves);
+            if (summaries)
+                _targetSummaries.Compute(_devicePixels, Target.Width(), Target.Height(), Size);
+            _indexLeavesDirty = _indexLeavesDirty && !leaves;
+            _targetSummariesDirty = _targetSummariesDirty && !summaries;
+        }
+        _passKey = PassKey(0); // scan order iteration is one pass, checkerboard ones set their keys
+        if (Propagation == CheckerboardPropagation)
+            CheckerboardIteration(parallel);
+        else if (Propagation == ExhaustiveSearch)
+            ExhaustiveIteration(parallel);
+        else if (!parallel)
             Iteration(_targetRect.Left, _targetRect.Top, _targetRect.Right, _targetRect.Bottom, _iteration);
         else
         {
-            _superPatchQueue.Reinitialize();
-            for (unsigned int i = 0; i < _superPatches.size(); i++)
+            Parallel::TaskGroup<IterationTask> workers;
+            if ((int)_readyQueues.size() != workers.Count())
+                _readyQueues.resize(workers.Count());
+            for (unsigned int i = 0; i < _readyQueues.size(); i++)
             {
-                _superPatches[i].AddedToQueue = false;
-                _superPatches[i].Processed = false;
+                _readyQueues[i].Reserve(_superPatches.size());
+                _readyQueues[i].Reinitialize();
             }
-            if ((_iteration % 2) == 0)
-            {
-                _topLeftSuperPatch->AddedToQueue = true;
-                _superPatchQueue.Add(_topLeftSuperPatch); // direct scan order
-            } else
+            for (unsigned int i = 0; i < _superPatches.size(); i++)
             {
-                _bottomRightSuperPatch->AddedToQueue = true;
-                _superPatchQueue.Add(_bottomRightSuperPatch); // reverse scan order
+                SuperPatch& patch = _superPatches[i];
+                if ((_iteration % 2) == 0)
+                    patch.Predecessors.Store((patch.LeftNeighbor != NULL) + (patch.TopNeighbor != NULL));
+                else
+                    patch.Predecessors.Store((patch.RightNeighbor != NULL) + (patch.BottomNeighbor != NULL));
             }
-            Parallel::TaskGroup<IterationTask> workers;
+            _unprocessed.Store((int)_superPatches.size());
+            if ((_iteration % 2) == 0)
+                _readyQueues[0].Add(_topLeftSuperPatch); // direct scan order
+            else
+                _readyQueues[0].Add(_bottomRightSuperPatch); // reverse scan order
+
             for (int i = 0; i < workers.Count(); i++)
-                workers[i].Initialize(this, &_superPatchQueue, _iteration, &_lock);
+                workers[i].Initialize(this, i, _iteration);
+            const int64_t start = Tools::GetTime();
             workers.SpawnAndSync();
+
+            _wavefront.Workers = workers.Count();
+            _wavefront.SuperPatchWidth = _superPatchWidth;
+            _wavefront.SuperPatchHeight = _superPatchHeight;
+            _wavefront.SuperPatches = (int)_superPatches.size();
+            _wavefront.WallTime = Tools::GetTime() - start;
+            for (int i = 0; i < workers.Count(); i++)
+                _wavefront.BusyTime += workers[i].GetBusyTime();
+            _wavefront.IdleTime = Maximum<int64_t>(_wavefront.WallTime * workers.Count() - _wavefront.BusyTime, 0);
+            // the last super patch of the scan order ends every chain
+            _wavefront.CriticalPath = ((_iteration % 2) == 0 ? _bottomRightSuperPatch : _topLeftSuperPatch)->PathTime;
         }
+        CollectCounters();
         _iteration++;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::Iteration(int left, int top, int right, int bottom, int iteration)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::Iteration(int left, int top, int right, int bottom, int iteration)
     {
         if (iteration == 0)
             PrepareCache(left, top, right, bottom);
@@ -247,25 +524,172 @@ namespace IRL
             ReverseScanOrder(left, top, right, bottom);
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::PrepareCache(int left, int top, int right, int bottom)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::PrepareCache(int left, int top, int right, int bottom)
     {
         for (int32_t y = top; y < bottom; y++)
         {
             for (int32_t x = left; x < right; x++)
             {
                 const Point32 p(x, y);
-                D.Pixel(x, y).A = Distance<false>(p, p + f(p));
+                // initial fields may come from other patch sizes and point too close to the border
+                Point32 source = p + f(p);
+                source.x = Maximum<int32_t>(_sourceRect.Left, Minimum<int32_t>(source.x, _sourceRect.Right - 1));
+                source.y = Maximum<int32_t>(_sourceRect.Top, Minimum<int32_t>(source.y, _sourceRect.Bottom - 1));
+                f(p) = Point16(source - p);
+                const DistanceType distance = Distance<false>(p, source);
+                _distance(x, y).A = distance;
+                _rowMeasure[y] += distance;
             }
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::DirectScanOrder(int left, int top, int right, int bottom)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::UpdateDistances(const Image<uint8_t>& changed, bool sourceChanged, bool parallel)
+    {
+        if (_iteration == 0)
+            return; // all distances will be calculated by the first iteration
+        if (sourceChanged)
+            _sourceSummariesDirty = true;
+        else
+        {
+            _indexLeavesDirty = true;
+            _targetSummariesDirty = true;
+        }
+
+        if (Backend == OpenCLBackend && _device != NULL && _deviceIteration == _iteration)
+        {
+            // device recalculates all distances once the image is uploaded again
+            if (sourceChanged)
+            {
+                _deviceSourceDirty = true;
+                _tiledSourceDirty = true;
+            } else
+                _deviceTargetDirty = true;
+            return;
+        }
+
+        Tools::Profiler profiler("UpdateDistances");
+
+        ASSERT(changed.IsValid());
+        ASSERT(changed.Width() == (sourceChanged ? Source : Target).Width());
+        ASSERT(changed.Height() == (sourceChanged ? Source : Target).Height());
+
+        BindViews();
+
+        // summed area table with extra zero row and column on the top left
+        const int32_t w = changed.Width() + 1;
+        const int32_t h = changed.Height() + 1;
+        if (!_changedSum.IsValid() || _changedSum.Width() != w || _changedSum.Height() != h)
+            _changedSum = Image<int32_t>(w, h);
+        const ImageView<int32_t> sum = _changedSum.View();
+        const ConstImageView<uint8_t> src = changed.ConstView();
+        int32_t* row = sum.Row(0);
+        for (int32_t x = 0; x < w; x++)
+            row[x] = 0;
+        for (int32_t y = 1; y < h; y++)
+        {
+            const uint8_t* c = src.Row(y - 1);
+            const int32_t* prev = sum.Row(y - 1);
+            row = sum.Row(y);
+            int32_t rowSum = 0;
+            row[0] = 0;
+            for (int32_t x = 1; x < w; x++)
+            {
+                if (c[x - 1] != 0)
+                    rowSum++;
+                row[x] = prev[x] + rowSum;
+            }
+        }
+        _changed = sum;
+
+        // the tiled copy is refreshed by rows with changed pixels, which are few when the solver has a Region
+        if (sourceChanged && _tiled)
+        {
+            Tools::Profiler profiler("TileSource");
+            for (int32_t y = 1; y < h; y++)
+                if (sum.Row(y)[w - 1] != sum.Row(y - 1)[w - 1])
+                    _tiledSource.AssignRow(_source, y - 1);
+        }
+
+        if (!parallel)
+            UpdateDistances(_targetRect.Top, _targetRect.Bottom, sourceChanged);
+        else
+        {
+            typename UpdateDistancesTask::State state;
+            state.Owner = this;
+            state.SourceChanged = sourceChanged;
+            Parallel::ParallelFor<UpdateDistancesTask, typename UpdateDistancesTask::State> 
+                tasks(_targetRect.Top, _targetRect.Bottom, state);
+            tasks.SpawnAndSync();
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::UpdateDistances(int top, int bottom, bool sourceChanged)
+    {
+        for (int32_t y = top; y < bottom; y++)
+        {
+            for (int32_t x = _targetRect.Left; x < _targetRect.Right; x++)
+            {
+                const Point32 p(x, y);
+                const Point32 q = p + f(p);
+                if (sourceChanged ? PatchChanged(q.x, q.y) : PatchChanged(x, y))
+                {
+                    SetDistance(x, y, Distance<false>(p, q));
+                    // better offsets may be around now, as if the previous iteration changed it
+                    MarkChanged(x, y, _iteration - 1);
+                }
+                if (K > 1)
+                    UpdateRunnersUp(p, sourceChanged);
+            }
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::UpdateRunnersUp(const Point32& target, bool sourceChanged)
+    {
+        RunnerUp* runnersUp = RunnersUp(target);
+        bool changed = false;
+        for (int k = 0; k < K - 1 && !runnersUp[k].IsEmpty(); k++)
+        {
+            const Point32 q = target + runnersUp[k].Offset;
+            if (sourceChanged ? PatchChanged(q.x, q.y) : PatchChanged(target.x, target.y))
+            {
+                runnersUp[k].Distance = Distance<false>(target, q);
+                changed = true;
+            }
+        }
+        if (!changed)
+            return;
+
+        // insertion sort, the list is short and mostly sorted
+        for (int k = 1; k < K - 1 && !runnersUp[k].IsEmpty(); k++)
+        {
+            const RunnerUp runnerUp = runnersUp[k];
+            int i = k;
+            for (; i > 0 && runnersUp[i - 1].Distance > runnerUp.Distance; i--)
+                runnersUp[i] = runnersUp[i - 1];
+            runnersUp[i] = runnerUp;
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    bool NNF<PixelType, UseSourceMask, Size>::PatchChanged(int x, int y)
+    {
+        const int32_t* top = _changed.Row(y - HalfSize);
+        const int32_t* bottom = _changed.Row(y + HalfSize + 1);
+        const int left = x - HalfSize;
+        const int right = x + HalfSize + 1;
+        return bottom[right] - bottom[left] - top[right] + top[left] != 0;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::DirectScanOrder(int left, int top, int right, int bottom)
     {
         // Top left point is special - nowhere to propagate from,
         // so do only random search on it
-        if (left == _targetRect.Left && top == _targetRect.Top)
+        if (left == _targetRect.Left && top == _targetRect.Top && IsActive(Point32(left, top)))
             RandomSearch(Point32(left, top));
 
         int startX = left;
@@ -279,8 +703,7 @@ namespace IRL
         {
             for (int32_t px = startX; px < right; px++)
             {
-                Propagate<-1, true, false>(Point32(px, top));
-                RandomSearch(Point32(px, top));
+                ScanUpdate<-1, true, false>(Point32(px, top));
             }
         }
 
@@ -289,8 +712,7 @@ namespace IRL
         {
             for (int32_t py = startY; py < bottom; py++)
             {
-                Propagate<-1, false, true>(Point32(left, py));
-                RandomSearch(Point32(left, py));
+                ScanUpdate<-1, false, true>(Point32(left, py));
             }
         }
 
@@ -299,18 +721,17 @@ namespace IRL
         {
             for (int32_t px = startX; px < right; px++)
             {
-                Propagate<-1, true, true>(Point32(px, py));
-                RandomSearch(Point32(px, py));
+                ScanUpdate<-1, true, true>(Point32(px, py));
             }
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    void NNF<PixelType, UseSourceMask>::ReverseScanOrder(int left, int top, int right, int bottom)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::ReverseScanOrder(int left, int top, int right, int bottom)
     {
         // Bottom right point is special - nowhere to propagate from,
         // so do only random search on it
-        if (right == _targetRect.Right && bottom == _targetRect.Bottom)
+        if (right == _targetRect.Right && bottom == _targetRect.Bottom && IsActive(Point32(right - 1, bottom - 1)))
             RandomSearch(Point32(right - 1, bottom - 1));
 
         int startX = right - 1;
@@ -323,8 +744,7 @@ namespace IRL
         {
             for (int32_t px = startX; px >= left; px--)
             {
-                Propagate<+1, true, false>(Point32(px, bottom - 1));
-                RandomSearch(Point32(px, bottom - 1));
+                ScanUpdate<+1, true, false>(Point32(px, bottom - 1));
             }
         }
 
@@ -333,8 +753,7 @@ namespace IRL
         {
             for (int32_t py = startY; py >= top; py--)
             {
-                Propagate<+1, false, true>(Point32(right - 1, py));
-                RandomSearch(Point32(right - 1, py));
+                ScanUpdate<+1, false, true>(Point32(right - 1, py));
             }
         }
 
@@ -343,15 +762,24 @@ namespace IRL
         {
             for (int32_t px = startX; px >= left; px--)
             {
-                Propagate<+1, true, true>(Point32(px, py));
-                RandomSearch(Point32(px, py));
+                ScanUpdate<+1, true, true>(Point32(px, py));
             }
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
+    template<class PixelType, bool UseSourceMask, int Size>
+    template<int Direction, bool LeftAvailable, bool UpAvailable>
+    void NNF<PixelType, UseSourceMask, Size>::ScanUpdate(const Point32& target)
+    {
+        if (!IsActive(target))
+            return;
+        Propagate<Direction, LeftAvailable, UpAvailable>(target);
+        RandomSearch(target);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
     template<int Direction, bool LeftAvailable, bool UpAvailable>
-    void NNF<PixelType, UseSourceMask>::Propagate(const Point32& target)
+    void NNF<PixelType, UseSourceMask, Size>::Propagate(const Point32& target)
     {
         // Direction - -1 for direct scan order, +1 for reverse
         // LeftAvailable == true if caller guarantees that CheckX<Direction>(target.x) == true
@@ -360,9 +788,12 @@ namespace IRL
         bool changed   = false;
         Point32 best   = target;
         Point32 source = target + f(target);
-        DistanceType bestD = D.Pixel(target.x, target.y).A;
+        DistanceType bestD = _distance(target.x, target.y).A;
         if (bestD == 0)
+        {
+            NNF_COUNT(_rowCounters[target.y], ZeroDistanceSkips);
             return;
+        }
 
         if (LeftAvailable || CheckX<Direction>(target.x))
         {
@@ -372,12 +803,15 @@ namespace IRL
             {
                 DistanceType distance = MoveDistanceByDx<Direction>(pointToTest);
                 source = newSource;
+                NNF_COUNT(_rowCounters[target.y], PropagationAttempts);
                 if (distance < bestD)
                 {
+                    NNF_COUNT(_rowCounters[target.y], PropagationAccepts);
                     bestD = distance;
                     best = pointToTest;
                     changed = true;
-                }
+                } else
+                    OfferRunnerUp(target, f(pointToTest), distance);
             }
         }
 
@@ -389,125 +823,392 @@ namespace IRL
             {
                 DistanceType distance = MoveDistanceByDy<Direction>(pointToTest);
                 source = newSource;
+                NNF_COUNT(_rowCounters[target.y], PropagationAttempts);
                 if (distance < bestD)
                 {
+                    NNF_COUNT(_rowCounters[target.y], PropagationAccepts);
+                    if (changed)
+                        OfferRunnerUp(target, f(best), bestD);
                     bestD = distance;
                     best = pointToTest;
                     changed = true;
-                }
+                } else
+                    OfferRunnerUp(target, f(pointToTest), distance);
             }
         }
 
         if (changed)
         {
-            f(target) = f(best);
-            D.Pixel(target.x, target.y).A = bestD;
+            SetMatch(target, f(best), bestD);
         }
     }
 
-    template<class PixelType, bool UseSourceMask>
-    template<int Direction>
-    typename NNF<PixelType, UseSourceMask>::DistanceType 
-        NNF<PixelType, UseSourceMask>::MoveDistanceByDx(const Point32& target)
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CheckerboardIteration(bool parallel)
     {
-        DistanceType distance = D.Pixel(target.x, target.y).A;
-        Point32 source = target + f(target);
-        if (Direction == -1)
+        if (_iteration == 0)
+            CheckerboardPass(PrepareCachePass, 0, parallel);
+
+        // odd steps keep neighbors in the other color: 2^k - 1, ..., 7, 3
+        if (_iteration < JumpFloodSteps)
         {
-            // move right
-            for (int y = -HalfPatchSize; y <= HalfPatchSize; y++)
+            int step = (1 << (JumpFloodSteps - _iteration + 1)) - 1;
+            CheckerboardPass(0, step, parallel);
+            CheckerboardPass(1, step, parallel);
+        }
+        CheckerboardPass(0, 1, parallel);
+        CheckerboardPass(1, 1, parallel);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::ExhaustiveIteration(bool parallel)
+    {
+        if (_iteration == 0)
+            CheckerboardPass(PrepareCachePass, 0, parallel);
+        CheckerboardPass(ExhaustivePass, 0, parallel);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    bool NNF<PixelType, UseSourceMask, Size>::DeviceIteration()
+    {
+        if (_deviceFailed || !Internal::DeviceNNF::IsAvailable())
+            return false;
+
+        Tools::Profiler profiler("DeviceIteration");
+        if (_device == NULL)
+            _device = new Internal::DeviceNNF(Size);
+
+        // images and offsets stay on device while it is in sync with this object
+        const bool synced = _iteration > 0 && _deviceIteration == _iteration;
+        bool ok = true;
+        if (!synced || _deviceSourceDirty)
+        {
+            Internal::ConvertForDevice(Source.Get(), _devicePixels);
+            ok = ok && _device->SetSource(_devicePixels, Source.Width(), Source.Height(), 
+                UseSourceMask ? SourceMask.Get() : Image<Alpha8>(), (float)PatchDistanceUpperBound<PixelType, Size>());
+        }
+        if (!synced || _deviceTargetDirty)
+        {
+            Internal::ConvertForDevice(Target.Get(), _devicePixels);
+            ok = ok && _device->SetTarget(_devicePixels, Target.Width(), Target.Height());
+        }
+        _device->SetRects(_sourceRect, _targetRect);
+        if (!synced)
+            ok = ok && _device->SetField(Field);
+        if (!synced || _deviceSourceDirty || _deviceTargetDirty)
+            ok = ok && _device->PrepareDistances();
+
+        // same schedule as CheckerboardIteration
+        if (_iteration < JumpFloodSteps)
+        {
+            int step = (1 << (JumpFloodSteps - _iteration + 1)) - 1;
+            ok = ok && _device->Pass(0, step, SearchRadius, RandomSearchLimit, RandomSearchInvAlpha, (uint32_t)PassKey(2 * step));
+            ok = ok && _device->Pass(1, step, SearchRadius, RandomSearchLimit, RandomSearchInvAlpha, (uint32_t)PassKey(2 * step + 1));
+        }
+        ok = ok && _device->Pass(0, 1, SearchRadius, RandomSearchLimit, RandomSearchInvAlpha, (uint32_t)PassKey(2));
+        ok = ok && _device->Pass(1, 1, SearchRadius, RandomSearchLimit, RandomSearchInvAlpha, (uint32_t)PassKey(3));
+        ok = ok && _device->GetField(_deviceField) && _device->GetDistances(_deviceDistances);
+
+        if (!ok)
+        {
+            // Field and D are not changed yet, CPU continues from them
+            delete _device;
+            _device = NULL;
+            _deviceFailed = true;
+            _deviceIteration = -1;
+            return false;
+        }
+
+        DownloadDeviceResults();
+        _deviceSourceDirty = false;
+        _deviceTargetDirty = false;
+        _deviceIteration = _iteration + 1;
+        return true;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::DownloadDeviceResults()
+    {
+        // passes do not count their updates, so changes are offsets which differ after iteration
+        const int32_t width = Target.Width();
+        for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+        {
+            const Point16* offsets = &_deviceField[y * width];
+            const float* distances = &_deviceDistances[y * width];
+            double measure = 0;
+            int32_t changes = 0;
+            for (int32_t x = _targetRect.Left; x < _targetRect.Right; x++)
             {
-                distance += PixelDistance(source.x + HalfPatchSize + 1, source.y + y,
-                                          target.x + HalfPatchSize + 1, target.y + y);
+                Point16& offset = _field(x, y);
+                if (offset != offsets[x])
+                {
+                    offset = offsets[x];
+                    changes++;
+                    MarkChanged(x, y, _iteration);
+                }
+                const DistanceType distance = (DistanceType)distances[x];
+                _distance(x, y).A = distance;
+                measure += distance;
             }
-            for (int y = -HalfPatchSize; y <= HalfPatchSize; y++)
+            _rowMeasure[y] = measure;
+            _rowChanges[y] = changes;
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    uint64_t NNF<PixelType, UseSourceMask, Size>::PassKey(int pass) const
+    {
+        return CounterRandom::Key(CounterRandom::Key(Seed, (uint64_t)_iteration), (uint64_t)pass);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CheckerboardPass(int pass, int step, bool parallel)
+    {
+        // passes of one color with one step are unique within the iteration
+        if (pass != PrepareCachePass)
+            _passKey = PassKey(2 * step + pass);
+        if (!parallel)
+            CheckerboardPass(_targetRect.Top, _targetRect.Bottom, pass, step);
+        else
+        {
+            typename CheckerboardTask::State state;
+            state.Owner = this;
+            state.Pass = pass;
+            state.Step = step;
+            Parallel::ParallelFor<CheckerboardTask, typename CheckerboardTask::State> 
+                tasks(_targetRect.Top, _targetRect.Bottom, state);
+            tasks.SpawnAndSync();
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CheckerboardPass(int top, int bottom, int pass, int step)
+    {
+        if (pass == PrepareCachePass)
+        {
+            PrepareCache(_targetRect.Left, top, _targetRect.Right, bottom);
+            return;
+        }
+        if (pass == ExhaustivePass)
+        {
+            for (int32_t y = top; y < bottom && !IsCancelled(); y++)
             {
-                distance -= PixelDistance(source.x - HalfPatchSize, source.y + y,
-                                          target.x - HalfPatchSize, target.y + y);
+                for (int32_t x = _targetRect.Left; x < _targetRect.Right; x++)
+                    SearchAll(Point32(x, y));
             }
+            return;
+        }
+
+        for (int32_t y = top; y < bottom; y++)
+        {
+            if (IsCancelled())
+                return;
+            for (int32_t x = _targetRect.Left + ((_targetRect.Left + y + pass) & 1); x < _targetRect.Right; x += 2)
+                CheckerboardUpdate(Point32(x, y), step);
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline bool NNF<PixelType, UseSourceMask, Size>::IsCancelled() const
+    {
+        return CancelFlag != NULL && CancelFlag->Load() != 0;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CheckerboardUpdate(const Point32& target, int step)
+    {
+        // distant neighbors are not tracked, so jump flood passes process all patches
+        if (step == 1 && !IsActive(target))
+            return;
+        Point16 bestOffset = f(target);
+        DistanceType bestD = _distance(target.x, target.y).A;
+        if (bestD == 0)
+        {
+            NNF_COUNT(_rowCounters[target.y], ZeroDistanceSkips);
+            return;
+        }
+
+        if (step == 1)
+        {
+            TryNeighbor<-1, true>(target, bestOffset, bestD);
+            TryNeighbor<+1, true>(target, bestOffset, bestD);
+            TryNeighbor<-1, false>(target, bestOffset, bestD);
+            TryNeighbor<+1, false>(target, bestOffset, bestD);
+        } else
+        {
+            TryNeighbor(target, Point32(target.x - step, target.y), bestOffset, bestD);
+            TryNeighbor(target, Point32(target.x + step, target.y), bestOffset, bestD);
+            TryNeighbor(target, Point32(target.x, target.y - step), bestOffset, bestD);
+            TryNeighbor(target, Point32(target.x, target.y + step), bestOffset, bestD);
+        }
+
+        if (bestOffset != f(target))
+        {
+            SetMatch(target, bestOffset, bestD);
+        }
+        RandomSearch(target);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    template<int Direction, bool Horizontal>
+    void NNF<PixelType, UseSourceMask, Size>::TryNeighbor(const Point32& target, Point16& bestOffset, DistanceType& bestD)
+    {
+        if (Horizontal ? !CheckX<Direction>(target.x) : !CheckY<Direction>(target.y))
+            return;
+        const Point32 pointToTest = Horizontal ? 
+            Point32(target.x + Direction, target.y) : Point32(target.x, target.y + Direction);
+        const Point16 offset = f(pointToTest);
+        if (offset == bestOffset || !_sourceRect.Contains(target + offset))
+            return;
+        DistanceType distance = Horizontal ? 
+            MoveDistanceByDx<Direction>(pointToTest) : MoveDistanceByDy<Direction>(pointToTest);
+        NNF_COUNT(_rowCounters[target.y], PropagationAttempts);
+        if (distance < bestD)
+        {
+            NNF_COUNT(_rowCounters[target.y], PropagationAccepts);
+            if (bestOffset != f(target))
+                OfferRunnerUp(target, bestOffset, bestD);
+            bestD = distance;
+            bestOffset = offset;
+        } else
+            OfferRunnerUp(target, offset, distance);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::TryNeighbor(const Point32& target, const Point32& neighbor, 
+        Point16& bestOffset, DistanceType& bestD)
+    {
+        if (!_targetRect.Contains(neighbor))
+            return;
+        const Point16 offset = f(neighbor);
+        if (offset == bestOffset || !_sourceRect.Contains(target + offset))
+            return;
+        NNF_COUNT(_rowCounters[target.y], PropagationAttempts);
+        const DistanceType keep = KeepDistance(target, bestD);
+        if (BoundRejects(target, target + offset, keep))
+            return;
+        DistanceType distance = Distance<true>(target, target + offset, keep);
+        if (distance < bestD)
+        {
+            NNF_COUNT(_rowCounters[target.y], PropagationAccepts);
+            if (bestOffset != f(target))
+                OfferRunnerUp(target, bestOffset, bestD);
+            bestD = distance;
+            bestOffset = offset;
+        } else
+            OfferRunnerUp(target, offset, distance);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    bool NNF<PixelType, UseSourceMask, Size>::BoundRejects(const Point32& targetPatch, const Point32& sourcePatch, DistanceType known)
+    {
+        if (!UsePatchBounds)
+            return false;
+        const float bound = PatchSummaries::LowerBound(_targetSummaries.Get(targetPatch.x, targetPatch.y),
+            _usedSourceSummaries->Get(sourcePatch.x, sourcePatch.y));
+        if (bound < (float)known)
+            return false;
+        NNF_COUNT(_rowCounters[targetPatch.y], LowerBoundRejections);
+        return true;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    template<int Direction>
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::MoveDistanceByDx(const Point32& target)
+    {
+        DistanceType distance = _distance(target.x, target.y).A;
+        Point32 source = target + f(target);
+        const int sy = source.y - HalfSize;
+        const int ty = target.y - HalfSize;
+        if (UseSourceMask)
+        {
+            // penalties of the whole patches, columns do not count masked pixels
+            distance += MaskPenalty(source.x - Direction, source.y);
+            distance -= MaskPenalty(source.x, source.y);
+        }
+        if (Direction == -1)
+        {
+            // move right
+            distance += ColumnDistance(source.x + HalfSize + 1, sy, target.x + HalfSize + 1, ty);
+            distance -= ColumnDistance(source.x - HalfSize, sy, target.x - HalfSize, ty);
             return distance;
         }
         if (Direction ==  1)
         {
             // move left
-            for (int y = -HalfPatchSize; y <= HalfPatchSize; y++)
-            {
-                distance += PixelDistance(source.x - HalfPatchSize - 1, source.y + y,
-                                          target.x - HalfPatchSize - 1, target.y + y);
-            }
-            for (int y = -HalfPatchSize; y <= HalfPatchSize; y++)
-            {
-                distance -= PixelDistance(source.x + HalfPatchSize, source.y + y,
-                                          target.x + HalfPatchSize, target.y + y);
-            }
+            distance += ColumnDistance(source.x - HalfSize - 1, sy, target.x - HalfSize - 1, ty);
+            distance -= ColumnDistance(source.x + HalfSize, sy, target.x + HalfSize, ty);
             return distance;
         }
         ASSERT(false);
         return 0;
     }
 
-    template<class PixelType, bool UseSourceMask>
+    template<class PixelType, bool UseSourceMask, int Size>
     template<int Direction>
-    typename NNF<PixelType, UseSourceMask>::DistanceType 
-        NNF<PixelType, UseSourceMask>::MoveDistanceByDy(const Point32& target)
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::MoveDistanceByDy(const Point32& target)
     {
-        DistanceType distance = D.Pixel(target.x, target.y).A;
+        DistanceType distance = _distance(target.x, target.y).A;
         Point32 source = target + f(target);
+        const int sx = source.x - HalfSize;
+        const int tx = target.x - HalfSize;
+        if (UseSourceMask)
+        {
+            // penalties of the whole patches, rows do not count masked pixels
+            distance += MaskPenalty(source.x, source.y - Direction);
+            distance -= MaskPenalty(source.x, source.y);
+        }
         if (Direction == -1)
         {
             // move up
-            for (int x = -HalfPatchSize; x <= HalfPatchSize; x++)
-            {
-                distance += PixelDistance(source.x + x, source.y + HalfPatchSize + 1,
-                                          target.x + x, target.y + HalfPatchSize + 1);
-                            
-            }
-            for (int x = -HalfPatchSize; x <= HalfPatchSize; x++)
-            {
-                distance -= PixelDistance(source.x + x, source.y - HalfPatchSize,
-                                          target.x + x, target.y - HalfPatchSize);
-            }
+            distance += RowDistance(sx, source.y + HalfSize + 1, tx, target.y + HalfSize + 1);
+            distance -= RowDistance(sx, source.y - HalfSize, tx, target.y - HalfSize);
             return distance;
         }
         if (Direction ==  1)
         {
             // move down
-            for (int x = -HalfPatchSize; x <= HalfPatchSize; x++)
-            {
-                distance += PixelDistance(source.x + x, source.y - HalfPatchSize - 1,
-                                          target.x + x, target.y - HalfPatchSize - 1);
-            }
-            for (int x = -HalfPatchSize; x <= HalfPatchSize; x++)
-            {
-                distance -= PixelDistance(source.x + x, source.y + HalfPatchSize,
-                                          target.x + x, target.y + HalfPatchSize);
-            }
+            distance += RowDistance(sx, source.y - HalfSize - 1, tx, target.y - HalfSize - 1);
+            distance -= RowDistance(sx, source.y + HalfSize, tx, target.y + HalfSize);
             return distance;
         }
         ASSERT(false);
         return 0;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    inline void NNF<PixelType, UseSourceMask>::RandomSearch(const Point32& target)
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline void NNF<PixelType, UseSourceMask, Size>::RandomSearch(const Point32& target)
     {
         if (SearchRadius < 2)
             return;
+        if (Index != NULL && SearchRadius >= Maximum(Source.Width(), Source.Height()))
+        {
+            IndexSearch(target);
+            return;
+        }
 
         Point16 offset = f(target);
-        DistanceType bestD = D.Pixel(target.x, target.y).A;
+        DistanceType bestD = _distance(target.x, target.y).A;
         Point32 best(0, 0);
         bool changed = false;
         if (bestD == 0)
+        {
+            NNF_COUNT(_rowCounters[target.y], ZeroDistanceSkips);
             return;
-        bestD = bestD / 2;
+        }
+        // a candidate has to halve the distance to replace the match, but with runners-up one
+        // in between would rank above the kept match, so there any improvement replaces it
+        if (K < 2)
+            bestD = bestD / 2;
 
         Point32 min_w = target + offset;
 
         // uniform random direction
-
-        int32_t Rx = _random.Uniform<int32_t>(-SearchRadius, +SearchRadius);
-        int32_t Ry = _random.Uniform<int32_t>(-SearchRadius, +SearchRadius);
+        CounterRandom random(CounterRandom::Key(_passKey, target.x, target.y));
+        int32_t Rx = random.Uniform<int32_t>(-SearchRadius, +SearchRadius);
+        int32_t Ry = random.Uniform<int32_t>(-SearchRadius, +SearchRadius);
 
         if (Rx + min_w.x <  _sourceRect.Left)   Rx = _sourceRect.Left - min_w.x;
         if (Rx + min_w.x >= _sourceRect.Right)  Rx = _sourceRect.Right - min_w.x - 1;
@@ -516,82 +1217,421 @@ namespace IRL
 
         Point32 w(Rx, Ry);
 
+        // candidates are the same either way, batches only change when their rows are loaded
+        const int batch = BatchedRandomSearch ? RandomSearchBatch : 1;
+        Point32 candidates[RandomSearchBatch];
         int i = 0;
-        while (i < RandomSearchLimit)
+        bool done = false;
+        while (!done)
         {
-            if (abs(w.x) < 1 && abs(w.y) < 1)
+            int count = 0;
+            while (count < batch && i < RandomSearchLimit && (abs(w.x) >= 1 || abs(w.y) >= 1))
+            {
+                candidates[count++] = w;
+                w.x /= RandomSearchInvAlpha;
+                w.y /= RandomSearchInvAlpha;
+                i++;
+            }
+            if (count == 0)
                 break;
-            Point32 source = min_w + w;
-            DistanceType distance = Distance<true>(target, source, bestD);
+            if (count > 1)
+            {
+                for (int k = 0; k < count; k++)
+                    PrefetchPatch(min_w.x + candidates[k].x, min_w.y + candidates[k].y);
+            }
+
+            for (int k = 0; k < count; k++)
+            {
+                Point32 source = min_w + candidates[k];
+                NNF_COUNT(_rowCounters[target.y], RandomSearchCandidates);
+                const DistanceType keep = KeepDistance(target, bestD);
+                if (BoundRejects(target, source, keep))
+                    continue;
+                DistanceType distance = Distance<true>(target, source, keep);
+                if (distance < bestD)
+                {
+                    NNF_COUNT(_rowCounters[target.y], RandomSearchImprovements);
+                    if (changed)
+                        OfferRunnerUp(target, offset + Point16((int16_t)best.x, (int16_t)best.y), bestD);
+                    bestD = distance;
+                    best = candidates[k];
+                    changed = true;
+                    if (bestD == 0)
+                    {
+                        NNF_COUNT(_rowCounters[target.y], ZeroDistanceSkips);
+                        done = true;
+                        break;
+                    }
+                } else
+                    OfferRunnerUp(target, Point16(source - target), distance);
+            }
+        }
+
+        if (changed)
+        {
+            SetMatch(target, offset + Point16((int16_t)best.x, (int16_t)best.y), bestD);
+        }
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline void NNF<PixelType, UseSourceMask, Size>::IndexSearch(const Point32& target)
+    {
+        Point16 offset = f(target);
+        DistanceType bestD = _distance(target.x, target.y).A;
+        if (bestD == 0)
+        {
+            NNF_COUNT(_rowCounters[target.y], ZeroDistanceSkips);
+            return;
+        }
+
+        int count;
+        const Point16* candidates = Index->GetLeaf(_indexLeaves[target.x + target.y * Target.Width()], count);
+
+        const Point32 current = target + offset;
+        Point32 best = current;
+        for (int i = 0; i < count; i++)
+        {
+            const Point32 source(candidates[i].x, candidates[i].y);
+            if (source == current)
+                continue;
+            NNF_COUNT(_rowCounters[target.y], RandomSearchCandidates);
+            const DistanceType keep = KeepDistance(target, bestD);
+            if (BoundRejects(target, source, keep))
+                continue;
+            DistanceType distance = Distance<true>(target, source, keep);
             if (distance < bestD)
             {
+                NNF_COUNT(_rowCounters[target.y], RandomSearchImprovements);
+                if (best != current)
+                    OfferRunnerUp(target, Point16(best - target), bestD);
                 bestD = distance;
-                best = w;
-                changed = true;
+                best = source;
                 if (bestD == 0)
                     break;
-            }
-            w.x /= RandomSearchInvAlpha;
-            w.y /= RandomSearchInvAlpha;
-            i++;
+            } else
+                OfferRunnerUp(target, Point16(source - target), distance);
         }
 
-        if (changed)
+        if (best != current)
+            SetMatch(target, Point16((int16_t)(best.x - target.x), (int16_t)(best.y - target.y)), bestD);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    inline void NNF<PixelType, UseSourceMask, Size>::SearchAll(const Point32& target)
+    {
+        Point16 offset = f(target);
+        DistanceType bestD = _distance(target.x, target.y).A;
+        if (bestD == 0)
+        {
+            NNF_COUNT(_rowCounters[target.y], ZeroDistanceSkips);
+            return;
+        }
+
+        // patches covering masked pixels lose to any valid one, so they are skipped while there are some
+        const bool valid = UseSourceMask && _validPatches->GetCount() > 0;
+        const int count = valid ? _validPatches->GetCount() : _sourceRect.Area();
+
+        const Point32 current = target + offset;
+        Point32 best = current;
+        Point32 source(_sourceRect.Left - 1, _sourceRect.Top);
+        for (int i = 0; i < count; i++)
         {
-            f(target) = offset + Point16((int16_t)best.x, (int16_t)best.y);
-            D.Pixel(target.x, target.y).A = bestD;
+            if (valid)
+                source = Point32(_validPatches->GetCenter(i).x, _validPatches->GetCenter(i).y);
+            else if (++source.x == _sourceRect.Right)
+            {
+                source.x = _sourceRect.Left;
+                source.y++;
+            }
+            if (source == current)
+                continue;
+            NNF_COUNT(_rowCounters[target.y], RandomSearchCandidates);
+            const DistanceType keep = KeepDistance(target, bestD);
+            if (BoundRejects(target, source, keep))
+                continue;
+            DistanceType distance = Distance<true>(target, source, keep);
+            if (distance < bestD)
+            {
+                NNF_COUNT(_rowCounters[target.y], RandomSearchImprovements);
+                if (best != current)
+                    OfferRunnerUp(target, Point16(best - target), bestD);
+                bestD = distance;
+                best = source;
+                if (bestD == 0)
+                    break;
+            } else
+                OfferRunnerUp(target, Point16(source - target), distance);
         }
+
+        if (best != current)
+            SetMatch(target, Point16((int16_t)(best.x - target.x), (int16_t)(best.y - target.y)), bestD);
     }
 
-    template<class PixelType, bool UseSourceMask>
+    template<class PixelType, bool UseSourceMask, int Size>
     template<bool EarlyTermination>
-    typename NNF<PixelType, UseSourceMask>::DistanceType 
-        NNF<PixelType, UseSourceMask>::Distance(const Point32& targetPatch, const Point32& sourcePatch, DistanceType known = 0)
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::Distance(const Point32& targetPatch, const Point32& sourcePatch, DistanceType known)
     {
         ASSERT(_sourceRect.Contains(sourcePatch));
         ASSERT(_targetRect.Contains(targetPatch));
 
+        const int sx = sourcePatch.x - HalfSize;
+        const int tx = targetPatch.x - HalfSize;
         DistanceType distance = 0;
-        for (int y = -HalfPatchSize; y <= HalfPatchSize; y++)
+        if (UseSourceMask)
         {
-            for (int x = -HalfPatchSize; x <= HalfPatchSize; x++)
+            distance = MaskPenalty(sourcePatch.x, sourcePatch.y);
+            if (EarlyTermination && distance > known)
             {
-                distance += PixelDistance(
-                    sourcePatch.x + x, sourcePatch.y + y,
-                    targetPatch.x + x, targetPatch.y + y);
-                if (EarlyTermination) 
+                NNF_COUNT(_rowCounters[targetPatch.y], MaskRejections);
+                return distance;
+            }
+        }
+        if (EarlyTermination)
+            NNF_COUNT(_rowCounters[targetPatch.y], EarlyTerminationTests);
+        const PixelType* source = SourcePixel(sx, sourcePatch.y - HalfSize);
+        const PixelType* target = &_target(tx, targetPatch.y - HalfSize);
+        for (int y = -HalfSize; y <= HalfSize; y++)
+        {
+            distance += _rowDistance(source, target);
+            source += _sourcePitch;
+            target += _target.Stride();
+            if (EarlyTermination) 
+            {
+                if (distance > known)
                 {
-                    if (distance > known)
-                        return distance;
+                    if (y < HalfSize)
+                        NNF_COUNT(_rowCounters[targetPatch.y], EarlyTerminations);
+                    return distance;
                 }
             }
         }
         return distance;
     }
 
-    template<class PixelType, bool UseSourceMask>
-    typename NNF<PixelType, UseSourceMask>::DistanceType 
-        NNF<PixelType, UseSourceMask>::PixelDistance(int sx, int sy, int tx, int ty)
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::RowDistance(int sx, int sy, int tx, int ty)
+    {
+        return _rowDistance(SourcePixel(sx, sy), &_target(tx, ty));
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::PrefetchPatch(int sx, int sy)
     {
         if (UseSourceMask)
+            IRL_PREFETCH(_validPatches->GetMaskedAddress(sx, sy));
+        // first and last pixel of every row, a row of Size pixels spans two cache lines at most
+        const PixelType* row = SourcePixel(sx - HalfSize, sy - HalfSize);
+        for (int y = 0; y < Size; y++)
         {
-            if (SourceMask(sx, sy).IsMasked())
-                return PatchDistanceUpperBound<PixelType>(); // return > maximum possible distance to eliminate that pixel
+            IRL_PREFETCH(row);
+            IRL_PREFETCH(row + Size - 1);
+            row += _sourcePitch;
         }
-        return PixelType::Distance(Source(sx, sy), Target(tx, ty));
     }
 
-    template<class PixelType, bool UseSourceMask>
-    double NNF<PixelType, UseSourceMask>::GetMeasure()
+    template<class PixelType, bool UseSourceMask, int Size>
+    const PixelType* NNF<PixelType, UseSourceMask, Size>::SourcePixel(int x, int y)
     {
-        double result = 0;
-        for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+        return _tiled ? _tiledSource.Pixel(x, y) : &_source(x, y);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::ColumnDistance(int sx, int sy, int tx, int ty)
+    {
+        // Gather columns and reuse the row kernel, so incremental updates round the same
+        // way as Distance does. Mixing scalar and vector sums lets D drift below real
+        // distances for floating point pixels.
+        PixelType sourceColumn[Size];
+        PixelType targetColumn[Size];
+        const PixelType* source = SourcePixel(sx, sy);
+        const PixelType* target = &_target(tx, ty);
+        for (int i = 0; i < Size; i++)
         {
-            for (int32_t x = _targetRect.Left; x < _targetRect.Right; x++)
+            sourceColumn[i] = *source;
+            targetColumn[i] = *target;
+            source += _sourcePitch;
+            target += _target.Stride();
+        }
+        return _rowDistance(sourceColumn, targetColumn);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::MaskPenalty(int sx, int sy)
+    {
+        // every masked pixel adds more than maximum possible patch distance to eliminate that patch
+        const int masked = _validPatches->GetMasked(sx, sy);
+        if (masked == 0)
+            return 0;
+        return PatchDistanceUpperBound<PixelType, Size>() * masked;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::SetDistance(int x, int y, DistanceType distance)
+    {
+        Alpha<StoredDistanceType>& d = _distance(x, y);
+        _rowMeasure[y] += (double)distance - d.A;
+        d.A = distance;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::SetMatch(const Point32& target, const Point16& offset, DistanceType distance)
+    {
+        if (K > 1)
+        {
+            // the new match leaves runners-up and the old one may join them
+            const Point16 previous = f(target);
+            const DistanceType previousD = _distance(target.x, target.y).A;
+            RunnerUp* runnersUp = RunnersUp(target);
+            for (int k = 0; k < K - 1 && !runnersUp[k].IsEmpty(); k++)
             {
-                result += D(x, y).A;
+                if (runnersUp[k].Offset == offset)
+                {
+                    for (; k < K - 2; k++)
+                        runnersUp[k] = runnersUp[k + 1];
+                    runnersUp[K - 2].Distance = std::numeric_limits<StoredDistanceType>::max();
+                    break;
+                }
             }
+            f(target) = offset;
+            OfferRunnerUp(target, previous, previousD);
+        } else
+            f(target) = offset;
+        SetDistance(target.x, target.y, distance);
+        _rowChanges[target.y]++;
+        MarkChanged(target.x, target.y, _iteration);
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::OfferRunnerUp(const Point32& target, const Point16& offset, DistanceType distance)
+    {
+        if (K < 2)
+            return;
+        RunnerUp* runnersUp = RunnersUp(target);
+        const int count = K - 1;
+        if (!(distance < runnersUp[count - 1].Distance) || offset == f(target))
+            return;
+        int slot = 0;
+        for (; slot < count && !runnersUp[slot].IsEmpty(); slot++)
+        {
+            if (runnersUp[slot].Offset == offset)
+                return; // equal offsets have equal distances
+        }
+        // the worst one drops out when the list is full
+        slot = Minimum(slot, count - 1);
+        for (; slot > 0 && runnersUp[slot - 1].Distance > distance; slot--)
+            runnersUp[slot] = runnersUp[slot - 1];
+        runnersUp[slot].Offset = offset;
+        runnersUp[slot].Distance = (StoredDistanceType)distance;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    typename NNF<PixelType, UseSourceMask, Size>::DistanceType 
+        NNF<PixelType, UseSourceMask, Size>::KeepDistance(const Point32& target, DistanceType bestD)
+    {
+        if (K < 2)
+            return bestD;
+        const StoredDistanceType worst = RunnersUp(target)[K - 2].Distance;
+        return worst > bestD ? (DistanceType)worst : bestD;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    bool NNF<PixelType, UseSourceMask, Size>::IsActive(const Point32& target)
+    {
+        if (_changedIteration.empty() || _iteration == 0)
+            return true;
+        const int32_t width = Target.Width();
+        const int32_t* changed = &_changedIteration[target.x + target.y * width];
+        const int32_t since = _iteration - 1;
+        // target rectangle keeps HalfSize pixels from the borders, so adjacent pixels are in the image
+        if (changed[0] >= since || changed[-1] >= since || changed[1] >= since ||
+            changed[-width] >= since || changed[width] >= since)
+            return true;
+        // a few converged patches keep searching, random search may still find what propagation does not bring
+        CounterRandom random(CounterRandom::Key(~_passKey, target.x, target.y));
+        if (random.Uniform<uint32_t>(ConvergedExploration) == 0)
+            return true;
+        NNF_COUNT(_rowCounters[target.y], ConvergedSkips);
+        return false;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::MarkChanged(int x, int y, int iteration)
+    {
+        if (!_changedIteration.empty())
+            _changedIteration[x + y * Target.Width()] = iteration;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    double NNF<PixelType, UseSourceMask, Size>::GetMeasure()
+    {
+        double result = 0;
+        for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+            result += _rowMeasure[y];
+        return result / (Size * Size) / _targetRect.Area();
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    double NNF<PixelType, UseSourceMask, Size>::GetChangedFraction()
+    {
+        int64_t changes = 0;
+        for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+            changes += _rowChanges[y];
+        return (double)changes / _targetRect.Area();
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    const NNFCounters& NNF<PixelType, UseSourceMask, Size>::GetIterationCounters() const
+    {
+        return _iterationCounters;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    const NNFCounters& NNF<PixelType, UseSourceMask, Size>::GetTotalCounters() const
+    {
+        return _totalCounters;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    const NNFWavefront& NNF<PixelType, UseSourceMask, Size>::GetWavefront() const
+    {
+        return _wavefront;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    size_t NNF<PixelType, UseSourceMask, Size>::GetBytes() const
+    {
+        size_t result = Field.GetBytes() + D.GetBytes() + _changedSum.GetBytes();
+        result += _rowMeasure.capacity() * sizeof(double);
+        result += _rowChanges.capacity() * sizeof(int32_t);
+        result += _rowCounters.capacity() * sizeof(NNFCounters);
+        result += _runnersUp.capacity() * sizeof(RunnerUp);
+        result += _changedIteration.capacity() * sizeof(int32_t);
+        result += _superPatches.capacity() * sizeof(SuperPatch);
+        result += _devicePixels.capacity() * sizeof(float);
+        result += _deviceField.capacity() * sizeof(Point16);
+        result += _deviceDistances.capacity() * sizeof(float);
+        result += _indexLeaves.capacity() * sizeof(int32_t);
+        result += _sourceSummaries.GetBytes() + _targetSummaries.GetBytes();
+        result += _ownValidPatches.GetBytes();
+        result += _tiledSource.GetBytes();
+        return result;
+    }
+
+    template<class PixelType, bool UseSourceMask, int Size>
+    void NNF<PixelType, UseSourceMask, Size>::CollectCounters()
+    {
+        _iterationCounters.Clear();
+#ifdef IRL_NNF_COUNTERS
+        for (int32_t y = _targetRect.Top; y < _targetRect.Bottom; y++)
+        {
+            _iterationCounters += _rowCounters[y];
+            _rowCounters[y].Clear();
         }
-        return result / (PatchSize * PatchSize) / _targetRect.Area();
+#endif
+        _totalCounters += _iterationCounters;
     }
 }
\ No newline at end of file
@@ -1,6 +1,14 @@
 #pragma once
 
 #include "Image.h"
+#include "ImageWithMask.h"
+#include "Parameters.h"
+#include "Threading.h"
+#include "JobQueue.h"
+#include "GaussianPyramid.h"
+#include "PyramidCache.h"
+#include "ResultCache.h"
+#include "OffsetField.h"
 
 namespace IRL
 {
@@ -10,10 +18,90 @@ namespace IRL
     public:
         virtual void IntermediateResult(const Image<PixelType>& result, int progress, int total) {(void)result; (void)progress; (void)total;}
         virtual void OperationEnded(const Image<PixelType>&) {}
+
+        // Asks the operation to stop, may be called from any thread. Workers check it between
+        // super patches, so the operation returns within milliseconds without OperationEnded.
+        void Cancel() { _cancelled.Store(1); }
+        bool ShouldCancel() const { return GetCancelFlag()->Load() != 0; }
+        // Flag checked by the workers, callbacks which pass results on return the one of their target
+        virtual const AtomicInt* GetCancelFlag() const { return &_cancelled; }
+
+    private:
+        AtomicInt _cancelled;
+    };
+
+    // Offset fields of every pyramid level, finest first, left by a removal. Passed to the next removal
+    // of the same size they seed offsets away from its hole, which are converged already, so only
+    // offsets near the hole start random.
+    struct RemovalFields
+    {
+        std::vector<OffsetField> SourceToTarget;
+        std::vector<OffsetField> TargetToSource;
+
+        void Clear()
+        {
+            SourceToTarget.clear();
+            TargetToSource.clear();
+        }
     };
 
+    // Returns invalid image when cancelled through the callback.
+    template<class PixelType>
+    Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback = NULL);
+
+    // Same with parameters of this call instead of the globals.
+    // With parameters.TimeBudget set, iterations which don't fit the budget are skipped and the result
+    // of the levels done so far is upscaled.
+    // With parameters.TileSize set, holes are solved one by one in crops around them, so pyramids, fields and
+    // votes are only as large as the crops and offsets stay short on images wider than offsets reach.
+    template<class PixelType>
+    Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback, 
+        const ObjectRemovalParameters& parameters);
+
+    // Same for pyramids of the image and of its mask with equal number of levels.
+    // When 'fields' is set, its fields of matching levels seed the solver and are replaced by the final ones,
+    // cancelled operation clears them.
     template<class PixelType>
-    const Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback = NULL);
+    Image<PixelType> RemoveObject(const GaussianPyramid<PixelType>& source, const GaussianPyramid<Alpha8>& mask, 
+        OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters, RemovalFields* fields = NULL);
+
+    // Same with the pyramid of the image kept by the cache, so repeated removals on one image
+    // redo only the part changed since the previous call. The solver works in pixels of the
+    // cache, parameters.FixedPoint has no effect.
+    template<class PixelType, class InputType>
+    Image<PixelType> RemoveObject(PyramidCache<PixelType, InputType>& cache, const ImageWithMask<InputType>& img, 
+        OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters, RemovalFields* fields = NULL);
+
+    // Same with results of earlier requests kept by the cache: the result of the same image, mask and
+    // parameters is returned without solving and the callback only sees OperationEnded.
+    // Results of solved requests are added to the cache, cancelled ones are not.
+    template<class PixelType>
+    Image<PixelType> RemoveObject(ResultCache& cache, const ImageWithMask<PixelType>& img,
+        OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters);
+
+    // Same with solver working in SolverType pixels (i.e. Lab8), input and results are converted
+    template<class SolverType, class PixelType>
+    Image<PixelType> RemoveObjectAs(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback, 
+        const ObjectRemovalParameters& parameters);
+    // RemoveObject to run in JobQueue, Result is valid once the job is done
+    template<class PixelType>
+    class RemoveObjectJob :
+        public Job
+    {
+    public:
+        RemoveObjectJob(const ImageWithMask<PixelType>& input, int priority = 0, OperationCallback<PixelType>* callback = NULL)
+            : Job(priority, (int64_t)input.Image.Width() * input.Image.Height()), Input(input), Callback(callback) {}
+
+        ImageWithMask<PixelType> Input;
+        ObjectRemovalParameters Parameters;
+        OperationCallback<PixelType>* Callback;
+        Image<PixelType> Result;
+
+        virtual void Run()
+        {
+            Result = RemoveObject(Input, Callback, Parameters);
+        }
+    };
 }
 
 #include "ObjectRemoval.inl"
\ No newline at end of file
@@ -2,80 +2,820 @@
 #include "GaussianPyramid.h"
 #include "BidirectionalSimilarity.h"
 #include "Parameters.h"
+#include "Profiler.h"
+#include "ImageConversion.h"
+#include "DebugWriter.h"
+#include "Checkpoint.h"
+#include "PatchHashing.h"
 
-#include <direct.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
 
 namespace IRL
 {
+    namespace Internal
+    {
+        // Passes results of solver in other pixels to the callback of the caller
+        template<class SolverType, class PixelType>
+        class ConvertingCallback :
+            public OperationCallback<SolverType>
+        {
+        public:
+            explicit ConvertingCallback(OperationCallback<PixelType>* callback) : _callback(callback) {}
+
+            virtual void IntermediateResult(const Image<SolverType>& result, int progress, int total)
+            {
+                Image<PixelType> converted;
+                Convert(converted, result);
+                _callback->IntermediateResult(converted, progress, total);
+            }
+
+            virtual void OperationEnded(const Image<SolverType>& result)
+            {
+                Convert(Result, result);
+                _callback->OperationEnded(Result);
+            }
+
+            virtual const AtomicInt* GetCancelFlag() const
+            {
+                return _callback->GetCancelFlag();
+            }
+
+            Image<PixelType> Result; // converted final result, valid after OperationEnded
+
+        private:
+            OperationCallback<PixelType>* _callback;
+        };
+
+        // Return true if the field was left by a removal on an image of this size
+        template<class PixelType>
+        inline bool IsFieldOf(const OffsetField& field, const Image<PixelType>& image)
+        {
+            return field.IsValid() && field.Width() == image.Width() && field.Height() == image.Height();
+        }
+
+        // Spreads wall clock budget of a removal over levels in proportion to their scheduled work.
+        // Time left by a level goes to the next ones. Cost of an iteration is measured on the current
+        // level, before its first iteration it is extrapolated from the previous level by pixels.
+        class TimeBudget
+        {
+        public:
+            // 'work' is pixels processed by all scheduled iterations of each level, 'seconds' <= 0 means no limit
+            TimeBudget(double seconds, const std::vector<double>& work)
+                : _work(work), _pixelCost(0), _levelCost(0), _levelIterations(0), _levelStart(0), _levelTime(0)
+            {
+                _deadline = seconds > 0 ? Tools::GetTime() + (int64_t)(seconds * 1e9) : 0;
+            }
+
+            void StartLevel(int level)
+            {
+                if (_deadline == 0)
+                    return;
+                double work = 0;
+                for (int i = 0; i <= level; i++)
+                    work += _work[i];
+                _levelStart = Tools::GetTime();
+                _levelTime = work > 0 ? (double)(_deadline - _levelStart) * _work[level] / work : 0;
+                _levelCost = 0;
+                _levelIterations = 0;
+            }
+
+            // Return true if one more iteration over 'pixels' fits the level's share, the first iteration
+            // of a level has to fit the time left only. Allows anything till the cost is measured,
+            // so the coarsest level gets its first iteration.
+            bool Allows(double pixels) const
+            {
+                if (_deadline == 0)
+                    return true;
+                double cost = pixels * _pixelCost;
+                if (_levelIterations > 0)
+                    cost = _levelCost / _levelIterations;
+                else if (_pixelCost == 0)
+                    return true;
+                const int64_t now = Tools::GetTime();
+                if ((double)now + cost > (double)_deadline)
+                    return false;
+                return _levelIterations == 0 || (double)(now - _levelStart) + cost <= _levelTime;
+            }
+
+            // Accounts iteration over 'pixels' started at 'start'
+            void IterationDone(double pixels, int64_t start)
+            {
+                const double cost = (double)(Tools::GetTime() - start);
+                _levelCost += cost;
+                _levelIterations++;
+                _pixelCost = _levelCost / (_levelIterations * pixels);
+            }
+
+        private:
+            std::vector<double> _work;
+            int64_t _deadline;      // 0 for no limit
+            double _pixelCost;      // time per pixel of an iteration on the last measured level
+            double _levelCost;      // time of iterations on the current level
+            int _levelIterations;
+            int64_t _levelStart;
+            double _levelTime;      // share of the current level
+        };
+
+        // Groups tiles of 'tileSize' with masked pixels. Groups whose crops, i.e. tiles grown by one tile
+        // of context, overlap are merged, so crops of groups are independent. Return crops of groups.
+        inline std::vector<Rectangle<int32_t> > GetTileCrops(const Image<Alpha8>& mask, int tileSize)
+        {
+            const int32_t columns = (mask.Width() + tileSize - 1) / tileSize;
+            const int32_t rows = (mask.Height() + tileSize - 1) / tileSize;
+            std::vector<uint8_t> masked(columns * rows, 0);
+            const ConstImageView<Alpha8> view = mask.ConstView();
+            for (int32_t y = 0; y < view.Height(); y++)
+            {
+                const Alpha8* row = view.Row(y);
+                uint8_t* tiles = &masked[(y / tileSize) * columns];
+                for (int32_t x = 0; x < view.Width(); x++)
+                {
+                    if (row[x].IsMasked())
+                        tiles[x / tileSize] = 1;
+                }
+            }
+
+            const Rectangle<int32_t> image(0, 0, mask.Width(), mask.Height());
+            std::vector<Rectangle<int32_t> > crops;
+            for (int32_t i = 0; i < columns * rows; i++)
+            {
+                if (masked[i])
+                {
+                    Rectangle<int32_t> tile((i % columns) * tileSize, (i / columns) * tileSize, tileSize, tileSize);
+                    crops.push_back(tile.Inflated(tileSize).Intersection(image));
+                }
+            }
+
+            // merge overlapping crops till there is no one
+            bool merged = true;
+            while (merged)
+            {
+                merged = false;
+                for (size_t i = 0; i < crops.size() && !merged; i++)
+                {
+                    for (size_t j = i + 1; j < crops.size() && !merged; j++)
+                    {
+                        if (crops[i].Intersection(crops[j]).IsEmpty())
+                            continue;
+                        crops[i].Left = Minimum(crops[i].Left, crops[j].Left);
+                        crops[i].Top = Minimum(crops[i].Top, crops[j].Top);
+                        crops[i].Right = Maximum(crops[i].Right, crops[j].Right);
+                        crops[i].Bottom = Maximum(crops[i].Bottom, crops[j].Bottom);
+                        crops.erase(crops.begin() + j);
+                        merged = true;
+                    }
+                }
+            }
+            return crops;
+        }
+
+        // Passes results of one crop as results of the whole image to the callback of the caller.
+        // Results of coarse levels have other size than the crop, only progress of them is lost.
+        template<class PixelType>
+        class TileCallback :
+            public OperationCallback<PixelType>
+        {
+        public:
+            TileCallback(OperationCallback<PixelType>* callback, Image<PixelType>& image, const Image<Alpha8>& mask, 
+                const Rectangle<int32_t>& crop, int index, int count) : 
+                _callback(callback), _image(image), _mask(mask), _crop(crop), _index(index), _count(count) {}
+
+            virtual void IntermediateResult(const Image<PixelType>& result, int progress, int total)
+            {
+                if (result.Width() != _mask.Width() || result.Height() != _mask.Height())
+                    return;
+                PasteMasked(_image, result, _mask, _crop.Left, _crop.Top);
+                _callback->IntermediateResult(_image, _index * total + progress, _count * total);
+            }
+
+            virtual const AtomicInt* GetCancelFlag() const
+            {
+                return _callback->GetCancelFlag();
+            }
+
+        private:
+            OperationCallback<PixelType>* _callback;
+            Image<PixelType>& _image;
+            const Image<Alpha8>& _mask;
+            Rectangle<int32_t> _crop;
+            int _index;
+            int _count;
+        };
+
+        // RemoveObject for crops around holes, see ObjectRemovalTileSize
+        template<class PixelType>
+        Image<PixelType> RemoveObjectTiled(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback, 
+            const ObjectRemovalParameters& parameters, const std::vector<Rectangle<int32_t> >& crops)
+        {
+            ObjectRemovalParameters tileParameters = parameters;
+            tileParameters.TileSize = 0;
+            int64_t area = 0;
+            for (size_t i = 0; i < crops.size(); i++)
+                area += crops[i].Area();
+
+            Image<PixelType> result = img.Image;
+            for (size_t i = 0; i < crops.size(); i++)
+            {
+                // every crop gets its share of the budget
+                if (parameters.TimeBudget > 0)
+                    tileParameters.TimeBudget = parameters.TimeBudget * crops[i].Area() / area;
+                if (!parameters.CheckpointPath.empty())
+                {
+                    std::ostringstream path;
+                    path << parameters.CheckpointPath << "." << i;
+                    tileParameters.CheckpointPath = path.str();
+                }
+                ImageWithMask<PixelType> tile(Crop(img.Image, crops[i]), Crop(img.Mask, crops[i]));
+                TileCallback<PixelType> tileCallback(callback, result, tile.Mask, crops[i], (int)i, (int)crops.size());
+                const Image<PixelType> filled = RemoveObject(tile, callback ? &tileCallback : NULL, tileParameters);
+                if (!filled.IsValid())
+                    return Image<PixelType>(); // cancelled
+                PasteMasked(result, filled, tile.Mask, crops[i].Left, crops[i].Top);
+            }
+            if (callback) callback->OperationEnded(result);
+            return result;
+        }
+
+        // Levels of pyramids for an image of the given size, the coarsest one is larger than a patch
+        inline int GetPyramidLevels(int width, int height, const ObjectRemovalParameters& parameters)
+        {
+            int size = Minimum<int>(width, height);
+            const int levels = (int)ceil(log((float)size)) + parameters.LODBias;
+            int coarsest = 1;
+            const int patchSize = Maximum(SupportedPatchSize(parameters.PatchSize), SupportedPatchSize(parameters.CoarsePatchSize));
+            while (coarsest < levels && ScaledDownSize(size) > patchSize)
+            {
+                size = ScaledDownSize(size);
+                coarsest++;
+            }
+            return Minimum(levels, coarsest);
+        }
+
+        // Parameters with time budget reduced by time spent since 'start', i.e. on building pyramids
+        inline ObjectRemovalParameters SpendTime(const ObjectRemovalParameters& parameters, int64_t start)
+        {
+            ObjectRemovalParameters result = parameters;
+            if (result.TimeBudget > 0) // keep it positive, 0 means no limit
+                result.TimeBudget = Maximum(result.TimeBudget - (Tools::GetTime() - start) * 1e-9, 1e-9);
+            return result;
+        }
+
+        // Result of one level, see RemovalRun::Start
+        template<class PixelType>
+        struct LevelState
+        {
+            Image<PixelType> Target;
+            OffsetField SourceToTarget;
+            OffsetField TargetToSource;
+        };
+
+        // State of one removal which is passed between runs of levels solved with different patch sizes
+        template<class PixelType>
+        struct RemovalRun
+        {
+            const GaussianPyramid<PixelType>* Source;
+            const GaussianPyramid<Alpha8>* Mask;
+            OperationCallback<PixelType>* Callback;
+            const ObjectRemovalParameters* Parameters;
+            RemovalFields* Fields;
+            std::vector<Rectangle<int32_t> > Regions;
+            std::vector<Rectangle<int32_t> > MaskedRegions;   // of masks of levels
+            std::vector<double> Work;
+            TimeBudget* Budget;
+            int Progress;
+            int Total;
+            const LevelState<PixelType>* Start;   // set up coarsest level instead of the source and random fields
+            LevelState<PixelType>* Kept;          // receives result of level KeptLevel
+            int KeptLevel;
+
+            // result of the last solved level, invalid before the coarsest one
+            Image<PixelType> Target;
+            OffsetField SourceToTarget;
+            OffsetField TargetToSource;
+        };
+
+        // Key of parameters which results of levels depend on, the same ones ResultCache hashes;
+        // checkpoints of other ones are not resumed
+        inline uint64_t GetCheckpointKey(const ObjectRemovalParameters& parameters, int levels)
+        {
+            ResultKey key;
+            HashParameters(key, parameters);
+            HashBytes(key, &levels, sizeof(levels));
+            return key.High;
+        }
+
+        template<class PixelType>
+        inline bool HasSamePixels(const Image<PixelType>& image, const Image<PixelType>& other)
+        {
+            return image.IsValid() && other.IsValid() && image.Width() == other.Width() && image.Height() == other.Height() &&
+                memcmp(image.Data(), other.Data(), image.GetBytes()) == 0;
+        }
+
+        // Writes result of the level to parameters.CheckpointPath, with the level's source and mask
+        // which a resumed removal has to match
+        template<class PixelType>
+        void SaveCheckpoint(const RemovalRun<PixelType>& run, int level, const Image<PixelType>& target,
+            const OffsetField& sourceToTarget, const OffsetField& targetToSource)
+        {
+            Tools::Profiler profiler("SaveCheckpoint");
+            CheckpointWriter writer;
+            if (!writer.Open(run.Parameters->CheckpointPath, run.Parameters->CheckpointOwner))
+                return;
+            writer.AddValue("Key", (int64_t)GetCheckpointKey(*run.Parameters, (int)run.Source->Levels.size()));
+            writer.AddValue("Level", level);
+            writer.Add("Source", run.Source->Levels[level]);
+            writer.Add("Mask", run.Mask->Levels[level]);
+            writer.Add("Target", target);
+            writer.Add("SourceToTarget", sourceToTarget);
+            writer.Add("TargetToSource", targetToSource);
+            writer.Finish(); // a failed checkpoint only costs the resume
+        }
+
+        // Sets result of the run to the checkpointed level, return the level or the number of levels
+        // when there is no checkpoint of this removal. Images wrap the mapped checkpoint.
+        template<class PixelType>
+        int LoadCheckpoint(RemovalRun<PixelType>& run)
+        {
+            const int levels = (int)run.Source->Levels.size();
+            Checkpoint checkpoint;
+            int64_t key = 0, level = 0;
+            if (!checkpoint.Open(run.Parameters->CheckpointPath) || !checkpoint.GetValue("Key", key) || 
+                !checkpoint.GetValue("Level", level) || (uint64_t)key != GetCheckpointKey(*run.Parameters, levels) ||
+                level < 0 || level >= levels)
+                return levels;
+
+            const Image<PixelType>& levelSource = run.Source->Levels[(size_t)level];
+            const Image<PixelType> target = checkpoint.GetImage<PixelType>("Target");
+            const OffsetField sourceToTarget = checkpoint.GetImage<Point16>("SourceToTarget");
+            const OffsetField targetToSource = checkpoint.GetImage<Point16>("TargetToSource");
+            if (!HasSamePixels(checkpoint.GetImage<PixelType>("Source"), levelSource) || 
+                !HasSamePixels(checkpoint.GetImage<Alpha8>("Mask"), run.Mask->Levels[(size_t)level]) ||
+                !target.IsValid() || target.Width() != levelSource.Width() || target.Height() != levelSource.Height() ||
+                !IsFieldOf(sourceToTarget, levelSource) || !IsFieldOf(targetToSource, levelSource))
+                return levels;
+            run.Target = target;
+            run.SourceToTarget = sourceToTarget;
+            run.TargetToSource = targetToSource;
+            return (int)level;
+        }
+
+        // Stages of setting a level up from the result of the coarser one, they are run as a Parallel::TaskGraph:
+        // the target and both fields are upscaled at once, and each field is merged with the previous removal's
+        // one as soon as it is upscaled
+
+        // Upscales result of the coarser level and fills the known pixels from the level's source
+        template<class PixelType>
+        class UpscaleTargetTask :
+            public Parallel::Runnable
+        {
+        public:
+            const Image<PixelType>* Source;
+            const Image<Alpha8>* Mask;
+            Image<PixelType>* Target;   // coarser result on input
+
+            virtual void Run()
+            {
+                *Target = ScaleUpMasked(*Target, *Source, *Mask);
+            }
+        };
+
+        // Upscales field of the coarser level, offsets are doubled and kept inside the level
+        class UpscaleFieldTask :
+            public Parallel::Runnable
+        {
+        public:
+            OffsetField* Field;
+            int Width;
+            int Height;
+
+            virtual void Run()
+            {
+                *Field = UpscaleField(*Field, Width, Height, Width, Height);
+            }
+        };
+
+        // Takes offsets of the previous removal outside of the region
+        class MergeFieldTask :
+            public Parallel::Runnable
+        {
+        public:
+            OffsetField* Field;
+            const OffsetField* Previous;
+            Rectangle<int32_t> Region;
+
+            virtual void Run()
+            {
+                MergeFields(*Field, *Previous, Region);
+            }
+        };
+
+        // Return patch size of the level, see ObjectRemovalFinePatchLevels
+        inline int LevelPatchSize(const ObjectRemovalParameters& parameters, int level)
+        {
+            return SupportedPatchSize(level < parameters.FinePatchLevels ? parameters.PatchSize : parameters.CoarsePatchSize);
+        }
+
+        // Solves levels from 'coarsest' down to 'finest' with patches of Size, continues from the result of the run
+        template<class PixelType, int Size>
+        void SolveLevels(RemovalRun<PixelType>& run, int coarsest, int finest)
+        {
+            BidirectionalSimilarity<PixelType, true, Size> solver;
+            solver.CancelFlag = run.Callback ? run.Callback->GetCancelFlag() : NULL;
+            solver.Target = run.Target;
+            solver.SourceToTarget = run.SourceToTarget;
+            solver.TargetToSource = run.TargetToSource;
+
+            for (int i = coarsest; i >= finest; i--)
+            {
+                // images of the level are accounted to it, see Memory::Report
+                Memory::LevelScope level(i);
+                // paths are only built when debug output is on
+                std::string debugPath;
+                if (run.Parameters->DebugOutput)
+                {
+                    std::ostringstream str;
+                    str << "Out/" << i;
+                    debugPath = str.str();
+                }
+
+                solver.Reset();
+                solver.DebugPath = debugPath;
+                const Image<PixelType>& levelSource = run.Source->Levels[i];
+                const Image<Alpha8>& levelMask = run.Mask->Levels[i];
+                solver.Source = levelSource;
+                solver.SourceMask = levelMask;
+                solver.NNFIterations = run.Parameters->MinNNFIterations + i * run.Parameters->NNFIterationsLODFactor;
+                solver.Alpha = run.Parameters->Alpha;
+                solver.NNFTolerance = run.Parameters->NNFTolerance;
+                solver.Seed = CounterRandom::Key(run.Parameters->Seed, (uint64_t)i);
+                solver.UsePatchIndex = run.Parameters->PatchIndex;
+                solver.UsePatchBounds = run.Parameters->PatchBounds;
+                solver.NearestNeighbors = run.Parameters->NearestNeighbors;
+                solver.UseCompactVotes = run.Parameters->CompactVotes;
+                solver.ExhaustiveSearchLimit = run.Parameters->ExhaustiveSearchLimit;
+                solver.SkipConverged = run.Parameters->SkipConverged;
+                solver.RandomSearchLimit = run.Parameters->RandomSearchLimit;
+                solver.RandomSearchInvAlpha = run.Parameters->RandomSearchInvAlpha;
+                solver.SuperPatchSize = run.Parameters->SuperPatchSize;
+                solver.TiledSource = run.Parameters->TiledSource;
+                solver.BatchedRandomSearch = run.Parameters->BatchedRandomSearch;
+                solver.Backend = run.Parameters->UseOpenCL ? OpenCLBackend : CpuBackend;
+                solver.Region = run.Regions[i];
+                const Rectangle<int32_t> hole = run.MaskedRegions[i].Inflated(Size);
+
+                // offsets of the previous removal stay valid away from the new hole
+                const bool merge = run.Fields && IsFieldOf(run.Fields->SourceToTarget[i], levelSource) && 
+                    IsFieldOf(run.Fields->TargetToSource[i], levelSource);
+                if (run.Start && i == (int)run.Source->Levels.size() - 1)
+                {
+                    solver.Target = run.Start->Target;
+                    solver.SourceToTarget = run.Start->SourceToTarget;
+                    solver.TargetToSource = run.Start->TargetToSource;
+                } else if (solver.Target.IsValid())
+                {
+                    // odd sized levels are one pixel smaller than the doubled coarser level
+                    UpscaleTargetTask<PixelType> target;
+                    target.Source = &levelSource;
+                    target.Mask = &levelMask;
+                    target.Target = &solver.Target;
+                    UpscaleFieldTask fields[2];
+                    MergeFieldTask merges[2];
+                    OffsetField* levelFields[2] = { &solver.SourceToTarget, &solver.TargetToSource };
+                    const OffsetField* previousFields[2] = { NULL, NULL };
+                    if (merge)
+                    {
+                        previousFields[0] = &run.Fields->SourceToTarget[i];
+                        previousFields[1] = &run.Fields->TargetToSource[i];
+                    }
+
+                    Parallel::TaskGraph graph;
+                    graph.Add(&target);
+                    for (int k = 0; k < 2; k++)
+                    {
+                        fields[k].Field = levelFields[k];
+                        fields[k].Width = levelSource.Width();
+                        fields[k].Height = levelSource.Height();
+                        const int upscale = graph.Add(&fields[k]);
+                        if (merge)
+                        {
+                            merges[k].Field = levelFields[k];
+                            merges[k].Previous = previousFields[k];
+                            merges[k].Region = hole;
+                            graph.Depend(graph.Add(&merges[k]), upscale);
+                        }
+                    }
+                    graph.Run();
+                } else
+                {
+                    solver.Target = levelSource; // use existing image
+                    if (run.Parameters->HashedField)
+                    {
+                        // the target is the source itself, its pixels are converted once for both fields
+                        std::vector<float> pixels;
+                        ConvertForDevice(levelSource, pixels);
+                        const int width = levelSource.Width();
+                        const int height = levelSource.Height();
+                        solver.SourceToTarget = MakeHashedField(pixels, width, height, pixels, width, height, Image<Alpha8>(),
+                            Size, CounterRandom::Key(solver.Seed, (uint64_t)2));
+                        solver.TargetToSource = MakeHashedField(pixels, width, height, pixels, width, height, levelMask,
+                            Size, CounterRandom::Key(solver.Seed, (uint64_t)3));
+                    } else
+                    {
+                        solver.SourceToTarget = MakeRandomField(levelSource, solver.Target);
+                        solver.TargetToSource = MakeRandomField(solver.Target, levelSource);
+                    }
+                    if (merge)
+                    {
+                        MergeFields(solver.SourceToTarget, run.Fields->SourceToTarget[i], hole);
+                        MergeFields(solver.TargetToSource, run.Fields->TargetToSource[i], hole);
+                    }
+                }
+
+                if (run.Parameters->DebugOutput)
+                {
+                    Debug::MakeDirectory(debugPath);
+                    Debug::SaveImage(levelSource, debugPath + "/Source.png");
+                    Debug::SaveImage(solver.Target, debugPath + "/Target.png");
+                }
+
+                const int iterations = run.Parameters->MinIterations + run.Parameters->IterationsLODFactor * i;
+                const double pixels = run.Work[i] / iterations;
+                run.Budget->StartLevel(i);
+                double energy = 0;
+                for (int j = 0; j < iterations; j++)
+                {
+                    // out of time, the level keeps the upscaled result of the coarser one
+                    if (!run.Budget->Allows(pixels))
+                    {
+                        run.Progress += iterations - j;
+                        if (i > 0 && run.Callback)
+                            run.Callback->IntermediateResult(solver.Target, run.Progress, run.Total);
+                        break;
+                    }
+
+                    const int64_t start = Tools::GetTime();
+                    solver.Iteration(true);
+                    if (run.Callback && run.Callback->ShouldCancel())
+                        break; // the target is left half done
+                    run.Budget->IterationDone(pixels, start);
+                    run.Progress++;
+
+                    // stop once the solution does not change much
+                    double previousEnergy = energy;
+                    energy = solver.GetEnergy();
+                    bool converged = false;
+                    if (j > 0 && j + 1 >= run.Parameters->MinIterations)
+                    {
+                        if (run.Parameters->EnergyTolerance > 0 && 
+                            fabs(previousEnergy - energy) <= run.Parameters->EnergyTolerance * fabs(previousEnergy))
+                            converged = true;
+                        if (run.Parameters->OffsetsTolerance > 0 && solver.GetChangedOffsets() < run.Parameters->OffsetsTolerance)
+                            converged = true;
+                    }
+                    if (converged)
+                        run.Progress += iterations - j - 1; // skipped iterations
+
+                    bool last = converged || j == iterations - 1;
+                    if (!(i == 0 && last) && run.Callback)
+                        run.Callback->IntermediateResult(solver.Target, run.Progress, run.Total);
+                    if (converged)
+                        break;
+                }
+                if (run.Callback && run.Callback->ShouldCancel())
+                    break;
+
+                if (run.Fields)
+                {
+                    run.Fields->SourceToTarget[i] = solver.SourceToTarget;
+                    run.Fields->TargetToSource[i] = solver.TargetToSource;
+                }
+                if (!run.Parameters->CheckpointPath.empty())
+                    SaveCheckpoint(run, i, solver.Target, solver.SourceToTarget, solver.TargetToSource);
+                if (run.Kept && i == run.KeptLevel)
+                {
+                    run.Kept->Target = solver.Target;
+                    run.Kept->SourceToTarget = solver.SourceToTarget;
+                    run.Kept->TargetToSource = solver.TargetToSource;
+                }
+
+                if (run.Parameters->DebugOutput)
+                {
+                    Debug::SaveImage(solver.Target, debugPath + "/Result.png");
+                    std::ostringstream counters;
+                    counters << solver.GetTotalNNFCounters() << "\n";
+                    counters << "Bytes held by the level: " << solver.GetBytes() << "\n";
+                    Debug::SaveText(counters.str(), debugPath + "/Counters.txt");
+                }
+            }
+
+            run.Target = solver.Target;
+            run.SourceToTarget = solver.SourceToTarget;
+            run.TargetToSource = solver.TargetToSource;
+        }
+
+        // SolveLevels for the patch size known at run time
+        template<class PixelType>
+        void SolveLevels(RemovalRun<PixelType>& run, int coarsest, int finest, int patchSize)
+        {
+            switch (patchSize)
+            {
+            case 5:  SolveLevels<PixelType, 5>(run, coarsest, finest); break;
+            case 9:  SolveLevels<PixelType, 9>(run, coarsest, finest); break;
+            default: SolveLevels<PixelType, 7>(run, coarsest, finest); break;
+            }
+        }
+    }
+
     template<class PixelType>
-    const Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback)
+    Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback)
     {
-        const int Levels = ceil(log((float)Minimum<int>(img.Image.Width(), img.Image.Height()))) + ObjectRemovalLODBias;
+        return RemoveObject(img, callback, ObjectRemovalParameters());
+    }
+
+    template<class PixelType>
+    Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback, 
+        const ObjectRemovalParameters& parameters)
+    {
+        if (parameters.TileSize > 0)
+        {
+            // solve only around holes when it is less than the whole image
+            const std::vector<Rectangle<int32_t> > crops = Internal::GetTileCrops(img.Mask, parameters.TileSize);
+            if (crops.empty() || crops.size() > 1 || crops[0].Area() < img.Image.Width() * img.Image.Height())
+                return Internal::RemoveObjectTiled(img, callback, parameters, crops);
+        }
+
+        if (parameters.FixedPoint && !TypeTraits<typename PixelType::ChannelType>::IsInteger)
+            return RemoveObjectAs<Lab8>(img, callback, parameters);
+
+        const int64_t start = Tools::GetTime();
+        const int Levels = Internal::GetPyramidLevels(img.Image.Width(), img.Image.Height(), parameters);
 
         // calculate Gaussian pyramid for source image and mask
-        GaussianPyramid<PixelType> source(img.Image, Levels);
+        GaussianPyramid<PixelType> source;
+        GaussianPyramid<Alpha8> mask;
+        BuildGaussianPyramids(source, mask, img, Levels);
+        return RemoveObject(source, mask, callback, Internal::SpendTime(parameters, start));
+    }
+
+    template<class PixelType, class InputType>
+    Image<PixelType> RemoveObject(PyramidCache<PixelType, InputType>& cache, const ImageWithMask<InputType>& img, 
+        OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters, RemovalFields* fields)
+    {
+        const int64_t start = Tools::GetTime();
+        const int Levels = Internal::GetPyramidLevels(img.Image.Width(), img.Image.Height(), parameters);
+        const GaussianPyramid<PixelType>& source = cache.Get(img.Image, Levels);
         GaussianPyramid<Alpha8> mask(img.Mask, Levels);
+        return RemoveObject(source, mask, callback, Internal::SpendTime(parameters, start), fields);
+    }
 
-        BidirectionalSimilarity<PixelType, true> solver;
+    template<class PixelType>
+    Image<PixelType> RemoveObject(ResultCache& cache, const ImageWithMask<PixelType>& img,
+        OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters)
+    {
+        const ResultKey key = ResultCache::MakeKey(img, parameters);
+        Image<PixelType> result;
+        if (cache.Find(key, result))
+        {
+            if (callback) callback->OperationEnded(result);
+            return result;
+        }
+        result = RemoveObject(img, callback, parameters);
+        cache.Add(key, result);
+        return result;
+    }
 
-        int progress = 0;
-        int total = 0;
-        for (int i = Levels - 1; i >= 0; i--)
+    namespace Internal
+    {
+        // RemoveObject for pyramids which starts from 'start' at the coarsest level when it is set
+        // and keeps result of level 'keptLevel' in 'kept' when it is set
+        template<class PixelType>
+        Image<PixelType> RemoveLevels(const GaussianPyramid<PixelType>& source, const GaussianPyramid<Alpha8>& mask, 
+            OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters, RemovalFields* fields,
+            const LevelState<PixelType>* start, LevelState<PixelType>* kept, int keptLevel)
         {
-            for (int j = 0; j < ObjectRemovalMinIterations + ObjectRemovalIterationsLODFactor * i; j++)
+            ASSERT(source.Levels.size() == mask.Levels.size());
+            const int Levels = (int)source.Levels.size();
+
+            // fields of another image size are ignored below and replaced
+            if (fields)
             {
-                total += 1;
+                fields->SourceToTarget.resize(Levels);
+                fields->TargetToSource.resize(Levels);
             }
-        }
 
-        if (DebugOutput)
-            _mkdir("Out/");
+            // at fine levels the hole is small compared to the image, so only its surroundings are processed
+            RemovalRun<PixelType> run;
+            run.Source = &source;
+            run.Mask = &mask;
+            run.Callback = callback;
+            run.Parameters = &parameters;
+            run.Fields = fields;
+            run.Regions.resize(Levels);
+            run.MaskedRegions.resize(Levels);
+            run.Work.resize(Levels);
+            run.Progress = 0;
+            run.Total = 0;
+            run.Start = start;
+            run.Kept = kept;
+            run.KeptLevel = keptLevel;
+            for (int i = Levels - 1; i >= 0; i--)
+            {
+                const Rectangle<int32_t> image(0, 0, source.Levels[i].Width(), source.Levels[i].Height());
+                run.MaskedRegions[i] = GetMaskedRegion(mask.Levels[i]);
+                Rectangle<int32_t> region = run.MaskedRegions[i];
+                run.Regions[i] = Rectangle<int32_t>(0, 0, 0, 0);
+                if (parameters.RegionReach > 0 && !region.IsEmpty())
+                {
+                    region = region.Inflated(LevelPatchSize(parameters, i) / 2 * parameters.RegionReach).Intersection(image);
+                    if (region.Area() * 2 <= image.Area())
+                        run.Regions[i] = region;
+                }
+                const int iterations = parameters.MinIterations + parameters.IterationsLODFactor * i;
+                run.Work[i] = (double)iterations * (run.Regions[i].IsEmpty() ? image.Area() : run.Regions[i].Area());
+                run.Total += iterations;
+            }
+            TimeBudget budget(parameters.TimeBudget, run.Work);
+            run.Budget = &budget;
 
-        // coarse to fine iteration
-        for (int i = Levels - 1; i >= 0; i--)
-        {
-            std::stringstream debugPath;
-            debugPath << "Out/" << i;
+            if (parameters.DebugOutput)
+            {
+                Debug::MakeDirectory("Out");
+                Tools::Profiler::Reset();
+                Tools::Profiler::SetTracing(true);
+                Memory::ResetPeak();
+            }
 
-            solver.Reset();
-            if (DebugOutput)
-                solver.DebugPath = debugPath.str();
-            solver.Source = source.Levels[i];
-            solver.SourceMask = mask.Levels[i];
-            solver.NNFIterations = ObjectRemovalMinNNFIterations + i * ObjectRemovalNNFIterationsLODFactor;
-            solver.Alpha = ObjectRemovalAlpha;
-            if (solver.Target.IsValid())
+            // levels solved before the removal was interrupted are skipped
+            int resumed = Levels;
+            if (!parameters.CheckpointPath.empty() && !start)
             {
-                solver.Target = MixImages(solver.Source, ScaleUp(solver.Target), solver.SourceMask);
-                solver.SourceToTarget = ClampField(ScaleUp(solver.SourceToTarget), solver.Target);
-                solver.TargetToSource = ClampField(ScaleUp(solver.TargetToSource), solver.Source);
-            } else
+                resumed = LoadCheckpoint(run);
+                for (int i = resumed; i < Levels; i++)
+                    run.Progress += parameters.MinIterations + parameters.IterationsLODFactor * i;
+            }
+
+            // coarse to fine iteration, levels of equal patch size share one solver
+            for (int coarsest = resumed - 1; coarsest >= 0; )
             {
-                solver.Target = solver.Source; // use existing image
-                solver.SourceToTarget = MakeRandomField(solver.Source, solver.Target);
-                solver.TargetToSource = MakeRandomField(solver.Target, solver.Source);
+                const int patchSize = LevelPatchSize(parameters, coarsest);
+                int finest = coarsest;
+                while (finest > 0 && LevelPatchSize(parameters, finest - 1) == patchSize)
+                    finest--;
+                SolveLevels(run, coarsest, finest, patchSize);
+                if (callback && callback->ShouldCancel())
+                    break;
+                coarsest = finest - 1;
             }
 
-            if (DebugOutput)
+            if (parameters.DebugOutput)
             {
-                _mkdir(debugPath.str().c_str());
-                SaveImage(solver.Source, debugPath.str() + "/Source.png");
-                SaveImage(solver.Target, debugPath.str() + "/Target.png");
+                Debug::Flush(); // level artifacts are in the trace
+                Tools::Profiler::SetTracing(false);
+                Tools::Profiler::ExportTrace("Out/Trace.json");
+                std::ofstream report("Out/Profile.txt");
+                Tools::Profiler::Report(report);
+                Memory::Report(report);
             }
 
-            for (int j = 0; j < ObjectRemovalMinIterations + ObjectRemovalIterationsLODFactor * i; j++)
+            if (callback && callback->ShouldCancel())
             {
-                solver.Iteration(true);
-                progress ++;
-                if (!(i == 0 && j == ObjectRemovalMinIterations + ObjectRemovalIterationsLODFactor * i - 1) && callback)
-                    callback->IntermediateResult(solver.Target, progress, total);
+                if (fields)
+                    fields->Clear();
+                return Image<PixelType>();
             }
+            if (!parameters.CheckpointPath.empty())
+                remove(parameters.CheckpointPath.c_str());
 
-            if (DebugOutput)
-                SaveImage(solver.Target, debugPath.str() + "/Result.png");
+            if (callback) callback->OperationEnded(run.Target);
+            return run.Target; // final image
         }
+    }
+
+    template<class PixelType>
+    Image<PixelType> RemoveObject(const GaussianPyramid<PixelType>& source, const GaussianPyramid<Alpha8>& mask, 
+        OperationCallback<PixelType>* callback, const ObjectRemovalParameters& parameters, RemovalFields* fields)
+    {
+        return Internal::RemoveLevels(source, mask, callback, parameters, fields, 
+            (const Internal::LevelState<PixelType>*)NULL, (Internal::LevelState<PixelType>*)NULL, 0);
+    }
+
+    template<class SolverType, class PixelType>
+    Image<PixelType> RemoveObjectAs(const ImageWithMask<PixelType>& img, OperationCallback<PixelType>* callback, 
+        const ObjectRemovalParameters& parameters)
+    {
+        ImageWithMask<SolverType> input;
+        Convert(input, img);
+        ObjectRemovalParameters solverParameters = parameters;
+        solverParameters.FixedPoint = false; // solver pixels are final
 
-        if (callback) callback->OperationEnded(solver.Target);
-        return solver.Target; // final image
+        Internal::ConvertingCallback<SolverType, PixelType> converter(callback);
+        Image<SolverType> result = RemoveObject(input, callback ? &converter : NULL, solverParameters);
+        if (converter.Result.IsValid() || !result.IsValid())
+            return converter.Result; // invalid when cancelled
+        Image<PixelType> converted;
+        Convert(converted, result);
+        return converted;
     }
 }
\ No newline at end of file
@@ -1,25 +1,312 @@
 #include "Includes.h"
 #include "OffsetField.h"
 #include "Random.h"
+#include "ValidPatches.h"
 #include "Profiler.h"
+#include "Parallel.h"
+
+#include <string.h>
 
 namespace IRL
 {
-    OffsetField MakeRandomField(int width, int height, int sourceWidth, int sourceHeight)
+    namespace Internal
     {
-        OffsetField result(width, height);
-        Random random;
-        for (int32_t y = HalfPatchSize; y < height - HalfPatchSize; y++)
+        // Parameters of all field passes
+        struct FieldState
         {
-            for (int32_t x = HalfPatchSize; x < width - HalfPatchSize; x++)
+            ImageView<Point16> Field;
+            const ValidPatches* Patches;
+            int SourceWidth;
+            int SourceHeight;
+            int Radius;
+            uint32_t Seed;
+            ConstImageView<Point16> Previous;
+            Rectangle<int32_t> Region;
+            int PreviousWidth;      // source size the offsets were made for
+            int PreviousHeight;
+            int MotionX;            // of the source since the previous field
+            int MotionY;
+        };
+
+        // Keeps source patch center within the source
+        inline void ClampToSource(int& sx, int& sy, int sourceWidth, int sourceHeight)
+        {
+            if (sx < HalfPatchSize) sx = HalfPatchSize;
+            if (sx >= sourceWidth - HalfPatchSize) sx = sourceWidth - HalfPatchSize - 1;
+            if (sy < HalfPatchSize) sy = HalfPatchSize;
+            if (sy >= sourceHeight - HalfPatchSize) sy = sourceHeight - HalfPatchSize - 1;
+        }
+
+        // Every row has its own generator, so result does not depend on how rows are split between tasks
+        inline uint32_t RowSeed(uint32_t seed, int32_t y)
+        {
+            return seed ^ ((uint32_t)y * 2654435761u);
+        }
+
+        // Base class of tasks which process range of field rows
+        class FieldTask :
+            public Parallel::Runnable
+        {
+        public:
+            void Set(int start, int end, const FieldState& state)
             {
-                int32_t sx = random.Uniform<int32_t>(HalfPatchSize, sourceWidth - HalfPatchSize);
-                int32_t sy = random.Uniform<int32_t>(HalfPatchSize, sourceHeight - HalfPatchSize);
+                _start = start;
+                _end = end;
+                S = state;
+            }
 
-                result(x, y).x = (uint16_t)(sx - x);
-                result(x, y).y = (uint16_t)(sy - y);
+            virtual void Run()
+            {
+                for (int32_t y = _start; y < _end; y++)
+                    ProcessRow(y);
+            }
+
+        protected:
+            virtual void ProcessRow(int32_t y) = 0;
+
+            inline int32_t Width() const { return S.Field.Width(); }
+            inline int32_t Height() const { return S.Field.Height(); }
+
+        protected:
+            FieldState S;
+        private:
+            int _start;
+            int _end;
+        };
+
+        class MakeRandomFieldTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Point16* row = S.Field.Row(y);
+                if (y < HalfPatchSize || y >= Height() - HalfPatchSize)
+                {
+                    // border pixels are not patch centers, keep them defined for scaling
+                    for (int32_t x = 0; x < Width(); x++)
+                        row[x] = Point16(0, 0);
+                    return;
+                }
+                Random random(RowSeed(S.Seed, y));
+                for (int32_t x = 0; x < Width(); x++)
+                {
+                    if (x < HalfPatchSize || x >= Width() - HalfPatchSize)
+                    {
+                        row[x] = Point16(0, 0);
+                        continue;
+                    }
+                    int32_t sx = random.Uniform<int32_t>(HalfPatchSize, S.SourceWidth - HalfPatchSize);
+                    int32_t sy = random.Uniform<int32_t>(HalfPatchSize, S.SourceHeight - HalfPatchSize);
+
+                    row[x].x = (uint16_t)(sx - x);
+                    row[x].y = (uint16_t)(sy - y);
+                }
             }
+        };
+
+        class RemoveMaskedOffsetsTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                const ValidPatches& patches = *S.Patches;
+                Point16* row = S.Field.Row(y);
+                for (int32_t x = HalfPatchSize; x < Width() - HalfPatchSize; x++)
+                {
+                    int32_t sx = row[x].x + x;
+                    int32_t sy = row[x].y + y;
+                    if (!patches.IsValid(sx, sy))
+                    {
+                        // every pixel draws from its own stream, so the field does not depend on tasks
+                        CounterRandom random(CounterRandom::Key(S.Seed, x, y));
+                        const Point16& center = patches.GetCenter(random.Uniform<int32_t>(0, patches.GetCount()));
+                        row[x].x = (uint16_t)(center.x - x);
+                        row[x].y = (uint16_t)(center.y - y);
+                    }
+                }
+            }
+        };
+
+        class ClampFieldTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Point16* row = S.Field.Row(y);
+                for (int x = HalfPatchSize; x < Width() - HalfPatchSize; x++)
+                {
+                    int sx = x + row[x].x;
+                    int sy = y + row[x].y;
+                    if (sx < HalfPatchSize) sx = HalfPatchSize;
+                    if (sx >= S.SourceWidth - HalfPatchSize) sx = S.SourceWidth - HalfPatchSize - 1;
+                    if (sy < HalfPatchSize) sy = HalfPatchSize;
+                    if (sy >= S.SourceHeight - HalfPatchSize) sy = S.SourceHeight - HalfPatchSize - 1;
+                    row[x].x = sx - x;
+                    row[x].y = sy - y;
+                }
+            }
+        };
+
+        class ShakeFieldTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Random random(RowSeed(S.Seed, y));
+                Point16* row = S.Field.Row(y);
+                for (int x = HalfPatchSize; x < Width() - HalfPatchSize; x++)
+                {
+                    int sx = x + row[x].x + random.Uniform<int>(-S.Radius, +S.Radius);
+                    int sy = y + row[x].y + random.Uniform<int>(-S.Radius, +S.Radius);
+                    if (sx < HalfPatchSize) sx = HalfPatchSize;
+                    if (sx >= S.SourceWidth - HalfPatchSize) sx = S.SourceWidth - HalfPatchSize - 1;
+                    if (sy < HalfPatchSize) sy = HalfPatchSize;
+                    if (sy >= S.SourceHeight - HalfPatchSize) sy = S.SourceHeight - HalfPatchSize - 1;
+                    row[x].x = sx - x;
+                    row[x].y = sy - y;
+                }
+            }
+        };
+
+        class MergeFieldsTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Point16* row = S.Field.Row(y);
+                const Point16* previous = S.Previous.Row(y);
+                if (S.Region.IsEmpty() || y < S.Region.Top || y >= S.Region.Bottom)
+                {
+                    memcpy(row, previous, sizeof(Point16) * Width());
+                    return;
+                }
+                memcpy(row, previous, sizeof(Point16) * S.Region.Left);
+                memcpy(row + S.Region.Right, previous + S.Region.Right, sizeof(Point16) * (Width() - S.Region.Right));
+            }
+        };
+
+        class ResizeFieldTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Point16* row = S.Field.Row(y);
+                // nearest pixel of the previous field
+                const int32_t py = (int32_t)(((2 * (int64_t)y + 1) * S.Previous.Height()) / (2 * Height()));
+                const Point16* previous = S.Previous.Row(py);
+                for (int32_t x = 0; x < Width(); x++)
+                {
+                    const int32_t px = (int32_t)(((2 * (int64_t)x + 1) * S.Previous.Width()) / (2 * Width()));
+                    int sx = px + previous[px].x;
+                    int sy = py + previous[px].y;
+                    ClampToSource(sx, sy, S.SourceWidth, S.SourceHeight);
+                    row[x].x = (uint16_t)(sx - x);
+                    row[x].y = (uint16_t)(sy - y);
+                }
+            }
+        };
+
+        class UpscaleOffsetsTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Point16* row = S.Field.Row(y);
+                const int32_t py = Minimum(y / 2, S.Previous.Height() - 1);
+                const Point16* previous = S.Previous.Row(py);
+                for (int32_t x = 0; x < Width(); x++)
+                {
+                    const int32_t px = Minimum(x / 2, S.Previous.Width() - 1);
+                    int sx = x + 2 * previous[px].x;
+                    int sy = y + 2 * previous[px].y;
+                    ClampToSource(sx, sy, S.SourceWidth, S.SourceHeight);
+                    row[x].x = (int16_t)(sx - x);
+                    row[x].y = (int16_t)(sy - y);
+                }
+            }
+        };
+
+        class ResizeFieldSourceTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                Point16* row = S.Field.Row(y);
+                for (int32_t x = 0; x < Width(); x++)
+                {
+                    const int sx0 = x + row[x].x;
+                    const int sy0 = y + row[x].y;
+                    int sx = (int)(((2 * (int64_t)sx0 + 1) * S.SourceWidth) / (2 * S.PreviousWidth));
+                    int sy = (int)(((2 * (int64_t)sy0 + 1) * S.SourceHeight) / (2 * S.PreviousHeight));
+                    ClampToSource(sx, sy, S.SourceWidth, S.SourceHeight);
+                    row[x].x = (uint16_t)(sx - x);
+                    row[x].y = (uint16_t)(sy - y);
+                }
+            }
+        };
+
+        class TranslateFieldTask :
+            public FieldTask
+        {
+        protected:
+            virtual void ProcessRow(int32_t y)
+            {
+                // offsets are relative, so the patch they point to moves with the pixel
+                Point16* row = S.Field.Row(y);
+                const int32_t py = Minimum(Maximum(y - S.MotionY, 0), Height() - 1);
+                const Point16* previous = S.Previous.Row(py);
+                for (int32_t x = 0; x < Width(); x++)
+                {
+                    const int32_t px = Minimum(Maximum(x - S.MotionX, 0), Width() - 1);
+                    int sx = x + previous[px].x;
+                    int sy = y + previous[px].y;
+                    ClampToSource(sx, sy, S.SourceWidth, S.SourceHeight);
+                    row[x].x = (uint16_t)(sx - x);
+                    row[x].y = (uint16_t)(sy - y);
+                }
+            }
+        };
+
+        inline FieldState MakeState(OffsetField& field, int sourceWidth, int sourceHeight)
+        {
+            FieldState state;
+            state.Field = field.View();
+            state.SourceWidth = sourceWidth;
+            state.SourceHeight = sourceHeight;
+            state.Radius = 0;
+            // the same fields get the same offsets, whatever else runs in the process
+            state.Seed = (uint32_t)CounterRandom::Key(CounterRandom::Key(0, field.Width(), field.Height()),
+                sourceWidth, sourceHeight);
+            state.PreviousWidth = sourceWidth;
+            state.PreviousHeight = sourceHeight;
+            state.MotionX = 0;
+            state.MotionY = 0;
+            return state;
+        }
+
+        template<class Task>
+        inline void RunFieldTask(int top, int bottom, const FieldState& state)
+        {
+            if (top >= bottom)
+                return;
+            Parallel::ParallelFor<Task, FieldState> tasks(top, bottom, state, state.Field.Width());
+            tasks.SpawnAndSync();
         }
+    }
+
+    OffsetField MakeRandomField(int width, int height, int sourceWidth, int sourceHeight)
+    {
+        OffsetField result(width, height);
+        Internal::FieldState state = Internal::MakeState(result, sourceWidth, sourceHeight);
+        Internal::RunFieldTask<Internal::MakeRandomFieldTask>(0, height, state);
         return result;
     }
 
@@ -40,77 +327,80 @@ namespace IRL
         return result;
     }
 
-    OffsetField& RemoveMaskedOffsets(OffsetField& field, const Image<Alpha8>& mask, int iterations)
+    OffsetField& RemoveMaskedOffsets(OffsetField& field, const ValidPatches& patches)
     {
-        if (!mask.IsValid())
+        // fully masked source leaves nothing to draw from
+        if (patches.GetCount() == 0)
             return field;
     
-        Random random;
-        int left = HalfPatchSize;
-        int right = mask.Width() - HalfPatchSize;
-        int top = HalfPatchSize;
-        int bottom = mask.Height() - HalfPatchSize;
-        for (int32_t y = HalfPatchSize; y < field.Height() - HalfPatchSize; y++)
-        {
-            for (int32_t x = HalfPatchSize; x < field.Width() - HalfPatchSize; x++)
-            {
-                int32_t sx = field(x, y).x + x;
-                int32_t sy = field(x, y).y + y;
-                if (mask(sx, sy).IsMasked())
-                {
-                    int i = 0;
-                    int32_t nsx;
-                    int32_t nsy;
-                    do 
-                    {
-                        nsx = random.Uniform<int>(left, right);
-                        nsy = random.Uniform<int>(top, bottom);
-                        i++;
-                    } while (mask(nsx, nsy).IsMasked() && i < iterations + 1);
-                    field(x, y).x = (uint16_t)(nsx - x);
-                    field(x, y).y = (uint16_t)(nsy - y);
-                }
-            }
-        }
+        Internal::FieldState state = Internal::MakeState(field, patches.Width(), patches.Height());
+        state.Patches = &patches;
+        Internal::RunFieldTask<Internal::RemoveMaskedOffsetsTask>(HalfPatchSize, field.Height() - HalfPatchSize, state);
         return field;
     }
 
     OffsetField& ClampField(OffsetField& field, int sourceWidth, int sourceHeight)
     {
-        for (int y = HalfPatchSize; y < field.Height() - HalfPatchSize; y++)
-        {
-            for (int x = HalfPatchSize; x < field.Width() - HalfPatchSize; x++)
-            {
-                int sx = x + field(x, y).x;
-                int sy = y + field(x, y).y;
-                if (sx < HalfPatchSize) sx = HalfPatchSize;
-                if (sx >= sourceWidth - HalfPatchSize) sx = sourceWidth - HalfPatchSize - 1;
-                if (sy < HalfPatchSize) sy = HalfPatchSize;
-                if (sy >= sourceHeight - HalfPatchSize) sy = sourceHeight - HalfPatchSize - 1;
-                field(x, y).x = sx - x;
-                field(x, y).y = sy - y;
-            }
-        }
+        Internal::FieldState state = Internal::MakeState(field, sourceWidth, sourceHeight);
+        Internal::RunFieldTask<Internal::ClampFieldTask>(HalfPatchSize, field.Height() - HalfPatchSize, state);
         return field;
     }
 
     extern OffsetField& ShakeField(OffsetField& field, int shakeRadius, int sourceWidth, int sourceHeight)
     {
-        Random random;
-        for (int y = HalfPatchSize; y < field.Height() - HalfPatchSize; y++)
-        {
-            for (int x = HalfPatchSize; x < field.Width() - HalfPatchSize; x++)
-            {
-                int sx = x + field(x, y).x + random.Uniform<int>(-shakeRadius, +shakeRadius);
-                int sy = y + field(x, y).y + random.Uniform<int>(-shakeRadius, +shakeRadius);
-                if (sx < HalfPatchSize) sx = HalfPatchSize;
-                if (sx >= sourceWidth - HalfPatchSize) sx = sourceWidth - HalfPatchSize - 1;
-                if (sy < HalfPatchSize) sy = HalfPatchSize;
-                if (sy >= sourceHeight - HalfPatchSize) sy = sourceHeight - HalfPatchSize - 1;
-                field(x, y).x = sx - x;
-                field(x, y).y = sy - y;
-            }
-        }
+        Internal::FieldState state = Internal::MakeState(field, sourceWidth, sourceHeight);
+        state.Radius = shakeRadius;
+        Internal::RunFieldTask<Internal::ShakeFieldTask>(HalfPatchSize, field.Height() - HalfPatchSize, state);
+        return field;
+    }
+
+    OffsetField& MergeFields(OffsetField& field, const OffsetField& previous, const Rectangle<int32_t>& region)
+    {
+        ASSERT(field.Width() == previous.Width() && field.Height() == previous.Height());
+        Internal::FieldState state = Internal::MakeState(field, 0, 0);
+        state.Previous = previous.ConstView();
+        state.Region = region.Intersection(Rectangle<int32_t>(0, 0, field.Width(), field.Height()));
+        Internal::RunFieldTask<Internal::MergeFieldsTask>(0, field.Height(), state);
+        return field;
+    }
+
+    OffsetField ResizeField(const OffsetField& field, int width, int height, int sourceWidth, int sourceHeight)
+    {
+        OffsetField result(width, height);
+        Internal::FieldState state = Internal::MakeState(result, sourceWidth, sourceHeight);
+        state.Previous = field.ConstView();
+        Internal::RunFieldTask<Internal::ResizeFieldTask>(0, height, state);
+        return result;
+    }
+
+    OffsetField UpscaleField(const OffsetField& field, int width, int height, int sourceWidth, int sourceHeight)
+    {
+        Tools::Profiler profiler("UpscaleField");
+        ASSERT(width <= field.Width() * 2 && height <= field.Height() * 2);
+        OffsetField result(width, height);
+        Internal::FieldState state = Internal::MakeState(result, sourceWidth, sourceHeight);
+        state.Previous = field.ConstView();
+        Internal::RunFieldTask<Internal::UpscaleOffsetsTask>(0, height, state);
+        return result;
+    }
+
+    OffsetField TranslateField(const OffsetField& field, int dx, int dy, int sourceWidth, int sourceHeight)
+    {
+        OffsetField result(field.Width(), field.Height());
+        Internal::FieldState state = Internal::MakeState(result, sourceWidth, sourceHeight);
+        state.Previous = field.ConstView();
+        state.MotionX = dx;
+        state.MotionY = dy;
+        Internal::RunFieldTask<Internal::TranslateFieldTask>(0, field.Height(), state);
+        return result;
+    }
+
+    OffsetField& ResizeFieldSource(OffsetField& field, int previousWidth, int previousHeight, int sourceWidth, int sourceHeight)
+    {
+        Internal::FieldState state = Internal::MakeState(field, sourceWidth, sourceHeight);
+        state.PreviousWidth = previousWidth;
+        state.PreviousHeight = previousHeight;
+        Internal::RunFieldTask<Internal::ResizeFieldSourceTask>(0, field.Height(), state);
         return field;
     }
 }
\ No newline at end of file
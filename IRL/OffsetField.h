@@ -3,16 +3,33 @@
 #include "Image.h"
 #include "Point2D.h"
 #include "Alpha.h"
+#include "Rectangle.h"
 
 namespace IRL
 {
+    class ValidPatches;
+
     typedef Image<Point16> OffsetField;
 
     extern OffsetField MakeRandomField(int width, int height, int sourceWidth, int sourceHeight);
     extern OffsetField MakeSmoothField(int width, int height, int sourceWidth, int sourceHeight);
-    extern OffsetField& RemoveMaskedOffsets(OffsetField& field, const Image<Alpha8>& mask, int iterations = 40);
+    // Replaces offsets to patches which cover masked pixels by offsets to valid patches drawn at random
+    extern OffsetField& RemoveMaskedOffsets(OffsetField& field, const ValidPatches& patches);
     extern OffsetField& ClampField(OffsetField& field, int sourceWidth, int sourceHeight);
     extern OffsetField& ShakeField(OffsetField& field, int shakeRadius, int sourceWidth, int sourceHeight);
+    // Copies offsets of 'previous' of the same size into 'field' everywhere except 'region'
+    extern OffsetField& MergeFields(OffsetField& field, const OffsetField& previous, const Rectangle<int32_t>& region);
+    // Field of the next finer level: width x height is twice the size of 'field' or one pixel less and
+    // so is the source. Every pixel takes the offset of its parent doubled, i.e. points to the same place
+    // within the scaled parent's patch, clamped to the source.
+    extern OffsetField UpscaleField(const OffsetField& field, int width, int height, int sourceWidth, int sourceHeight);
+    // Resamples 'field' to the target of width x height, offsets keep pointing to the same source patches
+    extern OffsetField ResizeField(const OffsetField& field, int width, int height, int sourceWidth, int sourceHeight);
+    // Moves offsets of 'field' to the same relative positions in the source resized to sourceWidth x sourceHeight
+    extern OffsetField& ResizeFieldSource(OffsetField& field, int previousWidth, int previousHeight, int sourceWidth, int sourceHeight);
+    // Moves 'field' of a source which moved by (dx, dy) with its target, i.e. between frames of a video.
+    // Pixels which come from outside take the nearest offset.
+    extern OffsetField TranslateField(const OffsetField& field, int dx, int dy, int sourceWidth, int sourceHeight);
 
     //////////////////////////////////////////////////////////////////////////
     // Helpers
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Image.h"
+
+namespace IRL
+{
+    // How pixels of the apron repeat the image
+    enum BorderMode
+    {
+        BorderMirror,   // ... 2 1 | 0 1 2 ..., the edge pixel is not repeated
+        BorderRepeat    // ... 0 0 | 0 1 2 ...
+    };
+
+    namespace Internal
+    {
+        // Coordinate 'i' of the apron mapped into [0, max]. Mirrored coordinates are reflected once and
+        // then clamped, so images narrower than the apron stay inside.
+        static force_inline int BorderIndex(int i, int max, BorderMode mode)
+        {
+            if (mode == BorderMirror)
+            {
+                if (i < 0)
+                    i = -i;
+                if (i > max)
+                    i = 2 * max - i;
+            }
+            return Maximum(0, Minimum(i, max));
+        }
+    }
+
+    // Image with an apron of Apron() pixels around every side. Rows start at aligned addresses and
+    // are Stride() pixels apart, so filters and distance kernels may read up to Apron() pixels past
+    // any edge and run the same branch-free loop over the whole row. The apron is filled from the
+    // image by FillBorders() after the image was written.
+    // Meant as scratch storage of one operation, so it is neither shared nor copied.
+    template<class PixelType>
+    class PaddedImage
+    {
+    public:
+        PaddedImage() : _buffer(NULL), _data(NULL), _width(0), _height(0), _apron(0), _stride(0) {}
+        PaddedImage(int32_t width, int32_t height, int32_t apron) : _buffer(NULL), _data(NULL)
+        {
+            Resize(width, height, apron);
+        }
+        ~PaddedImage() { Memory::Free(_buffer); }
+
+        // Keeps the buffer when it is large enough, contents are undefined afterwards
+        void Resize(int32_t width, int32_t height, int32_t apron)
+        {
+            ASSERT(width > 0 && height > 0 && apron >= 0);
+            // the first pixel of every row is aligned when pixels tile the alignment
+            const int32_t align = Memory::Alignment % sizeof(PixelType) == 0 ? Memory::Alignment / sizeof(PixelType) : 1;
+            const int32_t left = (apron + align - 1) / align * align;
+            const int32_t stride = (left + width + apron + align - 1) / align * align;
+            const size_t bytes = sizeof(PixelType) * stride * (height + 2 * apron);
+            if (!_buffer || bytes > _bytes)
+            {
+                Memory::Free(_buffer);
+                _buffer = (PixelType*)Memory::Allocate(bytes);
+                _bytes = bytes;
+            }
+            _data = _buffer + apron * stride + left;
+            _width = width;
+            _height = height;
+            _apron = apron;
+            _stride = stride;
+        }
+
+        inline bool IsValid() const { return _data != NULL; }
+        inline int32_t Width() const { return _width; }
+        inline int32_t Height() const { return _height; }
+        inline int32_t Apron() const { return _apron; }
+        inline int32_t Stride() const { return _stride; }
+
+        // Row y of [-Apron(), Height() + Apron()), pixels x of [-Apron(), Width() + Apron()) may be read
+        force_inline PixelType* Row(int32_t y)
+        {
+            ASSERT(y >= -_apron && y < _height + _apron);
+            return _data + y * _stride;
+        }
+        force_inline const PixelType* Row(int32_t y) const
+        {
+            ASSERT(y >= -_apron && y < _height + _apron);
+            return _data + y * _stride;
+        }
+
+        // Views of the image without the apron
+        ImageView<PixelType> View() { return ImageView<PixelType>(_data, _stride, _width, _height); }
+        ConstImageView<PixelType> ConstView() const { return ConstImageView<PixelType>(_data, _stride, _width, _height); }
+
+        // Copies the image and fills the apron
+        void Assign(const ConstImageView<PixelType>& src, BorderMode mode = BorderMirror)
+        {
+            ASSERT(src.Width() == _width && src.Height() == _height);
+            for (int32_t y = 0; y < _height; y++)
+                memcpy(Row(y), src.Row(y), sizeof(PixelType) * _width);
+            FillBorders(mode);
+        }
+
+        // Fills the left and right apron of rows of the image, then the rows above and below
+        void FillBorders(BorderMode mode = BorderMirror)
+        {
+            for (int32_t y = 0; y < _height; y++)
+                FillRowBorders(y, mode);
+            for (int32_t i = 1; i <= _apron; i++)
+            {
+                memcpy(Row(-i) - _apron, Row(Internal::BorderIndex(-i, _height - 1, mode)) - _apron,
+                    sizeof(PixelType) * (_width + 2 * _apron));
+                memcpy(Row(_height - 1 + i) - _apron, Row(Internal::BorderIndex(_height - 1 + i, _height - 1, mode)) - _apron,
+                    sizeof(PixelType) * (_width + 2 * _apron));
+            }
+        }
+
+        // Fills the left and right apron of row y from its pixels, i.e. after writing the row alone
+        void FillRowBorders(int32_t y, BorderMode mode = BorderMirror)
+        {
+            PixelType* row = Row(y);
+            const int max = _width - 1;
+            for (int32_t i = 1; i <= _apron; i++)
+            {
+                row[-i] = row[Internal::BorderIndex(-i, max, mode)];
+                row[max + i] = row[Internal::BorderIndex(max + i, max, mode)];
+            }
+        }
+
+    private:
+        // disable copy methods
+        PaddedImage(const PaddedImage&);
+        PaddedImage& operator=(const PaddedImage&);
+
+        PixelType* _buffer;
+        PixelType* _data;    // first pixel of the image
+        size_t _bytes;
+        int32_t _width;
+        int32_t _height;
+        int32_t _apron;
+        int32_t _stride;
+    };
+}
\ No newline at end of file
@@ -1,207 +1,597 @@
 #include "Includes.h"
 #include "Parallel.h"
 #include "Threading.h"
+#include "Profiler.h"
+#include "Memory.h"
+
+#include <deque>
+#include <map>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <stdio.h>
+#endif
 
 namespace IRL
 {
     namespace Parallel
     {
-        class ThreadPool
+        // How many times waiting thread checks for work before it blocks
+        const int WaitSpins = 4000;
+
+        //////////////////////////////////////////////////////////////////////////
+        // Topology
+
+        struct HardwareThread
+        {
+            int Cpu;        // as the system numbers it, -1 when it can't be pinned
+            int Socket;     // from 0
+            int Core;       // from 0 within the socket
+            int Sibling;    // from 0 within the core
+        };
+
+        // Pinning order: siblings by rank, then cores by rank, then sockets
+        static bool ByPinningOrder(const HardwareThread& a, const HardwareThread& b)
+        {
+            if (a.Sibling != b.Sibling)
+                return a.Sibling < b.Sibling;
+            if (a.Core != b.Core)
+                return a.Core < b.Core;
+            if (a.Socket != b.Socket)
+                return a.Socket < b.Socket;
+            return a.Cpu < b.Cpu;
+        }
+
+#ifdef __linux__
+        // Return value of topology file 'name' of the cpu, -1 when there is none
+        static int ReadCpuTopology(int cpu, const char* name)
+        {
+            char path[128];
+            sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+            FILE* file = fopen(path, "r");
+            if (file == NULL)
+                return -1;
+            int value = -1;
+            if (fscanf(file, "%d", &value) != 1)
+                value = -1;
+            fclose(file);
+            return value;
+        }
+#endif
+
+        // Hardware threads of the process affinity with ids of the system, sockets and cores may be any numbers
+        static std::vector<HardwareThread> ListThreads()
+        {
+            std::vector<HardwareThread> threads;
+#ifdef _WIN32
+            // one processor group, as far as the affinity mask reaches
+            DWORD bytes = 0;
+            GetLogicalProcessorInformation(NULL, &bytes);
+            std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(bytes / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+            DWORD_PTR process, system;
+            if (!infos.empty() && GetLogicalProcessorInformation(&infos[0], &bytes) &&
+                GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+            {
+                const int bits = sizeof(DWORD_PTR) * 8;
+                std::vector<int> sockets(bits, 0);
+                std::vector<int> cores(bits, -1);
+                for (size_t i = 0; i < infos.size(); i++)
+                    for (int cpu = 0; cpu < bits; cpu++)
+                    {
+                        if ((infos[i].ProcessorMask & ((ULONG_PTR)1 << cpu)) == 0)
+                            continue;
+                        if (infos[i].Relationship == RelationProcessorPackage)
+                            sockets[cpu] = (int)i;
+                        else if (infos[i].Relationship == RelationProcessorCore)
+                            cores[cpu] = (int)i;
+                    }
+                for (int cpu = 0; cpu < bits; cpu++)
+                    if (process & ((DWORD_PTR)1 << cpu))
+                    {
+                        HardwareThread thread = { cpu, sockets[cpu], cores[cpu] >= 0 ? cores[cpu] : cpu, 0 };
+                        threads.push_back(thread);
+                    }
+            }
+#elif defined(__linux__)
+            cpu_set_t set;
+            if (sched_getaffinity(0, sizeof(set), &set) == 0)
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                    if (CPU_ISSET(cpu, &set))
+                    {
+                        const int core = ReadCpuTopology(cpu, "core_id");
+                        HardwareThread thread = { cpu, Maximum(ReadCpuTopology(cpu, "physical_package_id"), 0),
+                            core >= 0 ? core : cpu, 0 };
+                        threads.push_back(thread);
+                    }
+#endif
+            if (threads.empty())
+            {
+                const unsigned int count = Thread::HardwareThreads();
+                for (unsigned int i = 0; i < count; i++)
+                {
+                    HardwareThread thread = { -1, 0, (int)i, 0 };
+                    threads.push_back(thread);
+                }
+            }
+            return threads;
+        }
+
+        // Hardware threads in pinning order, with ranks of sockets, cores and siblings
+        static std::vector<HardwareThread> DetectThreads()
+        {
+            std::vector<HardwareThread> threads = ListThreads();
+            std::map<int, int> sockets;
+            std::map<std::pair<int, int>, int> cores;
+            for (size_t i = 0; i < threads.size(); i++)
+            {
+                sockets[threads[i].Socket] = 0;
+                cores[std::make_pair(threads[i].Socket, threads[i].Core)] = 0;
+            }
+            int socketRank = 0;
+            for (std::map<int, int>::iterator it = sockets.begin(); it != sockets.end(); ++it)
+                it->second = socketRank++;
+            // cores are ranked within their sockets, which the map keeps together
+            std::map<int, int> coresOfSocket;
+            std::map<std::pair<int, int>, int>::iterator core;
+            for (core = cores.begin(); core != cores.end(); ++core)
+                core->second = coresOfSocket[core->first.first]++;
+            std::map<std::pair<int, int>, int> siblings;
+            for (size_t i = 0; i < threads.size(); i++)
+            {
+                HardwareThread& thread = threads[i];
+                const std::pair<int, int> key(thread.Socket, thread.Core);
+                thread.Sibling = siblings[key]++;
+                thread.Core = cores[key];
+                thread.Socket = sockets[thread.Socket];
+            }
+            std::sort(threads.begin(), threads.end(), ByPinningOrder);
+            return threads;
+        }
+
+        static const std::vector<HardwareThread>& GetThreads()
+        {
+            static const std::vector<HardwareThread> threads = DetectThreads();
+            return threads;
+        }
+
+        // Binds the calling thread to the hardware thread
+        static void PinCurrentThread(int cpu)
+        {
+#ifdef _WIN32
+            SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+#else
+            (void)cpu;
+#endif
+        }
+
+        // Queued tasks of one worker. The owner takes the newest tasks, thieves take the oldest ones.
+        class TaskDeque
+        {
+        public:
+            struct Item
+            {
+                Runnable* Task;
+                Completion* Owner;
+                // profiler scope and pyramid level of the spawning thread, which allocations of the task count to
+                const char* Scope;
+                int Level;
+            };
+
+            void Push(const Item& item)
+            {
+                AutoMutex lock(_lock);
+                _items.push_back(item);
+            }
+
+            bool Pop(Item& item)
+            {
+                AutoMutex lock(_lock);
+                if (_items.empty())
+                    return false;
+                item = _items.back();
+                _items.pop_back();
+                return true;
+            }
+
+            bool Steal(Item& item)
+            {
+                AutoMutex lock(_lock);
+                if (_items.empty())
+                    return false;
+                item = _items.front();
+                _items.pop_front();
+                return true;
+            }
+
+        private:
+            Mutex _lock;
+            std::deque<Item> _items;
+        };
+
+        class Scheduler
         {
         public:
-            ThreadPool()
+            Scheduler()
             {
                 _initialized = false;
-                _allReady = false;
+                _pinned = false;
+                _stop = false;
             }
 
-            ~ThreadPool()
+            ~Scheduler()
             {
-                if (!_initialized)
-                    return;
-                ASSERT(_allReady);
-                for (unsigned int i = 0; i < _workers.size(); i++)
-                {
-                    _workers[i]->Stop();
-                    delete _workers[i];
-                }
+                Shutdown();
             }
 
-            void Initialize(unsigned int workers)
+            void Initialize(unsigned int workers, bool pin)
             {
                 ASSERT(!_initialized);
-                ASSERT(workers > 0);
+                const std::vector<HardwareThread>& threads = GetThreads();
+                if (workers == 0)
+                    workers = (unsigned int)threads.size();
                 _initialized = true;
+                _pinned = pin && threads[0].Cpu >= 0;
+                // deque 0 is shared by all threads outside of the pool
+                _deques.resize(workers);
+                for (unsigned int i = 0; i < _deques.size(); i++)
+                    _deques[i] = new TaskDeque();
                 _workers.resize(workers - 1);
                 for (unsigned int i = 0; i < _workers.size(); i++)
                 {
-                    _workers[i] = new WorkerThread();
+                    // the first hardware thread is left to the thread outside of the pool
+                    const int cpu = _pinned ? threads[(i + 1) % threads.size()].Cpu : -1;
+                    _workers[i] = new WorkerThread(this, i + 1, cpu);
                     _workers[i]->Start();
                 }
-                _allReady = true;
+            }
+
+            void Shutdown()
+            {
+                if (!_initialized)
+                    return;
+                ASSERT(_queued.Load() == 0);
+                _idleLock.Lock();
+                _stop = true;
+                _hasWork.WakeAll();
+                _idleLock.Unlock();
+                for (unsigned int i = 0; i < _workers.size(); i++)
+                {
+                    _workers[i]->Join();
+                    delete _workers[i];
+                }
+                for (unsigned int i = 0; i < _deques.size(); i++)
+                    delete _deques[i];
+                _workers.clear();
+                _deques.clear();
+                _stop = false;
+                _pinned = false;
+                _initialized = false;
             }
 
             unsigned int GetWorkersCount()
             {
                 ASSERT(_initialized);
-                return _workers.size() + 1;
+                return _deques.size();
             }
 
-            void Spawn(Runnable** targets, unsigned int count)
+            bool IsPinned()
             {
-                ASSERT(_allReady);
-                if (count == 0)
-                    return;
-                _allReady = false;
-                // run count - 1 in parallel
-                unsigned int i = 0;
-                if (count > 1)
+                return _pinned;
+            }
+
+            void Spawn(Runnable* task, Completion* owner)
+            {
+                ASSERT(_initialized);
+                ASSERT(task != NULL);
+                TaskDeque::Item item;
+                item.Task = task;
+                item.Owner = owner;
+                item.Scope = Tools::Profiler::GetCurrentScope();
+                item.Level = Memory::GetLevel();
+                _deques[CurrentIndex()]->Push(item);
+                _queued.FetchAndAdd(1);
+                // sleeping counter is changed before checking _queued, so the wakeup is not lost
+                if (_sleeping.Load() > 0)
                 {
-                    for (i = 0; i < count - 1; i++)
+                    AutoMutex lock(_idleLock);
+                    _hasWork.WakeOne();
+                }
+            }
+
+            void Wait(Completion* completion)
+            {
+                const unsigned int index = CurrentIndex();
+                // remaining tasks are usually short, so spin first and block only after that
+                int spins = 0;
+                while (!completion->IsDone())
+                {
+                    if (_queued.Load() > 0 && RunOne(index))
                     {
-                        ASSERT(targets[i] != NULL);
-                        _workers[i]->RunTask(targets[i]);
+                        spins = 0;
+                        continue;
                     }
+                    if (spins++ < WaitSpins)
+                        continue;
+
+                    AutoMutex lock(_idleLock);
+                    _sleeping.FetchAndAdd(1);
+                    while (_queued.Load() == 0 && !completion->IsDone())
+                        _hasWork.Wait(_idleLock);
+                    _sleeping.FetchAndAdd(-1);
+                    spins = 0;
                 }
-                // and run remaining one right now
-                ASSERT(targets[i] != NULL);
-                targets[i]->Run();
             }
 
-            void Sync()
+            // Wakes threads blocked in Wait, called once completion has no pending tasks
+            void NotifyDone()
             {
-                if (_allReady)
-                    return;
-                for (unsigned int i = 0; i < _workers.size(); i++)
-                    _workers[i]->Sync();
-                _allReady = true;
+                // sleeping counter is changed before checking completion, so the wakeup is not lost
+                if (_sleeping.Load() > 0)
+                {
+                    AutoMutex lock(_idleLock);
+                    _hasWork.WakeAll();
+                }
             }
 
         private:
-            class WorkerThread :
-                public Thread
+            // Executes one queued task, own tasks first. Return false if there is no one.
+            bool RunOne(unsigned int index)
             {
-            public:
-                WorkerThread()
+                TaskDeque::Item item;
+                bool found = _deques[index]->Pop(item);
+                // steal starting from the next deque, so thieves spread over victims
+                for (unsigned int i = 1; !found && i < _deques.size(); i++)
+                    found = _deques[(index + i) % _deques.size()]->Steal(item);
+                if (!found)
+                    return false;
+                _queued.FetchAndAdd(-1);
                 {
-                    _ready = true;
+                    // shows workers occupancy in the trace, allocations count to the spawning scope
+                    Tools::Profiler profiler("Task", item.Scope);
+                    Memory::LevelScope level(item.Level);
+                    item.Task->Run();
                 }
+                item.Owner->Finished();
+                return true;
+            }
 
-                void Stop()
-                {
-                    _lock.Lock();
-                    _commands.push_back(Command(Command::Quit));
-                    _lock.Unlock();
-                    _hasCommands.WakeOne();
-                    Join();
-                }
+            // Index of the deque of the current thread
+            unsigned int CurrentIndex()
+            {
+                return _index.IsSet() ? _index.Get() : 0;
+            }
 
-                void Sync()
+            void WorkerLoop(unsigned int index)
+            {
+                _index.Set(index);
+                while (1)
                 {
-                    _lock.Lock();
-                    while (!_ready)
-                        _readyCondition.Wait(_lock);
-                    _lock.Unlock();
+                    if (RunOne(index))
+                        continue;
+                    AutoMutex lock(_idleLock);
+                    _sleeping.FetchAndAdd(1);
+                    while (_queued.Load() == 0 && !_stop)
+                        _hasWork.Wait(_idleLock);
+                    _sleeping.FetchAndAdd(-1);
+                    if (_stop)
+                        break;
                 }
+            }
 
-                void RunTask(Runnable* task)
-                {
-                    _lock.Lock();
-                    ASSERT(_ready);
-                    _ready = false;
-                    _commands.push_back(Command(Command::Exec, task));
-                    _lock.Unlock();
-                    _hasCommands.WakeOne();
-                }
+            class WorkerThread :
+                public Thread
+            {
+            public:
+                WorkerThread(Scheduler* owner, unsigned int index, int cpu) : _owner(owner), _index(index), _cpu(cpu) {}
 
             private:
-                class Command
-                {
-                public:
-                    enum Types
-                    {
-                        Unknown,
-                        Quit,
-                        Exec
-                    };
-                    
-                    Command()
-                    {
-                        Type = Unknown;
-                        Task = NULL;
-                    }
-
-                    Command(Types type, Runnable* task = NULL)
-                    {
-                        Type = type;
-                        Task = task;
-                    }
-
-                public:
-                    Types Type;
-                    Runnable* Task;
-                };
-
                 virtual void Run()
                 {
-                    while (1)
-                    {
-                        Command cmd;
-                        _lock.Lock();
-                        while (_commands.empty())
-                            _hasCommands.Wait(_lock);
-                        cmd = _commands.front();
-                        _commands.pop_front();
-                        _lock.Unlock();
-
-                        ASSERT(cmd.Type != Command::Unknown);
-                        if (cmd.Type == Command::Quit)
-                            break;
-                        if (cmd.Type == Command::Exec)
-                        {
-                            cmd.Task->Run();
-                            _lock.Lock();
-                            _ready = true;
-                            _readyCondition.WakeAll();
-                            _lock.Unlock();
-                        }
-                    }
+                    if (_cpu >= 0)
+                        PinCurrentThread(_cpu);
+                    _owner->WorkerLoop(_index);
                 }
 
-            private:
-                Mutex _lock;
-                bool _ready;
-                WaitCondition _readyCondition; // _ready == true
-                std::list<Command> _commands;
-                WaitCondition _hasCommands; // !_commands.empty()
+                Scheduler* _owner;
+                unsigned int _index;
+                int _cpu;   // hardware thread the worker is pinned to, -1 if none
             };
 
-            std::vector<WorkerThread*> _workers;
+        private:
             bool _initialized;
-            bool _allReady;
+            bool _pinned;
+            std::vector<TaskDeque*> _deques;
+            std::vector<WorkerThread*> _workers;
+            ThreadLocal<unsigned int> _index; // deque of the pool thread
+
+            AtomicInt _queued;   // tasks in all deques
+            AtomicInt _sleeping; // threads blocked on _hasWork
+            Mutex _idleLock;
+            WaitCondition _hasWork; // _queued > 0, _stop or some completion is done
+            bool _stop;
         };
 
-        ThreadPool g_ThreadPool;
+        Scheduler g_Scheduler;
+        ThreadLocal<const AtomicInt*> g_ConcurrencyLimit;
+        unsigned int g_GrainSize = 16384;
 
-        void Initialize(unsigned int workers)
+        Topology GetTopology()
         {
-            g_ThreadPool.Initialize(workers);
+            const std::vector<HardwareThread>& threads = GetThreads();
+            Topology result;
+            result.Sockets = 0;
+            result.Cores = 0;
+            result.Threads = (unsigned int)threads.size();
+            for (size_t i = 0; i < threads.size(); i++)
+            {
+                result.Sockets = Maximum(result.Sockets, (unsigned int)threads[i].Socket + 1);
+                if (threads[i].Sibling == 0)
+                    result.Cores++;
+            }
+            return result;
+        }
+
+        void Initialize(unsigned int workers, bool pin)
+        {
+            g_Scheduler.Initialize(workers, pin);
+        }
+
+        void Shutdown()
+        {
+            g_Scheduler.Shutdown();
         }
 
         unsigned int GetWorkersCount()
         {
-            return g_ThreadPool.GetWorkersCount();
+            return g_Scheduler.GetWorkersCount();
+        }
+
+        bool IsPinned()
+        {
+            return g_Scheduler.IsPinned();
+        }
+
+        void SetConcurrencyLimit(const AtomicInt* limit)
+        {
+            g_ConcurrencyLimit.Set(limit);
+        }
+
+        const AtomicInt* GetConcurrencyLimit()
+        {
+            return g_ConcurrencyLimit.Get();
         }
 
-        void Spawn(Runnable** targets, unsigned int count)
+        unsigned int GetConcurrency()
         {
-            ASSERT(count <= GetWorkersCount());
-            return g_ThreadPool.Spawn(targets, count);
+            unsigned int workers = g_Scheduler.GetWorkersCount();
+            const AtomicInt* limit = g_ConcurrencyLimit.Get();
+            const int value = limit != NULL ? limit->Load() : 0;
+            if (value > 0)
+                workers = Minimum<unsigned int>(workers, value);
+            return workers;
         }
 
-        void Sync()
+        void SetGrainSize(unsigned int work)
         {
-            g_ThreadPool.Sync();
+            ASSERT(work > 0);
+            g_GrainSize = work;
+        }
+
+        unsigned int GetGrainSize()
+        {
+            return g_GrainSize;
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+        // Completion
+
+        Completion::Completion()
+        {
+        }
+
+        Completion::~Completion()
+        {
+            Wait();
+        }
+
+        void Completion::Spawn(Runnable* task)
+        {
+            _pending.FetchAndAdd(1);
+            g_Scheduler.Spawn(task, this);
+        }
+
+        void Completion::SpawnAndRun(Runnable** targets, unsigned int count)
+        {
+            if (count == 0)
+                return;
+            // the newest task is taken first by this thread, so queue in reverse order
+            for (unsigned int i = count - 1; i > 0; i--)
+                Spawn(targets[i]);
+            ASSERT(targets[0] != NULL);
+            targets[0]->Run();
+        }
+
+        bool Completion::IsDone()
+        {
+            // compare and swap is a memory barrier, so results of the tasks are visible after it
+            return _pending.CompareAndSwap(0, 0);
+        }
+
+        void Completion::Wait()
+        {
+            if (!IsDone())
+                g_Scheduler.Wait(this);
+        }
+
+        void Completion::Finished()
+        {
+            if (_pending.FetchAndAdd(-1) == 1)
+                g_Scheduler.NotifyDone();
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+        // TaskGraph
+
+        TaskGraph::TaskGraph()
+            : _completion(NULL)
+        {
+        }
+
+        int TaskGraph::Add(Runnable* task)
+        {
+            ASSERT(task != NULL && _completion == NULL);
+            Node node;
+            node.Graph = this;
+            node.Task = task;
+            node.Predecessors = 0;
+            _nodes.push_back(node);
+            return (int)_nodes.size() - 1;
+        }
+
+        void TaskGraph::Depend(int task, int predecessor)
+        {
+            ASSERT(task != predecessor && _completion == NULL);
+            _nodes[predecessor].Successors.push_back(task);
+            _nodes[task].Predecessors++;
+        }
+
+        void TaskGraph::Run()
+        {
+            if (_nodes.empty())
+                return;
+            Completion completion;
+            _completion = &completion;
+            std::vector<Runnable*> ready;
+            for (size_t i = 0; i < _nodes.size(); i++)
+            {
+                _nodes[i].Waiting.Store(_nodes[i].Predecessors);
+                if (_nodes[i].Predecessors == 0)
+                    ready.push_back(&_nodes[i]);
+            }
+            ASSERT(!ready.empty()); // cycles never start
+            completion.SpawnAndRun(&ready[0], (unsigned int)ready.size());
+            completion.Wait();
+            _completion = NULL;
+        }
+
+        void TaskGraph::Node::Run()
+        {
+            Task->Run();
+            // the last predecessor spawns the successor, full barrier makes results of others visible
+            for (size_t i = 0; i < Successors.size(); i++)
+            {
+                Node& successor = Graph->_nodes[Successors[i]];
+                if (successor.Waiting.FetchAndAdd(-1) == 1)
+                    Graph->_completion->Spawn(&successor);
+            }
         }
     }
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Threading.h"
+
 namespace IRL
 {
     namespace Parallel
@@ -13,22 +15,145 @@ namespace IRL
 
         //////////////////////////////////////////////////////////////////////////
 
-        // Initialized the lib
-        extern void Initialize(unsigned int workers);
+        // Hardware the process may run on
+        struct Topology
+        {
+            unsigned int Sockets;   // processor packages, each with memory of its own on multi-socket hosts
+            unsigned int Cores;     // physical cores of all sockets
+            unsigned int Threads;   // hardware threads of all cores, more than cores with SMT
+        };
+
+        // Detected once from the hardware threads in the affinity of the process, one socket of
+        // HardwareThreads() cores where the system does not tell
+        extern Topology GetTopology();
+
+        // Initialized the lib, 0 workers means one per hardware thread of GetTopology().
+        // With 'pin' every worker runs on one hardware thread only, first threads of cores before their SMT
+        // siblings and consecutive workers on alternating sockets, so any count of workers shares cores and
+        // memory controllers evenly. The thread which initializes the lib is not pinned, the first hardware
+        // thread in that order is left to it. Pinned workers of more than one socket first touch big blocks
+        // of Memory, so their pages are spread over the memory of all sockets instead of the allocating one.
+        extern void Initialize(unsigned int workers, bool pin = false);
+        // Stops worker threads, no tasks may be running. The lib may be initialized again after it.
+        extern void Shutdown();
 
-        // Maximum allowed workers count in Spawn
+        // How many threads execute tasks, including the one which waits for them
         extern unsigned int GetWorkersCount();
+        // True when the lib is initialized with pinned workers
+        extern bool IsPinned();
+
+        // Limits how many tasks TaskGroup and ParallelFor created by the current thread split work into,
+        // so concurrent callers share the workers. The limit is read on every split, so its owner may
+        // change it meanwhile. NULL or value <= 0 means all workers.
+        extern void SetConcurrencyLimit(const AtomicInt* limit);
+        // Limit of the current thread, so that it may be restored after a temporary one
+        extern const AtomicInt* GetConcurrencyLimit();
+        // Workers count reduced by concurrency limit of the current thread
+        extern unsigned int GetConcurrency();
+
+        // Minimum work (i.e. pixels) worth a separate task in ParallelFor, default 16384
+        extern void SetGrainSize(unsigned int work);
+        extern unsigned int GetGrainSize();
+
+        // Join of tasks spawned with it.
+        // Tasks are queued to per worker deques, idle workers steal them from each other.
+        // Waiting thread executes queued tasks meanwhile, so tasks may spawn and wait
+        // for nested tasks, and there may be more tasks than workers.
+        class Completion
+        {
+        public:
+            Completion();
+            ~Completion(); // waits for spawned tasks
 
-        // Invokes targets in parallel. Count should be <= GetWorkersCount().
-        // All workers should not be busy, i.e. Sync should be called.
-        extern void Spawn(Runnable** targets, unsigned int count);
+            // Queues task for execution by any worker, task has to live till it is done
+            void Spawn(Runnable* task);
+            // Queues all targets and runs the first one right now
+            void SpawnAndRun(Runnable** targets, unsigned int count);
+            // Return true if all spawned tasks are done
+            bool IsDone();
+            // Wait till all spawned tasks are done
+            void Wait();
 
-        // Wait till all workers finish their tasks.
-        extern void Sync();
+            // Called by the scheduler once task is done
+            void Finished();
+
+        private:
+            // disable copy methods
+            Completion(const Completion&);
+            void operator=(const Completion&);
+
+            AtomicInt _pending;
+        };
+
+        //////////////////////////////////////////////////////////////////////////
+
+        // Runs the task asynchronously, i.e. to overlap independent stages
+        template<class Task>
+        class Future
+        {
+        public:
+            Future() {}
+            ~Future() { Wait(); }
+
+            // Setup the task before Start() and read results after Wait()
+            Task& Get() { return _task; }
+            void Start() { _completion.Spawn(&_task); }
+            bool IsDone() { return _completion.IsDone(); }
+            void Wait() { _completion.Wait(); }
+
+        private:
+            // disable copy methods
+            Future(const Future&);
+            void operator=(const Future&);
+
+            Task _task;
+            Completion _completion;
+        };
+
+        //////////////////////////////////////////////////////////////////////////
+
+        // Runs tasks once the tasks they depend on are done, so independent stages of a pipeline
+        // overlap instead of waiting for each other at barriers
+        class TaskGraph
+        {
+        public:
+            TaskGraph();
+
+            // Adds task, return its index. The task has to live till Run() returns.
+            int Add(Runnable* task);
+            // Makes 'task' start after 'predecessor' is done
+            void Depend(int task, int predecessor);
+            // Runs all tasks and waits for them. The calling thread runs one of the tasks without predecessors
+            // and executes queued ones meanwhile. The graph may be run again.
+            void Run();
+
+        private:
+            // disable copy methods
+            TaskGraph(const TaskGraph&);
+            void operator=(const TaskGraph&);
+
+            // Runs the task and spawns successors which became ready
+            class Node :
+                public Runnable
+            {
+            public:
+                virtual void Run();
+
+                TaskGraph* Graph;
+                Runnable* Task;
+                std::vector<int> Successors;
+                int Predecessors;
+                AtomicInt Waiting;  // predecessors which are not done yet in the running graph
+            };
+
+            std::vector<Node> _nodes;
+            Completion* _completion; // of the running graph
+        };
 
         //////////////////////////////////////////////////////////////////////////
 
-        // Little helper
+        // Little helper, runs its tasks in parallel and waits for them.
+        // Default size is GetConcurrency().
         template<class T>
         class TaskGroup
         {
@@ -49,13 +174,15 @@ namespace IRL
         class ParallelFor : public TaskGroup<Task>
         {
             // Task should have Set(Index start, Index stop, State state) method.
+            // With workPerIndex > 0 every task gets at least GetGrainSize() work,
+            // so small ranges run inline in SpawnAndSync.
 
             // disable copy methods
             ParallelFor();
             ParallelFor(const ParallelFor&);
             void operator=(const ParallelFor&);
         public:
-            ParallelFor(Index min, Index max, State state);
+            ParallelFor(Index min, Index max, State state, unsigned int workPerIndex = 0);
         };
     }
 }
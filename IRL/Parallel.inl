@@ -7,7 +7,7 @@ namespace IRL
         template<class T>
         TaskGroup<T>::TaskGroup()
         {
-            _vec.resize(GetWorkersCount());
+            _vec.resize(GetConcurrency());
         }
         template<class T>
         TaskGroup<T>::TaskGroup(unsigned int size)
@@ -35,31 +35,36 @@ namespace IRL
             if (!_vec.empty())
             {
                 std::vector<Runnable*> targets(_vec.size());
-                targets.resize(_vec.size());
                 for (unsigned int i = 0; i < _vec.size(); i++)
                     targets[i] = &_vec[i];
-                Spawn(&targets[0], targets.size());
-                Sync();
+                Completion completion;
+                completion.SpawnAndRun(&targets[0], targets.size());
+                completion.Wait();
             }
         }
 
         //////////////////////////////////////////////////////////////////////////
 
         template<class Task, class State, class Index>
-        ParallelFor<Task, State, Index>::ParallelFor(Index min, Index max, State state) : TaskGroup<Task>(0)
+        ParallelFor<Task, State, Index>::ParallelFor(Index min, Index max, State state, unsigned int workPerIndex)
+            : TaskGroup<Task>(0)
         {
             ASSERT(max >= min);
             if (max == min)
                 return;
             unsigned int range = max - min;
-            if (range <= GetWorkersCount())
-                Resize(range);
-            else
-                Resize(GetWorkersCount());
-            int step = (max - min) / Count();
+            unsigned int count = Minimum(range, GetConcurrency());
+            if (workPerIndex > 0)
+            {
+                uint64_t tasks = (uint64_t)range * workPerIndex / GetGrainSize();
+                if (tasks < count)
+                    count = Maximum<unsigned int>((unsigned int)tasks, 1);
+            }
+            this->Resize(count);
+            int step = (max - min) / this->Count();
             int i = 0;
             Index pos = min;
-            for (; i < Count() - 1; i++)
+            for (; i < this->Count() - 1; i++)
             {
                 (*this)[i].Set(pos, pos + step, state);
                 pos += step;
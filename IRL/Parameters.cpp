@@ -10,6 +10,33 @@ namespace IRL
     int ObjectRemovalMinNNFIterations;
     int ObjectRemovalNNFIterationsLODFactor;
     double ObjectRemovalAlpha;
+    double ObjectRemovalEnergyTolerance;
+    double ObjectRemovalOffsetsTolerance;
+    double ObjectRemovalNNFTolerance;
+    bool ObjectRemovalUseOpenCL;
+    int ObjectRemovalRegionReach;
+    bool ObjectRemovalFixedPoint;
+    double ObjectRemovalTimeBudget;
+    int ObjectRemovalTileSize;
+    double RetargetingStep;
+    int CorrespondenceLevels;
+    uint32_t RandomSeed;
+    bool ObjectRemovalPatchIndex;
+    bool ObjectRemovalPatchBounds;
+    bool ObjectRemovalHashedField;
+    int ObjectRemovalPatchSize;
+    int ObjectRemovalCoarsePatchSize;
+    int ObjectRemovalFinePatchLevels;
+    int ObjectRemovalNearestNeighbors;
+    bool ObjectRemovalCompactVotes;
+    int64_t ObjectRemovalExhaustiveSearchLimit;
+    bool ObjectRemovalSkipConverged;
+    int ObjectRemovalVideoWarmLevels;
+    int ObjectRemovalRandomSearchLimit;
+    int ObjectRemovalRandomSearchInvAlpha;
+    int ObjectRemovalSuperPatchSize;
+    bool ObjectRemovalTiledSource;
+    bool ObjectRemovalBatchedRandomSearch;
 
     void ResetParameters()
     {
@@ -20,5 +47,79 @@ namespace IRL
         ObjectRemovalMinNNFIterations = 4;
         ObjectRemovalNNFIterationsLODFactor = 4;
         ObjectRemovalAlpha = 0.5;
+        ObjectRemovalEnergyTolerance = 0.001;
+        ObjectRemovalOffsetsTolerance = 0.001;
+        ObjectRemovalNNFTolerance = 0.001;
+        ObjectRemovalUseOpenCL = true;
+        ObjectRemovalRegionReach = 8;
+        ObjectRemovalFixedPoint = false;
+        ObjectRemovalTimeBudget = 0;
+        ObjectRemovalTileSize = 0;
+        RetargetingStep = 0.05;
+        CorrespondenceLevels = 3;
+        RandomSeed = 0;
+        ObjectRemovalPatchIndex = false;
+        ObjectRemovalPatchBounds = false;
+        ObjectRemovalHashedField = false;
+        ObjectRemovalPatchSize = IRL::PatchSize;
+        ObjectRemovalCoarsePatchSize = IRL::PatchSize;
+        ObjectRemovalFinePatchLevels = 1;
+        ObjectRemovalNearestNeighbors = 1;
+        ObjectRemovalCompactVotes = false;
+        ObjectRemovalExhaustiveSearchLimit = 250000;
+        ObjectRemovalSkipConverged = false;
+        ObjectRemovalVideoWarmLevels = 2;
+        ObjectRemovalRandomSearchLimit = 80;
+        ObjectRemovalRandomSearchInvAlpha = 2;
+        ObjectRemovalSuperPatchSize = 0;
+        ObjectRemovalTiledSource = false;
+        ObjectRemovalBatchedRandomSearch = false;
+    }
+
+    ObjectRemovalParameters::ObjectRemovalParameters()
+    {
+        // the member hides the global of the same name
+        DebugOutput = IRL::DebugOutput;
+        LODBias = ObjectRemovalLODBias;
+        MinIterations = ObjectRemovalMinIterations;
+        IterationsLODFactor = ObjectRemovalIterationsLODFactor;
+        MinNNFIterations = ObjectRemovalMinNNFIterations;
+        NNFIterationsLODFactor = ObjectRemovalNNFIterationsLODFactor;
+        Alpha = ObjectRemovalAlpha;
+        EnergyTolerance = ObjectRemovalEnergyTolerance;
+        OffsetsTolerance = ObjectRemovalOffsetsTolerance;
+        NNFTolerance = ObjectRemovalNNFTolerance;
+        UseOpenCL = ObjectRemovalUseOpenCL;
+        RegionReach = ObjectRemovalRegionReach;
+        FixedPoint = ObjectRemovalFixedPoint;
+        TimeBudget = ObjectRemovalTimeBudget;
+        TileSize = ObjectRemovalTileSize;
+        Seed = RandomSeed;
+        PatchIndex = ObjectRemovalPatchIndex;
+        PatchBounds = ObjectRemovalPatchBounds;
+        HashedField = ObjectRemovalHashedField;
+        PatchSize = ObjectRemovalPatchSize;
+        CoarsePatchSize = ObjectRemovalCoarsePatchSize;
+        FinePatchLevels = ObjectRemovalFinePatchLevels;
+        NearestNeighbors = ObjectRemovalNearestNeighbors;
+        CompactVotes = ObjectRemovalCompactVotes;
+        ExhaustiveSearchLimit = ObjectRemovalExhaustiveSearchLimit;
+        SkipConverged = ObjectRemovalSkipConverged;
+        VideoWarmLevels = ObjectRemovalVideoWarmLevels;
+        RandomSearchLimit = ObjectRemovalRandomSearchLimit;
+        RandomSearchInvAlpha = ObjectRemovalRandomSearchInvAlpha;
+        SuperPatchSize = ObjectRemovalSuperPatchSize;
+        TiledSource = ObjectRemovalTiledSource;
+        BatchedRandomSearch = ObjectRemovalBatchedRandomSearch;
+    }
+
+    RetargetingParameters::RetargetingParameters()
+    {
+        Step = RetargetingStep;
+    }
+
+    CorrespondenceParameters::CorrespondenceParameters()
+    {
+        Levels = CorrespondenceLevels;
     }
 }
\ No newline at end of file
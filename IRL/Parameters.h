@@ -16,6 +16,143 @@ namespace IRL
     extern int ObjectRemovalNNFIterationsLODFactor;
     // weight of the completness term in object removal alg.
     extern double ObjectRemovalAlpha;
+    // stop iterations on level after ObjectRemovalMinIterations once relative energy change is lower (0 to disable)
+    extern double ObjectRemovalEnergyTolerance;
+    // stop iterations on level after ObjectRemovalMinIterations once offsets updates per patch is lower (0 to disable)
+    extern double ObjectRemovalOffsetsTolerance;
+    // stop NNF iterations once offsets updates per patch is lower (0 to disable)
+    extern double ObjectRemovalNNFTolerance;
+    // compute patch match on OpenCL device when it is available
+    extern bool ObjectRemovalUseOpenCL;
+    // process only pixels within ObjectRemovalRegionReach half patches from masked ones on levels where 
+    // such region is at most half of the image, the rest is copied from source (0 to always process whole image)
+    extern int ObjectRemovalRegionReach;
+    // solve in fixed point Lab8 pixels when the input has floating point channels, results are converted back.
+    // Several times less memory traffic for a little precision.
+    extern bool ObjectRemovalFixedPoint;
+    // wall clock budget of one removal in seconds, iterations which don't fit are skipped (0 for no limit).
+    // The budget is spread over levels by their scheduled work, cost of work is measured meanwhile.
+    extern double ObjectRemovalTimeBudget;
+    // solve large images in tiles of this size: tiles with masked pixels are grouped and every group is solved
+    // in its crop grown by one tile of context, so memory follows holes instead of the image (0 to disable)
+    extern int ObjectRemovalTileSize;
+    // largest relative change of image size made by one retargeting step, the solver runs once per step
+    extern double RetargetingStep;
+    // most pyramid levels correspondence queries match coarse to fine, 1 matches the full resolution only
+    extern int CorrespondenceLevels;
+    // seed of random search, runs with the same seed give bit identical results whatever the workers count
+    extern uint32_t RandomSeed;
+    // search target to source matches in a kd-tree of principal components of source patches instead of
+    // random samples, costs building the tree on every level
+    extern bool ObjectRemovalPatchIndex;
+    // reject patch match candidates by lower bounds of their distances from patch summaries, results are
+    // the same, pays off when the distance kernel is more expensive than looking the summaries up
+    extern bool ObjectRemovalPatchBounds;
+    // start cold levels, the coarsest level of a removal and the first step of retargeting, from offsets to
+    // source patches of similar hashed summaries instead of random or smooth ones (see MakeHashedField),
+    // so fewer iterations are spent finding the right regions
+    extern bool ObjectRemovalHashedField;
+    // patch size of the ObjectRemovalFinePatchLevels finest levels, odd from MinPatchSize to MaxPatchSize.
+    // Retargeting uses it on all levels.
+    extern int ObjectRemovalPatchSize;
+    // patch size of coarser levels of object removal, where larger patches capture structure and smaller
+    // ones are cheaper
+    extern int ObjectRemovalCoarsePatchSize;
+    // how many finest levels of object removal use ObjectRemovalPatchSize
+    extern int ObjectRemovalFinePatchLevels;
+    // how many best matches of a patch are kept and vote, from 1 to NNF::MaxK. More matches settle in fewer
+    // iterations, but disable OpenCL backend and cost more per iteration.
+    extern int ObjectRemovalNearestNeighbors;
+    // collect votes in 32 bit fixed point planes instead of accumulators of pixel channels, a half of the memory
+    // traffic of voting for double pixels, results differ by rounding
+    extern bool ObjectRemovalCompactVotes;
+    // levels where target patches times source patches of a field are at most this are matched exactly by one
+    // exhaustive NNF pass instead of patch match iterations (0 to disable)
+    extern int64_t ObjectRemovalExhaustiveSearchLimit;
+    // later NNF iterations process only patches whose offsets or offsets of their neighbors changed, and a few
+    // others, so they cost about as much as they change
+    extern bool ObjectRemovalSkipConverged;
+    // frames of a video after the first solve only this many finest levels, the coarsest of them starts from
+    // the previous frame's result, see VideoRemoval (0 to solve every frame from scratch)
+    extern int ObjectRemovalVideoWarmLevels;
+    // how many candidates random search of patch match examines per patch
+    extern int ObjectRemovalRandomSearchLimit;
+    // random search radius is divided by this after every candidate, at least 2
+    extern int ObjectRemovalRandomSearchInvAlpha;
+    // side of square super patches NNF iterations are scheduled by, results do not depend on it
+    // (0 to choose by the target size and the workers count)
+    extern int ObjectRemovalSuperPatchSize;
+    // patch match reads source images from copies in tiles of a few columns, where every patch is one block
+    // of memory, results do not change. Pays off on large levels, where patches of rows far apart miss caches.
+    extern bool ObjectRemovalTiledSource;
+    // random search of patch match prefetches source patches of several candidates before comparing them, so
+    // their cache misses overlap, results do not change
+    extern bool ObjectRemovalBatchedRandomSearch;
 
     extern void ResetParameters();
+
+    // Object removal parameters of one call, so calls with different settings may run concurrently.
+    // Constructor takes current values of the globals above.
+    struct ObjectRemovalParameters
+    {
+        ObjectRemovalParameters();
+
+        bool DebugOutput;
+        int LODBias;
+        int MinIterations;
+        int IterationsLODFactor;
+        int MinNNFIterations;
+        int NNFIterationsLODFactor;
+        double Alpha;
+        double EnergyTolerance;
+        double OffsetsTolerance;
+        double NNFTolerance;
+        bool UseOpenCL;
+        int RegionReach;
+        bool FixedPoint;
+        double TimeBudget;
+        int TileSize;
+        uint32_t Seed;
+        bool PatchIndex;
+        bool PatchBounds;
+        bool HashedField;
+        int PatchSize;
+        int CoarsePatchSize;
+        int FinePatchLevels;
+        int NearestNeighbors;
+        bool CompactVotes;
+        int64_t ExhaustiveSearchLimit;
+        bool SkipConverged;
+        int VideoWarmLevels;
+        int RandomSearchLimit;
+        int RandomSearchInvAlpha;
+        int SuperPatchSize;
+        bool TiledSource;
+        bool BatchedRandomSearch;
+        // file where the removal checkpoints its result after every level and which it resumes from when it
+        // holds a level of the same source, mask and parameters, so a preempted removal loses one level at most.
+        // Removed once the removal is done, tiles add their index to it (empty to disable, the default).
+        std::string CheckpointPath;
+        // written into names of temporary checkpoint files, so workers which may solve the same removal,
+        // i.e. one which lost its claim and the one which took it over, never write the same file (empty by default)
+        std::string CheckpointOwner;
+    };
+
+    // Retargeting parameters of one call, the solver is set up by the object removal ones
+    struct RetargetingParameters :
+        public ObjectRemovalParameters
+    {
+        RetargetingParameters();
+
+        double Step;
+    };
+
+    // Correspondence parameters of one call, patch match is set up by the object removal ones
+    struct CorrespondenceParameters :
+        public ObjectRemovalParameters
+    {
+        CorrespondenceParameters();
+
+        int Levels;
+    };
 }
\ No newline at end of file
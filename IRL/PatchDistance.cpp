@@ -0,0 +1,663 @@
+#include "Includes.h"
+#include "PatchDistance.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define IRL_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define IRL_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// AVX2 functions are compiled without global compiler flags so that
+// the binary still runs on older CPUs, selection happens in GetSimdLevel()
+#if defined(IRL_SIMD_X86) && !defined(_MSC_VER)
+#define IRL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IRL_TARGET_AVX2
+#endif
+
+namespace IRL
+{
+    namespace Internal
+    {
+        //////////////////////////////////////////////////////////////////////////
+        // CPU detection
+
+        static SimdLevel DetectSimdLevel()
+        {
+#if defined(IRL_SIMD_X86)
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 0);
+            int maxLeaf = info[0];
+            __cpuid(info, 1);
+            bool sse2 = (info[3] & (1 << 26)) != 0;
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            bool avx2 = false;
+            if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+            {
+                __cpuidex(info, 7, 0);
+                avx2 = (info[1] & (1 << 5)) != 0;
+            }
+#else
+            __builtin_cpu_init();
+            bool sse2 = __builtin_cpu_supports("sse2") != 0;
+            bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+            if (avx2)
+                return SimdAVX2;
+            if (sse2)
+                return SimdSSE2;
+            return SimdNone;
+#elif defined(IRL_SIMD_NEON)
+            return SimdNEON;
+#else
+            return SimdNone;
+#endif
+        }
+
+        SimdLevel GetSimdLevel()
+        {
+            static SimdLevel level = DetectSimdLevel();
+            return level;
+        }
+
+        const char* GetSimdLevelName(SimdLevel level)
+        {
+            switch (level)
+            {
+                case SimdSSE2: return "SSE2";
+                case SimdAVX2: return "AVX2";
+                case SimdNEON: return "NEON";
+                default:       return "None";
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+        // Lab channel weights, i.e. Multiplier<Channel>::X()^2 from Lab::Distance
+
+        template<class Channel>
+        struct LabWeights
+        {
+            Channel L, a, b;
+
+            LabWeights()
+            {
+                const Lab<Channel> zero(0, 0, 0);
+                L = Lab<Channel>::Distance(Lab<Channel>(1, 0, 0), zero);
+                a = Lab<Channel>::Distance(Lab<Channel>(0, 1, 0), zero);
+                b = Lab<Channel>::Distance(Lab<Channel>(0, 0, 1), zero);
+            }
+        };
+
+        static const LabWeights<uint8_t> g_Lab8Weights;
+        static const LabWeights<float> g_FloatWeights;
+        static const LabWeights<double> g_DoubleWeights;
+
+        // Kernels below process 7 pixels, i.e. 21 channels, unless they are templates of the patch size
+        const int RowChannels = 3 * 7;
+
+#if defined(IRL_SIMD_X86)
+        //////////////////////////////////////////////////////////////////////////
+        // SSE2
+
+        static force_inline int32_t HorizontalSum(__m128i v)
+        {
+            v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+            v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+            return _mm_cvtsi128_si32(v);
+        }
+
+        static force_inline __m128i SquaredDifference(__m128i a, __m128i b)
+        {
+            __m128i d = _mm_sub_epi16(a, b);
+            return _mm_madd_epi16(d, d);
+        }
+
+        static uint32_t RowRGB8_SSE2(const RGB8* source, const RGB8* target)
+        {
+            // 21 bytes per row: 16 bytes + 5 bytes taken from an overlapping 8 byte load,
+            // so we never read past the end of the row
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            const __m128i zero = _mm_setzero_si128();
+            __m128i s0 = _mm_loadu_si128((const __m128i*)s);
+            __m128i t0 = _mm_loadu_si128((const __m128i*)t);
+            __m128i s1 = _mm_srli_si128(_mm_loadl_epi64((const __m128i*)(s + RowChannels - 8)), 3);
+            __m128i t1 = _mm_srli_si128(_mm_loadl_epi64((const __m128i*)(t + RowChannels - 8)), 3);
+
+            __m128i sum = SquaredDifference(_mm_unpacklo_epi8(s0, zero), _mm_unpacklo_epi8(t0, zero));
+            sum = _mm_add_epi32(sum, SquaredDifference(_mm_unpackhi_epi8(s0, zero), _mm_unpackhi_epi8(t0, zero)));
+            sum = _mm_add_epi32(sum, SquaredDifference(_mm_unpacklo_epi8(s1, zero), _mm_unpacklo_epi8(t1, zero)));
+            return (uint32_t)HorizontalSum(sum);
+        }
+
+        static uint32_t RowLab8_SSE2(const Lab8* source, const Lab8* target)
+        {
+            // loads as in RowRGB8_SSE2, differences are multiplied by channel weights before madd,
+            // weights are at most 4, so products fit 16 bits
+            const LabWeights<uint8_t>& w = g_Lab8Weights;
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i w0 = _mm_setr_epi16(w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a);
+            const __m128i w1 = _mm_setr_epi16(w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L);
+            const __m128i w2 = _mm_setr_epi16(w.a, w.b, w.L, w.a, w.b, 0, 0, 0);
+            __m128i s0 = _mm_loadu_si128((const __m128i*)s);
+            __m128i t0 = _mm_loadu_si128((const __m128i*)t);
+            __m128i s1 = _mm_srli_si128(_mm_loadl_epi64((const __m128i*)(s + RowChannels - 8)), 3);
+            __m128i t1 = _mm_srli_si128(_mm_loadl_epi64((const __m128i*)(t + RowChannels - 8)), 3);
+
+            __m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(s0, zero), _mm_unpacklo_epi8(t0, zero));
+            __m128i sum = _mm_madd_epi16(d, _mm_mullo_epi16(d, w0));
+            d = _mm_sub_epi16(_mm_unpackhi_epi8(s0, zero), _mm_unpackhi_epi8(t0, zero));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(d, _mm_mullo_epi16(d, w1)));
+            d = _mm_sub_epi16(_mm_unpacklo_epi8(s1, zero), _mm_unpacklo_epi8(t1, zero));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(d, _mm_mullo_epi16(d, w2)));
+            return (uint32_t)HorizontalSum(sum);
+        }
+
+        static float RowLabFloat_SSE2(const LabFloat* source, const LabFloat* target)
+        {
+            const LabWeights<float>& w = g_FloatWeights;
+            const float* s = (const float*)source;
+            const float* t = (const float*)target;
+            // weights repeat every 12 channels
+            const __m128 w0 = _mm_setr_ps(w.L, w.a, w.b, w.L);
+            const __m128 w1 = _mm_setr_ps(w.a, w.b, w.L, w.a);
+            const __m128 w2 = _mm_setr_ps(w.b, w.L, w.a, w.b);
+            __m128 d, sum;
+            d = _mm_sub_ps(_mm_loadu_ps(s +  0), _mm_loadu_ps(t +  0)); sum = _mm_mul_ps(_mm_mul_ps(d, d), w0);
+            d = _mm_sub_ps(_mm_loadu_ps(s +  4), _mm_loadu_ps(t +  4)); sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(d, d), w1));
+            d = _mm_sub_ps(_mm_loadu_ps(s +  8), _mm_loadu_ps(t +  8)); sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(d, d), w2));
+            d = _mm_sub_ps(_mm_loadu_ps(s + 12), _mm_loadu_ps(t + 12)); sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(d, d), w0));
+            d = _mm_sub_ps(_mm_loadu_ps(s + 16), _mm_loadu_ps(t + 16)); sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(d, d), w1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            float last = s[20] - t[20];
+            return _mm_cvtss_f32(sum) + last * last * w.b;
+        }
+
+        static double RowLabDouble_SSE2(const LabDouble* source, const LabDouble* target)
+        {
+            const LabWeights<double>& w = g_DoubleWeights;
+            const double* s = (const double*)source;
+            const double* t = (const double*)target;
+            // weights repeat every 6 channels
+            const __m128d w0 = _mm_setr_pd(w.L, w.a);
+            const __m128d w1 = _mm_setr_pd(w.b, w.L);
+            const __m128d w2 = _mm_setr_pd(w.a, w.b);
+            __m128d sum = _mm_setzero_pd();
+            for (int i = 0; i < 18; i += 6)
+            {
+                __m128d d;
+                d = _mm_sub_pd(_mm_loadu_pd(s + i + 0), _mm_loadu_pd(t + i + 0)); sum = _mm_add_pd(sum, _mm_mul_pd(_mm_mul_pd(d, d), w0));
+                d = _mm_sub_pd(_mm_loadu_pd(s + i + 2), _mm_loadu_pd(t + i + 2)); sum = _mm_add_pd(sum, _mm_mul_pd(_mm_mul_pd(d, d), w1));
+                d = _mm_sub_pd(_mm_loadu_pd(s + i + 4), _mm_loadu_pd(t + i + 4)); sum = _mm_add_pd(sum, _mm_mul_pd(_mm_mul_pd(d, d), w2));
+            }
+            __m128d d = _mm_sub_pd(_mm_loadu_pd(s + 18), _mm_loadu_pd(t + 18));
+            sum = _mm_add_pd(sum, _mm_mul_pd(_mm_mul_pd(d, d), w0));
+            sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+            double last = s[20] - t[20];
+            return _mm_cvtsd_f64(sum) + last * last * w.b;
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+        // SSE2 of other patch sizes. Channels are processed by whole vectors, the tail
+        // of byte rows comes from an overlapping load ending with the row as above.
+
+        // Lab weights of vector lanes starting at the channel 'first'
+        static force_inline __m128i Lab8LaneWeights(int first)
+        {
+            const LabWeights<uint8_t>& w = g_Lab8Weights;
+            switch (first % 3)
+            {
+            case 0:  return _mm_setr_epi16(w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a);
+            case 1:  return _mm_setr_epi16(w.a, w.b, w.L, w.a, w.b, w.L, w.a, w.b);
+            default: return _mm_setr_epi16(w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L);
+            }
+        }
+
+        template<class Channel>
+        static force_inline Channel LabWeight(const LabWeights<Channel>& w, int channel)
+        {
+            switch (channel % 3)
+            {
+            case 0:  return w.L;
+            case 1:  return w.a;
+            default: return w.b;
+            }
+        }
+
+        // Bytes [first, first + 8) widened to 16 bits
+        static force_inline __m128i LoadBytes(const uint8_t* p, int first)
+        {
+            return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + first)), _mm_setzero_si128());
+        }
+
+        // Last 'Count' % 8 bytes of the row of 'Count' widened to 16 bits, other lanes are zero
+        template<int Count>
+        static force_inline __m128i LoadTailBytes(const uint8_t* p)
+        {
+            return _mm_unpacklo_epi8(_mm_srli_si128(_mm_loadl_epi64((const __m128i*)(p + Count - 8)), 8 - Count % 8),
+                _mm_setzero_si128());
+        }
+
+        template<int Size>
+        static uint32_t RowRGB8_SSE2T(const RGB8* source, const RGB8* target)
+        {
+            const int Channels = 3 * Size;
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            __m128i sum = _mm_setzero_si128();
+            for (int i = 0; i + 8 <= Channels; i += 8)
+                sum = _mm_add_epi32(sum, SquaredDifference(LoadBytes(s, i), LoadBytes(t, i)));
+            if (Channels % 8 != 0)
+                sum = _mm_add_epi32(sum, SquaredDifference(LoadTailBytes<Channels>(s), LoadTailBytes<Channels>(t)));
+            return (uint32_t)HorizontalSum(sum);
+        }
+
+        template<int Size>
+        static uint32_t RowLab8_SSE2T(const Lab8* source, const Lab8* target)
+        {
+            const int Channels = 3 * Size;
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            __m128i sum = _mm_setzero_si128();
+            for (int i = 0; i + 8 <= Channels; i += 8)
+            {
+                __m128i d = _mm_sub_epi16(LoadBytes(s, i), LoadBytes(t, i));
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(d, _mm_mullo_epi16(d, Lab8LaneWeights(i))));
+            }
+            if (Channels % 8 != 0)
+            {
+                __m128i d = _mm_sub_epi16(LoadTailBytes<Channels>(s), LoadTailBytes<Channels>(t));
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(d, _mm_mullo_epi16(d, Lab8LaneWeights(Channels - Channels % 8))));
+            }
+            return (uint32_t)HorizontalSum(sum);
+        }
+
+        template<int Size>
+        static float RowLabFloat_SSE2T(const LabFloat* source, const LabFloat* target)
+        {
+            const int Channels = 3 * Size;
+            const LabWeights<float>& w = g_FloatWeights;
+            const float* s = (const float*)source;
+            const float* t = (const float*)target;
+            // weights repeat every 12 channels
+            const __m128 weights[3] = {
+                _mm_setr_ps(w.L, w.a, w.b, w.L), _mm_setr_ps(w.a, w.b, w.L, w.a), _mm_setr_ps(w.b, w.L, w.a, w.b) };
+            __m128 sum = _mm_setzero_ps();
+            int i = 0;
+            for (; i + 4 <= Channels; i += 4)
+            {
+                __m128 d = _mm_sub_ps(_mm_loadu_ps(s + i), _mm_loadu_ps(t + i));
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(d, d), weights[(i / 4) % 3]));
+            }
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            float result = _mm_cvtss_f32(sum);
+            for (; i < Channels; i++)
+                result += (s[i] - t[i]) * (s[i] - t[i]) * LabWeight(w, i);
+            return result;
+        }
+
+        template<int Size>
+        static double RowLabDouble_SSE2T(const LabDouble* source, const LabDouble* target)
+        {
+            const int Channels = 3 * Size;
+            const LabWeights<double>& w = g_DoubleWeights;
+            const double* s = (const double*)source;
+            const double* t = (const double*)target;
+            // weights repeat every 6 channels
+            const __m128d weights[3] = { _mm_setr_pd(w.L, w.a), _mm_setr_pd(w.b, w.L), _mm_setr_pd(w.a, w.b) };
+            __m128d sum = _mm_setzero_pd();
+            int i = 0;
+            for (; i + 2 <= Channels; i += 2)
+            {
+                __m128d d = _mm_sub_pd(_mm_loadu_pd(s + i), _mm_loadu_pd(t + i));
+                sum = _mm_add_pd(sum, _mm_mul_pd(_mm_mul_pd(d, d), weights[(i / 2) % 3]));
+            }
+            sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+            double result = _mm_cvtsd_f64(sum);
+            for (; i < Channels; i++)
+                result += (s[i] - t[i]) * (s[i] - t[i]) * LabWeight(w, i);
+            return result;
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+        // AVX2
+
+        IRL_TARGET_AVX2 static uint32_t RowRGB8_AVX2(const RGB8* source, const RGB8* target)
+        {
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            __m256i s0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)s));
+            __m256i t0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)t));
+            __m128i s1 = _mm_cvtepu8_epi16(_mm_srli_si128(_mm_loadl_epi64((const __m128i*)(s + RowChannels - 8)), 3));
+            __m128i t1 = _mm_cvtepu8_epi16(_mm_srli_si128(_mm_loadl_epi64((const __m128i*)(t + RowChannels - 8)), 3));
+            __m256i d0 = _mm256_sub_epi16(s0, t0);
+            __m256i sum256 = _mm256_madd_epi16(d0, d0);
+            __m128i d1 = _mm_sub_epi16(s1, t1);
+            __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(d1, d1));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+            return (uint32_t)_mm_cvtsi128_si32(sum);
+        }
+
+        IRL_TARGET_AVX2 static uint32_t RowLab8_AVX2(const Lab8* source, const Lab8* target)
+        {
+            const LabWeights<uint8_t>& w = g_Lab8Weights;
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            const __m256i w0 = _mm256_setr_epi16(w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L);
+            const __m128i w1 = _mm_setr_epi16(w.a, w.b, w.L, w.a, w.b, 0, 0, 0);
+            __m256i s0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)s));
+            __m256i t0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)t));
+            __m128i s1 = _mm_cvtepu8_epi16(_mm_srli_si128(_mm_loadl_epi64((const __m128i*)(s + RowChannels - 8)), 3));
+            __m128i t1 = _mm_cvtepu8_epi16(_mm_srli_si128(_mm_loadl_epi64((const __m128i*)(t + RowChannels - 8)), 3));
+            __m256i d0 = _mm256_sub_epi16(s0, t0);
+            __m256i sum256 = _mm256_madd_epi16(d0, _mm256_mullo_epi16(d0, w0));
+            __m128i d1 = _mm_sub_epi16(s1, t1);
+            __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(d1, _mm_mullo_epi16(d1, w1)));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+            return (uint32_t)_mm_cvtsi128_si32(sum);
+        }
+
+        IRL_TARGET_AVX2 static float RowLabFloat_AVX2(const LabFloat* source, const LabFloat* target)
+        {
+            const LabWeights<float>& w = g_FloatWeights;
+            const float* s = (const float*)source;
+            const float* t = (const float*)target;
+            const __m256 w0 = _mm256_setr_ps(w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a);
+            const __m256 w1 = _mm256_setr_ps(w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L);
+            const __m128 w2 = _mm_setr_ps(w.a, w.b, w.L, w.a);
+            __m256 d, sum;
+            d = _mm256_sub_ps(_mm256_loadu_ps(s + 0), _mm256_loadu_ps(t + 0)); sum = _mm256_mul_ps(_mm256_mul_ps(d, d), w0);
+            d = _mm256_sub_ps(_mm256_loadu_ps(s + 8), _mm256_loadu_ps(t + 8)); sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_mul_ps(d, d), w1));
+            __m128 d2 = _mm_sub_ps(_mm_loadu_ps(s + 16), _mm_loadu_ps(t + 16));
+            __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+            sum128 = _mm_add_ps(sum128, _mm_mul_ps(_mm_mul_ps(d2, d2), w2));
+            sum128 = _mm_add_ps(sum128, _mm_movehl_ps(sum128, sum128));
+            sum128 = _mm_add_ss(sum128, _mm_shuffle_ps(sum128, sum128, 1));
+            float last = s[20] - t[20];
+            return _mm_cvtss_f32(sum128) + last * last * w.b;
+        }
+
+        IRL_TARGET_AVX2 static double RowLabDouble_AVX2(const LabDouble* source, const LabDouble* target)
+        {
+            const LabWeights<double>& w = g_DoubleWeights;
+            const double* s = (const double*)source;
+            const double* t = (const double*)target;
+            // weights repeat every 12 channels
+            const __m256d w0 = _mm256_setr_pd(w.L, w.a, w.b, w.L);
+            const __m256d w1 = _mm256_setr_pd(w.a, w.b, w.L, w.a);
+            const __m256d w2 = _mm256_setr_pd(w.b, w.L, w.a, w.b);
+            __m256d d, sum;
+            d = _mm256_sub_pd(_mm256_loadu_pd(s +  0), _mm256_loadu_pd(t +  0)); sum = _mm256_mul_pd(_mm256_mul_pd(d, d), w0);
+            d = _mm256_sub_pd(_mm256_loadu_pd(s +  4), _mm256_loadu_pd(t +  4)); sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_mul_pd(d, d), w1));
+            d = _mm256_sub_pd(_mm256_loadu_pd(s +  8), _mm256_loadu_pd(t +  8)); sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_mul_pd(d, d), w2));
+            d = _mm256_sub_pd(_mm256_loadu_pd(s + 12), _mm256_loadu_pd(t + 12)); sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_mul_pd(d, d), w0));
+            d = _mm256_sub_pd(_mm256_loadu_pd(s + 16), _mm256_loadu_pd(t + 16)); sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_mul_pd(d, d), w1));
+            __m128d sum128 = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+            sum128 = _mm_add_sd(sum128, _mm_unpackhi_pd(sum128, sum128));
+            double last = s[20] - t[20];
+            return _mm_cvtsd_f64(sum128) + last * last * w.b;
+        }
+#endif
+
+#if defined(IRL_SIMD_NEON)
+        //////////////////////////////////////////////////////////////////////////
+        // NEON
+
+        static uint32_t RowRGB8_NEON(const RGB8* source, const RGB8* target)
+        {
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            // 16 bytes + last 5 bytes from an overlapping 8 byte load
+            uint8x16_t s0 = vld1q_u8(s);
+            uint8x16_t t0 = vld1q_u8(t);
+            uint8x8_t s1 = vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(vld1_u8(s + RowChannels - 8)), 24));
+            uint8x8_t t1 = vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(vld1_u8(t + RowChannels - 8)), 24));
+            uint16x8_t d0 = vabdl_u8(vget_low_u8(s0), vget_low_u8(t0));
+            uint16x8_t d1 = vabdl_u8(vget_high_u8(s0), vget_high_u8(t0));
+            uint16x8_t d2 = vabdl_u8(s1, t1);
+            uint32x4_t sum = vmull_u16(vget_low_u16(d0), vget_low_u16(d0));
+            sum = vmlal_u16(sum, vget_high_u16(d0), vget_high_u16(d0));
+            sum = vmlal_u16(sum, vget_low_u16(d1), vget_low_u16(d1));
+            sum = vmlal_u16(sum, vget_high_u16(d1), vget_high_u16(d1));
+            sum = vmlal_u16(sum, vget_low_u16(d2), vget_low_u16(d2));
+            sum = vmlal_u16(sum, vget_high_u16(d2), vget_high_u16(d2));
+            uint64x2_t sum64 = vpaddlq_u32(sum);
+            return (uint32_t)(vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1));
+        }
+
+        static uint32_t RowLab8_NEON(const Lab8* source, const Lab8* target)
+        {
+            const LabWeights<uint8_t>& w = g_Lab8Weights;
+            const uint8_t* s = (const uint8_t*)source;
+            const uint8_t* t = (const uint8_t*)target;
+            const uint16_t w0[8] = { w.L, w.a, w.b, w.L, w.a, w.b, w.L, w.a };
+            const uint16_t w1[8] = { w.b, w.L, w.a, w.b, w.L, w.a, w.b, w.L };
+            const uint16_t w2[8] = { w.a, w.b, w.L, w.a, w.b, 0, 0, 0 };
+            uint8x16_t s0 = vld1q_u8(s);
+            uint8x16_t t0 = vld1q_u8(t);
+            uint8x8_t s1 = vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(vld1_u8(s + RowChannels - 8)), 24));
+            uint8x8_t t1 = vreinterpret_u8_u64(vshr_n_u64(vreinterpret_u64_u8(vld1_u8(t + RowChannels - 8)), 24));
+            uint16x8_t d0 = vabdl_u8(vget_low_u8(s0), vget_low_u8(t0));
+            uint16x8_t d1 = vabdl_u8(vget_high_u8(s0), vget_high_u8(t0));
+            uint16x8_t d2 = vabdl_u8(s1, t1);
+            uint16x8_t dw0 = vmulq_u16(d0, vld1q_u16(w0));
+            uint16x8_t dw1 = vmulq_u16(d1, vld1q_u16(w1));
+            uint16x8_t dw2 = vmulq_u16(d2, vld1q_u16(w2));
+            uint32x4_t sum = vmull_u16(vget_low_u16(d0), vget_low_u16(dw0));
+            sum = vmlal_u16(sum, vget_high_u16(d0), vget_high_u16(dw0));
+            sum = vmlal_u16(sum, vget_low_u16(d1), vget_low_u16(dw1));
+            sum = vmlal_u16(sum, vget_high_u16(d1), vget_high_u16(dw1));
+            sum = vmlal_u16(sum, vget_low_u16(d2), vget_low_u16(dw2));
+            sum = vmlal_u16(sum, vget_high_u16(d2), vget_high_u16(dw2));
+            uint64x2_t sum64 = vpaddlq_u32(sum);
+            return (uint32_t)(vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1));
+        }
+
+        static float RowLabFloat_NEON(const LabFloat* source, const LabFloat* target)
+        {
+            const LabWeights<float>& w = g_FloatWeights;
+            const float* s = (const float*)source;
+            const float* t = (const float*)target;
+            const float w0[4] = { w.L, w.a, w.b, w.L };
+            const float w1[4] = { w.a, w.b, w.L, w.a };
+            const float w2[4] = { w.b, w.L, w.a, w.b };
+            const float32x4_t v0 = vld1q_f32(w0);
+            const float32x4_t v1 = vld1q_f32(w1);
+            const float32x4_t v2 = vld1q_f32(w2);
+            float32x4_t d, sum;
+            d = vsubq_f32(vld1q_f32(s +  0), vld1q_f32(t +  0)); sum = vmulq_f32(vmulq_f32(d, d), v0);
+            d = vsubq_f32(vld1q_f32(s +  4), vld1q_f32(t +  4)); sum = vmlaq_f32(sum, vmulq_f32(d, d), v1);
+            d = vsubq_f32(vld1q_f32(s +  8), vld1q_f32(t +  8)); sum = vmlaq_f32(sum, vmulq_f32(d, d), v2);
+            d = vsubq_f32(vld1q_f32(s + 12), vld1q_f32(t + 12)); sum = vmlaq_f32(sum, vmulq_f32(d, d), v0);
+            d = vsubq_f32(vld1q_f32(s + 16), vld1q_f32(t + 16)); sum = vmlaq_f32(sum, vmulq_f32(d, d), v1);
+            float32x2_t sum2 = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+            float last = s[20] - t[20];
+            return vget_lane_f32(vpadd_f32(sum2, sum2), 0) + last * last * w.b;
+        }
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+        static double RowLabDouble_NEON(const LabDouble* source, const LabDouble* target)
+        {
+            const LabWeights<double>& w = g_DoubleWeights;
+            const double* s = (const double*)source;
+            const double* t = (const double*)target;
+            const double w0[2] = { w.L, w.a };
+            const double w1[2] = { w.b, w.L };
+            const double w2[2] = { w.a, w.b };
+            const float64x2_t v0 = vld1q_f64(w0);
+            const float64x2_t v1 = vld1q_f64(w1);
+            const float64x2_t v2 = vld1q_f64(w2);
+            float64x2_t sum = vdupq_n_f64(0.0);
+            for (int i = 0; i < 18; i += 6)
+            {
+                float64x2_t d;
+                d = vsubq_f64(vld1q_f64(s + i + 0), vld1q_f64(t + i + 0)); sum = vaddq_f64(sum, vmulq_f64(vmulq_f64(d, d), v0));
+                d = vsubq_f64(vld1q_f64(s + i + 2), vld1q_f64(t + i + 2)); sum = vaddq_f64(sum, vmulq_f64(vmulq_f64(d, d), v1));
+                d = vsubq_f64(vld1q_f64(s + i + 4), vld1q_f64(t + i + 4)); sum = vaddq_f64(sum, vmulq_f64(vmulq_f64(d, d), v2));
+            }
+            float64x2_t d = vsubq_f64(vld1q_f64(s + 18), vld1q_f64(t + 18));
+            sum = vaddq_f64(sum, vmulq_f64(vmulq_f64(d, d), v0));
+            double last = s[20] - t[20];
+            return vgetq_lane_f64(sum, 0) + vgetq_lane_f64(sum, 1) + last * last * w.b;
+        }
+#endif
+#endif
+
+        //////////////////////////////////////////////////////////////////////////
+        // Dispatch
+
+        template<>
+        PatchRowKernel<RGB8, 7>::Function PatchRowKernel<RGB8, 7>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() == SimdAVX2)
+                return &RowRGB8_AVX2;
+            if (GetSimdLevel() == SimdSSE2)
+                return &RowRGB8_SSE2;
+#elif defined(IRL_SIMD_NEON)
+            return &RowRGB8_NEON;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<Lab8, 7>::Function PatchRowKernel<Lab8, 7>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() == SimdAVX2)
+                return &RowLab8_AVX2;
+            if (GetSimdLevel() == SimdSSE2)
+                return &RowLab8_SSE2;
+#elif defined(IRL_SIMD_NEON)
+            return &RowLab8_NEON;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<LabFloat, 7>::Function PatchRowKernel<LabFloat, 7>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() == SimdAVX2)
+                return &RowLabFloat_AVX2;
+            if (GetSimdLevel() == SimdSSE2)
+                return &RowLabFloat_SSE2;
+#elif defined(IRL_SIMD_NEON)
+            return &RowLabFloat_NEON;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<LabDouble, 7>::Function PatchRowKernel<LabDouble, 7>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() == SimdAVX2)
+                return &RowLabDouble_AVX2;
+            if (GetSimdLevel() == SimdSSE2)
+                return &RowLabDouble_SSE2;
+#elif defined(IRL_SIMD_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+            return &RowLabDouble_NEON;
+#endif
+            return &Scalar;
+        }
+
+        // Sizes other than 7 use SSE2 templates on any x86 CPU
+
+        template<>
+        PatchRowKernel<RGB8, 5>::Function PatchRowKernel<RGB8, 5>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowRGB8_SSE2T<5>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<RGB8, 9>::Function PatchRowKernel<RGB8, 9>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowRGB8_SSE2T<9>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<Lab8, 5>::Function PatchRowKernel<Lab8, 5>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowLab8_SSE2T<5>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<Lab8, 9>::Function PatchRowKernel<Lab8, 9>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowLab8_SSE2T<9>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<LabFloat, 5>::Function PatchRowKernel<LabFloat, 5>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowLabFloat_SSE2T<5>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<LabFloat, 9>::Function PatchRowKernel<LabFloat, 9>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowLabFloat_SSE2T<9>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<LabDouble, 5>::Function PatchRowKernel<LabDouble, 5>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowLabDouble_SSE2T<5>;
+#endif
+            return &Scalar;
+        }
+
+        template<>
+        PatchRowKernel<LabDouble, 9>::Function PatchRowKernel<LabDouble, 9>::Get()
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+                return &RowLabDouble_SSE2T<9>;
+#endif
+            return &Scalar;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "RGB.h"
+#include "Lab.h"
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Instruction set used by vectorized kernels, detected at runtime
+        enum SimdLevel
+        {
+            SimdNone,
+            SimdSSE2,
+            SimdAVX2,
+            SimdNEON
+        };
+
+        extern SimdLevel GetSimdLevel();
+        extern const char* GetSimdLevelName(SimdLevel level);
+
+        // Sum of PixelType::Distance over Count consecutive pixels, unrolled at compile time
+        template<class PixelType, int Count>
+        struct UnrolledRow
+        {
+            static force_inline typename PixelType::DistanceType Sum(const PixelType* source, const PixelType* target)
+            {
+                return UnrolledRow<PixelType, Count - 1>::Sum(source, target) + 
+                    PixelType::Distance(source[Count - 1], target[Count - 1]);
+            }
+        };
+
+        template<class PixelType>
+        struct UnrolledRow<PixelType, 0>
+        {
+            static force_inline typename PixelType::DistanceType Sum(const PixelType*, const PixelType*)
+            {
+                return 0;
+            }
+        };
+
+        // Sum of PixelType::Distance over one row of Size consecutive pixels.
+        // Get() returns the best implementation for the current CPU, specializations
+        // for RGB8, Lab8, LabFloat and LabDouble of sizes 5, 7 and 9 are defined in PatchDistance.cpp.
+        template<class PixelType, int Size = PatchSize>
+        class PatchRowKernel
+        {
+        public:
+            typedef typename PixelType::DistanceType DistanceType;
+            typedef DistanceType (*Function)(const PixelType* source, const PixelType* target);
+
+            static Function Get()
+            {
+                return &Scalar;
+            }
+
+            static DistanceType Scalar(const PixelType* source, const PixelType* target)
+            {
+                return UnrolledRow<PixelType, Size>::Sum(source, target);
+            }
+        };
+
+        template<> PatchRowKernel<RGB8, 5>::Function PatchRowKernel<RGB8, 5>::Get();
+        template<> PatchRowKernel<RGB8, 7>::Function PatchRowKernel<RGB8, 7>::Get();
+        template<> PatchRowKernel<RGB8, 9>::Function PatchRowKernel<RGB8, 9>::Get();
+        template<> PatchRowKernel<Lab8, 5>::Function PatchRowKernel<Lab8, 5>::Get();
+        template<> PatchRowKernel<Lab8, 7>::Function PatchRowKernel<Lab8, 7>::Get();
+        template<> PatchRowKernel<Lab8, 9>::Function PatchRowKernel<Lab8, 9>::Get();
+        template<> PatchRowKernel<LabFloat, 5>::Function PatchRowKernel<LabFloat, 5>::Get();
+        template<> PatchRowKernel<LabFloat, 7>::Function PatchRowKernel<LabFloat, 7>::Get();
+        template<> PatchRowKernel<LabFloat, 9>::Function PatchRowKernel<LabFloat, 9>::Get();
+        template<> PatchRowKernel<LabDouble, 5>::Function PatchRowKernel<LabDouble, 5>::Get();
+        template<> PatchRowKernel<LabDouble, 7>::Function PatchRowKernel<LabDouble, 7>::Get();
+        template<> PatchRowKernel<LabDouble, 9>::Function PatchRowKernel<LabDouble, 9>::Get();
+    }
+}
\ No newline at end of file
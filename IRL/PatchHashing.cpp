@@ -0,0 +1,274 @@
+#include "Includes.h"
+#include "PatchHashing.h"
+#include "PatchSummaries.h"
+#include "ValidPatches.h"
+#include "Random.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <float.h>
+
+namespace IRL
+{
+    namespace Internal
+    {
+        const int HashTables = 2;
+        const int HashDimensions = 3;       // summary components of one table
+        const int HashCandidates = 2;       // patches drawn from one bucket
+        // means of the channels, and mean and slopes of lightness
+        const int HashComponents[HashTables][HashDimensions] = { { 0, 1, 2 }, { 0, 3, 6 } };
+        const float HashCellScale = 0.5f;   // cells are this part of the spread of their component
+        const int SampledSpreads = 4096;    // patches estimating spreads of components
+
+        // Cells are hashed into a power of two buckets, at least as many as patches. Cells which share
+        // a bucket only add candidates, which are compared by their summaries anyway.
+        struct HashTable
+        {
+            float Scale[HashDimensions];    // inverse width of cells
+            float Shift[HashDimensions];    // in cells
+            uint32_t Mask;                  // buckets - 1
+            std::vector<int32_t> Starts;    // of buckets in Centers and the end of the last one
+            std::vector<Point16> Centers;   // of source patches by bucket, in scan order within one
+        };
+
+        inline uint32_t GetBucket(const HashTable& table, int index, const float* summary)
+        {
+            uint64_t key = (uint64_t)index;
+            for (int d = 0; d < HashDimensions; d++)
+            {
+                const int32_t cell = (int32_t)floor(summary[HashComponents[index][d]] * table.Scale[d] + table.Shift[d]);
+                key = CounterRandom::Key(key, (uint64_t)(uint32_t)cell);
+            }
+            return (uint32_t)key & table.Mask;
+        }
+
+        struct HashQueryState
+        {
+            const PatchSummaries* Target;
+            const PatchSummaries* Source;
+            const HashTable* Tables;
+            const Point16* Centers;
+            int Count;                      // of centers
+            const ValidPatches* Patches;    // NULL when there is no mask
+            int Half;                       // least distance of summarized centers from the borders
+            int Width;
+            int Height;
+            int SourceWidth;
+            int SourceHeight;
+            uint64_t Seed;
+            ImageView<Point16> Field;
+        };
+
+        // Matches rows of target patches, each row on its own so the left neighbor is always done
+        class HashQueryTask :
+            public Parallel::Runnable
+        {
+        public:
+            void Set(int start, int end, const HashQueryState& state)
+            {
+                _start = start;
+                _end = end;
+                _state = state;
+            }
+
+            virtual void Run()
+            {
+                for (int32_t y = _start; y < _end; y++)
+                    ProcessRow(y);
+            }
+
+        private:
+            bool IsCenter(int32_t sx, int32_t sy) const
+            {
+                return sx >= _state.Half && sx < _state.SourceWidth - _state.Half &&
+                    sy >= _state.Half && sy < _state.SourceHeight - _state.Half &&
+                    (!_state.Patches || _state.Patches->IsValid(sx, sy));
+            }
+
+            void Try(const float* summary, int32_t sx, int32_t sy, float& best, int32_t& bestX, int32_t& bestY) const
+            {
+                const float distance = PatchSummaries::LowerBound(summary, _state.Source->Get(sx, sy));
+                if (distance < best)
+                {
+                    best = distance;
+                    bestX = sx;
+                    bestY = sy;
+                }
+            }
+
+            void ProcessRow(int32_t y)
+            {
+                Point16* row = _state.Field.Row(y);
+                for (int32_t x = 0; x < _state.Width; x++)
+                    row[x] = Point16(0, 0);
+                // border pixels are not patch centers, as in MakeRandomField
+                if (y < HalfPatchSize || y >= _state.Height - HalfPatchSize)
+                    return;
+
+                // centers closer to the borders than summaries reach take the nearest summary
+                const int32_t summaryY = Maximum(_state.Half, Minimum(y, _state.Height - _state.Half - 1));
+                int32_t lastX = -1;
+                int32_t lastY = -1;
+                for (int32_t x = HalfPatchSize; x < _state.Width - HalfPatchSize; x++)
+                {
+                    const int32_t summaryX = Maximum(_state.Half, Minimum(x, _state.Width - _state.Half - 1));
+                    const float* summary = _state.Target->Get(summaryX, summaryY);
+                    CounterRandom random(CounterRandom::Key(_state.Seed, x, y));
+                    float best = FLT_MAX;
+                    int32_t bestX = -1;
+                    int32_t bestY = -1;
+
+                    // coherent candidate, the source patch next to the match of the left neighbor
+                    if (lastX >= 0 && IsCenter(lastX + 1, lastY))
+                        Try(summary, lastX + 1, lastY, best, bestX, bestY);
+
+                    for (int t = 0; t < HashTables; t++)
+                    {
+                        const HashTable& table = _state.Tables[t];
+                        const uint32_t bucket = GetBucket(table, t, summary);
+                        const int32_t first = table.Starts[bucket];
+                        const int32_t count = table.Starts[bucket + 1] - first;
+                        const Point16* centers = &table.Centers[0] + first;
+                        if (count > HashCandidates)
+                        {
+                            for (int k = 0; k < HashCandidates; k++)
+                            {
+                                const Point16& center = centers[random.Uniform<uint32_t>((uint32_t)count)];
+                                Try(summary, center.x, center.y, best, bestX, bestY);
+                            }
+                        } else
+                        {
+                            for (int k = 0; k < count; k++)
+                                Try(summary, centers[k].x, centers[k].y, best, bestX, bestY);
+                        }
+                    }
+
+                    if (bestX < 0)
+                    {
+                        // empty buckets, any valid patch as MakeRandomField does
+                        const Point16& center = _state.Centers[random.Uniform<uint32_t>((uint32_t)_state.Count)];
+                        bestX = center.x;
+                        bestY = center.y;
+                    }
+                    row[x].x = (uint16_t)(bestX - x);
+                    row[x].y = (uint16_t)(bestY - y);
+                    lastX = bestX;
+                    lastY = bestY;
+                }
+            }
+
+        private:
+            int _start;
+            int _end;
+            HashQueryState _state;
+        };
+    }
+
+    OffsetField MakeHashedField(const std::vector<float>& target, int width, int height,
+        const std::vector<float>& source, int sourceWidth, int sourceHeight, const Image<Alpha8>& sourceMask,
+        int patchSize, uint64_t seed)
+    {
+        using namespace Internal;
+
+        Tools::Profiler profiler("MakeHashedField");
+        const int half = Maximum(patchSize / 2, HalfPatchSize);
+
+        // source patches which may be taken, in scan order
+        ValidPatches patches;
+        std::vector<Point16> centers;
+        if (sourceMask.IsValid())
+        {
+            patches.Compute(sourceMask, patchSize);
+            for (int i = 0; i < patches.GetCount(); i++)
+            {
+                const Point16& center = patches.GetCenter(i);
+                if (center.x >= half && center.x < sourceWidth - half && center.y >= half && center.y < sourceHeight - half)
+                    centers.push_back(center);
+            }
+        } else
+        {
+            for (int y = half; y < sourceHeight - half; y++)
+                for (int x = half; x < sourceWidth - half; x++)
+                    centers.push_back(Point16((uint16_t)x, (uint16_t)y));
+        }
+        if (centers.empty() || width <= 2 * half || height <= 2 * half)
+            return MakeRandomField(width, height, sourceWidth, sourceHeight);
+
+        PatchSummaries sourceSummaries;
+        PatchSummaries targetSummaries;
+        sourceSummaries.Compute(source, sourceWidth, sourceHeight, patchSize);
+        targetSummaries.Compute(target, width, height, patchSize);
+
+        // cells follow the spread of every component over the source, sampled evenly
+        const int count = (int)centers.size();
+        const int step = Maximum(1, count / SampledSpreads);
+        double sums[PatchSummaries::Components] = { 0 };
+        double squares[PatchSummaries::Components] = { 0 };
+        int samples = 0;
+        for (int i = 0; i < count; i += step, samples++)
+        {
+            const float* summary = sourceSummaries.Get(centers[i].x, centers[i].y);
+            for (int c = 0; c < PatchSummaries::Components; c++)
+            {
+                sums[c] += summary[c];
+                squares[c] += (double)summary[c] * summary[c];
+            }
+        }
+
+        uint32_t buckets = 1;
+        while (buckets < (uint32_t)count)
+            buckets *= 2;
+        std::vector<uint32_t> keys(count);
+        std::vector<int32_t> next(buckets);
+        HashTable tables[HashTables];
+        for (int t = 0; t < HashTables; t++)
+        {
+            HashTable& table = tables[t];
+            CounterRandom random(CounterRandom::Key(seed, (uint64_t)t));
+            for (int d = 0; d < HashDimensions; d++)
+            {
+                const int c = HashComponents[t][d];
+                const double mean = sums[c] / samples;
+                const double spread = sqrt(Maximum(squares[c] / samples - mean * mean, 0.0));
+                table.Scale[d] = spread > 1e-6 ? (float)(1 / (HashCellScale * spread)) : 1.0f;
+                table.Shift[d] = random.Uniform<int32_t>(0, 1024) / 1024.0f;
+            }
+            table.Mask = buckets - 1;
+
+            // counting sort of centers by bucket
+            table.Starts.assign(buckets + 1, 0);
+            for (int i = 0; i < count; i++)
+            {
+                keys[i] = GetBucket(table, t, sourceSummaries.Get(centers[i].x, centers[i].y));
+                table.Starts[keys[i] + 1]++;
+            }
+            for (uint32_t b = 0; b < buckets; b++)
+                table.Starts[b + 1] += table.Starts[b];
+            std::copy(table.Starts.begin(), table.Starts.end() - 1, next.begin());
+            table.Centers.resize(count);
+            for (int i = 0; i < count; i++)
+                table.Centers[next[keys[i]]++] = centers[i];
+        }
+
+        OffsetField result(width, height);
+        HashQueryState state;
+        state.Target = &targetSummaries;
+        state.Source = &sourceSummaries;
+        state.Tables = tables;
+        state.Centers = &centers[0];
+        state.Count = count;
+        state.Patches = sourceMask.IsValid() ? &patches : NULL;
+        state.Half = half;
+        state.Width = width;
+        state.Height = height;
+        state.SourceWidth = sourceWidth;
+        state.SourceHeight = sourceHeight;
+        state.Seed = seed;
+        state.Field = result.View();
+        Parallel::ParallelFor<HashQueryTask, HashQueryState> tasks(0, height, state,
+            width * (HashTables * HashCandidates + 1) * PatchSummaries::Components);
+        tasks.SpawnAndSync();
+        return result;
+    }
+}
\ No newline at end of file
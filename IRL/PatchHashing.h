@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Image.h"
+#include "Alpha.h"
+#include "OffsetField.h"
+#include "DeviceNNF.h"
+
+namespace IRL
+{
+    // Initial offset field from hashed patch summaries, in the manner of coherency-sensitive hashing, for
+    // solvers which start cold instead of MakeRandomField. Summaries are projections of patches onto their
+    // mean and slopes (the first Walsh-Hadamard kernels, see PatchSummaries). Every table hashes source patches
+    // by a few of them quantized on a grid with its own shift, a target patch takes the closest summary among
+    // patches drawn from its buckets and the one next to the match of its left neighbor, so coherent regions
+    // stay coherent. Tables are counting sorted into buckets and queries look one bucket up, so it is linear.
+    // Source patches which cover masked pixels are never taken, 'sourceMask' is ignored if not valid.
+    // Pixels are 4 floats each (see ConvertForDevice), the field has the borders of MakeRandomField.
+    extern OffsetField MakeHashedField(const std::vector<float>& target, int width, int height,
+        const std::vector<float>& source, int sourceWidth, int sourceHeight, const Image<Alpha8>& sourceMask,
+        int patchSize, uint64_t seed);
+
+    template<class PixelType>
+    OffsetField MakeHashedField(const Image<PixelType>& target, const Image<PixelType>& source,
+        const Image<Alpha8>& sourceMask, int patchSize, uint64_t seed)
+    {
+        std::vector<float> targetPixels;
+        std::vector<float> sourcePixels;
+        Internal::ConvertForDevice(target, targetPixels);
+        Internal::ConvertForDevice(source, sourcePixels);
+        return MakeHashedField(targetPixels, target.Width(), target.Height(), sourcePixels, source.Width(), source.Height(),
+            sourceMask, patchSize, seed);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,388 @@
+#include "Includes.h"
+#include "PatchIndex.h"
+#include "Config.h"
+#include "Random.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+namespace IRL
+{
+    namespace Internal
+    {
+        const int MaxPatchValues = MaxPatchSize * MaxPatchSize * 3;   // channels of ConvertForDevice which are used
+        const int SampledPatches = 4096;                              // patches estimating principal components
+        const int ComponentIterations = 20;                           // subspace iterations finding them
+
+        // Gathers values of the patch of 'size', the 4th channel of pixels is always zero
+        inline void GatherPatch(const float* pixels, int width, int size, int x, int y, float* values)
+        {
+            const int half = size / 2;
+            for (int dy = -half; dy <= half; dy++)
+            {
+                const float* pixel = pixels + 4 * ((y + dy) * width + x - half);
+                for (int dx = 0; dx < size; dx++, pixel += 4)
+                {
+                    *values++ = pixel[0];
+                    *values++ = pixel[1];
+                    *values++ = pixel[2];
+                }
+            }
+        }
+
+        struct DescribeState
+        {
+            const PatchIndex* Index;
+            const float* Pixels;
+            int Width;
+            const Point16* Centers;
+            float* Descriptors;
+        };
+
+        class DescribeTask :
+            public Parallel::Runnable
+        {
+        public:
+            void Set(int start, int stop, const DescribeState& state)
+            {
+                _start = start;
+                _stop = stop;
+                _state = state;
+            }
+
+            virtual void Run()
+            {
+                for (int i = _start; i < _stop; i++)
+                {
+                    const Point16& center = _state.Centers[i];
+                    _state.Index->Describe(_state.Pixels, _state.Width, center.x, center.y,
+                        _state.Descriptors + i * PatchIndex::Dimensions);
+                }
+            }
+
+        private:
+            int _start;
+            int _stop;
+            DescribeState _state;
+        };
+
+        struct LeavesState
+        {
+            const PatchIndex* Index;
+            const float* Pixels;
+            int Width;
+            int Left;
+            int Right;
+            int32_t* Leaves;
+        };
+
+        class LeavesTask :
+            public Parallel::Runnable
+        {
+        public:
+            void Set(int start, int stop, const LeavesState& state)
+            {
+                _start = start;
+                _stop = stop;
+                _state = state;
+            }
+
+            virtual void Run()
+            {
+                float descriptor[PatchIndex::Dimensions];
+                for (int y = _start; y < _stop; y++)
+                {
+                    int32_t* row = _state.Leaves + y * _state.Width;
+                    for (int x = _state.Left; x < _state.Right; x++)
+                    {
+                        _state.Index->Describe(_state.Pixels, _state.Width, x, y, descriptor);
+                        row[x] = _state.Index->FindLeaf(descriptor);
+                    }
+                }
+            }
+
+        private:
+            int _start;
+            int _stop;
+            LeavesState _state;
+        };
+
+        class DescriptorLess
+        {
+        public:
+            DescriptorLess(const std::vector<float>& descriptors, int dimension)
+                : _descriptors(descriptors), _dimension(dimension)
+            { }
+
+            bool operator()(int32_t l, int32_t r) const
+            {
+                return _descriptors[l * PatchIndex::Dimensions + _dimension] <
+                    _descriptors[r * PatchIndex::Dimensions + _dimension];
+            }
+
+        private:
+            const std::vector<float>& _descriptors;
+            int _dimension;
+        };
+    }
+
+    PatchIndex::PatchIndex()
+        : _patchSize(PatchSize), _patchValues(PatchSize * PatchSize * 3)
+    {
+    }
+
+    void PatchIndex::Build(const std::vector<float>& pixels, int width, int height, const Image<Alpha8>& mask,
+        int patchSize)
+    {
+        Tools::Profiler profiler("BuildPatchIndex");
+        Clear();
+        ASSERT(patchSize <= MaxPatchSize);
+        _patchSize = patchSize;
+        _patchValues = patchSize * patchSize * 3;
+        const int half = patchSize / 2;
+
+        // centers of allowed patches
+        std::vector<Point16> centers;
+        centers.reserve((size_t)Maximum(width - 2 * half, 0) * Maximum(height - 2 * half, 0));
+        const ConstImageView<Alpha8> maskView = mask.IsValid() ? mask.ConstView() : ConstImageView<Alpha8>();
+        for (int y = half; y < height - half; y++)
+        {
+            for (int x = half; x < width - half; x++)
+            {
+                bool masked = false;
+                if (mask.IsValid())
+                {
+                    for (int dy = -half; dy <= half && !masked; dy++)
+                    {
+                        const Alpha8* row = maskView.Row(y + dy);
+                        for (int dx = -half; dx <= half && !masked; dx++)
+                            masked = row[x + dx].IsMasked();
+                    }
+                }
+                if (!masked)
+                    centers.push_back(Point16((int16_t)x, (int16_t)y));
+            }
+        }
+        if (centers.empty())
+            return;
+
+        FindComponents(pixels, width, centers);
+
+        std::vector<float> descriptors(centers.size() * Dimensions);
+        Internal::DescribeState state;
+        state.Index = this;
+        state.Pixels = &pixels[0];
+        state.Width = width;
+        state.Centers = &centers[0];
+        state.Descriptors = &descriptors[0];
+        Parallel::ParallelFor<Internal::DescribeTask, Internal::DescribeState>
+            tasks(0, (int)centers.size(), state, Dimensions * patchSize);
+        tasks.SpawnAndSync();
+
+        std::vector<int32_t> order(centers.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int32_t)i;
+        _nodes.reserve(2 * order.size() / LeafSize + 1);
+        BuildNode(order, 0, (int32_t)order.size(), descriptors);
+
+        _centers.resize(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            _centers[i] = centers[order[i]];
+    }
+
+    void PatchIndex::Clear()
+    {
+        _components.clear();
+        std::vector<Node>().swap(_nodes);
+        std::vector<Point16>().swap(_centers);
+    }
+
+    void PatchIndex::FindComponents(const std::vector<float>& pixels, int width, const std::vector<Point16>& centers)
+    {
+        using namespace Internal;
+        const int PatchValues = _patchValues;
+
+        // covariance of evenly sampled patches
+        const size_t step = Maximum<size_t>(centers.size() / SampledPatches, 1);
+        std::vector<double> mean(PatchValues, 0.0);
+        std::vector<double> covariance(PatchValues * PatchValues, 0.0);
+        float values[MaxPatchValues];
+        int samples = 0;
+        for (size_t i = 0; i < centers.size(); i += step, samples++)
+        {
+            GatherPatch(&pixels[0], width, _patchSize, centers[i].x, centers[i].y, values);
+            for (int j = 0; j < PatchValues; j++)
+            {
+                mean[j] += values[j];
+                double* row = &covariance[j * PatchValues];
+                for (int k = 0; k <= j; k++)
+                    row[k] += (double)values[j] * values[k];
+            }
+        }
+        for (int j = 0; j < PatchValues; j++)
+            mean[j] /= samples;
+        for (int j = 0; j < PatchValues; j++)
+        {
+            for (int k = 0; k <= j; k++)
+            {
+                double c = covariance[j * PatchValues + k] / samples - mean[j] * mean[k];
+                covariance[j * PatchValues + k] = c;
+                covariance[k * PatchValues + j] = c;
+            }
+        }
+
+        // orthogonal iteration converges to the leading eigenvectors
+        std::vector<double> basis(Dimensions * PatchValues);
+        std::vector<double> product(Dimensions * PatchValues);
+        CounterRandom random(0);
+        for (size_t i = 0; i < basis.size(); i++)
+            basis[i] = random.Uniform<int>(-1024, 1024) + 0.5;
+        for (int iteration = 0; iteration <= ComponentIterations; iteration++)
+        {
+            if (iteration > 0)
+            {
+                for (int d = 0; d < Dimensions; d++)
+                {
+                    const double* v = &basis[d * PatchValues];
+                    for (int j = 0; j < PatchValues; j++)
+                    {
+                        const double* row = &covariance[j * PatchValues];
+                        double sum = 0;
+                        for (int k = 0; k < PatchValues; k++)
+                            sum += row[k] * v[k];
+                        product[d * PatchValues + j] = sum;
+                    }
+                }
+                basis.swap(product);
+            }
+            // Gram-Schmidt
+            for (int d = 0; d < Dimensions; d++)
+            {
+                double* v = &basis[d * PatchValues];
+                for (int e = 0; e < d; e++)
+                {
+                    const double* u = &basis[e * PatchValues];
+                    double dot = 0;
+                    for (int k = 0; k < PatchValues; k++)
+                        dot += u[k] * v[k];
+                    for (int k = 0; k < PatchValues; k++)
+                        v[k] -= dot * u[k];
+                }
+                double norm = 0;
+                for (int k = 0; k < PatchValues; k++)
+                    norm += v[k] * v[k];
+                norm = norm > 0 ? 1 / sqrt(norm) : 0;
+                for (int k = 0; k < PatchValues; k++)
+                    v[k] *= norm;
+            }
+        }
+
+        _components.resize(basis.size());
+        for (size_t i = 0; i < basis.size(); i++)
+            _components[i] = (float)basis[i];
+    }
+
+    int32_t PatchIndex::BuildNode(std::vector<int32_t>& order, int32_t first, int32_t last, const std::vector<float>& descriptors)
+    {
+        const int32_t index = (int32_t)_nodes.size();
+        _nodes.push_back(Node());
+        if (last - first <= LeafSize)
+        {
+            _nodes[index].Dimension = -1;
+            _nodes[index].Split = 0;
+            _nodes[index].First = first;
+            _nodes[index].Second = last;
+            return index;
+        }
+
+        float minimum[Dimensions];
+        float maximum[Dimensions];
+        for (int d = 0; d < Dimensions; d++)
+        {
+            minimum[d] = descriptors[order[first] * Dimensions + d];
+            maximum[d] = minimum[d];
+        }
+        for (int32_t i = first + 1; i < last; i++)
+        {
+            const float* descriptor = &descriptors[order[i] * Dimensions];
+            for (int d = 0; d < Dimensions; d++)
+            {
+                minimum[d] = Minimum(minimum[d], descriptor[d]);
+                maximum[d] = Maximum(maximum[d], descriptor[d]);
+            }
+        }
+        int dimension = 0;
+        for (int d = 1; d < Dimensions; d++)
+        {
+            if (maximum[d] - minimum[d] > maximum[dimension] - minimum[dimension])
+                dimension = d;
+        }
+
+        const int32_t middle = first + (last - first) / 2;
+        std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + last,
+            Internal::DescriptorLess(descriptors, dimension));
+        const float split = descriptors[order[middle] * Dimensions + dimension];
+
+        const int32_t firstChild = BuildNode(order, first, middle, descriptors);
+        const int32_t secondChild = BuildNode(order, middle, last, descriptors);
+        // the vector may be reallocated by children
+        Node& node = _nodes[index];
+        node.Dimension = dimension;
+        node.Split = split;
+        node.First = firstChild;
+        node.Second = secondChild;
+        return index;
+    }
+
+    void PatchIndex::Describe(const float* pixels, int width, int x, int y, float* descriptor) const
+    {
+        float values[Internal::MaxPatchValues];
+        Internal::GatherPatch(pixels, width, _patchSize, x, y, values);
+        for (int d = 0; d < Dimensions; d++)
+        {
+            const float* component = &_components[d * _patchValues];
+            float sum = 0;
+            for (int k = 0; k < _patchValues; k++)
+                sum += component[k] * values[k];
+            descriptor[d] = sum;
+        }
+    }
+
+    int32_t PatchIndex::FindLeaf(const float* descriptor) const
+    {
+        ASSERT(!_nodes.empty());
+        int32_t index = 0;
+        while (_nodes[index].Dimension >= 0)
+        {
+            const Node& node = _nodes[index];
+            index = descriptor[node.Dimension] < node.Split ? node.First : node.Second;
+        }
+        return index;
+    }
+
+    void PatchIndex::FindLeaves(const std::vector<float>& pixels, int width, const Rectangle<int32_t>& rect,
+        std::vector<int32_t>& leaves) const
+    {
+        Tools::Profiler profiler("FindPatchLeaves");
+        leaves.resize(pixels.size() / 4);
+        if (rect.IsEmpty())
+            return;
+        Internal::LeavesState state;
+        state.Index = this;
+        state.Pixels = &pixels[0];
+        state.Width = width;
+        state.Left = rect.Left;
+        state.Right = rect.Right;
+        state.Leaves = &leaves[0];
+        Parallel::ParallelFor<Internal::LeavesTask, Internal::LeavesState>
+            tasks(rect.Top, rect.Bottom, state, (rect.Right - rect.Left) * Dimensions * _patchSize);
+        tasks.SpawnAndSync();
+    }
+
+    size_t PatchIndex::GetBytes() const
+    {
+        return _components.capacity() * sizeof(float) + _nodes.capacity() * sizeof(Node) +
+            _centers.capacity() * sizeof(Point16);
+    }
+}
\ No newline at end of file
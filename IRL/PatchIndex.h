@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Image.h"
+#include "Point2D.h"
+#include "Alpha.h"
+#include "Rectangle.h"
+#include "DeviceNNF.h"
+
+namespace IRL
+{
+    // Approximate nearest neighbor index over source patches for NNF random search.
+    // Patches are reduced to Dimensions principal components of the source and kept in a kd-tree,
+    // a query descends to the leaf of the target patch and returns its source patches as candidates.
+    // Propagation in NNF spreads good candidates further, as in propagation-assisted kd-trees.
+    // Pixels are in the layout of Internal::ConvertForDevice, i.e. 4 floats each.
+    class PatchIndex
+    {
+    public:
+        static const int Dimensions = 8;   // principal components of a patch
+        static const int LeafSize = 8;     // most candidates returned by a query
+
+        PatchIndex();
+
+        // Indexes patches of 'patchSize' centered at least patchSize / 2 from the borders, patches covering
+        // masked pixels are skipped when the mask is valid
+        void Build(const std::vector<float>& pixels, int width, int height, const Image<Alpha8>& mask,
+            int patchSize = PatchSize);
+
+        template<class PixelType>
+        void Build(const Image<PixelType>& source, const Image<Alpha8>& mask, int patchSize = PatchSize)
+        {
+            std::vector<float> pixels;
+            Internal::ConvertForDevice(source, pixels);
+            Build(pixels, source.Width(), source.Height(), mask, patchSize);
+        }
+
+        // Releases the tree
+        void Clear();
+        bool IsEmpty() const { return _nodes.empty(); }
+
+        // Projects patch centered in (x, y) of the image of 'width' in the same layout
+        void Describe(const float* pixels, int width, int x, int y, float* descriptor) const;
+        // Return leaf of the descriptor
+        int32_t FindLeaf(const float* descriptor) const;
+        // Finds leaves of patches centered in 'rect' of the image of 'width' in parallel,
+        // 'leaves' are stored without stride, i.e. at x + y * width
+        void FindLeaves(const std::vector<float>& pixels, int width, const Rectangle<int32_t>& rect,
+            std::vector<int32_t>& leaves) const;
+        // Return centers of source patches in the leaf, 'count' is set to their number
+        const Point16* GetLeaf(int32_t leaf, int& count) const
+        {
+            const Node& node = _nodes[leaf];
+            count = node.Second - node.First;
+            return &_centers[node.First];
+        }
+
+        // Return bytes held by the tree
+        size_t GetBytes() const;
+
+    private:
+        struct Node
+        {
+            int32_t Dimension;  // split dimension, -1 for leaf
+            float Split;        // descriptors below it go to the First child
+            int32_t First;      // child nodes, or range of _centers for leaf
+            int32_t Second;
+        };
+
+        // Principal components of patches sampled from the source
+        void FindComponents(const std::vector<float>& pixels, int width, const std::vector<Point16>& centers);
+        // Splits order[first, last) at the median of the dimension with the largest spread
+        int32_t BuildNode(std::vector<int32_t>& order, int32_t first, int32_t last, const std::vector<float>& descriptors);
+
+    private:
+        int _patchSize;
+        int _patchValues;                // channels of a patch which are used, _patchSize * _patchSize * 3
+        std::vector<float> _components;  // Dimensions rows of _patchValues weights
+        std::vector<Node> _nodes;        // root first
+        std::vector<Point16> _centers;   // leaf ranges
+    };
+}
\ No newline at end of file
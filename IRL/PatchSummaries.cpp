@@ -0,0 +1,137 @@
+#include "Includes.h"
+#include "PatchSummaries.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+namespace IRL
+{
+    namespace Internal
+    {
+        const int RowMoments = 6;   // sum and x weighted sum of 3 channels
+
+        struct SummariesState
+        {
+            const float* Pixels;
+            int Width;
+            int PatchSize;
+            float* Rows;            // RowMoments per pixel
+            float* Values;          // PatchSummaries::Components per pixel
+            bool Horizontal;        // pass summing rows, the vertical one sums row moments up
+        };
+
+        class SummariesTask :
+            public Parallel::Runnable
+        {
+        public:
+            void Set(int start, int stop, const SummariesState& state)
+            {
+                _start = start;
+                _stop = stop;
+                _state = state;
+            }
+
+            virtual void Run()
+            {
+                // moments are scaled by norms of the projection vectors, so that they are orthonormal
+                const int size = _state.PatchSize;
+                const int half = size / 2;
+                float slopeNorm = 0;
+                for (int d = -half; d <= half; d++)
+                    slopeNorm += (float)(d * d);
+                const float meanScale = 1 / sqrt((float)(size * size));
+                const float slopeScale = 1 / sqrt(slopeNorm * size);
+
+                const int width = _state.Width;
+                for (int y = _start; y < _stop; y++)
+                {
+                    for (int x = half; x < width - half; x++)
+                    {
+                        if (_state.Horizontal)
+                        {
+                            float* rows = _state.Rows + (x + y * width) * RowMoments;
+                            for (int c = 0; c < 3; c++)
+                            {
+                                float sum = 0;
+                                float slope = 0;
+                                for (int d = -half; d <= half; d++)
+                                {
+                                    const float v = _state.Pixels[(x + d + y * width) * 4 + c];
+                                    sum += v;
+                                    slope += d * v;
+                                }
+                                rows[c] = sum;
+                                rows[3 + c] = slope;
+                            }
+                        } else
+                        {
+                            float* values = _state.Values + (x + y * width) * PatchSummaries::Components;
+                            for (int c = 0; c < 3; c++)
+                            {
+                                float sum = 0;
+                                float slopeX = 0;
+                                float slopeY = 0;
+                                for (int d = -half; d <= half; d++)
+                                {
+                                    const float* rows = _state.Rows + (x + (y + d) * width) * RowMoments;
+                                    sum += rows[c];
+                                    slopeX += rows[3 + c];
+                                    slopeY += d * rows[c];
+                                }
+                                values[c] = sum * meanScale;
+                                values[3 + c] = slopeX * slopeScale;
+                                values[6 + c] = slopeY * slopeScale;
+                            }
+                        }
+                    }
+                }
+            }
+
+        private:
+            int _start;
+            int _stop;
+            SummariesState _state;
+        };
+    }
+
+    PatchSummaries::PatchSummaries()
+        : _width(0)
+    {
+    }
+
+    void PatchSummaries::Compute(const std::vector<float>& pixels, int width, int height, int patchSize)
+    {
+        Tools::Profiler profiler("ComputePatchSummaries");
+        _width = width;
+        _values.assign((size_t)width * height * Components, 0.0f);
+        const int half = patchSize / 2;
+        if (width <= 2 * half || height <= 2 * half)
+            return;
+
+        std::vector<float> rows((size_t)width * height * Internal::RowMoments);
+        Internal::SummariesState state;
+        state.Pixels = &pixels[0];
+        state.Width = width;
+        state.PatchSize = patchSize;
+        state.Rows = &rows[0];
+        state.Values = &_values[0];
+        state.Horizontal = true;
+        Parallel::ParallelFor<Internal::SummariesTask, Internal::SummariesState>
+            horizontal(0, height, state, width * Internal::RowMoments * patchSize);
+        horizontal.SpawnAndSync();
+
+        state.Horizontal = false;
+        Parallel::ParallelFor<Internal::SummariesTask, Internal::SummariesState>
+            vertical(half, height - half, state, width * Components * patchSize);
+        vertical.SpawnAndSync();
+    }
+
+    void PatchSummaries::Clear()
+    {
+        std::vector<float>().swap(_values);
+    }
+
+    size_t PatchSummaries::GetBytes() const
+    {
+        return _values.capacity() * sizeof(float);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Config.h"
+
+namespace IRL
+{
+    // Low dimensional summaries of all patches of an image, which bound distances between patches from below.
+    // Summaries are projections of a patch onto Components orthonormal vectors: its mean and its horizontal
+    // and vertical slopes in every channel. Projection does not increase euclidean distance, so distance
+    // between summaries never exceeds distance between patches, and a candidate can be rejected before
+    // its distance is calculated.
+    // Pixels are in the layout of Internal::ConvertForDevice, i.e. 4 floats each.
+    class PatchSummaries
+    {
+    public:
+        static const int Components = 9;   // 3 moments of 3 channels
+
+        PatchSummaries();
+
+        // Summarizes patches of 'patchSize' centered at least patchSize / 2 from the borders, in parallel
+        void Compute(const std::vector<float>& pixels, int width, int height, int patchSize = PatchSize);
+        // Releases summaries
+        void Clear();
+        bool IsEmpty() const { return _values.empty(); }
+
+        // Return summary of patch centered in (x, y)
+        const float* Get(int x, int y) const
+        {
+            return &_values[(x + y * _width) * Components];
+        }
+
+        // Return lower bound of distance between patches with summaries 'a' and 'b'. It is lowered a bit,
+        // so that float rounding never takes it above the distance.
+        static force_inline float LowerBound(const float* a, const float* b)
+        {
+            float sum = 0;
+            for (int i = 0; i < Components; i++)
+            {
+                const float d = a[i] - b[i];
+                sum += d * d;
+            }
+            return sum * 0.99f;
+        }
+
+        // Return bytes held by summaries
+        size_t GetBytes() const;
+
+    private:
+        int _width;
+        std::vector<float> _values;   // Components per pixel without stride, zeros near the borders
+    };
+}
\ No newline at end of file
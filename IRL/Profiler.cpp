@@ -2,86 +2,262 @@
 #include "Profiler.h"
 #include "Threading.h"
 
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <string.h>
+#ifdef IRL_USE_QT
+#include <QtCore/QElapsedTimer>
+#else
+#include <chrono>
+#endif
+
 namespace IRL
 {
     namespace Tools
     {
-        static ThreadLocal<Profiler*> g_LastProfiler;
-
-        class Profiler::Result
+        // Monotonic clock started with the program
+        class Clock
         {
         public:
-            Result(const std::string& name) 
-                : _name(name), _totalTime(0), _timeInside(0)
+#ifdef IRL_USE_QT
+            Clock() { _timer.start(); }
+            int64_t Now() const { return _timer.nsecsElapsed(); }
+        private:
+            QElapsedTimer _timer;
+#else
+            Clock() : _start(std::chrono::steady_clock::now()) {}
+            int64_t Now() const
             {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
             }
+        private:
+            std::chrono::steady_clock::time_point _start;
+#endif
+        };
+
+        static Clock g_Clock;
+
+        int64_t GetTime()
+        {
+            return g_Clock.Now();
+        }
+
+        // Statistics of one scope name
+        struct ScopeStatistics
+        {
+            ScopeStatistics() : Calls(0), TotalTime(0), SelfTime(0) {}
+
+            int64_t Calls;
+            int64_t TotalTime;
+            int64_t SelfTime;
+        };
+
+        // Closed scope
+        struct ScopeEvent
+        {
+            const char* Name;
+            int64_t StartTime;
+            int64_t Duration;
+        };
 
-            ~Result()
+        // Scopes of one thread, changed by the owner thread only
+        class Internal::ProfilerThread
+        {
+        public:
+            explicit ProfilerThread(int id) : Id(id), Current(NULL) {}
+
+            void Reset()
             {
-                for (unsigned int i = 0; i < _childs.size(); i++)
-                    delete _childs[i];
+                Statistics.clear();
+                for (unsigned int i = 0; i < Events.size(); i++)
+                    delete Events[i];
+                Events.clear();
             }
 
-            void SetTotalTime(clock_t totalTime)
+            void AddEvent(const ScopeEvent& event)
             {
-                _totalTime = totalTime;
+                // events are stored in chunks, so recording never copies previous ones
+                if (Events.empty() || Events.back()->size() == ChunkSize)
+                {
+                    Events.push_back(new std::vector<ScopeEvent>());
+                    Events.back()->reserve(ChunkSize);
+                }
+                Events.back()->push_back(event);
             }
 
-            clock_t GetTotalTime() const
+        public:
+            static const unsigned int ChunkSize = 4096;
+
+            int Id;
+            Profiler* Current; // innermost open scope
+            std::map<const char*, ScopeStatistics> Statistics;
+            std::vector<std::vector<ScopeEvent>*> Events;
+        };
+
+        // All threads which used the profiler
+        static Mutex g_ThreadsLock;
+        static std::vector<Internal::ProfilerThread*> g_Threads;
+        static ThreadLocal<Internal::ProfilerThread*> g_CurrentThread;
+        static volatile bool g_Tracing = false;
+
+        static Internal::ProfilerThread* GetThreadData()
+        {
+            Internal::ProfilerThread* data = g_CurrentThread.Get();
+            if (data == NULL)
             {
-                return _totalTime;
+                AutoMutex lock(g_ThreadsLock);
+                data = new Internal::ProfilerThread((int)g_Threads.size() + 1);
+                g_Threads.push_back(data);
+                g_CurrentThread.Set(data);
             }
+            return data;
+        }
+
+        Profiler::Profiler(const char* name)
+        {
+            _name = name;
+            _current = name;
+            _childTime = 0;
+            _thread = GetThreadData();
+            _parent = _thread->Current;
+            _thread->Current = this;
+            _startTime = g_Clock.Now();
+        }
 
-            void AddChild(Result* child)
+        Profiler::Profiler(const char* name, const char* current)
+        {
+            _name = name;
+            _current = current;
+            _childTime = 0;
+            _thread = GetThreadData();
+            _parent = _thread->Current;
+            _thread->Current = this;
+            _startTime = g_Clock.Now();
+        }
+
+        Profiler::~Profiler()
+        {
+            const int64_t duration = g_Clock.Now() - _startTime;
+            ASSERT(_thread->Current == this);
+            _thread->Current = _parent;
+            if (_parent != NULL)
+                _parent->_childTime += duration;
+
+            ScopeStatistics& statistics = _thread->Statistics[_name];
+            statistics.Calls++;
+            statistics.TotalTime += duration;
+            statistics.SelfTime += duration - _childTime;
+
+            if (g_Tracing)
             {
-                _childs.push_back(child);
-                _timeInside += child->GetTotalTime();
+                ScopeEvent event;
+                event.Name = _name;
+                event.StartTime = _startTime;
+                event.Duration = duration;
+                _thread->AddEvent(event);
             }
+        }
+
+        const char* Profiler::GetCurrentScope()
+        {
+            // threads which never opened a scope get no data
+            const Internal::ProfilerThread* data = g_CurrentThread.Get();
+            return data != NULL && data->Current != NULL ? data->Current->_current : NULL;
+        }
 
-            void Report(const std::string& prefix)
+        void Profiler::SetTracing(bool enabled)
+        {
+            g_Tracing = enabled;
+        }
+
+        void Profiler::Reset()
+        {
+            AutoMutex lock(g_ThreadsLock);
+            for (unsigned int i = 0; i < g_Threads.size(); i++)
+                g_Threads[i]->Reset();
+        }
+
+        void Profiler::Report(std::ostream& out)
+        {
+            // the same name may come from different literals, so merge by string
+            std::map<std::string, ScopeStatistics> total;
             {
-                std::cout << prefix << _name << " : " 
-                    << (_totalTime * 1000 / CLOCKS_PER_SEC) << "("
-                    << ((_totalTime - _timeInside) * 1000 / CLOCKS_PER_SEC) << ")\n";
-                if (!_childs.empty())
+                AutoMutex lock(g_ThreadsLock);
+                for (unsigned int i = 0; i < g_Threads.size(); i++)
                 {
-                    std::string newPrefix = prefix + "  ";
-                    for (unsigned int i = 0; i < _childs.size(); i++)
-                        _childs[i]->Report(newPrefix);
-                    std::cout << prefix << "---\n";
+                    const std::map<const char*, ScopeStatistics>& statistics = g_Threads[i]->Statistics;
+                    std::map<const char*, ScopeStatistics>::const_iterator it;
+                    for (it = statistics.begin(); it != statistics.end(); ++it)
+                    {
+                        ScopeStatistics& sum = total[it->first];
+                        sum.Calls += it->second.Calls;
+                        sum.TotalTime += it->second.TotalTime;
+                        sum.SelfTime += it->second.SelfTime;
+                    }
                 }
             }
 
-        private:
-            std::string _name;
-            std::vector<Result*> _childs;
-            clock_t _totalTime;
-            clock_t _timeInside;
-        };
+            out << std::setw(32) << std::left << "Scope" << std::right
+                << std::setw(10) << "Calls" << std::setw(14) << "Total, ms" << std::setw(14) << "Self, ms" << "\n";
+            std::map<std::string, ScopeStatistics>::const_iterator it;
+            for (it = total.begin(); it != total.end(); ++it)
+            {
+                out << std::setw(32) << std::left << it->first << std::right
+                    << std::setw(10) << it->second.Calls << std::fixed << std::setprecision(2)
+                    << std::setw(14) << it->second.TotalTime / 1e6
+                    << std::setw(14) << it->second.SelfTime / 1e6 << "\n";
+            }
+        }
 
-        Profiler::Profiler(const std::string& name) : 
-            _startTime(clock())
+        // Writes string as JSON literal
+        static void WriteJsonString(std::ostream& out, const char* s)
         {
-            _result = new Result(name);
-            if (g_LastProfiler.IsSet())
-                _parent = g_LastProfiler.Get();
-            else
-                _parent = NULL;
-            g_LastProfiler.Set(this);
+            out << '"';
+            for (; *s != 0; s++)
+            {
+                if (*s == '"' || *s == '\\')
+                    out << '\\';
+                if ((unsigned char)*s >= 0x20)
+                    out << *s;
+            }
+            out << '"';
         }
 
-        Profiler::~Profiler()
+        bool Profiler::ExportTrace(const std::string& path)
         {
-            ASSERT(g_LastProfiler.Get() == this);
-            _result->SetTotalTime(clock() - _startTime);
-            g_LastProfiler.Set(_parent);
-            if (_parent != NULL)
-                _parent->_result->AddChild(_result);
-            else
+            std::ofstream out(path.c_str());
+            if (!out)
+                return false;
+
+            AutoMutex lock(g_ThreadsLock);
+            out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            bool first = true;
+            out << std::fixed << std::setprecision(3);
+            for (unsigned int i = 0; i < g_Threads.size(); i++)
             {
-                _result->Report("");
-                delete _result;
+                const Internal::ProfilerThread* thread = g_Threads[i];
+                if (!first)
+                    out << ",\n";
+                first = false;
+                out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->Id
+                    << ",\"args\":{\"name\":\"Thread " << thread->Id << "\"}}";
+                for (unsigned int j = 0; j < thread->Events.size(); j++)
+                {
+                    const std::vector<ScopeEvent>& events = *thread->Events[j];
+                    for (unsigned int k = 0; k < events.size(); k++)
+                    {
+                        // complete events, time in microseconds
+                        out << ",\n{\"name\":";
+                        WriteJsonString(out, events[k].Name);
+                        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->Id
+                            << ",\"ts\":" << events[k].StartTime / 1e3
+                            << ",\"dur\":" << events[k].Duration / 1e3 << "}";
+                    }
+                }
             }
+            out << "\n]}\n";
+            return out.good();
         }
     }
 }
\ No newline at end of file
@@ -4,18 +4,51 @@ namespace IRL
 {
     namespace Tools
     {
+        namespace Internal
+        {
+            class ProfilerThread;
+        }
+
+        // Nanoseconds of the monotonic wall clock used by the profiler
+        extern int64_t GetTime();
+
+        // Times the scope with monotonic wall clock.
+        // Every thread keeps its own statistics and events, so scopes take no locks.
+        // Static methods below should be called while no scope is open in other threads.
         class Profiler
         {
         public:
-            Profiler(const std::string& name);
+            // 'name' has to live till Reset(), i.e. be a string literal
+            explicit Profiler(const char* name);
+            // Scope which GetCurrentScope reports as 'current' while it is the innermost one, for tasks
+            // run on behalf of a scope of another thread; 'current' may be NULL
+            Profiler(const char* name, const char* current);
             ~Profiler();
 
+            // Record every scope as event for ExportTrace, off by default.
+            // Statistics are collected always.
+            static void SetTracing(bool enabled);
+            // Drops collected statistics and events
+            static void Reset();
+            // Writes calls count, total and self time (without nested scopes) in ms of every scope name
+            static void Report(std::ostream& out);
+            // Writes recorded events in Chrome trace event format (chrome://tracing, Perfetto)
+            static bool ExportTrace(const std::string& path);
+            // Name of the innermost open scope of the calling thread, NULL outside of scopes
+            // (the 'current' one of a scope opened with it)
+            static const char* GetCurrentScope();
+
         private:
-            clock_t _startTime;
-            Profiler* _parent;
+            // disable copy methods
+            Profiler(const Profiler&);
+            void operator=(const Profiler&);
 
-            class Result;
-            Result* _result;
+            const char* _name;
+            const char* _current; // reported by GetCurrentScope
+            int64_t _startTime;
+            int64_t _childTime; // total time of nested scopes
+            Profiler* _parent;
+            Internal::ProfilerThread* _thread;
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Image.h"
+#include "Rectangle.h"
+#include "GaussianPyramid.h"
+
+namespace IRL
+{
+    // Keeps the input converted to PixelType and its Gaussian pyramid between calls on the same image,
+    // i.e. when objects are removed one by one. Pixels are compared with the previous input, so the
+    // cache is valid whatever the caller did with the image. Not thread safe.
+    template<class PixelType, class InputType = PixelType>
+    class PyramidCache
+    {
+    public:
+        PyramidCache();
+
+        // Pyramid of 'input' with 'levels' levels. When the previous input had the same size, only its
+        // pixels which differ are converted again and levels are filtered again only above them.
+        const GaussianPyramid<PixelType>& Get(const Image<InputType>& input, int levels);
+
+        // Rectangle of the first level redone by the last Get, empty if the pyramid was reused as is
+        const Rectangle<int32_t>& GetUpdated() const { return _updated; }
+
+        // Releases kept images
+        void Clear();
+
+    private:
+        // disable copy methods
+        PyramidCache(const PyramidCache&);
+        void operator=(const PyramidCache&);
+
+        void Rebuild(const Image<InputType>& input, int levels);
+        void Update(const Image<InputType>& input, const Rectangle<int32_t>& changed);
+
+    private:
+        Image<InputType> _input;    // shares pixels with the caller, copy on write keeps it intact
+        GaussianPyramid<PixelType> _pyramid;
+        Rectangle<int32_t> _updated;
+    };
+}
+
+#include "PyramidCache.inl"
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "PyramidCache.h"
+#include "ImageConversion.h"
+#include "Scaling.h"
+#include "Parallel.h"
+#include "Profiler.h"
+
+#include <string.h>
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Bounding box of pixels which differ in rows of two images of the same size
+        template<class PixelType>
+        class DifferenceTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                ConstImageView<PixelType> A;
+                ConstImageView<PixelType> B;
+            };
+
+        private:
+            int _start;
+            int _end;
+            State _state;
+        public:
+            Rectangle<int32_t> Found;
+
+            void Set(int start, int end, const State& state)
+            {
+                _start = start;
+                _end = end;
+                _state = state;
+                Found = Rectangle<int32_t>(0, 0, 0, 0);
+            }
+
+            virtual void Run()
+            {
+                const int width = _state.A.Width();
+                for (int y = _start; y < _end; y++)
+                {
+                    const PixelType* a = _state.A.Row(y);
+                    const PixelType* b = _state.B.Row(y);
+                    if (memcmp(a, b, sizeof(PixelType) * width) == 0)
+                        continue;
+                    int left = 0;
+                    while (memcmp(&a[left], &b[left], sizeof(PixelType)) == 0)
+                        left++;
+                    int right = width;
+                    while (memcmp(&a[right - 1], &b[right - 1], sizeof(PixelType)) == 0)
+                        right--;
+                    if (Found.IsEmpty())
+                    {
+                        Found = Rectangle<int32_t>(left, y, right - left, 1);
+                    } else
+                    {
+                        Found.Left = Minimum(Found.Left, left);
+                        Found.Right = Maximum(Found.Right, right);
+                        Found.Bottom = y + 1;
+                    }
+                }
+            }
+        };
+
+        template<class PixelType>
+        Rectangle<int32_t> GetDifferenceRegion(const Image<PixelType>& a, const Image<PixelType>& b)
+        {
+            ASSERT(a.Width() == b.Width() && a.Height() == b.Height());
+
+            typename DifferenceTask<PixelType>::State state;
+            state.A = a.ConstView();
+            state.B = b.ConstView();
+
+            Parallel::ParallelFor
+                <
+                DifferenceTask<PixelType>,
+                typename DifferenceTask<PixelType>::State
+                > tasks(0, a.Height(), state, a.Width());
+            tasks.SpawnAndSync();
+
+            Rectangle<int32_t> region(0, 0, 0, 0);
+            for (int i = 0; i < tasks.Count(); i++)
+            {
+                const Rectangle<int32_t>& found = tasks[i].Found;
+                if (found.IsEmpty())
+                    continue;
+                if (region.IsEmpty())
+                {
+                    region = found;
+                } else
+                {
+                    region.Left = Minimum(region.Left, found.Left);
+                    region.Right = Maximum(region.Right, found.Right);
+                    region.Top = Minimum(region.Top, found.Top);
+                    region.Bottom = Maximum(region.Bottom, found.Bottom);
+                }
+            }
+            return region;
+        }
+
+        // Pixels of the next level which read any pixel of 'region' of the previous level
+        // through the 5 tap kernel, levels narrower than the kernel are redone whole
+        inline Rectangle<int32_t> ScaledDownRegion(const Rectangle<int32_t>& region,
+            int32_t previousWidth, int32_t previousHeight, int32_t width, int32_t height)
+        {
+            const int32_t reach = Kernel1D5Tap::HalfSize();
+            if (previousWidth <= 2 * reach || previousHeight <= 2 * reach)
+                return Rectangle<int32_t>(0, 0, width, height);
+            Rectangle<int32_t> result;
+            result.Left = Maximum(0, (region.Left - reach + 1) / 2);
+            result.Top = Maximum(0, (region.Top - reach + 1) / 2);
+            result.Right = Minimum(width, (region.Right + reach - 1) / 2 + 1);
+            result.Bottom = Minimum(height, (region.Bottom + reach - 1) / 2 + 1);
+            return result;
+        }
+    }
+
+    template<class PixelType, class InputType>
+    PyramidCache<PixelType, InputType>::PyramidCache()
+    {
+        _updated = Rectangle<int32_t>(0, 0, 0, 0);
+    }
+
+    template<class PixelType, class InputType>
+    const GaussianPyramid<PixelType>& PyramidCache<PixelType, InputType>::Get(const Image<InputType>& input, int levels)
+    {
+        Tools::Profiler profiler("PyramidCache::Get");
+        ASSERT(input.IsValid());
+
+        if (!_input.IsValid() || (int)_pyramid.Levels.size() != levels ||
+            _input.Width() != input.Width() || _input.Height() != input.Height())
+        {
+            Rebuild(input, levels);
+            _updated = Rectangle<int32_t>(0, 0, input.Width(), input.Height());
+            return _pyramid;
+        }
+
+        // the same pixels can't change while the cache shares them
+        _updated = Rectangle<int32_t>(0, 0, 0, 0);
+        if (_input.ConstView().Data() == input.ConstView().Data())
+            return _pyramid;
+
+        const Rectangle<int32_t> changed = Internal::GetDifferenceRegion(_input, input);
+        _input = input;
+        if (!changed.IsEmpty())
+        {
+            Update(input, changed);
+            _updated = changed;
+        }
+        return _pyramid;
+    }
+
+    template<class PixelType, class InputType>
+    void PyramidCache<PixelType, InputType>::Clear()
+    {
+        _input = Image<InputType>();
+        _pyramid.Levels.clear();
+        _updated = Rectangle<int32_t>(0, 0, 0, 0);
+    }
+
+    template<class PixelType, class InputType>
+    void PyramidCache<PixelType, InputType>::Rebuild(const Image<InputType>& input, int levels)
+    {
+        _input = input;
+        Image<PixelType> converted;
+        Convert(converted, input);
+        _pyramid = GaussianPyramid<PixelType>(converted, levels);
+    }
+
+    template<class PixelType, class InputType>
+    void PyramidCache<PixelType, InputType>::Update(const Image<InputType>& input, const Rectangle<int32_t>& changed)
+    {
+        using namespace Internal;
+
+        const int32_t width = changed.Right - changed.Left;
+        const int32_t height = changed.Bottom - changed.Top;
+
+        {
+            typename ConvertTask<PixelType, InputType>::State state;
+            state.From = input.ConstView().SubView(changed.Left, changed.Top, width, height);
+            state.To = _pyramid.Levels[0].View().SubView(changed.Left, changed.Top, width, height);
+
+            Parallel::ParallelFor
+                <
+                ConvertTask<PixelType, InputType>,
+                typename ConvertTask<PixelType, InputType>::State
+                > tasks(0, height, state, width);
+            tasks.SpawnAndSync();
+        }
+
+        Rectangle<int32_t> region = changed;
+        for (unsigned int i = 1; i < _pyramid.Levels.size(); i++)
+        {
+            const Image<PixelType>& previous = _pyramid.Levels[i - 1];
+            Image<PixelType>& level = _pyramid.Levels[i];
+            region = ScaledDownRegion(region, previous.Width(), previous.Height(), level.Width(), level.Height());
+            if (region.IsEmpty())
+                break;
+
+            typename ScaleDownTask<PixelType>::State state;
+            state.Src = previous.ConstView();
+            state.Dst = level.View();
+            state.Left = region.Left;
+            state.Right = region.Right;
+
+            Parallel::ParallelFor
+                <
+                ScaleDownTask<PixelType>,
+                typename ScaleDownTask<PixelType>::State
+                > tasks(region.Top, region.Bottom, state, 2 * (region.Right - region.Left));
+            tasks.SpawnAndSync();
+        }
+    }
+}
\ No newline at end of file
@@ -109,6 +109,16 @@ namespace IRL
             Norm += c;
         }
 
+        // Adds pixels and norm appended to other accumulator
+        force_inline Accumulator& operator+=(const Accumulator& other)
+        {
+            B += other.B;
+            G += other.G;
+            R += other.R;
+            Norm += other.Norm;
+            return *this;
+        }
+
         force_inline const PixelType GetSum() const
         {
             return GetSum(Norm);
@@ -120,4 +130,20 @@ namespace IRL
     private:
         LargerType B, G, R;
     };
+
+    template<class ChannelType>
+    struct PixelChannels<RGB<ChannelType> >
+    {
+        static const int Count = 3;
+
+        static force_inline double Get(const RGB<ChannelType>& pixel, int i)
+        {
+            return i == 0 ? (double)pixel.B : (i == 1 ? (double)pixel.G : (double)pixel.R);
+        }
+
+        static force_inline void Set(RGB<ChannelType>& pixel, int i, double value)
+        {
+            (i == 0 ? pixel.B : (i == 1 ? pixel.G : pixel.R)) = Internal::ToChannel<ChannelType>(value);
+        }
+    };
 }
\ No newline at end of file
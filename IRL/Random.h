@@ -6,7 +6,7 @@ namespace IRL
     class Random
     {
     public:
-        explicit Random(uint32_t seed = rand()) : _state(seed)
+        explicit Random(uint32_t seed) : _state(seed)
         { }
 
         void Seed(uint32_t seed) 
@@ -39,4 +39,57 @@ namespace IRL
 
         uint32_t _state;
     };
+
+    // Counter based generator: values are SplitMix64 of the key advanced by their index, so there is
+    // no state besides the key. Keyed by seed, pass and pixel it gives every pixel its own stream,
+    // threads share nothing and results do not depend on which thread processes the pixel.
+    class CounterRandom
+    {
+    public:
+        explicit CounterRandom(uint64_t key) : _state(key)
+        { }
+
+        // Key of the stream 'index' derived from 'key', i.e. of an iteration or of a pixel
+        static uint64_t Key(uint64_t key, uint64_t index)
+        {
+            return Mix(key ^ Mix(index + Gamma));
+        }
+
+        static uint64_t Key(uint64_t key, int32_t x, int32_t y)
+        {
+            return Key(key, ((uint64_t)(uint32_t)y << 32) | (uint32_t)x);
+        }
+
+        // Value in [min, max)
+        template<class T>
+        const T Uniform(const T min, const T max)
+        {
+            return (T)(min + (T)(((uint64_t)Next() * (uint32_t)(max - min)) >> 32));
+        }
+
+        // Value in [0, max)
+        template<class T>
+        const T Uniform(const T max)
+        {
+            return (T)(((uint64_t)Next() * (uint32_t)max) >> 32);
+        }
+
+    private:
+        static const uint64_t Gamma = 0x9E3779B97F4A7C15ull;
+
+        static force_inline uint64_t Mix(uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        force_inline uint32_t Next()
+        {
+            _state += Gamma;
+            return (uint32_t)(Mix(_state) >> 32);
+        }
+
+        uint64_t _state;
+    };
 }
\ No newline at end of file
@@ -24,11 +24,38 @@ namespace IRL
             return (p.x >= Left && p.x < Right) && (p.y >= Top && p.y < Bottom);
         }
 
-        const IntType Area()
+        const IntType Area() const
         {
             return (Right - Left) * (Bottom - Top);
         }
 
+        bool IsEmpty() const
+        {
+            return Right <= Left || Bottom <= Top;
+        }
+
+        // Return rectangle grown by 'margin' on every side
+        const Rectangle Inflated(IntType margin) const
+        {
+            Rectangle result;
+            result.Left = Left - margin;
+            result.Right = Right + margin;
+            result.Top = Top - margin;
+            result.Bottom = Bottom + margin;
+            return result;
+        }
+
+        // Return common part of rectangles, it may be empty
+        const Rectangle Intersection(const Rectangle& other) const
+        {
+            Rectangle result;
+            result.Left = Maximum(Left, other.Left);
+            result.Right = Minimum(Right, other.Right);
+            result.Top = Maximum(Top, other.Top);
+            result.Bottom = Minimum(Bottom, other.Bottom);
+            return result;
+        }
+
     public:
         IntType Left;
         IntType Right;
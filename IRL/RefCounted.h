@@ -1,7 +1,10 @@
 #pragma once
 
+#include "Threading.h"
+
 namespace IRL
 {
+    // Reference counter is atomic, so references may be acquired and released by different threads
     template<class T>
     class RefCounted
     {
@@ -10,20 +13,19 @@ namespace IRL
         { }
         void Acquire() const
         {
-            _refs++;
+            _refs.FetchAndAdd(1);
         }
         void Release() const
         {
-            --_refs;
-            if (_refs == 0)
+            if (_refs.FetchAndAdd(-1) == 1)
                 T::Delete((T*)this);
         }
         int32_t GetRefs() const 
         { 
-            return _refs;
+            return _refs.Load();
         }
 
     private:
-        mutable int32_t _refs;
+        mutable AtomicInt _refs;
     };
 }
\ No newline at end of file
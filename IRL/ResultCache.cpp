@@ -0,0 +1,128 @@
+#include "Includes.h"
+#include "ResultCache.h"
+#include "Random.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace IRL
+{
+    std::string ResultKey::ToString() const
+    {
+        char text[33];
+        snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)High, (unsigned long long)Low);
+        return text;
+    }
+
+    namespace Internal
+    {
+        void HashBytes(ResultKey& key, const void* data, size_t bytes)
+        {
+            const uint8_t* bytePtr = (const uint8_t*)data;
+            uint64_t lanes[4] = { key.High, key.Low, ~key.High, ~key.Low };
+            size_t i = 0;
+            for (; i + 32 <= bytes; i += 32)
+            {
+                uint64_t words[4];
+                memcpy(words, bytePtr + i, sizeof(words));
+                lanes[0] = CounterRandom::Key(lanes[0], words[0]);
+                lanes[1] = CounterRandom::Key(lanes[1], words[1]);
+                lanes[2] = CounterRandom::Key(lanes[2], words[2]);
+                lanes[3] = CounterRandom::Key(lanes[3], words[3]);
+            }
+            for (; i < bytes; i += 8)
+            {
+                uint64_t word = 0;
+                memcpy(&word, bytePtr + i, Minimum<size_t>(8, bytes - i));
+                lanes[0] = CounterRandom::Key(lanes[0], word);
+            }
+            // the length tells apart inputs which differ by trailing zeros
+            key.High = CounterRandom::Key(CounterRandom::Key(CounterRandom::Key(lanes[0], lanes[1]), lanes[2]), lanes[3]);
+            key.Low = CounterRandom::Key(CounterRandom::Key(CounterRandom::Key(lanes[3], lanes[2]), lanes[1]), lanes[0] ^ bytes);
+        }
+
+        void HashParameters(ResultKey& key, const ObjectRemovalParameters& parameters)
+        {
+            // field by field, padding of the structure is not hashed; CheckpointPath, CheckpointOwner, DebugOutput,
+            // SuperPatchSize, TiledSource and BatchedRandomSearch do not change results
+            const int64_t values[] =
+            {
+                parameters.LODBias, parameters.MinIterations, parameters.IterationsLODFactor,
+                parameters.MinNNFIterations, parameters.NNFIterationsLODFactor,
+                parameters.UseOpenCL, parameters.RegionReach, parameters.FixedPoint, parameters.TileSize,
+                parameters.Seed, parameters.PatchIndex, parameters.PatchBounds, parameters.HashedField, parameters.PatchSize,
+                parameters.CoarsePatchSize, parameters.FinePatchLevels, parameters.NearestNeighbors,
+                parameters.CompactVotes, parameters.ExhaustiveSearchLimit, parameters.SkipConverged,
+                parameters.VideoWarmLevels, parameters.RandomSearchLimit, parameters.RandomSearchInvAlpha
+            };
+            const double reals[] =
+            {
+                parameters.Alpha, parameters.EnergyTolerance, parameters.OffsetsTolerance,
+                parameters.NNFTolerance, parameters.TimeBudget
+            };
+            HashBytes(key, values, sizeof(values));
+            HashBytes(key, reals, sizeof(reals));
+        }
+    }
+
+    ResultCache::ResultCache(size_t memoryBytes, const std::string& directory)
+        : _capacity(memoryBytes), _directory(directory)
+    {
+    }
+
+    ResultCache::~ResultCache()
+    {
+        Clear();
+    }
+
+    void ResultCache::Clear()
+    {
+        AutoMutex autoMutex(_lock);
+        while (!_entries.empty())
+            Remove(_entries.begin());
+    }
+
+    ResultCache::Statistics ResultCache::GetStatistics() const
+    {
+        AutoMutex autoMutex(_lock);
+        return _statistics;
+    }
+
+    std::string ResultCache::GetPath(const ResultKey& key) const
+    {
+        const char last = _directory[_directory.size() - 1];
+        const bool separated = last == '/' || last == '\\';
+        return _directory + (separated ? "" : "/") + key.ToString() + ".irlc";
+    }
+
+    ResultCache::Entry* ResultCache::Touch(const ResultKey& key)
+    {
+        std::map<ResultKey, EntryList::iterator>::iterator found = _index.find(key);
+        if (found == _index.end())
+            return NULL;
+        _entries.splice(_entries.begin(), _entries, found->second);
+        return found->second->second;
+    }
+
+    void ResultCache::Insert(const ResultKey& key, Entry* entry)
+    {
+        std::map<ResultKey, EntryList::iterator>::iterator found = _index.find(key);
+        if (found != _index.end())
+            Remove(found->second);
+        _entries.push_front(std::make_pair(key, entry));
+        _index[key] = _entries.begin();
+        _statistics.MemoryBytes += entry->Bytes;
+        _statistics.Entries++;
+        while (_statistics.MemoryBytes > _capacity && !_entries.empty())
+            Remove(--_entries.end());
+    }
+
+    void ResultCache::Remove(EntryList::iterator position)
+    {
+        _statistics.MemoryBytes -= position->second->Bytes;
+        _statistics.Entries--;
+        _index.erase(position->first);
+        delete position->second;
+        _entries.erase(position);
+    }
+}
\ No newline at end of file
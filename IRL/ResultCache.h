@@ -0,0 +1,194 @@
+#pragma once
+
+#include "Image.h"
+#include "ImageWithMask.h"
+#include "Parameters.h"
+#include "Threading.h"
+#include "Checkpoint.h"
+
+#include <list>
+#include <map>
+#include <typeinfo>
+
+namespace IRL
+{
+    // 128 bit hash of a removal request, see ResultCache::MakeKey
+    struct ResultKey
+    {
+        ResultKey() : High(0), Low(0) {}
+
+        uint64_t High;
+        uint64_t Low;
+
+        bool operator==(const ResultKey& other) const { return High == other.High && Low == other.Low; }
+        bool operator<(const ResultKey& other) const { return High < other.High || (High == other.High && Low < other.Low); }
+
+        // 32 hex digits
+        std::string ToString() const;
+    };
+
+    namespace Internal
+    {
+        // Continues both halves of 'key' with 'bytes' at 'data', four independent chains of words
+        // are folded in at the end so hashing runs at memory speed. Not meant for adversarial input.
+        void HashBytes(ResultKey& key, const void* data, size_t bytes);
+        // Continues 'key' with every parameter which results depend on
+        void HashParameters(ResultKey& key, const ObjectRemovalParameters& parameters);
+    }
+
+    // Results of removals keyed by a hash of the image, the mask, the parameters, the pixel type and
+    // ResultCache::Version. Removals are deterministic for a seed whatever the number of workers, so a result
+    // found for the key is the one RemoveObject would return again; only results cut by TimeBudget depend
+    // on the machine, they are kept as the answer for that budget.
+    //
+    // Recently used results are kept in memory up to 'memoryBytes' (0 keeps none), the least recently used
+    // ones are dropped.
+    // With 'directory' set every result is also written there as a checkpoint file named by the key, which
+    // other processes and later runs find. Files are never removed, the directory is managed by its owner.
+    // Thread safe, results share pixels with the cache and are copied on write. See also RemoveObject.
+    class ResultCache
+    {
+    public:
+        // Bumped whenever the solver gives other results for the same input and parameters,
+        // so entries of older builds are not found anymore
+        static const uint32_t Version = 1;
+
+        struct Statistics
+        {
+            Statistics() : MemoryHits(0), DiskHits(0), Misses(0), MemoryBytes(0), Entries(0) {}
+
+            int64_t MemoryHits;
+            int64_t DiskHits;
+            int64_t Misses;
+            size_t MemoryBytes;
+            size_t Entries;         // in memory
+        };
+
+        explicit ResultCache(size_t memoryBytes = (size_t)256 << 20, const std::string& directory = std::string());
+        ~ResultCache();
+
+        template<class PixelType>
+        static ResultKey MakeKey(const ImageWithMask<PixelType>& input, const ObjectRemovalParameters& parameters)
+        {
+            ResultKey key;
+            key.High = Version;
+            key.Low = sizeof(PixelType);
+            const char* type = typeid(PixelType).name();
+            Internal::HashBytes(key, type, strlen(type));
+            const int32_t sizes[] = { input.Image.Width(), input.Image.Height(), input.Mask.Width(), input.Mask.Height() };
+            Internal::HashBytes(key, sizes, sizeof(sizes));
+            Internal::HashParameters(key, parameters);
+            if (input.Image.IsValid())
+                Internal::HashBytes(key, input.Image.Data(), input.Image.GetBytes());
+            if (input.Mask.IsValid())
+                Internal::HashBytes(key, input.Mask.Data(), input.Mask.GetBytes());
+            return key;
+        }
+
+        // Return false when there is no result of the key, in memory nor in the directory.
+        // Results found in the directory are kept in memory from then on.
+        template<class PixelType>
+        bool Find(const ResultKey& key, Image<PixelType>& result)
+        {
+            {
+                AutoMutex autoMutex(_lock);
+                Entry* entry = Touch(key);
+                if (entry && entry->PixelSize == sizeof(PixelType))
+                {
+                    result = static_cast<ImageEntry<PixelType>*>(entry)->Result;
+                    _statistics.MemoryHits++;
+                    return true;
+                }
+            }
+
+            Image<PixelType> found;
+            if (!_directory.empty())
+            {
+                Checkpoint checkpoint;
+                int64_t high = 0, low = 0;
+                if (checkpoint.Open(GetPath(key)) && checkpoint.GetValue("KeyHigh", high) && checkpoint.GetValue("KeyLow", low) &&
+                    (uint64_t)high == key.High && (uint64_t)low == key.Low)
+                    found = checkpoint.GetImage<PixelType>("Result");
+            }
+
+            AutoMutex autoMutex(_lock);
+            if (!found.IsValid())
+            {
+                _statistics.Misses++;
+                return false;
+            }
+            _statistics.DiskHits++;
+            Insert(key, new ImageEntry<PixelType>(found));
+            result = found;
+            return true;
+        }
+
+        // Keeps 'result' of the key in memory and writes it to the directory
+        template<class PixelType>
+        void Add(const ResultKey& key, const Image<PixelType>& result)
+        {
+            if (!result.IsValid())
+                return;
+            if (!_directory.empty())
+            {
+                CheckpointWriter writer;
+                if (writer.Open(GetPath(key)))
+                {
+                    writer.AddValue("KeyHigh", (int64_t)key.High);
+                    writer.AddValue("KeyLow", (int64_t)key.Low);
+                    writer.Add("Result", result);
+                    writer.Finish();
+                }
+            }
+            AutoMutex autoMutex(_lock);
+            Insert(key, new ImageEntry<PixelType>(result));
+        }
+
+        // Drops results kept in memory, files stay
+        void Clear();
+
+        Statistics GetStatistics() const;
+
+    private:
+        // disable copy methods
+        ResultCache(const ResultCache&);
+        void operator=(const ResultCache&);
+
+        struct Entry
+        {
+            Entry(size_t pixelSize, size_t bytes) : PixelSize(pixelSize), Bytes(bytes) {}
+            virtual ~Entry() {}
+
+            size_t PixelSize;
+            size_t Bytes;
+        };
+
+        template<class PixelType>
+        struct ImageEntry :
+            public Entry
+        {
+            explicit ImageEntry(const Image<PixelType>& result) : Entry(sizeof(PixelType), result.GetBytes()), Result(result) {}
+
+            Image<PixelType> Result;
+        };
+
+        typedef std::list<std::pair<ResultKey, Entry*> > EntryList;
+
+        std::string GetPath(const ResultKey& key) const;
+        // Moves the entry of the key to the front of the list, NULL when there is none. Under the lock.
+        Entry* Touch(const ResultKey& key);
+        // Takes 'entry', replaces the one of the same key and drops the least recently used ones
+        // above the capacity. Under the lock.
+        void Insert(const ResultKey& key, Entry* entry);
+        void Remove(EntryList::iterator position);
+
+    private:
+        size_t _capacity;
+        std::string _directory;
+
+        mutable Mutex _lock;    // guards fields below
+        EntryList _entries;     // most recently used first
+        std::map<ResultKey, EntryList::iterator> _index;
+        Statistics _statistics;
+    };
+}
\ No newline at end of file
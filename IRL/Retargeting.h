@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Image.h"
+#include "Parameters.h"
+#include "GaussianPyramid.h"
+#include "OffsetField.h"
+#include "ObjectRemoval.h"
+
+namespace IRL
+{
+    // Content aware resizing of the image to width x height. The size changes gradually, each step
+    // by at most parameters.Step, and every step is solved coarse to fine starting from the image and
+    // offset fields of the previous one resampled to its size, so it converges in a few iterations.
+    // Returns invalid image when cancelled through the callback.
+    template<class PixelType>
+    Image<PixelType> Retarget(const Image<PixelType>& img, int width, int height,
+        OperationCallback<PixelType>* callback = NULL);
+
+    // Same with parameters of this call instead of the globals, TimeBudget and RegionReach have no effect
+    template<class PixelType>
+    Image<PixelType> Retarget(const Image<PixelType>& img, int width, int height,
+        OperationCallback<PixelType>* callback, const RetargetingParameters& parameters);
+}
+
+#include "Retargeting.inl"
\ No newline at end of file
@@ -0,0 +1,182 @@
+#include "Retargeting.h"
+#include "BidirectionalSimilarity.h"
+#include "Scaling.h"
+#include "PatchHashing.h"
+#include "Profiler.h"
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Size of the target on the level where the source of 'sourceSize' has 'levelSize'
+        inline int GetLevelSize(int size, int sourceSize, int levelSize, int patchSize)
+        {
+            const int result = (int)((2 * (int64_t)size * levelSize + sourceSize) / (2 * (int64_t)sourceSize));
+            return Maximum<int>(result, patchSize + 1);
+        }
+
+        // Levels of pyramids, the coarsest one keeps at least two patches across the smaller side
+        inline int GetRetargetingLevels(int width, int height, const ObjectRemovalParameters& parameters, int patchSize)
+        {
+            int levels = Maximum<int>(GetPyramidLevels(width, height, parameters), 1);
+            while (levels > 1 && (Minimum<int>(width, height) >> (levels - 1)) < 2 * patchSize)
+                levels--;
+            return levels;
+        }
+
+        // Iterations on level i, steps between the first and the last one start close to their solution
+        inline int GetRetargetingIterations(const ObjectRemovalParameters& parameters, int i, bool warm)
+        {
+            return warm ? parameters.MinIterations : parameters.MinIterations + parameters.IterationsLODFactor * i;
+        }
+
+        // Retarget with patches of Size on all levels
+        template<class PixelType, int Size>
+        Image<PixelType> RetargetWithPatches(const Image<PixelType>& img, int width, int height,
+            OperationCallback<PixelType>* callback, const RetargetingParameters& parameters)
+        {
+            ASSERT(width > Size && height > Size);
+            const int sourceWidth = img.Width();
+            const int sourceHeight = img.Height();
+            const int Levels = GetRetargetingLevels(Minimum(sourceWidth, width), Minimum(sourceHeight, height), parameters, Size);
+            GaussianPyramid<PixelType> source(img, Levels);
+
+            // sides change geometrically, so every step changes them by the same ratio
+            const double scaleX = (double)width / sourceWidth;
+            const double scaleY = (double)height / sourceHeight;
+            const double change = Maximum(fabs(log(scaleX)), fabs(log(scaleY)));
+            const int steps = Maximum<int>(1, (int)ceil(change / log(1.0 + Maximum(parameters.Step, 0.001)) - 1e-9));
+
+            int progress = 0;
+            int total = 0;
+            for (int k = 1; k <= steps; k++)
+            {
+                for (int i = Levels - 1; i >= 0; i--)
+                    total += GetRetargetingIterations(parameters, i, k > 1 && k < steps);
+            }
+
+            BidirectionalSimilarity<PixelType, false, Size> solver;
+            solver.CancelFlag = callback ? callback->GetCancelFlag() : NULL;
+            // fields and the coarsest target of the previous step
+            RemovalFields fields;
+            fields.SourceToTarget.resize(Levels);
+            fields.TargetToSource.resize(Levels);
+            Image<PixelType> coarsest = source.Levels[Levels - 1];
+
+            for (int k = 1; k <= steps; k++)
+            {
+                const int stepWidth = k == steps ? width : (int)floor(sourceWidth * pow(scaleX, (double)k / steps) + 0.5);
+                const int stepHeight = k == steps ? height : (int)floor(sourceHeight * pow(scaleY, (double)k / steps) + 0.5);
+                const bool warm = k > 1 && k < steps;
+
+                // coarse to fine iteration
+                for (int i = Levels - 1; i >= 0; i--)
+                {
+                    const Image<PixelType>& levelSource = source.Levels[i];
+                    const int levelWidth = GetLevelSize(stepWidth, sourceWidth, levelSource.Width(), Size);
+                    const int levelHeight = GetLevelSize(stepHeight, sourceHeight, levelSource.Height(), Size);
+
+                    solver.Reset();
+                    solver.Source = levelSource;
+                    solver.NNFIterations = parameters.MinNNFIterations + i * parameters.NNFIterationsLODFactor;
+                    solver.Alpha = parameters.Alpha;
+                    solver.NNFTolerance = parameters.NNFTolerance;
+                    solver.Seed = CounterRandom::Key(parameters.Seed, k, i);
+                    solver.UsePatchIndex = parameters.PatchIndex;
+                    solver.UsePatchBounds = parameters.PatchBounds;
+                    solver.NearestNeighbors = parameters.NearestNeighbors;
+                    solver.UseCompactVotes = parameters.CompactVotes;
+                    solver.ExhaustiveSearchLimit = parameters.ExhaustiveSearchLimit;
+                    solver.SkipConverged = parameters.SkipConverged;
+                    solver.RandomSearchLimit = parameters.RandomSearchLimit;
+                    solver.RandomSearchInvAlpha = parameters.RandomSearchInvAlpha;
+                    solver.SuperPatchSize = parameters.SuperPatchSize;
+                    solver.TiledSource = parameters.TiledSource;
+                    solver.BatchedRandomSearch = parameters.BatchedRandomSearch;
+                    solver.Backend = parameters.UseOpenCL ? OpenCLBackend : CpuBackend;
+                    // the coarsest level continues the previous step, finer ones refine the coarser result
+                    solver.Target = Resize(i == Levels - 1 ? coarsest : solver.Target, levelWidth, levelHeight);
+
+                    const OffsetField& previousT2S = fields.TargetToSource[i];
+                    if (previousT2S.IsValid())
+                    {
+                        // offsets of the previous step point to the same patches of the resized target
+                        solver.TargetToSource = ResizeField(previousT2S, levelWidth, levelHeight,
+                            levelSource.Width(), levelSource.Height());
+                        solver.SourceToTarget = fields.SourceToTarget[i];
+                        ResizeFieldSource(solver.SourceToTarget, previousT2S.Width(), previousT2S.Height(),
+                            levelWidth, levelHeight);
+                    } else if (parameters.HashedField)
+                    {
+                        solver.TargetToSource = MakeHashedField(solver.Target, levelSource, Image<Alpha8>(), Size,
+                            CounterRandom::Key(solver.Seed, (uint64_t)2));
+                        solver.SourceToTarget = MakeHashedField(levelSource, solver.Target, Image<Alpha8>(), Size,
+                            CounterRandom::Key(solver.Seed, (uint64_t)3));
+                    } else
+                    {
+                        solver.TargetToSource = MakeSmoothField(solver.Target, levelSource);
+                        solver.SourceToTarget = MakeSmoothField(levelSource, solver.Target);
+                    }
+
+                    const int iterations = GetRetargetingIterations(parameters, i, warm);
+                    double energy = 0;
+                    for (int j = 0; j < iterations; j++)
+                    {
+                        solver.Iteration(true);
+                        if (callback && callback->ShouldCancel())
+                            return Image<PixelType>();
+                        progress++;
+
+                        // stop once the solution does not change much
+                        double previousEnergy = energy;
+                        energy = solver.GetEnergy();
+                        if (j > 0 && j + 1 >= parameters.MinIterations)
+                        {
+                            bool converged = false;
+                            if (parameters.EnergyTolerance > 0 &&
+                                fabs(previousEnergy - energy) <= parameters.EnergyTolerance * fabs(previousEnergy))
+                                converged = true;
+                            if (parameters.OffsetsTolerance > 0 && solver.GetChangedOffsets() < parameters.OffsetsTolerance)
+                                converged = true;
+                            if (converged)
+                            {
+                                progress += iterations - j - 1; // skipped iterations
+                                break;
+                            }
+                        }
+                    }
+
+                    fields.SourceToTarget[i] = solver.SourceToTarget;
+                    fields.TargetToSource[i] = solver.TargetToSource;
+                    if (i == Levels - 1)
+                        coarsest = solver.Target;
+                }
+
+                if (k < steps && callback)
+                    callback->IntermediateResult(solver.Target, progress, total);
+            }
+
+            if (callback) callback->OperationEnded(solver.Target);
+            return solver.Target; // final image
+        }
+    }
+
+    template<class PixelType>
+    Image<PixelType> Retarget(const Image<PixelType>& img, int width, int height, OperationCallback<PixelType>* callback)
+    {
+        return Retarget(img, width, height, callback, RetargetingParameters());
+    }
+
+    template<class PixelType>
+    Image<PixelType> Retarget(const Image<PixelType>& img, int width, int height,
+        OperationCallback<PixelType>* callback, const RetargetingParameters& parameters)
+    {
+        // coarse patch size is specific to object removal, every retargeting level matches whole images
+        switch (SupportedPatchSize(parameters.PatchSize))
+        {
+        case 5:  return Internal::RetargetWithPatches<PixelType, 5>(img, width, height, callback, parameters);
+        case 9:  return Internal::RetargetWithPatches<PixelType, 9>(img, width, height, callback, parameters);
+        default: return Internal::RetargetWithPatches<PixelType, 7>(img, width, height, callback, parameters);
+        }
+    }
+}
\ No newline at end of file
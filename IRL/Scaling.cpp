@@ -0,0 +1,85 @@
+#include "Includes.h"
+#include "Scaling.h"
+#include "PatchDistance.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define IRL_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+namespace IRL
+{
+    namespace Internal
+    {
+#if defined(IRL_SIMD_X86)
+        // Pairs of even and odd pixels, both read the same four source pixels with their own weights.
+        // Six doubles of a pair are three vectors: [L a] of the even pixel, [b L] and [a b] of the odd one.
+        // Products are summed in the order of Accumulator appends, so results are equal.
+        static void ScaleUpRowLabDouble_SSE2(LabDouble* dst, const ConstImageView<LabDouble>& src, int y, int from, int to)
+        {
+            const int sy1 = y / 2;
+            const int sy2 = Minimum<int>(sy1 + 1, src.Height() - 1);
+            const int beta = y - 2 * sy1;
+            const LabDouble* src1 = src.Row(sy1);
+            const LabDouble* src2 = src.Row(sy2);
+
+            int x = from;
+            if (x & 1)
+            {
+                ScaleUpRow<LabDouble>(dst, src, y, x, x + 1);
+                x++;
+            }
+
+            // weights of src1[sx1], src1[sx2], src2[sx2] and src2[sx1]
+            const double even[4] = { 2.0 * (2 - beta), 0.0, 0.0, 2.0 * beta };
+            const double odd[4] = { (double)(2 - beta), (double)(2 - beta), (double)beta, (double)beta };
+            __m128d evenWeights[4], mixedWeights[4], oddWeights[4];
+            for (int i = 0; i < 4; i++)
+            {
+                evenWeights[i] = _mm_set1_pd(even[i]);
+                mixedWeights[i] = _mm_setr_pd(even[i], odd[i]);
+                oddWeights[i] = _mm_set1_pd(odd[i]);
+            }
+            const __m128d quarter = _mm_set1_pd(0.25);
+
+            for (; x + 2 <= to; x += 2)
+            {
+                const int sx1 = x / 2;
+                const int sx2 = Minimum<int>(sx1 + 1, src.Width() - 1);
+                const LabDouble* pixels[4] = { src1 + sx1, src1 + sx2, src2 + sx2, src2 + sx1 };
+                __m128d sum0 = _mm_setzero_pd();
+                __m128d sum1 = _mm_setzero_pd();
+                __m128d sum2 = _mm_setzero_pd();
+                for (int i = 0; i < 4; i++)
+                {
+                    const __m128d La = _mm_loadu_pd(&pixels[i]->L);
+                    const __m128d ab = _mm_loadu_pd(&pixels[i]->a);
+                    const __m128d bL = _mm_shuffle_pd(ab, La, 1);
+                    sum0 = _mm_add_pd(sum0, _mm_mul_pd(La, evenWeights[i]));
+                    sum1 = _mm_add_pd(sum1, _mm_mul_pd(bL, mixedWeights[i]));
+                    sum2 = _mm_add_pd(sum2, _mm_mul_pd(ab, oddWeights[i]));
+                }
+                double* out = &dst[x].L;
+                _mm_storeu_pd(out, _mm_mul_pd(sum0, quarter));
+                _mm_storeu_pd(out + 2, _mm_mul_pd(sum1, quarter));
+                _mm_storeu_pd(out + 4, _mm_mul_pd(sum2, quarter));
+            }
+
+            if (x < to)
+                ScaleUpRow<LabDouble>(dst, src, y, x, to);
+        }
+#endif
+
+        void ScaleUpRow(LabDouble* dst, const ConstImageView<LabDouble>& src, int y, int from, int to)
+        {
+#if defined(IRL_SIMD_X86)
+            if (GetSimdLevel() != SimdNone)
+            {
+                ScaleUpRowLabDouble_SSE2(dst, src, y, from, to);
+                return;
+            }
+#endif
+            ScaleUpRow<LabDouble>(dst, src, y, from, to);
+        }
+    }
+}
\ No newline at end of file
@@ -1,14 +1,46 @@
 #pragma once
 
 #include "Image.h"
+#include "Lab.h"
+#include "Alpha.h"
 
 namespace IRL
 {
+    // Size of the next coarser level, odd sizes are rounded up so the last row and column are kept
+    inline int ScaledDownSize(int size)
+    {
+        return (size + 1) / 2;
+    }
+
     template<class PixelType>
     Image<PixelType> ScaleDown(const Image<PixelType>& src);
  
     template<class PixelType>
     Image<PixelType> ScaleUp(const Image<PixelType>& src);
+
+    // Upsamples to width x height of the finer level src was scaled down from,
+    // i.e. width is 2 * src.Width() or 2 * src.Width() - 1 and the same for height
+    template<class PixelType>
+    Image<PixelType> ScaleUp(const Image<PixelType>& src, int width, int height);
+
+    // Copy of 'base' whose masked pixels are upsampled from src, its coarser level, in one pass.
+    // Equal to MixImages(base, ScaleUp(src, base.Width(), base.Height()), mask) without the upsampled image.
+    template<class PixelType>
+    Image<PixelType> ScaleUpMasked(const Image<PixelType>& src, const Image<PixelType>& base, const Image<Alpha8>& mask);
+
+    // Bilinear resampling to any size, meant for small changes of size (no prefiltering)
+    template<class PixelType>
+    Image<PixelType> Resize(const Image<PixelType>& src, int width, int height);
+
+    namespace Internal
+    {
+        // Pixels [from, to) of row y of src upsampled twice, dst is the start of the row
+        template<class PixelType>
+        void ScaleUpRow(PixelType* dst, const ConstImageView<PixelType>& src, int y, int from, int to);
+
+        // The same with SIMD, results are equal
+        void ScaleUpRow(LabDouble* dst, const ConstImageView<LabDouble>& src, int y, int from, int to);
+    }
 }
 
 #include "Scaling.inl"
\ No newline at end of file
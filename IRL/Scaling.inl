@@ -1,4 +1,5 @@
 #include "Scaling.h"
+#include "PaddedImage.h"
 #include "Parallel.h"
 #include "Profiler.h"
 
@@ -6,169 +7,243 @@ namespace IRL
 {
     namespace Internal
     {
-        template<class PixelType>
-        class ScaleDownTask :
-            public Parallel::Runnable
+        class Kernel1D5Tap
         {
         public:
-            struct State
-            {
-                const Image<PixelType>* Src;
-                Image<PixelType>* Dst;
-            };
-            State S;
-            int StartPos;
-            int StopPos;
-        public:
-            void Set(int startPos, int stopPos, State s)
-            {
-                S = s;
-                StartPos = startPos;
-                StopPos = stopPos;
+            typedef int CoefficientType;
+
+            static const int HalfSize()     { return 2; }
+            static const int Sum()          { return 16; }
+            static const int Value(int i)
+            { 
+                static int LookUp[5] = { 1, 4, 6, 4, 1 }; 
+                return LookUp[i + HalfSize()];
             }
         };
 
+        // Filters rows [start, stop) of Dst from Src with the kernel in both directions and drops
+        // every other row and column. Source rows are filtered horizontally into a ring of kernel
+        // size rows, so each one is read once and the vertical filter combines contiguous rows.
+        // Only columns [left, right) of Dst are computed, right < 0 means all columns.
+        // Edges of Src are mirrored: rows by the choice of the row, columns by an apron of the filtered row.
         template<class Kernel, class PixelType>
-        class HScaleDownTask :
-            public ScaleDownTask<PixelType>
+        class ScaleDownStrip
         {
         public:
-            virtual void Run()
-            {
-                for (int y = StartPos; y < StopPos; y++)
-                    ProcessLine(y);
-            }
-
-            inline void ProcessLine(int y)
+            ScaleDownStrip(const ConstImageView<PixelType>& src, const ImageView<PixelType>& dst, int left = 0, int right = -1) : 
+                _src(src), _dst(dst), _left(left), _right(right < 0 ? dst.Width() : right),
+                _ring(dst.Width(), 2 * Kernel::HalfSize() + 1), 
+                _ringRows(2 * Kernel::HalfSize() + 1, -Kernel::HalfSize() - 1), // no row is above -HalfSize
+                _padded(src.Width(), 1, Kernel::HalfSize())
             {
-                const int EdgeSize = Kernel::HalfSize() / 2;
-                const int Width = S.Dst->Width();
-                int x = 0;
-                for (; x < EdgeSize; x++)
-                    S.Dst->Pixel(x, y) = ProcessLeftEdge(x, y);
-                for (; x < Width - EdgeSize; x++)
-                    S.Dst->Pixel(x, y) = ProcessMidlePart(x, y);
-                for (; x < Width; x++)
-                    S.Dst->Pixel(x, y) = ProcessRightEdge(x, y);
+                ASSERT(_left >= 0 && _left <= _right && _right <= dst.Width());
             }
 
-            inline const PixelType ProcessLeftEdge(int x, int y)
+            void Process(int start, int stop)
             {
-                Accumulator<PixelType, typename Kernel::CoefficientType> accum;
-                for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
+                const int taps = 2 * Kernel::HalfSize() + 1;
+                const int maxY = _src.Height() - 1;
+                std::vector<const PixelType*> rows(taps);
+                for (int y = start; y < stop; y++)
                 {
-                    const PixelType* src = &S.Src->Pixel(abs(2*x + m), 2*y);
-                    accum.Append(*src, Kernel::Value(m));
+                    for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
+                        rows[m + Kernel::HalfSize()] = FilteredRow(2 * y + m, maxY);
+
+                    PixelType* dst = _dst.Row(y);
+                    for (int x = _left; x < _right; x++)
+                    {
+                        Accumulator<PixelType, typename Kernel::CoefficientType> accum;
+                        for (int i = 0; i < taps; i++)
+                            accum.Append(rows[i][x], Kernel::Value(i - Kernel::HalfSize()));
+                        dst[x] = accum.GetSum(Kernel::Sum());
+                    }
                 }
-                return accum.GetSum(Kernel::Sum());
             }
 
-            inline const PixelType ProcessMidlePart(int x, int y)
+        private:
+            // Horizontally filtered source row 'sy' (before reflection), kept in slot sy mod taps
+            const PixelType* FilteredRow(int sy, int maxY)
             {
-                Accumulator<PixelType, typename Kernel::CoefficientType> accum;
-                for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
+                const int taps = (int)_ringRows.size();
+                const int slot = ((sy % taps) + taps) % taps;
+                PixelType* row = _ring.View().Row(slot);
+                if (_ringRows[slot] != sy)
                 {
-                    const PixelType* src = &S.Src->Pixel(2*x + m, 2*y);
-                    accum.Append(*src, Kernel::Value(m));
+                    FilterRow(_src.Row(BorderIndex(sy, maxY, BorderMirror)), row);
+                    _ringRows[slot] = sy;
                 }
-                return accum.GetSum(Kernel::Sum());
+                return row;
             }
 
-            inline const PixelType ProcessRightEdge(int x, int y)
+            void FilterRow(const PixelType* src, PixelType* dst)
             {
-                Accumulator<PixelType, typename Kernel::CoefficientType> accum;
-                const int maxX = S.Src->Width() - 1;
-                for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
+                // source columns of [left, right) go to the padded row, so every column has all taps
+                const int from = Maximum(0, 2 * _left - Kernel::HalfSize());
+                const int to = Maximum(from, Minimum(_src.Width(), 2 * _right + Kernel::HalfSize() - 1));
+                PixelType* padded = _padded.Row(0);
+                memcpy(padded + from, src + from, sizeof(PixelType) * (to - from));
+                _padded.FillRowBorders(0, BorderMirror);
+                for (int x = _left; x < _right; x++)
                 {
-                    const PixelType* src = &S.Src->Pixel(maxX - abs(maxX - (2*x + m)), 2 * y);
-                    accum.Append(*src, Kernel::Value(m));
+                    Accumulator<PixelType, typename Kernel::CoefficientType> accum;
+                    for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
+                        accum.Append(padded[2*x + m], Kernel::Value(m));
+                    dst[x] = accum.GetSum(Kernel::Sum());
                 }
-                return accum.GetSum(Kernel::Sum());
             }
+
+        private:
+            ConstImageView<PixelType> _src;
+            ImageView<PixelType> _dst;
+            int _left;
+            int _right;
+            Image<PixelType> _ring;
+            std::vector<int> _ringRows;   // source row held by every slot of the ring
+            PaddedImage<PixelType> _padded; // source row being filtered
         };
 
-        template<class Kernel, class PixelType>
-        class VScaleDownTask :
-            public ScaleDownTask<PixelType>
+        template<class PixelType>
+        class ScaleDownTask :
+            public Parallel::Runnable
         {
         public:
+            struct State
+            {
+                State() : Left(0), Right(-1) {}
+
+                ConstImageView<PixelType> Src;
+                ImageView<PixelType> Dst;
+                int Left;   // columns of Dst to compute, see ScaleDownStrip
+                int Right;
+            };
+            State S;
+            int StartPos;
+            int StopPos;
+        public:
+            void Set(int startPos, int stopPos, State s)
+            {
+                S = s;
+                StartPos = startPos;
+                StopPos = stopPos;
+            }
+
             virtual void Run()
             {
-                for (int x = StartPos; x < StopPos; x++)
-                    ProcessLine(x);
+                ScaleDownStrip<Kernel1D5Tap, PixelType>(S.Src, S.Dst, S.Left, S.Right).Process(StartPos, StopPos);
             }
+        };
 
-            inline void ProcessLine(int x)
+        template<class PixelType>
+        class ScaleUpTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
+            {
+                ConstImageView<PixelType> Src;
+                ImageView<PixelType> Dst;
+            };
+            State S;
+            int StartPos;
+            int StopPos;
+        public:
+            void Set(int startPos, int stopPos, State s)
             {
-                const int EdgeSize = Kernel::HalfSize() / 2;
-                const int Height = S.Dst->Height();
-                int y = 0;
-                for (; y < EdgeSize; y++)
-                    S.Dst->Pixel(x, y) = ProcessUpEdge(x, y);
-                for (; y < Height - EdgeSize; y++)
-                    S.Dst->Pixel(x, y) = ProcessMidlePart(x, y);
-                for (; y < Height; y++)
-                    S.Dst->Pixel(x, y) = ProcessDownEdge(x, y);
+                S = s;
+                StartPos = startPos;
+                StopPos = stopPos;
             }
 
-            inline const PixelType ProcessUpEdge(int x, int y)
+            virtual void Run()
             {
-                Accumulator<PixelType, typename Kernel::CoefficientType> accum;
-                for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
-                {
-                    const PixelType* src = &S.Src->Pixel(2*x, abs(2*y + m));
-                    accum.Append(*src, Kernel::Value(m));
-                }
-                return accum.GetSum(Kernel::Sum());
+                for (int y = StartPos; y < StopPos; y++)
+                    ScaleUpRow(S.Dst.Row(y), S.Src, y, 0, S.Dst.Width());
             }
+        };
 
-            inline const PixelType ProcessMidlePart(int x, int y)
+        // Copies rows of Base and upsamples runs of masked pixels over them
+        template<class PixelType>
+        class ScaleUpMaskedTask :
+            public Parallel::Runnable
+        {
+        public:
+            struct State
             {
-                Accumulator<PixelType, typename Kernel::CoefficientType> accum;
-                for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
-                {
-                    const PixelType* src = &S.Src->Pixel(2*x, 2*y + m);
-                    accum.Append(*src, Kernel::Value(m));
-                }
-                return accum.GetSum(Kernel::Sum());
+                ConstImageView<PixelType> Src;
+                ConstImageView<PixelType> Base;
+                ConstImageView<Alpha8> Mask;
+                ImageView<PixelType> Dst;
+            };
+            State S;
+            int StartPos;
+            int StopPos;
+        public:
+            void Set(int startPos, int stopPos, State s)
+            {
+                S = s;
+                StartPos = startPos;
+                StopPos = stopPos;
             }
 
-            inline const PixelType ProcessDownEdge(int x, int y)
+            virtual void Run()
             {
-                Accumulator<PixelType, typename Kernel::CoefficientType> accum;
-                const int maxY = S.Src->Height() - 1;
-                for (int m = -Kernel::HalfSize(); m <= Kernel::HalfSize(); m++)
+                const int width = S.Dst.Width();
+                for (int y = StartPos; y < StopPos; y++)
                 {
-                    const PixelType* src = &S.Src->Pixel(2*x, maxY - abs(maxY - (2*y + m)));
-                    accum.Append(*src, Kernel::Value(m));
+                    PixelType* dst = S.Dst.Row(y);
+                    const Alpha8* mask = S.Mask.Row(y);
+                    memcpy(dst, S.Base.Row(y), sizeof(PixelType) * width);
+                    for (int x = 0; x < width; )
+                    {
+                        if (!mask[x].IsMasked())
+                        {
+                            x++;
+                            continue;
+                        }
+                        const int start = x;
+                        while (x < width && mask[x].IsMasked())
+                            x++;
+                        ScaleUpRow(dst, S.Src, y, start, x);
+                    }
                 }
-                return accum.GetSum(Kernel::Sum());
             }
         };
 
-        class Kernel1D5Tap
+        template<class PixelType>
+        void ScaleUpRow(PixelType* dst, const ConstImageView<PixelType>& src, int y, int from, int to)
         {
-        public:
-            typedef int CoefficientType;
-
-            static const int HalfSize()     { return 2; }
-            static const int Sum()          { return 16; }
-            static const int Value(int i)
-            { 
-                static int LookUp[5] = { 1, 4, 6, 4, 1 }; 
-                return LookUp[i + HalfSize()];
+            int sy1 = y / 2;
+            int sy2 = Minimum<int>(sy1 + 1, src.Height() - 1);
+            int beta  = y - 2 * sy1;
+            const PixelType* src1 = src.Row(sy1);
+            const PixelType* src2 = src.Row(sy2);
+            for (int x = from; x < to; x++)
+            {
+                int sx1 = x / 2;
+                int sx2 = Minimum<int>(sx1 + 1, src.Width() - 1);
+                int alpha = x - 2 * sx1;
+                Accumulator<PixelType, int> accum;
+                accum.Append(src1[sx1], (2 - alpha) * (2 - beta));
+                accum.Append(src1[sx2], (    alpha) * (2 - beta));
+                accum.Append(src2[sx2], (    alpha) * (    beta));
+                accum.Append(src2[sx1], (2 - alpha) * (    beta));
+                dst[x] = accum.GetSum(4);
             }
-        };
+        }
 
         template<class PixelType>
-        class ScaleUpTask :
+        class ResizeTask :
             public Parallel::Runnable
         {
         public:
+            // weights are in 1/256 of pixel
+            static const int Scale = 256;
+
             struct State
             {
-                const Image<PixelType>* Src;
-                Image<PixelType>* Dst;
+                ConstImageView<PixelType> Src;
+                ImageView<PixelType> Dst;
+                const int* Columns;   // left source column of every destination column, Scale times
             };
             State S;
             int StartPos;
@@ -189,22 +264,34 @@ namespace IRL
 
             inline void ProcessLine(int y)
             {
-                int sy1 = y / 2;
-                int sy2 = Minimum<int>(sy1 + 1, S.Src->Height() - 1);
-                int beta  = y - 2 * sy1;
-                for (int x = 0; x < S.Dst->Width(); x++)
+                int sy = SourcePosition(y, S.Dst.Height(), S.Src.Height());
+                int sy1 = sy / Scale;
+                int sy2 = Minimum<int>(sy1 + 1, S.Src.Height() - 1);
+                int beta = sy - sy1 * Scale;
+                const PixelType* src1 = S.Src.Row(sy1);
+                const PixelType* src2 = S.Src.Row(sy2);
+                PixelType* dst = S.Dst.Row(y);
+                for (int x = 0; x < S.Dst.Width(); x++)
                 {
-                    int sx1 = x / 2;
-                    int sx2 = Minimum<int>(sx1 + 1, S.Src->Width() - 1);
-                    int alpha = x - 2 * sx1;
+                    int sx = S.Columns[x];
+                    int sx1 = sx / Scale;
+                    int sx2 = Minimum<int>(sx1 + 1, S.Src.Width() - 1);
+                    int alpha = sx - sx1 * Scale;
                     Accumulator<PixelType, int> accum;
-                    accum.Append(S.Src->Pixel(sx1, sy1), (2 - alpha) * (2 - beta));
-                    accum.Append(S.Src->Pixel(sx2, sy1), (    alpha) * (2 - beta));
-                    accum.Append(S.Src->Pixel(sx2, sy2), (    alpha) * (    beta));
-                    accum.Append(S.Src->Pixel(sx1, sy2), (2 - alpha) * (    beta));
-                    S.Dst->Pixel(x, y) = accum.GetSum(4);
+                    accum.Append(src1[sx1], (Scale - alpha) * (Scale - beta));
+                    accum.Append(src1[sx2], (        alpha) * (Scale - beta));
+                    accum.Append(src2[sx2], (        alpha) * (        beta));
+                    accum.Append(src2[sx1], (Scale - alpha) * (        beta));
+                    dst[x] = accum.GetSum(Scale * Scale);
                 }
             }
+
+            // Source coordinate of the center of destination pixel 'i', Scale times
+            static inline int SourcePosition(int i, int dstSize, int srcSize)
+            {
+                int64_t p = ((2 * (int64_t)i + 1) * srcSize * Scale) / (2 * dstSize) - Scale / 2;
+                return (int)Maximum<int64_t>(0, Minimum<int64_t>(p, (int64_t)(srcSize - 1) * Scale));
+            }
         };
     }
 
@@ -213,52 +300,98 @@ namespace IRL
     {
         using namespace Internal;
 
-        typedef Kernel1D5Tap Kernel;
-
         Tools::Profiler profiler("ScaleDown");
         int w = src.Width();
         int h = src.Height();
 
-        Image<PixelType> res(w / 2, h / 2);
+        Image<PixelType> res(ScaledDownSize(w), ScaledDownSize(h));
         typename ScaleDownTask<PixelType>::State state;
-        state.Src = &src;
-        state.Dst = &res;
-
-        // horizontal filter
-        Parallel::ParallelFor<
-            HScaleDownTask<Kernel, PixelType>,
-            typename ScaleDownTask<PixelType>::State
-        > htasks(0, res.Height(), state);
-        htasks.SpawnAndSync();
+        state.Src = src.ConstView();
+        state.Dst = res.View();
 
-        // vertical filter
+        // every destination row reads two source rows
         Parallel::ParallelFor<
-            VScaleDownTask<Kernel, PixelType>,
+            ScaleDownTask<PixelType>,
             typename ScaleDownTask<PixelType>::State
-        > vtasks(0, res.Width(), state);
-        vtasks.SpawnAndSync();
+        > tasks(0, res.Height(), state, 2 * w);
+        tasks.SpawnAndSync();
 
         return res;
     }
 
     template<class PixelType>
     Image<PixelType> ScaleUp(const Image<PixelType>& src)
+    {
+        return ScaleUp(src, src.Width() * 2, src.Height() * 2);
+    }
+
+    template<class PixelType>
+    Image<PixelType> ScaleUp(const Image<PixelType>& src, int width, int height)
     {
         using namespace Internal;
 
         Tools::Profiler profiler("ScaleUp");
-        int w = src.Width();
-        int h = src.Height();
+        ASSERT(width <= src.Width() * 2 && height <= src.Height() * 2);
 
-        Image<PixelType> res(w * 2, h * 2);
+        Image<PixelType> res(width, height);
         typename ScaleUpTask<PixelType>::State state;
-        state.Src = &src;
-        state.Dst = &res;
+        state.Src = src.ConstView();
+        state.Dst = res.View();
 
         Parallel::ParallelFor<
             ScaleUpTask<PixelType>,
             typename ScaleUpTask<PixelType>::State
-        > tasks(0, res.Height(), state);
+        > tasks(0, res.Height(), state, res.Width());
+        tasks.SpawnAndSync();
+
+        return res;
+    }
+
+    template<class PixelType>
+    Image<PixelType> ScaleUpMasked(const Image<PixelType>& src, const Image<PixelType>& base, const Image<Alpha8>& mask)
+    {
+        using namespace Internal;
+
+        Tools::Profiler profiler("ScaleUpMasked");
+        ASSERT(base.Width() <= src.Width() * 2 && base.Height() <= src.Height() * 2);
+        ASSERT(mask.Width() == base.Width() && mask.Height() == base.Height());
+
+        Image<PixelType> res(base.Width(), base.Height());
+        typename ScaleUpMaskedTask<PixelType>::State state;
+        state.Src = src.ConstView();
+        state.Base = base.ConstView();
+        state.Mask = mask.ConstView();
+        state.Dst = res.View();
+
+        Parallel::ParallelFor<
+            ScaleUpMaskedTask<PixelType>,
+            typename ScaleUpMaskedTask<PixelType>::State
+        > tasks(0, res.Height(), state, res.Width());
+        tasks.SpawnAndSync();
+
+        return res;
+    }
+
+    template<class PixelType>
+    Image<PixelType> Resize(const Image<PixelType>& src, int width, int height)
+    {
+        using namespace Internal;
+
+        Tools::Profiler profiler("Resize");
+
+        Image<PixelType> res(width, height);
+        std::vector<int> columns(width);
+        for (int x = 0; x < width; x++)
+            columns[x] = ResizeTask<PixelType>::SourcePosition(x, width, src.Width());
+        typename ResizeTask<PixelType>::State state;
+        state.Src = src.ConstView();
+        state.Dst = res.View();
+        state.Columns = &columns[0];
+
+        Parallel::ParallelFor<
+            ResizeTask<PixelType>,
+            typename ResizeTask<PixelType>::State
+        > tasks(0, res.Height(), state, res.Width());
         tasks.SpawnAndSync();
 
         return res;
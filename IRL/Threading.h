@@ -5,7 +5,7 @@
 #ifdef IRL_USE_QT
 #include "ThreadingQt.h"
 #else
-#error Implement threading.
+#include "ThreadingStd.h"
 #endif
 
 namespace IRL
@@ -6,12 +6,14 @@
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QThreadStorage>
+#include <QtCore/QAtomicInt>
 
 namespace IRL
 {
     class Thread;
     class Mutex;
     class WaitCondition;
+    class AtomicInt;
 
     class Thread : 
         private QThread
@@ -26,6 +28,16 @@ namespace IRL
         {
             wait();
         }
+        static void YieldCurrentThread()
+        {
+            yieldCurrentThread();
+        }
+        // Return hardware threads of the machine, at least 1
+        static unsigned int HardwareThreads()
+        {
+            const int count = idealThreadCount();
+            return count > 0 ? (unsigned int)count : 1;
+        }
     private:
         virtual void run()
         {
@@ -66,6 +78,33 @@ namespace IRL
         }
     };
 
+    // All modifications are full memory barriers, Load() is a plain read.
+    class AtomicInt :
+        private QAtomicInt
+    {
+    public:
+        AtomicInt(int value = 0) : QAtomicInt(value) {}
+
+        int Load() const
+        {
+            return *this;
+        }
+        void Store(int value)
+        {
+            fetchAndStoreOrdered(value);
+        }
+        // Returns previous value
+        int FetchAndAdd(int value)
+        {
+            return fetchAndAddOrdered(value);
+        }
+        // Sets to 'value' if equals to 'expected', returns true on success
+        bool CompareAndSwap(int expected, int value)
+        {
+            return testAndSetOrdered(expected, value);
+        }
+    };
+
     template<class T>
     class ThreadLocal :
         private QThreadStorage<T*>
@@ -82,7 +121,12 @@ namespace IRL
 
         void Set(T t)
         {
-            setLocalData(new T(t));
+            // QThreadStorage deletes the previous value, so reuse it instead
+            T* current = localData();
+            if (current)
+                *current = t;
+            else
+                setLocalData(new T(t));
         }
 
         bool IsSet() const
@@ -0,0 +1,178 @@
+#pragma once
+
+// Custom threading classes on the C++11 standard library, for builds without Qt.
+// Uncontended locks are one atomic operation and contended ones wait on futexes (pthreads on Linux).
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+namespace IRL
+{
+    class Thread;
+    class Mutex;
+    class WaitCondition;
+    class AtomicInt;
+
+    class Thread
+    {
+    public:
+        virtual ~Thread() {}
+        virtual void Run() = 0;
+        void Start()
+        {
+            _thread = std::thread(&Thread::Entry, this);
+        }
+        void Join()
+        {
+            if (_thread.joinable())
+                _thread.join();
+        }
+        static void YieldCurrentThread()
+        {
+            std::this_thread::yield();
+        }
+        // Return hardware threads of the machine, at least 1
+        static unsigned int HardwareThreads()
+        {
+            const unsigned int count = std::thread::hardware_concurrency();
+            return count > 0 ? count : 1;
+        }
+    private:
+        static void Entry(Thread* thread)
+        {
+            thread->Run();
+        }
+
+        std::thread _thread;
+    };
+
+    class Mutex
+    {
+        friend class WaitCondition;
+    public:
+        void Lock()
+        {
+            _mutex.lock();
+        }
+        void Unlock()
+        {
+            _mutex.unlock();
+        }
+    private:
+        std::mutex _mutex;
+    };
+
+    class WaitCondition
+    {
+    public:
+        void Wait(Mutex& lock)
+        {
+            // the caller holds the lock and keeps holding it after the wait
+            std::unique_lock<std::mutex> locked(lock._mutex, std::adopt_lock);
+            _condition.wait(locked);
+            locked.release();
+        }
+        void WakeOne()
+        {
+            _condition.notify_one();
+        }
+        void WakeAll()
+        {
+            _condition.notify_all();
+        }
+    private:
+        std::condition_variable _condition;
+    };
+
+    // All modifications are full memory barriers, Load() is a plain read.
+    class AtomicInt
+    {
+    public:
+        AtomicInt(int value = 0) : _value(value) {}
+        AtomicInt(const AtomicInt& obj) : _value(obj.Load()) {}
+        AtomicInt& operator=(const AtomicInt& obj)
+        {
+            Store(obj.Load());
+            return *this;
+        }
+
+        int Load() const
+        {
+            return _value.load(std::memory_order_acquire);
+        }
+        void Store(int value)
+        {
+            _value.store(value, std::memory_order_seq_cst);
+        }
+        // Returns previous value
+        int FetchAndAdd(int value)
+        {
+            return _value.fetch_add(value, std::memory_order_seq_cst);
+        }
+        // Sets to 'value' if equals to 'expected', returns true on success
+        bool CompareAndSwap(int expected, int value)
+        {
+            return _value.compare_exchange_strong(expected, value, std::memory_order_seq_cst);
+        }
+    private:
+        std::atomic<int> _value;
+    };
+
+    // Value of every thread for every instance. Instances take slots of a thread local array,
+    // so values of a destroyed instance are never seen by a new one.
+    template<class T>
+    class ThreadLocal
+    {
+    public:
+        ThreadLocal() : _slot(NextSlot()) {}
+
+        T Get() const
+        {
+            const std::vector<Value>& values = Values();
+            if (_slot < values.size() && values[_slot].IsSet)
+                return values[_slot].Data;
+            else
+                return T();
+        }
+
+        void Set(T t)
+        {
+            std::vector<Value>& values = Values();
+            if (_slot >= values.size())
+                values.resize(_slot + 1);
+            values[_slot].Data = t;
+            values[_slot].IsSet = true;
+        }
+
+        bool IsSet() const
+        {
+            const std::vector<Value>& values = Values();
+            return _slot < values.size() && values[_slot].IsSet;
+        }
+
+    private:
+        struct Value
+        {
+            Value() : Data(), IsSet(false) {}
+            T Data;
+            bool IsSet;
+        };
+
+        static std::vector<Value>& Values()
+        {
+            static thread_local std::vector<Value> values;
+            return values;
+        }
+
+        static size_t NextSlot()
+        {
+            static std::atomic<size_t> slots(0);
+            return slots.fetch_add(1);
+        }
+
+        size_t _slot;
+    };
+}
\ No newline at end of file
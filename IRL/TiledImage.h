@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Image.h"
+
+namespace IRL
+{
+    // Copy of an image in tiles of TileWidth columns and full height, every tile stored by itself with
+    // Overlap() columns of the next tile repeated on its right. Any Overlap() + 1 pixels of a row which start
+    // in a tile are contiguous, so a patch of Overlap() + 1 columns is one block of its rows Pitch() pixels
+    // apart: patch reads stay within a few kilobytes instead of touching as many pages as it has rows.
+    // Meant as a read only copy of one operation, so it is neither shared nor copied.
+    template<class PixelType>
+    class TiledImage
+    {
+    public:
+        enum { TileShift = 4, TileWidth = 1 << TileShift };
+
+        TiledImage() : _buffer(NULL), _bytes(0), _width(0), _height(0), _overlap(0), _pitch(0), _tileSize(0) {}
+        ~TiledImage() { Memory::Free(_buffer); }
+
+        // Copies 'src', keeps the buffer when it is large enough
+        void Assign(const ConstImageView<PixelType>& src, int32_t overlap)
+        {
+            ASSERT(overlap >= 0);
+            _width = src.Width();
+            _height = src.Height();
+            _overlap = overlap;
+            _pitch = TileWidth + overlap;
+            _tileSize = (size_t)_pitch * _height;
+            const int32_t tiles = (_width + TileWidth - 1) / TileWidth;
+            const size_t bytes = sizeof(PixelType) * _tileSize * tiles;
+            if (!_buffer || bytes > _bytes)
+            {
+                Memory::Free(_buffer);
+                _buffer = (PixelType*)Memory::Allocate(Maximum(bytes, sizeof(PixelType)));
+                _bytes = bytes;
+            }
+            for (int32_t y = 0; y < _height; y++)
+                AssignRow(src, y);
+        }
+
+        // Copies row y of 'src' of the size of the last Assign, i.e. after the row changed
+        void AssignRow(const ConstImageView<PixelType>& src, int32_t y)
+        {
+            ASSERT(src.Width() == _width && src.Height() == _height);
+            const PixelType* row = src.Row(y);
+            for (int32_t x = 0; x < _width; x += TileWidth)
+                memcpy(MutablePixel(x, y), row + x, sizeof(PixelType) * Minimum(_pitch, _width - x));
+        }
+
+        void Clear()
+        {
+            Memory::Free(_buffer);
+            _buffer = NULL;
+            _bytes = 0;
+            _width = _height = _overlap = _pitch = 0;
+            _tileSize = 0;
+        }
+
+        inline bool IsValid() const { return _buffer != NULL; }
+        inline int32_t Width() const { return _width; }
+        inline int32_t Height() const { return _height; }
+        inline int32_t Overlap() const { return _overlap; }
+        // Pixels between a pixel and the one below it
+        inline int32_t Pitch() const { return _pitch; }
+        inline size_t GetBytes() const { return _bytes; }
+
+        // Pixels x to x + Overlap() of row y follow the returned one, as far as the image reaches
+        force_inline const PixelType* Pixel(int32_t x, int32_t y) const
+        {
+            ASSERT(x >= 0 && x < _width && y >= 0 && y < _height);
+            return _buffer + (x >> TileShift) * _tileSize + y * _pitch + (x & (TileWidth - 1));
+        }
+
+    private:
+        force_inline PixelType* MutablePixel(int32_t x, int32_t y)
+        {
+            return const_cast<PixelType*>(Pixel(x, y));
+        }
+
+        // disable copy methods
+        TiledImage(const TiledImage&);
+        TiledImage& operator=(const TiledImage&);
+
+        PixelType* _buffer;
+        size_t _bytes;
+        int32_t _width;
+        int32_t _height;
+        int32_t _overlap;
+        int32_t _pitch;
+        size_t _tileSize;   // pixels of one tile
+    };
+}
\ No newline at end of file
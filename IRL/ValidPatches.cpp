@@ -0,0 +1,69 @@
+#include "Includes.h"
+#include "ValidPatches.h"
+#include "Profiler.h"
+
+namespace IRL
+{
+    ValidPatches::ValidPatches()
+        : _width(0), _height(0)
+    {
+    }
+
+    void ValidPatches::Compute(const Image<Alpha8>& mask, int patchSize)
+    {
+        Tools::Profiler profiler("ComputeValidPatches");
+        ASSERT(patchSize * patchSize <= 255);
+        const int width = mask.Width();
+        const int height = mask.Height();
+        const int half = patchSize / 2;
+        _width = width;
+        _height = height;
+        _masked.assign((size_t)width * height, (uint8_t)(patchSize * patchSize));
+        _centers.clear();
+        if (width <= 2 * half || height <= 2 * half)
+            return;
+
+        // masked pixels of every column of the window, moved down a row at a time
+        const ConstImageView<Alpha8> view = mask.ConstView();
+        std::vector<int> columns(width, 0);
+        for (int y = 0; y < patchSize - 1; y++)
+        {
+            for (int x = 0; x < width; x++)
+                columns[x] += view(x, y).IsMasked() ? 1 : 0;
+        }
+        for (int y = half; y < height - half; y++)
+        {
+            const Alpha8* bottom = view.Row(y + half);
+            for (int x = 0; x < width; x++)
+                columns[x] += bottom[x].IsMasked() ? 1 : 0;
+
+            uint8_t* row = &_masked[(size_t)y * width];
+            int masked = 0;
+            for (int x = 0; x < patchSize - 1; x++)
+                masked += columns[x];
+            for (int x = half; x < width - half; x++)
+            {
+                masked += columns[x + half];
+                row[x] = (uint8_t)masked;
+                if (masked == 0)
+                    _centers.push_back(Point16((int16_t)x, (int16_t)y));
+                masked -= columns[x - half];
+            }
+
+            const Alpha8* top = view.Row(y - half);
+            for (int x = 0; x < width; x++)
+                columns[x] -= top[x].IsMasked() ? 1 : 0;
+        }
+    }
+
+    void ValidPatches::Clear()
+    {
+        std::vector<uint8_t>().swap(_masked);
+        std::vector<Point16>().swap(_centers);
+    }
+
+    size_t ValidPatches::GetBytes() const
+    {
+        return _masked.capacity() * sizeof(uint8_t) + _centers.capacity() * sizeof(Point16);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Config.h"
+#include "Image.h"
+#include "Point2D.h"
+#include "Alpha.h"
+
+#include <vector>
+
+namespace IRL
+{
+    // Patches of a source with a mask: how many masked pixels every patch covers and centers of the
+    // valid ones, i.e. of patches which cover no masked pixels. Computed once per mask, so candidates
+    // are rejected by one lookup instead of checking the mask pixel by pixel, and valid patches are
+    // drawn from the list of centers instead of sampling the mask until it is not masked.
+    class ValidPatches
+    {
+    public:
+        ValidPatches();
+
+        // Counts masked pixels of patches of 'patchSize' centered at least patchSize / 2 from the borders,
+        // patches closer to the borders are never valid
+        void Compute(const Image<Alpha8>& mask, int patchSize = PatchSize);
+        // Releases counts and centers
+        void Clear();
+        bool IsEmpty() const { return _masked.empty(); }
+
+        int Width() const { return _width; }
+        int Height() const { return _height; }
+
+        // Return masked pixels covered by the patch centered in (x, y)
+        int GetMasked(int x, int y) const
+        {
+            return _masked[(size_t)y * _width + x];
+        }
+        bool IsValid(int x, int y) const { return GetMasked(x, y) == 0; }
+        // Return address of the count of the patch centered in (x, y), to prefetch it
+        const uint8_t* GetMaskedAddress(int x, int y) const
+        {
+            return &_masked[(size_t)y * _width + x];
+        }
+
+        // Return number of valid patches and center of the valid patch 'index', in scan order
+        int GetCount() const { return (int)_centers.size(); }
+        const Point16& GetCenter(int index) const { return _centers[index]; }
+
+        // Return bytes held by counts and centers
+        size_t GetBytes() const;
+
+    private:
+        int _width;
+        int _height;
+        std::vector<uint8_t> _masked;    // per pixel without stride, MaxPatchSize^2 fits
+        std::vector<Point16> _centers;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ObjectRemoval.h"
+
+namespace IRL
+{
+    // Removes an object from the frames of a video one after another. The first frame, and frames of another
+    // size, are solved from coarse to fine as by RemoveObject. Later frames solve only the
+    // Parameters.VideoWarmLevels finest levels. The coarsest of them starts from the previous frame's result
+    // and offset fields of that level, moved with the scene. Finer levels keep the previous offsets away
+    // from the hole. So the hole is filled alike from frame to frame, at a fraction of the cost.
+    // Frames are solved in pixels of PixelType, Parameters.FixedPoint and Parameters.TileSize have no effect.
+    // Decoding and encoding of other frames may overlap with RemoveObject, see Batch.
+    template<class PixelType>
+    class VideoRemoval
+    {
+    public:
+        explicit VideoRemoval(const ObjectRemovalParameters& parameters = ObjectRemovalParameters());
+
+        // Returns the frame with the object removed, invalid image when cancelled through the callback.
+        // (motionX, motionY) is how far the scene moved since the previous frame in pixels, i.e. by a pan
+        // of the camera, the previous result and offsets are moved by it.
+        Image<PixelType> RemoveObject(const ImageWithMask<PixelType>& frame, OperationCallback<PixelType>* callback = NULL,
+            int motionX = 0, int motionY = 0);
+
+        // The next frame is solved from scratch, i.e. after a cut
+        void Reset();
+
+        ObjectRemovalParameters Parameters;
+
+    private:
+        Internal::LevelState<PixelType> _kept;  // coarsest warm level of the previous frame
+        int _keptLevel;                         // -1 when there is no previous frame
+        RemovalFields _fields;
+        int _width;
+        int _height;
+    };
+}
+
+#include "VideoRemoval.inl"
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "VideoRemoval.h"
+#include "Profiler.h"
+
+namespace IRL
+{
+    namespace Internal
+    {
+        // Moves the image by (dx, dy), pixels which come from outside repeat the nearest border
+        template<class PixelType>
+        Image<PixelType> TranslateImage(const Image<PixelType>& image, int dx, int dy)
+        {
+            if (dx == 0 && dy == 0)
+                return image;
+            Image<PixelType> result(image.Width(), image.Height());
+            const ConstImageView<PixelType> src = image.ConstView();
+            const ImageView<PixelType> dst = result.View();
+            for (int32_t y = 0; y < dst.Height(); y++)
+            {
+                const PixelType* s = src.Row(Minimum(Maximum(y - dy, 0), src.Height() - 1));
+                PixelType* d = dst.Row(y);
+                for (int32_t x = 0; x < dst.Width(); x++)
+                    d[x] = s[Minimum(Maximum(x - dx, 0), src.Width() - 1)];
+            }
+            return result;
+        }
+
+        // Motion of the frame in pixels of its level
+        inline int ScaleMotion(int motion, int levelSize, int frameSize)
+        {
+            return (int)floor((double)motion * levelSize / frameSize + 0.5);
+        }
+    }
+
+    template<class PixelType>
+    VideoRemoval<PixelType>::VideoRemoval(const ObjectRemovalParameters& parameters)
+        : Parameters(parameters), _keptLevel(-1), _width(0), _height(0)
+    {
+    }
+
+    template<class PixelType>
+    void VideoRemoval<PixelType>::Reset()
+    {
+        _kept = Internal::LevelState<PixelType>();
+        _keptLevel = -1;
+        _fields.Clear();
+    }
+
+    template<class PixelType>
+    Image<PixelType> VideoRemoval<PixelType>::RemoveObject(const ImageWithMask<PixelType>& frame,
+        OperationCallback<PixelType>* callback, int motionX, int motionY)
+    {
+        Tools::Profiler profiler("VideoRemoval::RemoveObject");
+        const int64_t start = Tools::GetTime();
+        const int width = frame.Image.Width();
+        const int height = frame.Image.Height();
+        const int levels = Internal::GetPyramidLevels(width, height, Parameters);
+        const int warmLevels = Minimum(Parameters.VideoWarmLevels, levels);
+        const bool warm = warmLevels > 0 && _keptLevel == warmLevels - 1 && width == _width && height == _height &&
+            _kept.Target.IsValid();
+
+        // warm frames need no coarser levels
+        GaussianPyramid<PixelType> source;
+        GaussianPyramid<Alpha8> mask;
+        BuildGaussianPyramids(source, mask, frame, warm ? warmLevels : levels);
+
+        Internal::LevelState<PixelType> level;
+        if (warm)
+        {
+            const int top = warmLevels - 1;
+            const Image<PixelType>& levelSource = source.Levels[top];
+            const int w = levelSource.Width();
+            const int h = levelSource.Height();
+            const int dx = Internal::ScaleMotion(motionX, w, width);
+            const int dy = Internal::ScaleMotion(motionY, h, height);
+
+            // known pixels come from the frame, the hole from the previous result
+            level.Target = MixImages(levelSource, Internal::TranslateImage(_kept.Target, dx, dy), mask.Levels[top]);
+            level.SourceToTarget = dx || dy ? TranslateField(_kept.SourceToTarget, dx, dy, w, h) : _kept.SourceToTarget;
+            level.TargetToSource = dx || dy ? TranslateField(_kept.TargetToSource, dx, dy, w, h) : _kept.TargetToSource;
+            if (motionX || motionY)
+            {
+                for (int i = 0; i < top && i < (int)_fields.SourceToTarget.size(); i++)
+                {
+                    const int lw = source.Levels[i].Width();
+                    const int lh = source.Levels[i].Height();
+                    if (!_fields.SourceToTarget[i].IsValid() || !_fields.TargetToSource[i].IsValid())
+                        continue;
+                    const int ldx = Internal::ScaleMotion(motionX, lw, width);
+                    const int ldy = Internal::ScaleMotion(motionY, lh, height);
+                    _fields.SourceToTarget[i] = TranslateField(_fields.SourceToTarget[i], ldx, ldy, lw, lh);
+                    _fields.TargetToSource[i] = TranslateField(_fields.TargetToSource[i], ldx, ldy, lw, lh);
+                }
+            }
+        }
+        _kept = Internal::LevelState<PixelType>();
+
+        const Image<PixelType> result = Internal::RemoveLevels(source, mask, callback, Internal::SpendTime(Parameters, start),
+            &_fields, warm ? &level : NULL, &_kept, warmLevels - 1);
+        if (!result.IsValid() || warmLevels == 0)
+        {
+            Reset();
+            return result;
+        }
+        _keptLevel = warmLevels - 1;
+        _width = width;
+        _height = height;
+        return result;
+    }
+}
\ No newline at end of file
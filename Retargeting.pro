@@ -3,6 +3,22 @@ debug {
   CONFIG += debug
 }
 
+# build with CONFIG+=opencl to enable OpenCL backend of patch match
+opencl {
+  DEFINES += IRL_USE_OPENCL
+  LIBS += -lOpenCL
+}
+
+# build with CONFIG+=counters to collect patch match work counters, see IRL/NNFCounters.h
+counters {
+  DEFINES += IRL_NNF_COUNTERS
+}
+
+# build with CONFIG+=lean to keep patch match distances of double pixels in single precision
+lean {
+  DEFINES += IRL_COMPACT_DISTANCES
+}
+
 SOURCES += UI/main.cpp
 PRECOMPILED_HEADER = UI/Includes.h
 RESOURCES = UI/resources.qrc
@@ -11,7 +27,7 @@ HEADERS += IRL/pstdint.h IRL/Config.h IRL/RefCounted.h
 HEADERS += IRL/Convert.h IRL/Accumulator.h IRL/TypeTraits.h IRL/Random.h IRL/Rectangle.h
 
 HEADERS += IRL/IO.h IRL/IO.inl
-SOURCES += IRL/IO.cpp
+SOURCES += IRL/IO.cpp IRL/IOQt.cpp
 
 HEADERS += IRL/Parameters.h
 SOURCES += IRL/Parameters.cpp
@@ -19,9 +35,18 @@ SOURCES += IRL/Parameters.cpp
 HEADERS += IRL/Profiler.h
 SOURCES += IRL/Profiler.cpp
 
-HEADERS += IRL/Threading.h IRL/ThreadingQt.h IRL/Parallel.h IRL/Queue.h IRL/Parallel.inl
+HEADERS += IRL/DebugWriter.h
+SOURCES += IRL/DebugWriter.cpp
+
+HEADERS += IRL/Memory.h
+SOURCES += IRL/Memory.cpp
+
+HEADERS += IRL/Threading.h IRL/ThreadingQt.h IRL/Parallel.h IRL/Queue.h IRL/LockFreeQueue.h IRL/Parallel.inl
 SOURCES += IRL/Parallel.cpp
 
+HEADERS += IRL/JobQueue.h
+SOURCES += IRL/JobQueue.cpp
+
 HEADERS += IRL/Point2D.h
 SOURCES += IRL/Point2D.cpp
 
@@ -29,14 +54,44 @@ HEADERS += IRL/OffsetField.h
 SOURCES += IRL/OffsetField.cpp
 
 HEADERS += IRL/RGB.h IRL/Lab.h IRL/Alpha.h IRL/ColorConversion.h IRL/ColorConversion.inl
+SOURCES += IRL/ColorConversion.cpp
 
+HEADERS += IRL/ImageView.h IRL/PaddedImage.h IRL/TiledImage.h
 HEADERS += IRL/Image.h IRL/ImageConversion.h IRL/ImageWithMask.h IRL/Image.inl IRL/ImageConversion.inl IRL/ImageWithMask.inl
 HEADERS += IRL/Scaling.h IRL/Scaling.inl
+SOURCES += IRL/Scaling.cpp
 HEADERS += IRL/GaussianPyramid.h IRL/GaussianPyramid.inl
 
-HEADERS += IRL/NearestNeighborField.h IRL/NearestNeighborField.inl
+HEADERS += IRL/PatchDistance.h
+SOURCES += IRL/PatchDistance.cpp
+
+HEADERS += IRL/PatchIndex.h
+HEADERS += IRL/PatchSummaries.h
+SOURCES += IRL/PatchIndex.cpp
+SOURCES += IRL/PatchSummaries.cpp
+HEADERS += IRL/PatchHashing.h
+SOURCES += IRL/PatchHashing.cpp
+HEADERS += IRL/CompactVotes.h
+SOURCES += IRL/CompactVotes.cpp
+HEADERS += IRL/ValidPatches.h
+SOURCES += IRL/ValidPatches.cpp
+HEADERS += IRL/Checkpoint.h
+SOURCES += IRL/Checkpoint.cpp
+
+HEADERS += IRL/DeviceNNF.h
+SOURCES += IRL/DeviceNNF.cpp
+
+HEADERS += IRL/NNFCounters.h IRL/NearestNeighborField.h IRL/NearestNeighborField.inl
 HEADERS += IRL/BidirectionalSimilarity.h IRL/BidirectionalSimilarity.inl
+HEADERS += IRL/PyramidCache.h IRL/PyramidCache.inl
+HEADERS += IRL/ResultCache.h
+SOURCES += IRL/ResultCache.cpp
 HEADERS += IRL/ObjectRemoval.h IRL/ObjectRemoval.inl
+HEADERS += IRL/VideoRemoval.h IRL/VideoRemoval.inl
+HEADERS += IRL/Calibration.h IRL/Calibration.inl
+SOURCES += IRL/Calibration.cpp
+HEADERS += IRL/Retargeting.h IRL/Retargeting.inl
+HEADERS += IRL/Correspondence.h IRL/Correspondence.inl
 
 HEADERS += UI/MainWindow.h
 SOURCES += UI/MainWindow.cpp
@@ -44,6 +99,9 @@ SOURCES += UI/MainWindow.cpp
 HEADERS += UI/WorkingArea.h
 SOURCES += UI/WorkingArea.cpp
 
+HEADERS += UI/History.h
+SOURCES += UI/History.cpp
+
 HEADERS += UI/Tool.h
 SOURCES += UI/Tool.cpp
 
@@ -57,6 +115,7 @@ HEADERS += UI/Tools/PolygonTool.h
 SOURCES += UI/Tools/PolygonTool.cpp
 
 HEADERS += UI/WorkItem.h
+HEADERS += UI/Preview.h
 
 HEADERS += UI/ObjectRemoval.h
 SOURCES += UI/ObjectRemoval.cpp
\ No newline at end of file
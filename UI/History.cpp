@@ -0,0 +1,181 @@
+#include "Includes.h"
+#include "History.h"
+
+// Pixels of one tile before and after a step, rows are packed. The raw pixels are replaced by
+// their compressed form once the background job is done, readers take whichever is there.
+class History::Tile
+{
+public:
+    Tile(const QRect& rect, const QByteArray& before, const QByteArray& after)
+        : _rect(rect), _before(before), _after(after), _compressed(false)
+    { }
+
+    const QRect& rect() const { return _rect; }
+
+    QByteArray pixels(bool after) const
+    {
+        QMutexLocker locker(&_lock);
+        const QByteArray& data = after ? _after : _before;
+        return _compressed ? qUncompress(data) : data;
+    }
+
+    qint64 bytes() const
+    {
+        QMutexLocker locker(&_lock);
+        return _before.size() + _after.size();
+    }
+
+    void compress()
+    {
+        QByteArray before, after;
+        {
+            QMutexLocker locker(&_lock);
+            if (_compressed)
+                return;
+            before = _before;
+            after = _after;
+        }
+        // the fastest level, neighbouring pixels of photos differ too much for the others to pay off
+        before = qCompress(before, 1);
+        after = qCompress(after, 1);
+        QMutexLocker locker(&_lock);
+        _before = before;
+        _after = after;
+        _compressed = true;
+    }
+
+private:
+    QRect _rect;
+    mutable QMutex _lock;
+    QByteArray _before;
+    QByteArray _after;
+    bool _compressed;
+};
+
+// Compresses tiles of one step on the global thread pool, tiles of dropped steps are kept alive by it
+class History::CompressJob :
+    public QRunnable
+{
+public:
+    explicit CompressJob(const QList<TilePointer>& tiles) : _tiles(tiles) {}
+
+    virtual void run()
+    {
+        for (int i = 0; i < _tiles.size(); i++)
+            _tiles[i]->compress();
+    }
+
+private:
+    QList<TilePointer> _tiles;
+};
+
+// Packed rows of 'rect' of 'image' whose top left pixel is at 'origin'
+static QByteArray copyPixels(const QImage& image, const QRect& rect, const QPoint& origin)
+{
+    const int pixelBytes = image.depth() / 8;
+    const int rowBytes = rect.width() * pixelBytes;
+    QByteArray result;
+    result.resize(rowBytes * rect.height());
+    for (int y = 0; y < rect.height(); y++)
+    {
+        const uchar* row = image.constScanLine(rect.top() - origin.y() + y) + (rect.left() - origin.x()) * pixelBytes;
+        memcpy(result.data() + y * rowBytes, row, rowBytes);
+    }
+    return result;
+}
+
+History::History(qint64 capacity) : _current(0), _capacity(capacity)
+{
+}
+
+void History::clear()
+{
+    _steps.clear();
+    _current = 0;
+}
+
+void History::record(const QImage& before, const QImage& image, const QRect& rect)
+{
+    if (rect.isEmpty() || before.format() != image.format() || before.size() != rect.size() || image.depth() % 8 != 0)
+        return;
+
+    // tiles are cut on the grid of the image, so steps over the same area share tile rectangles
+    Step step;
+    step.Rect = rect;
+    step.Format = image.format();
+    const QPoint origin(0, 0);
+    for (int top = rect.top() / TileSize * TileSize; top <= rect.bottom(); top += TileSize)
+    {
+        for (int left = rect.left() / TileSize * TileSize; left <= rect.right(); left += TileSize)
+        {
+            const QRect tile = QRect(left, top, TileSize, TileSize).intersected(rect);
+            const QByteArray previous = copyPixels(before, tile, rect.topLeft());
+            const QByteArray current = copyPixels(image, tile, origin);
+            if (previous != current)
+                step.Tiles << TilePointer(new Tile(tile, previous, current));
+        }
+    }
+    if (step.Tiles.empty())
+        return;
+
+    while (_steps.size() > _current)
+        _steps.removeLast();
+    _steps << step;
+    _current = _steps.size();
+    QThreadPool::globalInstance()->start(new CompressJob(step.Tiles));
+    trim();
+}
+
+QRect History::undo(QImage& image)
+{
+    if (!canUndo() || image.format() != _steps[_current - 1].Format)
+        return QRect();
+    _current--;
+    apply(_steps[_current], false, image);
+    return _steps[_current].Rect;
+}
+
+QRect History::redo(QImage& image)
+{
+    if (!canRedo() || image.format() != _steps[_current].Format)
+        return QRect();
+    apply(_steps[_current], true, image);
+    _current++;
+    return _steps[_current - 1].Rect;
+}
+
+qint64 History::bytes() const
+{
+    qint64 result = 0;
+    for (int i = 0; i < _steps.size(); i++)
+    {
+        for (int j = 0; j < _steps[i].Tiles.size(); j++)
+            result += _steps[i].Tiles[j]->bytes();
+    }
+    return result;
+}
+
+void History::apply(const Step& step, bool after, QImage& image) const
+{
+    const int pixelBytes = image.depth() / 8;
+    for (int i = 0; i < step.Tiles.size(); i++)
+    {
+        const QRect& rect = step.Tiles[i]->rect();
+        const QByteArray pixels = step.Tiles[i]->pixels(after);
+        const int rowBytes = rect.width() * pixelBytes;
+        for (int y = 0; y < rect.height(); y++)
+            memcpy(image.scanLine(rect.top() + y) + rect.left() * pixelBytes, pixels.constData() + y * rowBytes, rowBytes);
+    }
+}
+
+void History::trim()
+{
+    qint64 total = bytes();
+    while (_steps.size() > 1 && _current > 1 && total > _capacity)
+    {
+        for (int j = 0; j < _steps[0].Tiles.size(); j++)
+            total -= _steps[0].Tiles[j]->bytes();
+        _steps.removeFirst();
+        _current--;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+// Undo history of the working image. A step keeps only the tiles its change touched, as they were
+// before and after it. Tiles are compressed in the background, and undo and redo decompress only
+// the tiles of their step. The oldest steps are dropped once the history holds more than its capacity.
+class History
+{
+public:
+    explicit History(qint64 capacity = (qint64)256 << 20);
+
+    // Drops all steps, e.g. when another image is opened
+    void clear();
+    // Adds a step in which 'image' changed within 'rect'. 'before' is the copy of 'rect' before the change,
+    // in the format of 'image'. Steps which were undone are dropped; unchanged tiles are not stored.
+    void record(const QImage& before, const QImage& image, const QRect& rect);
+
+    bool canUndo() const { return _current > 0; }
+    bool canRedo() const { return _current < _steps.size(); }
+    // Write the tiles of the last done or the next undone step into 'image' and
+    // return the rectangle which changed
+    QRect undo(QImage& image);
+    QRect redo(QImage& image);
+
+    // Bytes of all steps, tiles which are still being compressed count in full
+    qint64 bytes() const;
+
+public:
+    static const int TileSize = 64;
+
+private:
+    class Tile;
+    class CompressJob;
+    typedef QSharedPointer<Tile> TilePointer;
+
+    struct Step
+    {
+        QRect Rect;
+        QImage::Format Format;
+        QList<TilePointer> Tiles;
+    };
+
+    void apply(const Step& step, bool after, QImage& image) const;
+    // Drops the oldest steps above the capacity, the last done one is kept
+    void trim();
+
+private:
+    // disable copy methods
+    History(const History&);
+    void operator=(const History&);
+
+    QList<Step> _steps;
+    int _current;           // steps before it are done, the rest were undone
+    qint64 _capacity;
+};
\ No newline at end of file
@@ -6,8 +6,9 @@
 #include "Tools/PolygonTool.h"
 
 #include "../IRL/Parameters.h"
+#include "../IRL/JobQueue.h"
 
-MainWindow::MainWindow() : _workerThread(NULL)
+MainWindow::MainWindow() : _jobQueue(NULL)
 {
     setupWorkingArea();
     setupActions();
@@ -16,7 +17,7 @@ MainWindow::MainWindow() : _workerThread(NULL)
     setupToolbar();
     setupStatusBar();
 
-    clearHistroy();
+    setHistoryState(false, false);
 
     setWindowTitle(tr("Object Removal"));
     resize(600, 400);
@@ -197,80 +198,91 @@ void MainWindow::setProgress(bool visible, int current, int total)
 
 //////////////////////////////////////////////////////////////////////////
 
-class WorkerThread : public QThread
+// Work item as a job of the queue, running items share workers by their sizes
+class WorkItemJob :
+    public IRL::Job
 {
 public:
-    WorkerThread(MainWindow* parent) : _parent(parent)
+    WorkItemJob(WorkItem* item) : IRL::Job(0, item->size()), _item(item)
     {
     }
 
-protected:
-    virtual void run()
+    ~WorkItemJob()
     {
-        while (1)
-        {
-            WorkItem* item = NULL;
-            _parent->_lock.lock();
-            while (_parent->_workItems.empty())
-                _parent->_workItemsNotEmpty.wait(&_parent->_lock);
-            item = _parent->_workItems.front();
-            _parent->_workItems.pop_front();
-            _parent->_lock.unlock();
-            if (item == NULL)
-                break;
-            item->execute();
-            delete item;
-        }
+        delete _item;
+    }
+
+    WorkItem* item() const { return _item; }
+
+    virtual void Run()
+    {
+        // items cancelled while queued are skipped
+        if (!_item->isCancelled())
+            _item->execute();
     }
 
 private:
-    MainWindow* _parent;
+    WorkItem* _item;
 };
 
+MainWindow::~MainWindow()
+{
+    cancelWorkItems();
+    delete _jobQueue;
+    for (int i = 0; i < _workItems.size(); i++)
+        delete _workItems[i];
+}
+
 void MainWindow::enqueueWorkItem(WorkItem* item)
 {
     QMutexLocker locker(&_lock);
-    _workItems.push_back(item);
-    _workItemsNotEmpty.wakeOne();
-    if (_workerThread == NULL)
-    {
-        _workerThread = new WorkerThread(this);
-        _workerThread->start();
-    }
+    deleteFinishedWorkItems();
+    if (_jobQueue == NULL)
+        _jobQueue = new IRL::JobQueue();
+    WorkItemJob* job = new WorkItemJob(item);
+    _workItems.push_back(job);
+    _jobQueue->Submit(job);
 }
 
-//////////////////////////////////////////////////////////////////////////
+void MainWindow::cancelWorkItems()
+{
+    QMutexLocker locker(&_lock);
+    for (int i = 0; i < _workItems.size(); i++)
+        _workItems[i]->item()->cancel();
+    deleteFinishedWorkItems();
+}
 
-void MainWindow::addToHistory(const QImage& state)
+void MainWindow::deleteFinishedWorkItems()
 {
-    _backAction->setEnabled(true);
-    _forwardAction->setEnabled(false);
-    _savedInHistory = state;
+    // the working area identifies updates by their items, so an item lives till its final update is shown
+    for (int i = 0; i < _workItems.size(); )
+    {
+        WorkItemJob* job = _workItems[i];
+        if (job->IsDone() && (job->item()->isCancelled() || !_workingArea->isWaitingFor(job->item())))
+        {
+            delete job;
+            _workItems.removeAt(i);
+        } else
+            i++;
+    }
 }
 
-void MainWindow::clearHistroy()
+//////////////////////////////////////////////////////////////////////////
+
+void MainWindow::setHistoryState(bool canUndo, bool canRedo)
 {
-    _savedInHistory = QImage();
-    _backAction->setEnabled(false);
-    _forwardAction->setEnabled(false);
+    _backAction->setEnabled(canUndo);
+    _forwardAction->setEnabled(canRedo);
 }
 
 void MainWindow::back()
 {
-    QImage history = _savedInHistory;
-    _workingArea->memorizeInHistory();
-    _workingArea->revertFromHistroy(history);
-    _backAction->setEnabled(false);
-    _forwardAction->setEnabled(true);
+    _workingArea->undo();
 }
 
 void MainWindow::forward()
 {
-    QImage history = _savedInHistory;
-    _workingArea->memorizeInHistory();
-    _workingArea->revertFromHistroy(history);
-    _backAction->setEnabled(true);
-    _forwardAction->setEnabled(false);
+    _workingArea->redo();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -4,23 +4,32 @@
 #include "Tool.h"
 #include "WorkItem.h"
 
-class WorkerThread;
+class WorkItemJob;
+
+namespace IRL
+{
+    class JobQueue;
+}
 
 class MainWindow :
     public QMainWindow
 {
     Q_OBJECT
 
-    friend class WorkerThread;
 public:
     MainWindow();
+    // Cancels work items and waits for the running ones
+    ~MainWindow();
 
     WorkingArea* workingArea() const { return _workingArea; }
     Tool* selectedTool() const { return _currentTool; }
 
+    // Starts the item next to the running ones when a worker is free, it is deleted once done
     void enqueueWorkItem(WorkItem* item);
-    void addToHistory(const QImage& state);
-    void clearHistroy();
+    // Cancels queued and running work items, queued ones do not start
+    void cancelWorkItems();
+    // Enables undo and redo actions
+    void setHistoryState(bool canUndo, bool canRedo);
 
 public slots:
     void open();
@@ -39,6 +48,8 @@ private:
     void setupMenu();
     void setupToolbar();
     void setupStatusBar();
+    // Deletes items which are done and whose results are displayed, called under _lock
+    void deleteFinishedWorkItems();
 
 private:
     WorkingArea* _workingArea;
@@ -54,12 +65,9 @@ private:
     Tool* _currentTool;
 
     QMutex _lock;
-    QList<WorkItem*> _workItems;
-    QWaitCondition _workItemsNotEmpty;
-    WorkerThread* _workerThread;
+    QList<WorkItemJob*> _workItems;    // queued, running and not deleted yet
+    IRL::JobQueue* _jobQueue;          // runs as many items at once as there are workers
 
     QLabel* _statusIndicator;
     QProgressBar* _progress;
-
-    QImage _savedInHistory;
 };
\ No newline at end of file
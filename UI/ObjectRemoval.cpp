@@ -1,10 +1,10 @@
 #include "Includes.h"
 #include "ObjectRemoval.h"
 
-ObjectRemovalWorkItem::ObjectRemovalWorkItem(WorkingArea* workingArea, 
+ObjectRemovalWorkItem::ObjectRemovalWorkItem(WorkingArea* workingArea, ObjectRemovalCache* cache,
                                              const QImage& image, 
                                              const QPolygonF& mask, qreal scaleX, qreal scaleY) 
-    : _image(image), _poly(mask), _scaleX(scaleX), _scaleY(scaleY), _workingArea(workingArea)
+    : _image(image), _poly(mask), _scaleX(scaleX), _scaleY(scaleY), _preview(NULL), _workingArea(workingArea), _cache(cache)
 {
 }
 
@@ -13,12 +13,42 @@ void ObjectRemovalWorkItem::execute()
     QImage surface(_image.size(), QImage::Format_Mono);
     prepareMask(surface);
 
-    IRL::ImageWithMask<Color> imageWithMask;
-    imageWithMask.Image = IRL::LoadFromQImage<Color>(_image);
+    IRL::ImageWithMask<IRL::RGB8> imageWithMask;
+    imageWithMask.Image = IRL::LoadFromQImage<IRL::RGB8>(_image);
     imageWithMask.Mask  = IRL::LoadMaskFromQImage(surface);
 
-    _lastResultTime = clock();
-    IRL::RemoveObject(imageWithMask, this);
+    _preview = new PreviewPipeline<Color>(_workingArea, this, _poly, _image.size());
+    IRL::ObjectRemovalParameters parameters;
+    // items running next to the one which holds the cache start from scratch
+    if (parameters.FixedPoint || !_cache->Lock.tryLock())
+    {
+        IRL::ImageWithMask<Color> converted;
+        IRL::Convert(converted, imageWithMask);
+        IRL::RemoveObject(converted, this, parameters);
+    } else
+    {
+        // the image is the result of the previous removal, so only its changed part is converted again
+        // and offsets of the previous removal are reused away from the new hole
+        IRL::RemoveObject(*_cache, imageWithMask, this, parameters, &_cache->Fields);
+        _cache->Lock.unlock();
+    }
+    delete _preview; // already stopped unless cancelled
+    _preview = NULL;
+}
+
+qint64 ObjectRemovalWorkItem::size() const
+{
+    return qint64(_image.width()) * _image.height();
+}
+
+void ObjectRemovalWorkItem::cancel()
+{
+    Cancel();
+}
+
+bool ObjectRemovalWorkItem::isCancelled() const
+{
+    return ShouldCancel();
 }
 
 void ObjectRemovalWorkItem::prepareMask(QImage& surface)
@@ -39,19 +69,22 @@ void ObjectRemovalWorkItem::prepareMask(QImage& surface)
 
 void ObjectRemovalWorkItem::IntermediateResult(const IRL::Image<Color>& result, int progress, int total)
 {
-    if (clock() - _lastResultTime > 50 * CLOCKS_PER_SEC / 1000)
-    {
-        pushUpdate(IRL::SaveToQImage(result), progress * 100 / total, false);
-        _lastResultTime = clock();
-    }
+    _preview->publish(result, progress * 100 / total);
 }
 
 void ObjectRemovalWorkItem::OperationEnded(const IRL::Image<Color>& result)
 {
-    pushUpdate(IRL::SaveToQImage(result), 100, true);
+    // no preview may come after the final result
+    _preview->stop();
+    // only the area which is shown is converted
+    const QRect area = WorkingArea::updateArea(_poly, _image.size());
+    QImage image;
+    if (!area.isEmpty())
+        image = IRL::SaveToQImage(IRL::Crop(result, IRL::Rectangle<int32_t>(area.x(), area.y(), area.width(), area.height())));
+    pushUpdate(image, area, 100, true);
 }
 
-void ObjectRemovalWorkItem::pushUpdate(const QImage& image, int progress, bool final)
+void ObjectRemovalWorkItem::pushUpdate(const QImage& image, const QRect& rect, int progress, bool final)
 {
-    _workingArea->pushUpdate(image, _poly, progress, final);
+    _workingArea->pushUpdate(this, image, rect, _poly, progress, final);
 }
\ No newline at end of file
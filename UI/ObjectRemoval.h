@@ -2,6 +2,7 @@
 
 #include "WorkItem.h"
 #include "WorkingArea.h"
+#include "Preview.h"
 
 #include "../IRL/Image.h"
 #include "../IRL/ImageWithMask.h"
@@ -9,30 +10,45 @@
 #include "../IRL/RGB.h"
 #include "../IRL/Lab.h"
 #include "../IRL/ObjectRemoval.h"
+#include "../IRL/PyramidCache.h"
+#include "../IRL/ImageConversion.h"
 
 typedef IRL::LabDouble Color;
 
+// Pyramid and offset fields of the working copy kept between removals, used by one work item at a time
+class ObjectRemovalCache :
+    public IRL::PyramidCache<Color, IRL::RGB8>
+{
+public:
+    IRL::RemovalFields Fields;
+    QMutex Lock;    // held by the work item which uses the cache
+};
+
 class ObjectRemovalWorkItem :
     public WorkItem,
     public IRL::OperationCallback<Color>
 {
 public:
-    ObjectRemovalWorkItem(WorkingArea* workingArea, const QImage& image, 
+    ObjectRemovalWorkItem(WorkingArea* workingArea, ObjectRemovalCache* cache, const QImage& image, 
         const QPolygonF& mask, qreal scaleX, qreal scaleY);
 
     virtual void execute();
+    virtual qint64 size() const;
+    virtual void cancel();
+    virtual bool isCancelled() const;
 
     virtual void IntermediateResult(const IRL::Image<Color>& result, int progress, int total);
     virtual void OperationEnded(const IRL::Image<Color>& result);
 
 private:
     void prepareMask(QImage& surface);
-    void pushUpdate(const QImage& image, int progress, bool final);
+    void pushUpdate(const QImage& image, const QRect& rect, int progress, bool final);
 
 private:
     QImage _image;
     QPolygonF _poly;
     qreal _scaleX, _scaleY;
-    clock_t _lastResultTime;
+    PreviewPipeline<Color>* _preview; // intermediate results while execute() runs
     WorkingArea* _workingArea;
+    ObjectRemovalCache* _cache;
 };
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "WorkItem.h"
+#include "WorkingArea.h"
+
+#include "../IRL/Image.h"
+#include "../IRL/IO.h"
+#include "../IRL/Parallel.h"
+
+// Delivers intermediate results of a work item to the working area without slowing down the solver.
+// The solver thread only copies a downsampled snapshot into a free frame and never waits, conversion
+// to QImage happens on the pipeline's own thread. Frames published while the previous one is being
+// converted replace each other, so only the newest one is shown. Frames hold only the area the
+// removal may change, see WorkingArea::updateArea.
+template<class PixelType>
+class PreviewPipeline :
+    public QThread
+{
+public:
+    // longer side of preview frames, intermediate results are shown stretched over the image anyway
+    static const int MaxSize = 1024;
+
+    // 'size' is the size of the image 'mask' was drawn on, intermediate results are smaller
+    PreviewPipeline(WorkingArea* workingArea, const WorkItem* source, const QPolygonF& mask, const QSize& size)
+        : _workingArea(workingArea), _source(source), _mask(mask), _size(size), _pending(false), _stopping(false),
+          _concurrency(1)
+    {
+        start(QThread::LowPriority);
+    }
+
+    ~PreviewPipeline()
+    {
+        stop();
+    }
+
+    // Called by the solver thread
+    void publish(const IRL::Image<PixelType>& image, int progress)
+    {
+        // the area in pixels of the image and in pixels of the working copy
+        const QTransform scale = QTransform::fromScale(qreal(image.Width()) / _size.width(), qreal(image.Height()) / _size.height());
+        const QRect area = WorkingArea::updateArea(scale.map(_mask), QSize(image.Width(), image.Height()));
+        if (area.isEmpty())
+            return;
+        downsample(image, area, _writing.Image);
+        _writing.Rect = scale.inverted().mapRect(QRectF(area)).toAlignedRect();
+        _writing.Progress = progress;
+
+        QMutexLocker locker(&_lock);
+        // the frame which was not taken yet becomes the next free one
+        _writing.Swap(_latest);
+        _pending = true;
+        _frameReady.wakeOne();
+    }
+
+    // Drops the pending frame and waits for the frame being converted, so nothing
+    // is pushed after it returns, i.e. after the final result
+    void stop()
+    {
+        _lock.lock();
+        _stopping = true;
+        _pending = false;
+        _frameReady.wakeOne();
+        _lock.unlock();
+        wait();
+    }
+
+protected:
+    virtual void run()
+    {
+        // conversion runs inline, workers are left to the solver
+        IRL::Parallel::SetConcurrencyLimit(&_concurrency);
+        while (true)
+        {
+            _lock.lock();
+            while (!_pending && !_stopping)
+                _frameReady.wait(&_lock);
+            if (_stopping)
+            {
+                _lock.unlock();
+                break;
+            }
+            _latest.Swap(_reading);
+            _pending = false;
+            _lock.unlock();
+
+            _workingArea->pushUpdate(_source, IRL::SaveToQImage(_reading.Image), _reading.Rect, _mask, _reading.Progress, false);
+        }
+        IRL::Parallel::SetConcurrencyLimit(NULL);
+    }
+
+private:
+    struct Frame
+    {
+        Frame() : Progress(0) {}
+
+        // Exchanges frames without touching reference counters or copying pixels
+        void Swap(Frame& frame)
+        {
+            Image.Swap(frame.Image);
+            std::swap(Rect, frame.Rect);
+            std::swap(Progress, frame.Progress);
+        }
+
+        IRL::Image<PixelType> Image;
+        QRect Rect;     // covered by Image in pixels of the working copy
+        int Progress;
+    };
+
+    // Every step-th pixel of 'area' of the image, so that it fits MaxSize. The frame is reused when its size matches.
+    static void downsample(const IRL::Image<PixelType>& image, const QRect& area, IRL::Image<PixelType>& frame)
+    {
+        const int step = (Maximum(area.width(), area.height()) + MaxSize - 1) / MaxSize;
+        const int width = (area.width() + step - 1) / step;
+        const int height = (area.height() + step - 1) / step;
+        if (!frame.IsValid() || frame.Width() != width || frame.Height() != height)
+            frame = IRL::Image<PixelType>(width, height);
+
+        const IRL::ConstImageView<PixelType> from = image.ConstView();
+        const IRL::ImageView<PixelType> to = frame.View();
+        for (int y = 0; y < height; y++)
+        {
+            const PixelType* src = from.Row(area.top() + y * step) + area.left();
+            PixelType* dst = to.Row(y);
+            for (int x = 0; x < width; x++)
+                dst[x] = src[x * step];
+        }
+    }
+
+private:
+    WorkingArea* _workingArea;
+    const WorkItem* _source;
+    QPolygonF _mask;
+    QSize _size;
+
+    // frames are only swapped under the lock: the solver fills _writing, _latest waits
+    // for the pipeline thread and _reading is converted by it
+    QMutex _lock;
+    QWaitCondition _frameReady;
+    Frame _writing;
+    Frame _latest;
+    Frame _reading;
+    bool _pending;    // _latest holds a frame which was not taken yet
+    bool _stopping;
+
+    IRL::AtomicInt _concurrency;
+};
\ No newline at end of file
@@ -6,4 +6,11 @@ public:
     virtual ~WorkItem() {}
 
     virtual void execute() = 0;
+
+    // Work of the item, i.e. pixels, concurrent items share workers in proportion to it
+    virtual qint64 size() const { return 1; }
+
+    // Asks execute() to return early, may be called from any thread while it runs
+    virtual void cancel() {}
+    virtual bool isCancelled() const { return false; }
 };
\ No newline at end of file
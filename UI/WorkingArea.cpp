@@ -3,16 +3,35 @@
 #include "MainWindow.h"
 #include "ObjectRemoval.h"
 
-class WorkingAreaItem : public QGraphicsPixmapItem
+// Working copy over a checker background. The item owns its pixmap alone, so changed areas are
+// painted into it in place and only they are repainted.
+class WorkingAreaItem : public QGraphicsItem
 {
 public:
-    WorkingAreaItem(const QPixmap& pixmap) : QGraphicsPixmapItem(pixmap)
+    WorkingAreaItem(const QImage& image) : _pixmap(QPixmap::fromImage(image))
     { 
         _backgroundBrush.setTexture(QPixmap(":/images/checker.png"));
+        setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    }
+
+    // Copies 'rect' of 'image', which has the size of the pixmap, into the pixmap
+    void updateArea(const QImage& image, const QRect& rect)
+    {
+        if (rect.isEmpty())
+            return;
+        QPainter painter(&_pixmap);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(rect.topLeft(), image, rect);
+        update(QRectF(rect));
+    }
+
+    virtual QRectF boundingRect() const
+    {
+        return QRectF(_pixmap.rect());
     }
 
 protected:
-    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget*)
     {
         QTransform t = painter->transform();
         qreal scaleX = sqrt(t.m11()*t.m11() + t.m12()*t.m12());
@@ -21,23 +40,75 @@ protected:
         brushTransform.scale(1.0 / scaleX, 1.0 / scaleY);
         _backgroundBrush.setTransform(brushTransform);
 
-        painter->fillRect(option->exposedRect, _backgroundBrush);
-        QGraphicsPixmapItem::paint(painter, option, widget);
+        const QRectF exposed = option->exposedRect.intersected(boundingRect());
+        painter->fillRect(exposed, _backgroundBrush);
+        painter->drawPixmap(exposed, _pixmap, exposed);
     }
 
 private:
+    QPixmap _pixmap;
     QBrush _backgroundBrush;
 };
 
+// Intermediate result of a running work item, shown inside its hole over the image
+class PreviewItem : public QGraphicsItem
+{
+public:
+    PreviewItem(QGraphicsItem* parent, const QPolygonF& mask)
+        : QGraphicsItem(parent), _progress(0)
+    {
+        _clip.addPolygon(mask);
+        _clip.closeSubpath();
+    }
+
+    int progress() const { return _progress; }
+
+    // 'frame' is stretched over 'rect' of the image
+    void setFrame(const QImage& frame, const QRect& rect, int progress)
+    {
+        _frame = frame;
+        _rect = rect;
+        _progress = progress;
+        update();
+    }
+
+    virtual QRectF boundingRect() const
+    {
+        return _clip.boundingRect();
+    }
+
+protected:
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem*, QWidget*)
+    {
+        if (_frame.isNull())
+            return;
+        // intermediate results come from coarser levels, they are stretched over their area
+        painter->setClipPath(_clip, Qt::IntersectClip);
+        painter->drawImage(QRectF(_rect), _frame);
+    }
+
+private:
+    QPainterPath _clip;
+    QImage _frame;
+    QRect _rect;
+    int _progress;
+};
+
 WorkingArea::WorkingArea(MainWindow* window) : QGraphicsView(window)
 {
     _item = NULL;
     _window = window;
+    _cache = new ObjectRemovalCache();
     setScene(&_scene);
 
     connect(&_checker, SIGNAL(timeout()), this, SLOT(checkUpdateQueue()));
 }
 
+WorkingArea::~WorkingArea()
+{
+    delete _cache;
+}
+
 QGraphicsItem* WorkingArea::mainItem() const
 {
     return _item;
@@ -45,25 +116,27 @@ QGraphicsItem* WorkingArea::mainItem() const
 
 void WorkingArea::open(const QImage& image)
 {
-    _window->clearHistroy();
-
-    _originalSize = image.size();
-    double lnw = ceil(log((double)image.width()) / log(2.0));
-    _powerOfTwoSize.setWidth(pow(2, lnw));
-    double lnh = ceil(log((double)image.height()) / log(2.0));
-    _powerOfTwoSize.setHeight(pow(2, lnh));
+    // removal of the previous image is stopped, the lock keeps its late updates out of the queue
+    _updatesLock.lock();
+    _window->cancelWorkItems();
+    _updates.clear();
+    _updatesLock.unlock();
+    _running.clear(); // preview items are deleted with the scene
+    _checker.stop();
+    _window->setBusy(false);
+    _window->setProgress(false, 0, 100);
 
-    _scaleX = qreal(_originalSize.width()) / _powerOfTwoSize.width();
-    _scaleY = qreal(_originalSize.height()) / _powerOfTwoSize.height();
+    _history.clear();
+    showHistory();
 
-    _workingCopy = image.scaled(_powerOfTwoSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    // removal works on images of any size, so the image is processed as is
+    _workingCopy = image;
 
     selectedTool()->reset();
     resetTransform();
     _scene.clear();
-    _item = new WorkingAreaItem(QPixmap::fromImage(_workingCopy));
-    _item->setTransform(QTransform::fromScale(_scaleX, _scaleY));
-    _scene.setSceneRect(0, 0, _originalSize.width(), _originalSize.height());
+    _item = new WorkingAreaItem(_workingCopy);
+    _scene.setSceneRect(0, 0, _workingCopy.width(), _workingCopy.height());
     _scene.addItem(_item);
 
     qreal viewportScaleX = qreal(width() - 40) / image.width();
@@ -76,24 +149,32 @@ void WorkingArea::open(const QImage& image)
     }
 }
 
-void WorkingArea::memorizeInHistory()
+void WorkingArea::undo()
 {
-    _window->addToHistory(_workingCopy);
+    if (_item == NULL)
+        return;
+    _item->updateArea(_workingCopy, _history.undo(_workingCopy));
+    showHistory();
 }
 
-void WorkingArea::revertFromHistroy(const QImage& img)
+void WorkingArea::redo()
 {
-    if (_workingCopy.size() != img.size())
+    if (_item == NULL)
         return;
-    _workingCopy = img;
-    _item->setPixmap(QPixmap::fromImage(_workingCopy));
+    _item->updateArea(_workingCopy, _history.redo(_workingCopy));
+    showHistory();
+}
+
+void WorkingArea::showHistory()
+{
+    _window->setHistoryState(_history.canUndo(), _history.canRedo());
 }
 
 void WorkingArea::save(const QString& path)
 {
     if (_item == NULL)
         return;
-    _workingCopy.scaled(_originalSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).save(path);
+    _workingCopy.save(path);
 }
 
 Tool* WorkingArea::selectedTool() const 
@@ -141,54 +222,112 @@ void WorkingArea::zoom(const QPoint& center, double factor)
 
 void WorkingArea::processPolygon(const QPolygonF& polygon)
 {
-    qreal scaleX = qreal(_powerOfTwoSize.width()) / _originalSize.width();
-    qreal scaleY = qreal(_powerOfTwoSize.height()) / _originalSize.height();
-
-    _window->setBusy(true);
-    _window->setProgress(true, 0, 100);
-    memorizeInHistory();
+    // scene coordinates are pixels of the working copy
+    WorkItem* item = new ObjectRemovalWorkItem(this, _cache, _workingCopy, polygon, 1, 1);
+    _running.insert(item, new PreviewItem(_item, polygon));
+    showProgress();
     _checker.start(50);
-    _window->enqueueWorkItem(new ObjectRemovalWorkItem(this, _workingCopy, polygon, scaleX, scaleY));
+    _window->enqueueWorkItem(item);
 }
 
-void WorkingArea::pushUpdate(const QImage& img, const QPolygonF& mask, int progress, bool final)
+void WorkingArea::pushUpdate(const WorkItem* source, const QImage& img, const QRect& rect, const QPolygonF& mask, int progress, bool final)
 {
     QMutexLocker locker(&_updatesLock);
-    _updates.push_back(Update(img, mask, progress, final));
+    if (source->isCancelled())
+        return;
+    for (int i = _updates.size() - 1; i >= 0; i--)
+    {
+        if (_updates[i].Source == source)
+        {
+            if (!_updates[i].Final)
+                _updates.removeAt(i);
+            break;
+        }
+    }
+    _updates.push_back(Update(source, img, rect, mask, progress, final));
+}
+
+bool WorkingArea::isWaitingFor(const WorkItem* item) const
+{
+    return _running.contains(item);
+}
+
+QRect WorkingArea::updateArea(const QPolygonF& mask, const QSize& size)
+{
+    // the margin of composite() and a pixel of rasterization on every side
+    const int margin = 4;
+    return mask.boundingRect().toAlignedRect().adjusted(-margin, -margin, margin, margin).intersected(QRect(QPoint(0, 0), size));
 }
 
 void WorkingArea::checkUpdateQueue()
 {
+    // intermediate updates are coalesced, so the queue holds at most a final update and the newest one of each item
     _updatesLock.lock();
-    if (_updates.empty())
-    {
-        _updatesLock.unlock();
-        return;
-    }
-    Update update = _updates.front();
-    _updates.pop_front();
+    QList<Update> updates;
+    updates.swap(_updates);
     _updatesLock.unlock();
 
-    displayUpdate(update);
-    if (update.Final)
-        _checker.stop();
+    for (int i = 0; i < updates.size(); i++)
+        displayUpdate(updates[i]);
+    if (!updates.empty())
+        showProgress();
 }
 
 void WorkingArea::displayUpdate(const Update& update)
 {
+    PreviewItem* preview = _running.value(update.Source);
+    if (preview == NULL)
+        return; // the item was cancelled
     if (update.Final)
     {
-        _workingCopy = update.Image;
-        _item->setPixmap(QPixmap::fromImage(_workingCopy));
-        _item->setTransform(QTransform::fromScale(_scaleX, _scaleY));
-        _window->setBusy(false);
-        _window->setProgress(false, 100, 100);
+        _item->updateArea(_workingCopy, composite(update.Image, update.Rect, update.Mask));
+        _running.remove(update.Source);
+        delete preview;
     } else
+        preview->setFrame(update.Image, update.Rect, update.Progress);
+}
+
+QRect WorkingArea::composite(const QImage& result, const QRect& rect, const QPolygonF& mask)
+{
+    if (_workingCopy.format() != QImage::Format_RGB32 && _workingCopy.format() != QImage::Format_ARGB32)
+        _workingCopy = _workingCopy.convertToFormat(QImage::Format_ARGB32);
+
+    // items started before this one finished did not see its result, so only the hole is taken from it,
+    // with a margin which covers rasterization differences of its mask
+    QPainterPath hole;
+    hole.addPolygon(mask);
+    hole.closeSubpath();
+    QPainterPathStroker margin;
+    margin.setWidth(4);
+    const QPainterPath clip = hole.united(margin.createStroke(hole));
+
+    // the history keeps only what changed, so the area is copied before painting over it
+    const QRect area = clip.boundingRect().toAlignedRect().intersected(rect);
+    const QImage before = _workingCopy.copy(area);
     {
-        _item->setPixmap(QPixmap::fromImage(update.Image));
-        _item->setTransform(QTransform::fromScale(_powerOfTwoSize.width() / update.Image.width(), 
-            _powerOfTwoSize.height() / update.Image.height()));
-        _item->setTransform(QTransform::fromScale(_scaleX, _scaleY), true);
-        _window->setProgress(true, update.Progress, 100);
+        QPainter painter(&_workingCopy);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.setClipPath(clip);
+        painter.drawImage(rect.topLeft(), result);
     }
+    _history.record(before, _workingCopy, area);
+    showHistory();
+    return area;
+}
+
+void WorkingArea::showProgress()
+{
+    if (_running.empty())
+    {
+        _checker.stop();
+        _window->setBusy(false);
+        _window->setProgress(false, 100, 100);
+        return;
+    }
+    // average of the running items
+    int progress = 0;
+    foreach (PreviewItem* preview, _running)
+        progress += preview->progress();
+    _window->setBusy(true);
+    _window->setProgress(true, progress / _running.size(), 100);
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
 #pragma once
 
+#include "History.h"
+
 class MainWindow;
 class Tool;
 class WorkingAreaItem;
+class PreviewItem;
+class ObjectRemovalCache;
+class WorkItem;
 
 class WorkingArea :
     public QGraphicsView
@@ -14,30 +19,43 @@ class WorkingArea :
     class Update
     {
     public:
-        Update(const QImage& img, const QPolygonF& mask, int progress, bool final)
-            : Image(img), Mask(mask), Final(final), Progress(progress)
+        Update(const WorkItem* source, const QImage& img, const QRect& rect, const QPolygonF& mask, int progress, bool final)
+            : Source(source), Image(img), Rect(rect), Mask(mask), Final(final), Progress(progress)
         { }
 
+        const WorkItem* Source;
         QImage Image;
+        QRect Rect;     // of the working copy covered by Image
         QPolygonF Mask;
         bool Final;
         int Progress;
     };
 public:
     WorkingArea(MainWindow* window);
+    ~WorkingArea();
     QGraphicsScene& scene() { return _scene; }
     const QGraphicsScene& scene() const { return _scene; }
     QGraphicsItem* mainItem() const;
 
-    void pushUpdate(const QImage& img, const QPolygonF& mask, int progress, bool final);
+    // Updates of cancelled items are dropped, an intermediate update which was not displayed yet
+    // is replaced by the next one of the same item. 'img' covers 'rect' of the working copy, final updates
+    // have its size, intermediate ones are stretched over it.
+    void pushUpdate(const WorkItem* source, const QImage& img, const QRect& rect, const QPolygonF& mask, int progress, bool final);
+    // Return true till the final update of the item is displayed
+    bool isWaitingFor(const WorkItem* item) const;
+
+    // Pixels of an image of 'size' which a removal inside 'mask' changes on screen:
+    // the hole and the margin composite() takes with it
+    static QRect updateArea(const QPolygonF& mask, const QSize& size);
 
 public slots:
     void open(const QImage& image);
     void save(const QString& path);
     void zoom(const QPoint& center, double factor);
     void processPolygon(const QPolygonF& polygon);
-    void memorizeInHistory();
-    void revertFromHistroy(const QImage& img);
+    // Step back and forth through the results of finished removals
+    void undo();
+    void redo();
 
 private slots:
     void checkUpdateQueue();
@@ -52,18 +70,25 @@ protected:
 private:
     Tool* selectedTool() const;
     void displayUpdate(const Update& update);
+    // Copies pixels of the hole and around it from the result which covers 'rect', the rest may come
+    // from other items. Returns the area which was painted.
+    QRect composite(const QImage& result, const QRect& rect, const QPolygonF& mask);
+    void showProgress();
+    void showHistory();
 
 private:
     MainWindow* _window;
     QGraphicsScene _scene;
     WorkingAreaItem* _item;
 
-    QSize _originalSize;
-    QSize _powerOfTwoSize;
-    qreal _scaleX, _scaleY;
     QImage _workingCopy;
+    History _history;       // of the working copy, a step per composited result
     QTimer _checker;
 
     QList<Update> _updates;
     QMutex _updatesLock;
+
+    QHash<const WorkItem*, PreviewItem*> _running;  // work items which were not displayed yet
+
+    ObjectRemovalCache* _cache;    // used only by work items
 };
\ No newline at end of file
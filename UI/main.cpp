@@ -6,7 +6,7 @@
 
 int main(int argc, char** argv)
 {
-    IRL::Parallel::Initialize(4);
+    IRL::Parallel::Initialize(0, true);
     IRL::ResetParameters();
 
     QApplication app(argc, argv);